@@ -6,6 +6,7 @@
 #include "dep/rmutil/strings.h"
 #include "dep/rmr/endpoint.h"
 #include "dep/rmr/hiredis/hiredis.h"
+#include "dep/rmr/rmr.h"
 
 #define CONFIG_SETTER(name) \
   static int name(RSConfig *config, ArgsCursor *ac, QueryError *status)
@@ -49,6 +50,35 @@ CONFIG_GETTER(getNumPartitions) {
   return sdscatprintf(ss, "%ld", realConfig->numPartitions);
 }
 
+// PARTITIONER
+CONFIG_SETTER(setPartitioner) {
+  const char *name;
+  int acrc = AC_GetString(ac, &name, NULL, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  if (!strcasecmp(name, PARTITIONHASH_MODULO_STR)) {
+    realConfig->partitioner = PartitionHash_Modulo;
+  } else if (!strcasecmp(name, PARTITIONHASH_JUMP_STR)) {
+    realConfig->partitioner = PartitionHash_Jump;
+  } else {
+    QueryError_SetError(status, QUERY_EPARSEARGS, "Invalid partitioner");
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getPartitioner) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  if (realConfig->partitioner == PartitionHash_Jump) {
+    return sdscat(ss, PARTITIONHASH_JUMP_STR);
+  }
+  return sdscat(ss, PARTITIONHASH_MODULO_STR);
+}
+
 // TIMEOUT
 CONFIG_SETTER(setTimeout) {
   long long ll;
@@ -74,6 +104,92 @@ CONFIG_GETTER(getTimeout) {
   return sdscatprintf(ss, "%d", realConfig->timeoutMS);
 }
 
+// DIST_AGG_MEMORY_LIMIT
+CONFIG_SETTER(setDistAggMemoryLimit) {
+  long long ll;
+  int acrc = AC_GetLongLong(ac, &ll, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  if (ll < 0) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, NULL);
+    return REDISMODULE_ERR;
+  }
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  realConfig->distAggMemoryLimit = ll;
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getDistAggMemoryLimit) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  return sdscatprintf(ss, "%zu", realConfig->distAggMemoryLimit);
+}
+
+// READ_POLICY
+CONFIG_SETTER(setReadPolicy) {
+  const char *policy;
+  int acrc = AC_GetString(ac, &policy, NULL, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  if (!strcasecmp(policy, MRREADPOLICY_MASTERS_STR)) {
+    realConfig->readPolicy = MRReadPolicy_Masters;
+  } else if (!strcasecmp(policy, MRREADPOLICY_PREFER_REPLICAS_STR)) {
+    realConfig->readPolicy = MRReadPolicy_PreferReplicas;
+  } else if (!strcasecmp(policy, MRREADPOLICY_ANY_STR)) {
+    realConfig->readPolicy = MRReadPolicy_Any;
+  } else {
+    QueryError_SetError(status, QUERY_EPARSEARGS, "Invalid read policy");
+    return REDISMODULE_ERR;
+  }
+  MR_SetReadPolicy(realConfig->readPolicy);
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getReadPolicy) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  switch (realConfig->readPolicy) {
+    case MRReadPolicy_PreferReplicas:
+      return sdscat(ss, MRREADPOLICY_PREFER_REPLICAS_STR);
+    case MRReadPolicy_Any:
+      return sdscat(ss, MRREADPOLICY_ANY_STR);
+    case MRReadPolicy_Masters:
+    default:
+      return sdscat(ss, MRREADPOLICY_MASTERS_STR);
+  }
+}
+
+// PARTIAL_RESULTS
+CONFIG_SETTER(setPartialResults) {
+  const char *val;
+  int acrc = AC_GetString(ac, &val, NULL, 0);
+  if (acrc != AC_OK) {
+    QueryError_SetError(status, QUERY_EPARSEARGS, AC_Strerror(acrc));
+    return REDISMODULE_ERR;
+  }
+  SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
+  if (!strcasecmp(val, "true")) {
+    realConfig->partialResults = 1;
+  } else if (!strcasecmp(val, "false")) {
+    realConfig->partialResults = 0;
+  } else {
+    QueryError_SetError(status, QUERY_EPARSEARGS, "Expected true or false");
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+CONFIG_GETTER(getPartialResults) {
+  SearchClusterConfig *realConfig = getOrCreateRealConfig((RSConfig *)config);
+  sds ss = sdsempty();
+  return sdscat(ss, realConfig->partialResults ? "true" : "false");
+}
+
 CONFIG_SETTER(setGlobalPass) {
   SearchClusterConfig *realConfig = getOrCreateRealConfig(config);
   int acrc = AC_GetString(ac, &realConfig->globalPass, NULL, 0);
@@ -97,6 +213,12 @@ static RSConfigOptions clusterOptions_g = {
              .setValue = setNumPartitions,
              .getValue = getNumPartitions,
              .flags = RSCONFIGVAR_F_IMMUTABLE},
+            {.name = "PARTITIONER",
+             .helpText = "How keys are assigned to partitions: MODULO, or JUMP for a consistent "
+                         "hash that moves few keys when the number of partitions changes",
+             .setValue = setPartitioner,
+             .getValue = getPartitioner,
+             .flags = RSCONFIGVAR_F_IMMUTABLE},
             {.name = "TIMEOUT",
              .helpText = "Cluster synchronization timeout",
              .setValue = setTimeout,
@@ -105,6 +227,23 @@ static RSConfigOptions clusterOptions_g = {
               .helpText = "Global oss cluster password that will be used to connect to other shards",
               .setValue = setGlobalPass,
               .getValue = getGlobalPass},
+            {.name = "DIST_AGG_MEMORY_LIMIT",
+             .helpText = "Memory budget in bytes for merging the groups of a distributed aggregation, "
+                         "above which partial groups are spilled to disk (0 for unlimited, at "
+                         "least 1MB otherwise). Only applies to groups whose reducers are all "
+                         "COUNT, SUM, MIN or MAX; other groups are always held in memory",
+             .setValue = setDistAggMemoryLimit,
+             .getValue = getDistAggMemoryLimit},
+            {.name = "READ_POLICY",
+             .helpText = "Which nodes serve searches and aggregations: MASTERS, PREFER_REPLICAS or "
+                         "ANY",
+             .setValue = setReadPolicy,
+             .getValue = getReadPolicy},
+            {.name = "PARTIAL_RESULTS",
+             .helpText = "Whether searches reply with the results of the available shards when "
+                         "some shards are unavailable, instead of failing",
+             .setValue = setPartialResults,
+             .getValue = getPartialResults},
             {.name = NULL}
             // fin
         }
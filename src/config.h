@@ -3,6 +3,8 @@
 
 #include "redismodule.h"
 #include "dep/rmr/endpoint.h"
+#include "dep/rmr/cluster.h"
+#include "partition.h"
 #include "dep/RediSearch/src/config.h"
 #include <string.h>
 typedef enum { ClusterType_RedisOSS = 0, ClusterType_RedisLabs = 1 } MRClusterType;
@@ -12,6 +14,15 @@ typedef struct {
   MRClusterType type;
   int timeoutMS;
   const char* globalPass;
+  // Memory budget, in bytes, of a distributed aggregation's merge of the shards' groups. 0 is
+  // unlimited
+  size_t distAggMemoryLimit;
+  // Which nodes serve the shards' part of searches and aggregations
+  MRReadPolicy readPolicy;
+  // Whether searches reply with the results of the available shards when some are unavailable
+  int partialResults;
+  // How keys are assigned to partitions
+  PartitionHashFunc partitioner;
 } SearchClusterConfig;
 
 extern SearchClusterConfig clusterConfig;
@@ -22,6 +33,8 @@ extern SearchClusterConfig clusterConfig;
 #define DEFAULT_CLUSTER_CONFIG                                                             \
   (SearchClusterConfig) {                                                                  \
     .numPartitions = 0, .type = DetectClusterType(), .timeoutMS = 500, .globalPass = NULL, \
+    .distAggMemoryLimit = 0, .readPolicy = MRReadPolicy_Masters, .partialResults = 0,      \
+    .partitioner = PartitionHash_Modulo,                                                   \
   }
 
 /* Detect the cluster type, by trying to see if we are running inside RLEC.
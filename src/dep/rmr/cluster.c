@@ -6,58 +6,84 @@
 #include <dep/rmutil/vector.h>
 
 #include <stdlib.h>
+#include <sys/param.h>
 
-void _MRClsuter_UpdateNodes(MRCluster *cl) {
-  if (cl->topo) {
+static int _MRNode_SameEndpoint(const MRClusterNode *a, const MRClusterNode *b) {
+  return !strcmp(a->endpoint.host, b->endpoint.host) && a->endpoint.port == b->endpoint.port;
+}
 
-    /* Reallocate the cluster's node map */
-    if (cl->nodeMap) {
-      MRNodeMap_Free(cl->nodeMap);
-    }
+/* Apply the node changes between the old topology and the current one to the connection manager
+ * and the node map. Nodes that kept their id and address keep their connections */
+void _MRClsuter_UpdateNodes(MRCluster *cl, MRClusterTopology *old) {
+  if (!cl->topo) {
+    return;
+  }
+  if (!cl->nodeMap) {
     cl->nodeMap = MR_NewNodeMap();
+  }
+  cl->myNode = NULL;
+  cl->myshard = NULL;
+
+  /* Index the new topology's nodes by id */
+  TrieMap *newNodes = NewTrieMap();
+  for (int sh = 0; sh < cl->topo->numShards; sh++) {
+    for (int n = 0; n < cl->topo->shards[sh].numNodes; n++) {
+      MRClusterNode *node = &cl->topo->shards[sh].nodes[n];
+      TrieMap_Add(newNodes, (char *)node->id, strlen(node->id), node, NULL);
+    }
+  }
 
-    /* Get all the current node ids from the connection manager.  We will remove all the nodes
-     * that are in the new topology, and after the update, delete all the nodes that are in this map
-     * and not in the new topology */
-    TrieMap *currentNodes = NewTrieMap();
-    TrieMapIterator *it = TrieMap_Iterate(cl->mgr.map, "", 0);
-    char *k;
-    tm_len_t len;
-    void *p;
-    while (TrieMapIterator_Next(it, &k, &len, &p)) {
-      TrieMap_Add(currentNodes, k, len, NULL, NULL);
+  /* Remove the nodes that left, or moved to another address, before adding the new ones - a new
+   * node may have taken the address of a removed one */
+  for (int sh = 0; old && sh < old->numShards; sh++) {
+    for (int n = 0; n < old->shards[sh].numNodes; n++) {
+      MRClusterNode *node = &old->shards[sh].nodes[n];
+      MRClusterNode *cur = TrieMap_Find(newNodes, (char *)node->id, strlen(node->id));
+      if (cur == TRIEMAP_NOTFOUND) {
+        MRConnManager_Disconnect(&cl->mgr, node->id);
+        MRNodeMap_Remove(cl->nodeMap, node);
+      } else if (!_MRNode_SameEndpoint(cur, node)) {
+        MRNodeMap_Remove(cl->nodeMap, node);
+      }
     }
-    TrieMapIterator_Free(it);
-
-    /* Walk the topology and add all nodes in it to the connection manager */
-    for (int sh = 0; sh < cl->topo->numShards; sh++) {
-      for (int n = 0; n < cl->topo->shards[sh].numNodes; n++) {
-        MRClusterNode *node = &cl->topo->shards[sh].nodes[n];
-        // printf("Adding node %s:%d to cluster\n", node->endpoint.host, node->endpoint.port);
-        MRConnManager_Add(&cl->mgr, node->id, &node->endpoint, 0);
-
-        /* Add the node to the node map */
-        MRNodeMap_Add(cl->nodeMap, node);
-
-        /* Remove the node id from the current nodes ids map*/
-        TrieMap_Delete(currentNodes, (char *)node->id, strlen(node->id), NULL);
-
-        /* See if this is us - if so we need to update the cluster's host and current id */
-        if (node->flags & MRNode_Self) {
-          cl->myNode = node;
-          cl->myshard = &cl->topo->shards[sh];
-        }
+  }
+  TrieMap_Free(newNodes, NULL);
+
+  /* Walk the topology and add all nodes in it to the connection manager. Nodes already in it with
+   * the same address are left as they are */
+  for (int sh = 0; sh < cl->topo->numShards; sh++) {
+    for (int n = 0; n < cl->topo->shards[sh].numNodes; n++) {
+      MRClusterNode *node = &cl->topo->shards[sh].nodes[n];
+      MRConnManager_Add(&cl->mgr, node->id, &node->endpoint, 0);
+      node->stats = MRConn_GetStats(&cl->mgr, node->id);
+
+      /* Add the node to the node map, or point its entry at the new topology */
+      MRNodeMap_Add(cl->nodeMap, node);
+
+      /* See if this is us - if so we need to update the cluster's host and current id */
+      if (node->flags & MRNode_Self) {
+        cl->myNode = node;
+        cl->myshard = &cl->topo->shards[sh];
       }
     }
+  }
+}
 
-    /* Remove all nodes that are still in the current node map and not in the new topology*/
-    it = TrieMap_Iterate(currentNodes, "", 0);
-    while (TrieMapIterator_Next(it, &k, &len, &p)) {
-      k[len] = '\0';
-      MRConnManager_Disconnect(&cl->mgr, k);
+/* Map every slot of the topology to the shard serving it. When shards overlap, the first one
+ * serving a slot gets it */
+static void _MRCluster_UpdateSlotMap(MRCluster *cl) {
+  free(cl->slotMap);
+  cl->slotMap = NULL;
+  if (!cl->topo || !cl->topo->numSlots) {
+    return;
+  }
+
+  cl->slotMap = calloc(cl->topo->numSlots, sizeof(*cl->slotMap));
+  for (size_t i = cl->topo->numShards; i > 0; i--) {
+    MRClusterShard *sh = &cl->topo->shards[i - 1];
+    for (size_t slot = sh->startSlot; slot <= sh->endSlot && slot < cl->topo->numSlots; slot++) {
+      cl->slotMap[slot] = i;
     }
-    TrieMapIterator_Free(it);
-    TrieMap_Free(currentNodes, NULL);
   }
 }
 
@@ -65,87 +91,232 @@ MRCluster *MR_NewCluster(MRClusterTopology *initialTopolgy, ShardFunc sf,
                          long long minTopologyUpdateInterval) {
   MRCluster *cl = malloc(sizeof(MRCluster));
   cl->sf = sf;
+  cl->selectPolicies[MRCluster_FlatCoordination] = MRNodeSelect_LeastLoaded;
+  cl->selectPolicies[MRCluster_RemoteCoordination] = MRNodeSelect_First;
+  cl->selectPolicies[MRCluster_LocalCoordination] = MRNodeSelect_First;
+  cl->readPolicy = MRReadPolicy_Masters;
+  cl->slowReplyMS = 0;
+  cl->latencyEWMA = 0;
   cl->topologyUpdateMinInterval = minTopologyUpdateInterval;
   cl->lastTopologyUpdate = 0;
   cl->topo = initialTopolgy;
+  cl->slotMap = NULL;
   cl->nodeMap = NULL;
   cl->myNode = NULL;  // tODO: discover local ip/port
   MRConnManager_Init(&cl->mgr, MR_CONN_POOL_SIZE);
 
+  pthread_mutex_init(&cl->topoLock, NULL);
+  cl->topoVersion = 0;
+
   if (cl->topo) {
-    _MRClsuter_UpdateNodes(cl);
+    cl->topo->version = ++cl->topoVersion;
+    cl->topo->refcount = 1;
+    _MRClsuter_UpdateNodes(cl, NULL);
+    _MRCluster_UpdateSlotMap(cl);
   }
   return cl;
 }
 
+void MRCluster_Free(MRCluster *cl) {
+  MRConnManager_Free(&cl->mgr);
+  if (cl->nodeMap) {
+    MRNodeMap_Free(cl->nodeMap);
+  }
+  MRClusterTopology_Release(cl->topo);
+  free(cl->slotMap);
+  pthread_mutex_destroy(&cl->topoLock);
+  free(cl);
+}
+
 /* Find the shard responsible for a given slot */
 MRClusterShard *_MRCluster_FindShard(MRCluster *cl, uint slot) {
-  // TODO: Switch to binary search
-  for (int i = 0; i < cl->topo->numShards; i++) {
-    if (cl->topo->shards[i].startSlot <= slot && cl->topo->shards[i].endSlot >= slot) {
-      return &cl->topo->shards[i];
-    }
+  if (!cl->slotMap || slot >= cl->topo->numSlots || !cl->slotMap[slot]) {
+    return NULL;
   }
-  return NULL;
+  return &cl->topo->shards[cl->slotMap[slot] - 1];
+}
+
+void MRCluster_SetNodeSelectPolicy(MRCluster *cl, MRCoordinationStrategy strategy,
+                                   MRNodeSelectPolicy policy) {
+  cl->selectPolicies[(strategy & ~MRCLUSTER_STRATEGY_FLAGS) % MRCLUSTER_NUM_STRATEGIES] = policy;
+}
+
+void MRCluster_SetReadPolicy(MRCluster *cl, MRReadPolicy policy) {
+  cl->readPolicy = policy;
+}
+
+void MRCluster_SetSlowReplyThreshold(MRCluster *cl, uint64_t ms) {
+  cl->slowReplyMS = ms;
+}
+
+// Consecutive failures after which a node's circuit breaker opens
+#define MRNODE_BREAKER_THRESHOLD 5
+// How long an open circuit breaker fails commands before letting a probe through
+#define MRNODE_BREAKER_OPEN_MS 1000
+
+/* A node is sent commands while its circuit breaker is closed. Once open, a single probing
+ * command is let through after MRNODE_BREAKER_OPEN_MS, and its reply decides whether to close it */
+static int _MRNodeStats_Available(MRNodeStats *st) {
+  if (!st || st->failures < MRNODE_BREAKER_THRESHOLD) {
+    return 1;
+  }
+  return !st->probing && uv_now(uv_default_loop()) >= st->openUntil;
+}
+
+int MRCluster_NodeAvailable(MRCluster *cl, const char *nodeId) {
+  return _MRNodeStats_Available(MRConn_GetStats(&cl->mgr, nodeId));
+}
+
+/* The expected latency of a node's next command, in milliseconds. Nodes that have not replied yet
+ * are expected to be as fast as the cluster's average */
+static double _MRCluster_ExpectedLatency(MRCluster *cl, MRClusterNode *n) {
+  MRNodeStats *st = n->stats;
+  if (!st) {
+    return cl->latencyEWMA;
+  }
+  return (st->latencyEWMA ? st->latencyEWMA : cl->latencyEWMA) * (st->outstanding + 1);
 }
 
 /* Select a node from the shard according to the coordination strategy */
-MRClusterNode *_MRClusterShard_SelectNode(MRClusterShard *sh, MRClusterNode *myNode,
+MRClusterNode *_MRClusterShard_SelectNode(MRCluster *cl, MRClusterShard *sh,
                                           MRCoordinationStrategy strategy) {
+  MRClusterNode *candidates[sh->numNodes + 1];
+  size_t num = 0;
+
+  // for reads, the read policy decides whether replicas may be selected, and if they come first
+  int replicasFirst = 0;
+  if (strategy & MRCluster_ReadOnly) {
+    strategy &= ~MRCluster_MastersOnly;
+    if (cl->readPolicy == MRReadPolicy_Masters) {
+      strategy |= MRCluster_MastersOnly;
+    }
+    replicasFirst = cl->readPolicy == MRReadPolicy_PreferReplicas;
+  }
 
-  switch (strategy & ~MRCluster_MastersOnly) {
-
-    case MRCluster_LocalCoordination:
-      for (int i = 0; i < sh->numNodes; i++) {
-        MRClusterNode *n = &sh->nodes[i];
-        // skip slaves if this is a master only request
-        if (strategy & MRCluster_MastersOnly && !(n->flags & MRNode_Master)) {
-          continue;
-        }
-        if (MRNode_IsSameHost(n, myNode)) {
-          return n;
-        }
+  for (int pass = replicasFirst ? 0 : 1; pass < 2 && !num; pass++) {
+    for (int i = 0; i < sh->numNodes; i++) {
+      MRClusterNode *n = &sh->nodes[i];
+      // skip slaves if this is a master only request, and masters while looking for replicas
+      if (strategy & MRCluster_MastersOnly && !(n->flags & MRNode_Master)) {
+        continue;
       }
-      // Not found...
-      return NULL;
-
-    case MRCluster_RemoteCoordination:
-      for (int i = 0; i < sh->numNodes; i++) {
-        MRClusterNode *n = &sh->nodes[i];
-        // skip slaves if this is a master only request
-        if (strategy & MRCluster_MastersOnly && !(n->flags & MRNode_Master)) {
-          continue;
-        }
-        if (!MRNode_IsSameHost(n, myNode)) {
-          return n;
-        }
+      if (pass == 0 && (n->flags & MRNode_Master)) {
+        continue;
       }
-      // Not found...
-      return NULL;
-
-    case MRCluster_FlatCoordination:
-      // if we only want masters - find the master of this shard
-      if (strategy & MRCluster_MastersOnly) {
-        for (int i = 0; i < sh->numNodes; i++) {
-          if (sh->nodes[i].flags & MRNode_Master) {
-            return &sh->nodes[i];
-          }
-        }
-        return NULL;
+      switch (strategy & ~MRCLUSTER_STRATEGY_FLAGS) {
+        case MRCluster_LocalCoordination:
+          if (!MRNode_IsSameHost(n, cl->myNode)) continue;
+          break;
+        case MRCluster_RemoteCoordination:
+          if (MRNode_IsSameHost(n, cl->myNode)) continue;
+          break;
+        case MRCluster_FlatCoordination:
+          break;
+        default:
+          return NULL;
       }
-      // if we don't care - select a random node
-      return &sh->nodes[rand() % sh->numNodes];
+      candidates[num++] = n;
+    }
+  }
+  // Not found...
+  if (!num) {
+    return NULL;
+  }
+
+  // avoid suspect and failing nodes, unless all the candidates are
+  size_t healthy = 0;
+  for (size_t i = 0; i < num; i++) {
+    MRNodeStats *st = candidates[i]->stats;
+    if (!st || (!st->suspect && _MRNodeStats_Available(st))) {
+      candidates[healthy++] = candidates[i];
+    }
+  }
+  if (healthy) {
+    num = healthy;
+  }
+
+  switch (cl->selectPolicies[strategy & ~MRCLUSTER_STRATEGY_FLAGS]) {
+    case MRNodeSelect_Random:
+      return candidates[rand() % num];
+
+    case MRNodeSelect_LeastLoaded: {
+      if (num == 1) {
+        return candidates[0];
+      }
+      size_t a = rand() % num;
+      size_t b = (a + 1 + rand() % (num - 1)) % num;
+      return _MRCluster_ExpectedLatency(cl, candidates[b]) <
+                     _MRCluster_ExpectedLatency(cl, candidates[a])
+                 ? candidates[b]
+                 : candidates[a];
+    }
+
+    case MRNodeSelect_First:
+    default:
+      return candidates[0];
   }
-  return NULL;
 }
 
-/* Send a single command to the right shard in the cluster, with an optoinal control over node
- * selection */
-int MRCluster_SendCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCommand *cmd,
-                          redisCallbackFn *fn, void *privdata) {
+/* Wraps the callback of a command sent to a node, to keep the node's load statistics */
+typedef struct MRNodeCallbackCtx {
+  redisCallbackFn *fn;
+  void *privdata;
+  MRCluster *cl;
+  MRNodeStats *stats;
+  uint64_t sentAt;
+  /* Next in the free list, once the command is done */
+  struct MRNodeCallbackCtx *next;
+} MRNodeCallbackCtx;
+
+/* Contexts of finished commands, reused by the next ones. Only used on the I/O thread */
+static MRNodeCallbackCtx *freeCallbackCtxs_g = NULL;
+
+// Weight of the latest response time in the node's moving average
+#define MRNODE_LATENCY_ALPHA 0.2
+// Response time a failed command counts as, unless the slow reply threshold is set
+#define MRNODE_FAILURE_LATENCY_MS 1000
+
+static double _MRNode_AddLatency(double ewma, double ms) {
+  return ewma ? (1 - MRNODE_LATENCY_ALPHA) * ewma + MRNODE_LATENCY_ALPHA * ms : ms;
+}
 
+static void _MRCluster_NodeCallback(redisAsyncContext *c, void *r, void *privdata) {
+  MRNodeCallbackCtx *nctx = privdata;
+  MRCluster *cl = nctx->cl;
+  MRNodeStats *st = nctx->stats;
+
+  // no reply means the connection failed, and a slow one that the request timed out
+  double ms = (uv_hrtime() - nctx->sentAt) / 1000000.0;
+  int failed = !r || (cl->slowReplyMS && ms > cl->slowReplyMS);
+  if (failed) {
+    // a failure is at least as bad as the slowest acceptable reply
+    ms = MAX(ms, cl->slowReplyMS ? cl->slowReplyMS : MRNODE_FAILURE_LATENCY_MS);
+  }
+  st->latencyEWMA = _MRNode_AddLatency(st->latencyEWMA, ms);
+  cl->latencyEWMA = _MRNode_AddLatency(cl->latencyEWMA, ms);
+
+  st->probing = 0;
+  if (failed) {
+    if (++st->failures >= MRNODE_BREAKER_THRESHOLD) {
+      st->openUntil = uv_now(uv_default_loop()) + MRNODE_BREAKER_OPEN_MS;
+    }
+  } else {
+    st->failures = 0;
+  }
+  // frees the stats if the node was removed since the command was sent
+  MRNodeStats_CommandDone(st);
+
+  if (nctx->fn) {
+    nctx->fn(c, r, nctx->privdata);
+  }
+  nctx->next = freeCallbackCtxs_g;
+  freeCallbackCtxs_g = nctx;
+}
+
+MRClusterNode *MRCluster_SelectCommandNode(MRCluster *cl, MRCoordinationStrategy strategy,
+                                           MRCommand *cmd) {
   if (!cl || !cl->topo) {
-    return REDIS_ERR;
+    return NULL;
   }
 
   /* Get the cluster slot from the sharder */
@@ -154,15 +325,67 @@ int MRCluster_SendCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRComm
   /* Get the shard from the slotmap */
   MRClusterShard *sh = _MRCluster_FindShard(cl, slot);
   if (!sh) {
+    return NULL;
+  }
+  return _MRClusterShard_SelectNode(cl, sh, strategy);
+}
+
+int MRCluster_SendCommandToNode(MRCluster *cl, const char *nodeId, MRCommand *cmd,
+                                redisCallbackFn *fn, void *privdata) {
+  MRConn *conn = MRConn_Get(&cl->mgr, nodeId);
+  if (!conn) return REDIS_ERR;
+
+  // fail fast while the node's circuit breaker is open
+  MRNodeStats *st = conn->stats;
+  if (!_MRNodeStats_Available(st)) return REDIS_ERR;
+  if (!st) {
+    return MRConn_SendCommand(conn, cmd, fn, privdata);
+  }
+
+  MRNodeCallbackCtx *nctx = freeCallbackCtxs_g;
+  if (nctx) {
+    freeCallbackCtxs_g = nctx->next;
+  } else {
+    nctx = malloc(sizeof(*nctx));
+  }
+  *nctx = (MRNodeCallbackCtx){
+      .fn = fn,
+      .privdata = privdata,
+      .cl = cl,
+      .stats = st,
+      .sentAt = uv_hrtime(),
+  };
+  if (MRConn_SendCommand(conn, cmd, _MRCluster_NodeCallback, nctx) == REDIS_ERR) {
+    nctx->next = freeCallbackCtxs_g;
+    freeCallbackCtxs_g = nctx;
     return REDIS_ERR;
   }
+  st->outstanding++;
+  // an open breaker lets this command through as its probe
+  if (st->failures >= MRNODE_BREAKER_THRESHOLD) st->probing = 1;
+  return REDIS_OK;
+}
 
-  MRClusterNode *node = _MRClusterShard_SelectNode(sh, cl->myNode, strategy);
+/* Send a single command to the right shard in the cluster, with an optoinal control over node
+ * selection */
+int MRCluster_SendCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCommand *cmd,
+                          redisCallbackFn *fn, void *privdata) {
+  MRClusterNode *node = MRCluster_SelectCommandNode(cl, strategy, cmd);
   if (!node) return REDIS_ERR;
+  return MRCluster_SendCommandToNode(cl, node->id, cmd, fn, privdata);
+}
 
-  MRConn *conn = MRConn_Get(&cl->mgr, node->id);
-  if (!conn) return REDIS_ERR;
-  return MRConn_SendCommand(conn, cmd, fn, privdata);
+/* Send a read only command to a single node of every shard. Returns the number of sent commands */
+static int _MRCluster_FanoutRead(MRCluster *cl, MRCoordinationStrategy strategy, MRCommand *cmd,
+                                 redisCallbackFn *fn, void *privdata) {
+  int ret = 0;
+  for (size_t i = 0; cl->topo && i < cl->topo->numShards; i++) {
+    MRClusterNode *n = _MRClusterShard_SelectNode(cl, &cl->topo->shards[i], strategy);
+    if (n && MRCluster_SendCommandToNode(cl, n->id, cmd, fn, privdata) != REDIS_ERR) {
+      ret++;
+    }
+  }
+  return ret;
 }
 
 /* Multiplex a command to all coordinators, using a specific coordination strategy. Returns the
@@ -173,8 +396,17 @@ int MRCluster_FanoutCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCo
     return 0;
   }
 
+  if (strategy & MRCluster_ReadOnly) {
+    int ret = _MRCluster_FanoutRead(cl, strategy, cmd, fn, privdata);
+    if (cmd->cmd) {
+      sdsfree(cmd->cmd);
+      cmd->cmd = NULL;
+    }
+    return ret;
+  }
+
   MRNodeMapIterator it;
-  switch (strategy & ~(MRCluster_MastersOnly)) {
+  switch (strategy & ~MRCLUSTER_STRATEGY_FLAGS) {
     case MRCluster_RemoteCoordination:
       it = MRNodeMap_IterateRandomNodePerhost(cl->nodeMap, cl->myNode);
       break;
@@ -282,6 +514,20 @@ mr_slot_t CRC12ShardFunc(MRCommand *cmd, mr_slot_t numSlots) {
   return crc % numSlots;
 }
 
+int MRCluster_KeySlot(MRCluster *cl, const char *key, size_t len) {
+  MRClusterTopology *topo = MRCluster_GetTopology(cl);
+  if (!topo) {
+    return -1;
+  }
+  MRKey mk;
+  MRKey_Parse(&mk, key, len);
+  uint16_t crc =
+      cl->sf == CRC12ShardFunc ? crc12(mk.shard, mk.shardLen) : crc16(mk.shard, mk.shardLen);
+  int slot = crc % topo->numSlots;
+  MRClusterTopology_Release(topo);
+  return slot;
+}
+
 void MRClusterTopology_Free(MRClusterTopology *t) {
   for (int s = 0; s < t->numShards; s++) {
     for (int n = 0; n < t->shards[s].numNodes; n++) {
@@ -334,6 +580,59 @@ static ShardFunc selectHashFunc(MRHashFunc f) {
   }
   return NULL;
 }
+/* Return 1 if both topologies have the same shards, in the same order, with the same nodes */
+int MRClusterTopology_Equals(MRClusterTopology *a, MRClusterTopology *b) {
+  if (a->numSlots != b->numSlots || a->hashFunc != b->hashFunc || a->numShards != b->numShards) {
+    return 0;
+  }
+  for (size_t s = 0; s < a->numShards; s++) {
+    MRClusterShard *sa = &a->shards[s], *sb = &b->shards[s];
+    if (sa->startSlot != sb->startSlot || sa->endSlot != sb->endSlot ||
+        sa->numNodes != sb->numNodes) {
+      return 0;
+    }
+    for (size_t n = 0; n < sa->numNodes; n++) {
+      MRClusterNode *na = &sa->nodes[n], *nb = &sb->nodes[n];
+      if (strcmp(na->id, nb->id) || na->flags != nb->flags || !_MRNode_SameEndpoint(na, nb) ||
+          (na->endpoint.auth == NULL) != (nb->endpoint.auth == NULL) ||
+          (na->endpoint.auth && strcmp(na->endpoint.auth, nb->endpoint.auth))) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/* Return 1 if both topologies map the slots to the same shard indexes */
+static int _MRClusterTopology_SameSlots(MRClusterTopology *a, MRClusterTopology *b) {
+  if (!a || !b || a->numSlots != b->numSlots || a->numShards != b->numShards) {
+    return 0;
+  }
+  for (size_t s = 0; s < a->numShards; s++) {
+    if (a->shards[s].startSlot != b->shards[s].startSlot ||
+        a->shards[s].endSlot != b->shards[s].endSlot) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+MRClusterTopology *MRCluster_GetTopology(MRCluster *cl) {
+  pthread_mutex_lock(&cl->topoLock);
+  MRClusterTopology *topo = cl->topo;
+  if (topo) {
+    __atomic_add_fetch(&topo->refcount, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&cl->topoLock);
+  return topo;
+}
+
+void MRClusterTopology_Release(MRClusterTopology *t) {
+  if (t && __atomic_sub_fetch(&t->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+    MRClusterTopology_Free(t);
+  }
+}
+
 int MRCLuster_UpdateTopology(MRCluster *cl, MRClusterTopology *newTopo) {
 
   if (!newTopo) return REDIS_ERR;
@@ -347,16 +646,27 @@ int MRCLuster_UpdateTopology(MRCluster *cl, MRClusterTopology *newTopo) {
     newTopo->hashFunc = cl->topo->hashFunc;
   }
 
+  // nothing changed - keep the current topology, and everything pointing into it
+  if (cl->topo && MRClusterTopology_Equals(cl->topo, newTopo)) {
+    MRClusterTopology_Free(newTopo);
+    return REDIS_OK;
+  }
+
+  newTopo->version = ++cl->topoVersion;
+  newTopo->refcount = 1;
   MRClusterTopology *old = cl->topo;
+  pthread_mutex_lock(&cl->topoLock);
   cl->topo = newTopo;
-  if (cl->topo) {
-    _MRClsuter_UpdateNodes(cl);
+  pthread_mutex_unlock(&cl->topoLock);
 
-    MRCluster_ConnectAll(cl);
-  }
-  if (old) {
-    MRClusterTopology_Free(old);
+  if (!_MRClusterTopology_SameSlots(old, newTopo)) {
+    _MRCluster_UpdateSlotMap(cl);
   }
+  _MRClsuter_UpdateNodes(cl, old);
+  MRCluster_ConnectAll(cl);
+
+  // readers that got the old topology release it when they are done with it
+  MRClusterTopology_Release(old);
   return REDIS_OK;
 }
 
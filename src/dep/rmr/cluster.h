@@ -9,6 +9,8 @@
 #include "command.h"
 #include "node.h"
 
+#include <pthread.h>
+
 typedef uint16_t mr_slot_t;
 
 /* A "shard" represents a slot range of the cluster, with its associated nodes. For each sharding
@@ -44,7 +46,11 @@ typedef struct {
   size_t numShards;
   size_t capShards;
   MRClusterShard *shards;
-
+  /* Set by the cluster when the topology is applied, and incremented with every change */
+  size_t version;
+  /* References to an applied topology - the cluster's, and those of readers that got it with
+   * MRCluster_GetTopology */
+  int refcount;
 } MRClusterTopology;
 
 MRClusterTopology *MR_NewTopology(size_t numShards, size_t numSlots);
@@ -52,6 +58,12 @@ void MRClusterTopology_AddShard(MRClusterTopology *topo, MRClusterShard *sh);
 
 void MRClusterTopology_Free(MRClusterTopology *t);
 
+/* Release a reference to a topology, freeing it with the last reference */
+void MRClusterTopology_Release(MRClusterTopology *t);
+
+/* Return 1 if both topologies have the same shards, in the same order, with the same nodes */
+int MRClusterTopology_Equals(MRClusterTopology *a, MRClusterTopology *b);
+
 void MRClusterNode_Free(MRClusterNode *n);
 
 /* Check the validity of the topology. A topology is considered valid if we have shards, and the
@@ -62,17 +74,60 @@ int MRClusterTopology_IsValid(MRClusterTopology *t);
  * applicable */
 typedef mr_slot_t (*ShardFunc)(MRCommand *cmd, mr_slot_t numSlots);
 
+/* How a node is selected among the nodes of a shard that match a coordination strategy */
+typedef enum {
+  /* Select the first matching node */
+  MRNodeSelect_First,
+  /* Select a random matching node */
+  MRNodeSelect_Random,
+  /* Sample two random matching nodes, and select the one with the lower expected latency given its
+   * response time and outstanding commands (power of two choices) */
+  MRNodeSelect_LeastLoaded,
+} MRNodeSelectPolicy;
+
+/* Which nodes of a shard may serve read only commands */
+typedef enum {
+  /* Only masters serve reads */
+  MRReadPolicy_Masters = 0,
+  /* Replicas serve reads, and masters only serve reads of shards without replicas */
+  MRReadPolicy_PreferReplicas,
+  /* Any node serves reads */
+  MRReadPolicy_Any,
+} MRReadPolicy;
+
+#define MRREADPOLICY_MASTERS_STR "MASTERS"
+#define MRREADPOLICY_PREFER_REPLICAS_STR "PREFER_REPLICAS"
+#define MRREADPOLICY_ANY_STR "ANY"
+
+/* The number of coordination strategies, not counting the MastersOnly flag */
+#define MRCLUSTER_NUM_STRATEGIES 3
+
 /* A cluster has nodes and connections that can be used by the engine to send requests */
 typedef struct {
   /* The connection manager holds a connection to each node, indexed by node id */
   MRConnManager mgr;
-  /* The latest topology of the cluster */
+  /* The latest topology of the cluster. Only replaced on the I/O thread, while holding topoLock */
   MRClusterTopology *topo;
+  pthread_mutex_t topoLock;
+  /* The version of the latest topology */
+  size_t topoVersion;
+  /* Index + 1 of the topology shard serving each slot, or 0 if no shard serves it. Rebuilt
+   * whenever the topology is updated */
+  uint16_t *slotMap;
   /* the current node, detected when updating the topology */
   MRClusterNode *myNode;
   MRClusterShard *myshard;
   /* The sharding functino, responsible for transforming keys into slots */
   ShardFunc sf;
+  /* The node selection policy of each coordination strategy */
+  MRNodeSelectPolicy selectPolicies[MRCLUSTER_NUM_STRATEGIES];
+  /* Which nodes may serve read only commands */
+  MRReadPolicy readPolicy;
+  /* Replies slower than this count as failures of their node's circuit breaker. 0 to disable */
+  uint64_t slowReplyMS;
+  /* Moving average of the response time of all the nodes, in milliseconds, which nodes that have
+   * not replied yet are expected to have */
+  double latencyEWMA;
 
   /* map of nodes by ip:port */
   MRNodeMap *nodeMap;
@@ -95,9 +150,30 @@ typedef enum {
   /* If this is set, we only wish to talk to masters.
    * NOTE: This is a flag that should be added to the strategy along with one of the above */
   MRCluster_MastersOnly = 0x08,
+  /* If this is set, the command only reads, and the cluster's read policy decides which nodes may
+   * serve it instead of the MastersOnly flag. A read only fanout is sent to a single node of each
+   * shard.
+   * NOTE: This is a flag that should be added to the strategy along with one of the above */
+  MRCluster_ReadOnly = 0x10,
 
 } MRCoordinationStrategy;
 
+#define MRCLUSTER_STRATEGY_FLAGS (MRCluster_MastersOnly | MRCluster_ReadOnly)
+
+/* Set how a node of a shard is selected for commands sent with a coordination strategy. By default,
+ * flat coordination selects the least loaded node, and the others select the first matching node */
+void MRCluster_SetNodeSelectPolicy(MRCluster *cl, MRCoordinationStrategy strategy,
+                                   MRNodeSelectPolicy policy);
+
+/* Set which nodes may serve read only commands */
+void MRCluster_SetReadPolicy(MRCluster *cl, MRReadPolicy policy);
+
+/* Set the response time above which a reply counts as a failure of its node */
+void MRCluster_SetSlowReplyThreshold(MRCluster *cl, uint64_t ms);
+
+/* Returns 1 if commands may be sent to a node, 0 while its circuit breaker is open */
+int MRCluster_NodeAvailable(MRCluster *cl, const char *nodeId);
+
 /* Multiplex a non-sharding command to all coordinators, using a specific coordination strategy. The
  * return value is the number of nodes we managed to successfully send the command to */
 int MRCluster_FanoutCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCommand *cmd,
@@ -109,6 +185,16 @@ int MRCluster_FanoutCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCo
 int MRCluster_SendCommand(MRCluster *cl, MRCoordinationStrategy strategy, MRCommand *cmd,
                           redisCallbackFn *fn, void *privdata);
 
+/* Select the node a command would be sent to by MRCluster_SendCommand, or NULL if there is none.
+ * The node is only valid until the next topology update */
+MRClusterNode *MRCluster_SelectCommandNode(MRCluster *cl, MRCoordinationStrategy strategy,
+                                           MRCommand *cmd);
+
+/* Send a command to a specific node by id. Returns REDIS_ERR if the node is not connected, or no
+ * longer in the cluster */
+int MRCluster_SendCommandToNode(MRCluster *cl, const char *nodeId, MRCommand *cmd,
+                                redisCallbackFn *fn, void *privdata);
+
 /* The number of individual hosts (by IP adress) in the cluster */
 size_t MRCluster_NumHosts(MRCluster *cl);
 
@@ -126,6 +212,14 @@ int MRCluster_ConnectAll(MRCluster *cl);
 MRCluster *MR_NewCluster(MRClusterTopology *topology, ShardFunc sharder,
                          long long minTopologyUpdateInterval);
 
+/* Free the cluster, its topology and its connections. Readers keep the topology references they
+ * got. Must be called on the I/O loop thread */
+void MRCluster_Free(MRCluster *cl);
+
+/* Get a reference to the latest topology, which stays valid after it is replaced. It must be
+ * released with MRClusterTopology_Release */
+MRClusterTopology *MRCluster_GetTopology(MRCluster *cl);
+
 /* Update the topology by calling the topology provider explicitly with ctx. If ctx is NULL, the
  * provider's current context is used. Otherwise, we call its function with the given context */
 int MRCLuster_UpdateTopology(MRCluster *cl, MRClusterTopology *newTopology);
@@ -133,6 +227,9 @@ int MRCLuster_UpdateTopology(MRCluster *cl, MRClusterTopology *newTopology);
 mr_slot_t CRC16ShardFunc(MRCommand *cmd, mr_slot_t numSlots);
 mr_slot_t CRC12ShardFunc(MRCommand *cmd, mr_slot_t numSlots);
 
+/* The slot of a key by the cluster's sharding function, or -1 if the cluster has no topology yet */
+int MRCluster_KeySlot(MRCluster *cl, const char *key, size_t len);
+
 typedef struct {
   const char *base;
   size_t baseLen;
@@ -109,8 +109,7 @@ int _getCommandConfId(MRCommand *cmd) {
   }
 
   for (int i = 0; __commandConfig[i].command != NULL; i++) {
-    if (!strcasecmp(cmd->strs[0], __commandConfig[i].command)) {
-      // printf("conf id for cmd %s: %d\n", cmd->strs[0], i);
+    if (!strcasecmp(MRCommand_ArgStringPtrLen(cmd, 0, NULL), __commandConfig[i].command)) {
       cmd->id = i;
       return 1;
     }
@@ -118,54 +117,161 @@ int _getCommandConfId(MRCommand *cmd) {
   return 0;
 }
 
-void MRCommand_Free(MRCommand *cmd) {
+/* Allocate an argument block with room for numArgs arguments, and for bufSize bytes of them */
+static MRCommandArgs *argsNew(size_t numArgs, size_t bufSize) {
+  MRCommandArgs *a = malloc(sizeof(*a));
+  a->refcount = 1;
+  a->bufLen = 0;
+  if (numArgs > MRCOMMAND_INLINE_ARGS) {
+    a->args = malloc(sizeof(*a->args) * numArgs);
+    a->cap = numArgs;
+  } else {
+    a->args = a->inlineArgs;
+    a->cap = MRCOMMAND_INLINE_ARGS;
+  }
+  if (bufSize > MRCOMMAND_INLINE_BUF) {
+    a->buf = malloc(bufSize);
+    a->bufCap = bufSize;
+  } else {
+    a->buf = a->inlineBuf;
+    a->bufCap = MRCOMMAND_INLINE_BUF;
+  }
+  return a;
+}
+
+static void argsRelease(MRCommandArgs *a) {
+  if (!a || __atomic_sub_fetch(&a->refcount, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  if (a->args != a->inlineArgs) free(a->args);
+  if (a->buf != a->inlineBuf) free(a->buf);
+  free(a);
+}
+
+/* Make room for numArgs arguments in total, and for n more bytes in the buffer */
+static void argsReserve(MRCommandArgs *a, size_t numArgs, size_t n) {
+  if (numArgs > a->cap) {
+    size_t cap = numArgs > a->cap * 2 ? numArgs : a->cap * 2;
+    if (a->args == a->inlineArgs) {
+      a->args = malloc(sizeof(*a->args) * cap);
+      memcpy(a->args, a->inlineArgs, sizeof(a->inlineArgs));
+    } else {
+      a->args = realloc(a->args, sizeof(*a->args) * cap);
+    }
+    a->cap = cap;
+  }
+  if (a->bufLen + n > a->bufCap) {
+    size_t cap = a->bufLen + n > a->bufCap * 2 ? a->bufLen + n : a->bufCap * 2;
+    if (a->buf == a->inlineBuf) {
+      a->buf = malloc(cap);
+      memcpy(a->buf, a->inlineBuf, a->bufLen);
+    } else {
+      a->buf = realloc(a->buf, cap);
+    }
+    a->bufCap = cap;
+  }
+}
+
+/* Copy a string to the end of the buffer, and return its offset. The string may be an argument of
+ * the same block */
+static uint32_t argsStore(MRCommandArgs *a, const char *s, size_t n) {
+  if (s >= a->buf && s < a->buf + a->bufLen) {
+    size_t soff = s - a->buf;
+    argsReserve(a, 0, n + 1);
+    s = a->buf + soff;
+  } else {
+    argsReserve(a, 0, n + 1);
+  }
+  uint32_t off = a->bufLen;
+  memcpy(a->buf + off, s, n);
+  a->buf[off + n] = 0;
+  a->bufLen += n + 1;
+  return off;
+}
+
+/* Copy the first num arguments of a block into a new, compact one */
+static MRCommandArgs *argsClone(const MRCommandArgs *src, size_t num, size_t addArgs,
+                                size_t addBytes) {
+  size_t bytes = addBytes;
+  for (size_t i = 0; i < num; i++) {
+    bytes += src->args[i].len + 1;
+  }
+  MRCommandArgs *a = argsNew(num + addArgs, bytes);
+  for (size_t i = 0; i < num; i++) {
+    const MRCommandArg *arg = &src->args[i];
+    a->args[i].off = argsStore(a, src->buf + arg->off, arg->len);
+    a->args[i].len = arg->len;
+  }
+  return a;
+}
+
+/* Drop the cached wire format of a command whose arguments change */
+static void resetFormatted(MRCommand *cmd) {
   if (cmd->cmd) {
     sdsfree(cmd->cmd);
+    cmd->cmd = NULL;
   }
-  for (int i = 0; i < cmd->num; i++) {
-    free(cmd->strs[i]);
+}
+
+/* Prepare the command's arguments for a change adding addArgs arguments of about addBytes bytes.
+ * If they are shared with copies of the command, the command gets a block of its own. The shared
+ * block is returned, to be released once the change is done, as the new arguments may come from
+ * it */
+static MRCommandArgs *beginChange(MRCommand *cmd, size_t addArgs, size_t addBytes) {
+  resetFormatted(cmd);
+  if (!cmd->args) {
+    cmd->args = argsNew(addArgs, addBytes);
+    return NULL;
+  }
+  if (__atomic_load_n(&cmd->args->refcount, __ATOMIC_ACQUIRE) > 1) {
+    MRCommandArgs *shared = cmd->args;
+    cmd->args = argsClone(shared, cmd->num, addArgs, addBytes);
+    return shared;
   }
-  free(cmd->strs);
-  free(cmd->lens);
+  // the buffer grows when the arguments are stored, as they may come from it
+  argsReserve(cmd->args, cmd->num + addArgs, 0);
+  return NULL;
+}
+
+void MRCommand_Free(MRCommand *cmd) {
+  resetFormatted(cmd);
+  argsRelease(cmd->args);
+  cmd->args = NULL;
 }
 
 static void assignStr(MRCommand *cmd, size_t idx, const char *s, size_t n) {
-  char *news = malloc(n + 1);
-  cmd->strs[idx] = news;
-  cmd->lens[idx] = n;
-  news[n] = 0;
-  memcpy(news, s, n);
+  uint32_t off = argsStore(cmd->args, s, n);
+  cmd->args->args[idx].off = off;
+  cmd->args->args[idx].len = n;
 }
 
 static void assignCstr(MRCommand *cmd, size_t idx, const char *s) {
   assignStr(cmd, idx, s, strlen(s));
 }
 
-static void copyStr(MRCommand *dst, size_t dstidx, const MRCommand *src, size_t srcidx) {
-  const char *srcs = src->strs[srcidx];
-  size_t srclen = src->lens[srcidx];
-
-  assignStr(dst, dstidx, srcs, srclen);
-}
-
 static void assignRstr(MRCommand *dst, size_t idx, RedisModuleString *src) {
   size_t n;
   const char *s = RedisModule_StringPtrLen(src, &n);
   assignStr(dst, idx, s, n);
 }
 
-static void MRCommand_Init(MRCommand *cmd, size_t len) {
+/* Allocate the arguments of a new command, with bufSize bytes for their strings */
+static void MRCommand_Init(MRCommand *cmd, size_t len, size_t bufSize) {
   cmd->num = len;
-  cmd->strs = malloc(sizeof(*cmd->strs) * len);
-  cmd->lens = malloc(sizeof(*cmd->lens) * len);
+  cmd->args = argsNew(len, bufSize);
   cmd->id = 0;
   cmd->targetSlot = -1;
+  cmd->timeoutMS = 0;
   cmd->cmd = NULL;
 }
 
 MRCommand MR_NewCommandArgv(int argc, const char **argv) {
-  MRCommand cmd = {.num = argc};
-  MRCommand_Init(&cmd, argc);
+  size_t bufSize = 0;
+  for (int i = 0; i < argc; i++) {
+    bufSize += strlen(argv[i]) + 1;
+  }
+  MRCommand cmd;
+  MRCommand_Init(&cmd, argc, bufSize);
 
   for (int i = 0; i < argc; i++) {
     assignCstr(&cmd, i, argv[i]);
@@ -174,23 +280,29 @@ MRCommand MR_NewCommandArgv(int argc, const char **argv) {
   return cmd;
 }
 
-/* Create a deep copy of a command by duplicating all strings */
+/* Create a copy of a command, sharing its arguments */
 MRCommand MRCommand_Copy(const MRCommand *cmd) {
-  MRCommand ret;
-  MRCommand_Init(&ret, cmd->num);
-  ret.id = cmd->id;
-
-  for (int i = 0; i < cmd->num; i++) {
-    copyStr(&ret, i, cmd, i);
+  MRCommand ret = *cmd;
+  ret.targetSlot = -1;
+  ret.cmd = NULL;
+  if (ret.args) {
+    __atomic_add_fetch(&ret.args->refcount, 1, __ATOMIC_RELAXED);
   }
   return ret;
 }
 
 MRCommand MR_NewCommand(int argc, ...) {
+  va_list ap;
+  size_t bufSize = 0;
+  va_start(ap, argc);
+  for (int i = 0; i < argc; i++) {
+    bufSize += strlen(va_arg(ap, const char *)) + 1;
+  }
+  va_end(ap);
+
   MRCommand cmd;
-  MRCommand_Init(&cmd, argc);
+  MRCommand_Init(&cmd, argc, bufSize);
 
-  va_list ap;
   va_start(ap, argc);
   for (int i = 0; i < argc; i++) {
     assignCstr(&cmd, i, va_arg(ap, const char *));
@@ -201,18 +313,18 @@ MRCommand MR_NewCommand(int argc, ...) {
 }
 
 MRCommand MR_NewCommandFromStrings(int argc, char **argv) {
-  MRCommand cmd;
-  MRCommand_Init(&cmd, argc);
-  for (size_t ii = 0; ii < argc; ++ii) {
-    assignCstr(&cmd, ii, argv[ii]);
-  }
-  _getCommandConfId(&cmd);
-  return cmd;
+  return MR_NewCommandArgv(argc, (const char **)argv);
 }
 
 MRCommand MR_NewCommandFromRedisStrings(int argc, RedisModuleString **argv) {
+  size_t bufSize = 0;
+  for (int i = 0; i < argc; i++) {
+    size_t n;
+    RedisModule_StringPtrLen(argv[i], &n);
+    bufSize += n + 1;
+  }
   MRCommand cmd;
-  MRCommand_Init(&cmd, argc);
+  MRCommand_Init(&cmd, argc, bufSize);
   for (int i = 0; i < argc; i++) {
     assignRstr(&cmd, i, argv[i]);
   }
@@ -220,30 +332,33 @@ MRCommand MR_NewCommandFromRedisStrings(int argc, RedisModuleString **argv) {
   return cmd;
 }
 
-static void extendCommandList(MRCommand *cmd, size_t toAdd) {
+/* Add toAdd arguments to the end of the command, to be assigned by the caller. Returns the shared
+ * block to release once they are */
+static MRCommandArgs *extendCommandList(MRCommand *cmd, size_t toAdd, size_t addBytes) {
+  MRCommandArgs *shared = beginChange(cmd, toAdd, addBytes);
   cmd->num += toAdd;
-  cmd->strs = realloc(cmd->strs, sizeof(*cmd->strs) * cmd->num);
-  cmd->lens = realloc(cmd->lens, sizeof(*cmd->lens) * cmd->num);
+  return shared;
 }
 
 void MRCommand_AppendStringsArgs(MRCommand *cmd, int num, char **args) {
   if (num <= 0) return;
   int oldNum = cmd->num;
-  extendCommandList(cmd, num);
+  MRCommandArgs *shared = extendCommandList(cmd, num, 0);
 
   for (int i = oldNum; i < cmd->num; i++) {
-    assignCstr(cmd, i, args[i]);
+    assignCstr(cmd, i, args[i - oldNum]);
   }
+  argsRelease(shared);
 }
 
 void MRCommand_AppendArgsAtPos(MRCommand *cmd, int pos, int num, ...) {
   if (num <= 0) return;
   int oldNum = cmd->num;
-  extendCommandList(cmd, num);
+  MRCommandArgs *shared = extendCommandList(cmd, num, 0);
 
   // shift right all arguments that comes after pos
-  memmove(cmd->strs + pos + num, cmd->strs + pos, (oldNum - pos) * sizeof(char*));
-  memmove(cmd->lens + pos + num, cmd->lens + pos, (oldNum - pos) * sizeof(size_t));
+  MRCommandArg *args = cmd->args->args;
+  memmove(args + pos + num, args + pos, (oldNum - pos) * sizeof(*args));
 
   va_list(ap);
   va_start(ap, num);
@@ -251,12 +366,13 @@ void MRCommand_AppendArgsAtPos(MRCommand *cmd, int pos, int num, ...) {
     assignCstr(cmd, i, va_arg(ap, const char *));
   }
   va_end(ap);
+  argsRelease(shared);
 }
 
 void MRCommand_AppendArgs(MRCommand *cmd, int num, ...) {
   if (num <= 0) return;
   int oldNum = cmd->num;
-  extendCommandList(cmd, num);
+  MRCommandArgs *shared = extendCommandList(cmd, num, 0);
 
   va_list(ap);
   va_start(ap, num);
@@ -264,15 +380,19 @@ void MRCommand_AppendArgs(MRCommand *cmd, int num, ...) {
     assignCstr(cmd, i, va_arg(ap, const char *));
   }
   va_end(ap);
+  argsRelease(shared);
 }
 
 void MRCommand_AppendFrom(MRCommand *cmd, const MRCommand *srcCmd, size_t srcidx) {
-  MRCommand_Append(cmd, srcCmd->strs[srcidx], srcCmd->lens[srcidx]);
+  size_t n;
+  const char *s = MRCommand_ArgStringPtrLen(srcCmd, srcidx, &n);
+  MRCommand_Append(cmd, s, n);
 }
 
 void MRCommand_Append(MRCommand *cmd, const char *s, size_t n) {
-  extendCommandList(cmd, 1);
+  MRCommandArgs *shared = extendCommandList(cmd, 1, n + 1);
   assignStr(cmd, cmd->num - 1, s, n);
+  argsRelease(shared);
   if (cmd->num == 1) {
     _getCommandConfId(cmd);
   }
@@ -282,39 +402,83 @@ void MRCommand_Append(MRCommand *cmd, const char *s, size_t n) {
  * module style prefx it gets replaced with the new prefix. If it doesn't, we prepend the prefix to
  * the command. */
 void MRCommand_SetPrefix(MRCommand *cmd, const char *newPrefix) {
-
-  char *suffix = strchr(cmd->strs[0], '.');
+  size_t nameLen;
+  const char *name = MRCommand_ArgStringPtrLen(cmd, 0, &nameLen);
+  const char *suffix = memchr(name, '.', nameLen);
   if (!suffix) {
-    suffix = cmd->strs[0];
+    suffix = name;
   } else {
     suffix++;
   }
-
-  char *buf = NULL;
-  asprintf(&buf, "%s.%s", newPrefix, suffix);
-  MRCommand_ReplaceArgNoDup(cmd, 0, buf, strlen(buf));
+  size_t suffixOff = suffix - name;
+  size_t suffixLen = nameLen - suffixOff;
+  size_t prefixLen = strlen(newPrefix);
+  size_t len = prefixLen + 1 + suffixLen;
+
+  // write {prefix}.{suffix} directly to the end of the buffer
+  MRCommandArgs *shared = beginChange(cmd, 0, len + 1);
+  MRCommandArgs *a = cmd->args;
+  argsReserve(a, 0, len + 1);
+  suffix = a->buf + a->args[0].off + suffixOff;
+
+  char *dst = a->buf + a->bufLen;
+  memcpy(dst, newPrefix, prefixLen);
+  dst[prefixLen] = '.';
+  memcpy(dst + prefixLen + 1, suffix, suffixLen);
+  dst[len] = 0;
+  a->args[0].off = a->bufLen;
+  a->args[0].len = len;
+  a->bufLen += len + 1;
+
+  argsRelease(shared);
   _getCommandConfId(cmd);
 }
 
 void MRCommand_ReplaceArgNoDup(MRCommand *cmd, int index, const char *newArg, size_t len) {
+  MRCommand_ReplaceArg(cmd, index, newArg, len);
+  free((char *)newArg);
+}
+
+void MRCommand_ReplaceArg(MRCommand *cmd, int index, const char *newArg, size_t len) {
   if (index < 0 || index >= cmd->num) {
     return;
   }
-  char *tmp = cmd->strs[index];
-  cmd->strs[index] = (char *)newArg;
-  cmd->lens[index] = len;
-  free(tmp);
+  MRCommandArgs *shared = beginChange(cmd, 0, len + 1);
+  MRCommandArgs *a = cmd->args;
+  if (len <= a->args[index].len) {
+    // a shorter value takes the place of the old one
+    char *dst = a->buf + a->args[index].off;
+    memmove(dst, newArg, len);
+    dst[len] = 0;
+  } else {
+    a->args[index].off = argsStore(a, newArg, len);
+  }
+  a->args[index].len = len;
+  argsRelease(shared);
 
   // if we've replaced the first argument, we need to reconfigure the command
   if (index == 0) {
     _getCommandConfId(cmd);
   }
 }
-void MRCommand_ReplaceArg(MRCommand *cmd, int index, const char *newArg, size_t len) {
-  char *news = malloc(len + 1);
-  news[len] = 0;
-  memcpy(news, newArg, len);
-  MRCommand_ReplaceArgNoDup(cmd, index, news, len);
+
+/* Append the RESP bulk strings of arguments [from, to) of a command */
+static sds formatArgs(sds s, const MRCommand *cmd, size_t from, size_t to) {
+  for (size_t i = from; i < to; i++) {
+    size_t n;
+    const char *arg = MRCommand_ArgStringPtrLen(cmd, i, &n);
+    s = sdscatfmt(s, "$%U\r\n", (unsigned long long)n);
+    s = sdscatlen(s, arg, n);
+    s = sdscatlen(s, "\r\n", 2);
+  }
+  return s;
+}
+
+sds MRCommand_Format(const MRCommand *cmd) {
+  // the arguments and about 16 bytes of RESP framing each, so that it is usually allocated once
+  sds s = sdsMakeRoomFor(sdsempty(), (cmd->args ? cmd->args->bufLen : 0) + 16 * (cmd->num + 1));
+  s = sdscatfmt(s, "*%u\r\n", cmd->num);
+  return formatArgs(s, cmd, 0, cmd->num);
 }
 
 MRCommandFlags MRCommand_GetFlags(MRCommand *cmd) {
@@ -360,7 +524,9 @@ void MRCommand_Print(MRCommand *cmd) {
 
 void MRCommand_FPrint(FILE *fd, MRCommand *cmd) {
   for (int i = 0; i < cmd->num; i++) {
-    fprintf(fd, "%.*s ", (int)cmd->lens[i], cmd->strs[i]);
+    size_t n;
+    const char *arg = MRCommand_ArgStringPtrLen(cmd, i, &n);
+    fprintf(fd, "%.*s ", (int)n, arg);
   }
   fprintf(fd, "\n");
 }
@@ -3,11 +3,35 @@
 #include <redismodule.h>
 #include "hiredis/sds.h"
 #include <assert.h>
+/* Arguments that fit in these are stored inside the argument block, without more allocations */
+#define MRCOMMAND_INLINE_ARGS 16
+#define MRCOMMAND_INLINE_BUF 256
+
+typedef struct {
+  /* Offset of the argument in the buffer. Arguments are NUL terminated */
+  uint32_t off;
+  uint32_t len;
+} MRCommandArg;
+
+/* The arguments of a command, stored back to back in a single growable buffer. Copies of a command
+ * share the block, until one of them changes its arguments and gets a block of its own */
+typedef struct {
+  int refcount;
+  /* The table of arguments, and its capacity */
+  MRCommandArg *args;
+  uint32_t cap;
+  char *buf;
+  size_t bufLen;
+  size_t bufCap;
+  MRCommandArg inlineArgs[MRCOMMAND_INLINE_ARGS];
+  char inlineBuf[MRCOMMAND_INLINE_BUF];
+} MRCommandArgs;
+
 /* A redis command is represented with all its arguments and its flags as MRCommand */
 typedef struct {
-  /* The command args starting from the command itself */
-  char **strs;
-  size_t *lens;
+  /* The command args starting from the command itself. Possibly shared with copies of the
+   * command, so they are only changed with the MRCommand functions */
+  MRCommandArgs *args;
 
   /* Number of arguments */
   uint32_t num;
@@ -18,6 +42,9 @@ typedef struct {
   /* if not -1, this value indicate to which slot the command should be sent */
   int targetSlot;
 
+  /* How long the shard may take to answer, in milliseconds, or 0 if it is not bounded */
+  long long timeoutMS;
+
   sds cmd;
 } MRCommand;
 
@@ -34,12 +61,14 @@ MRCommand MR_NewCommandFromStrings(int argc, char **argv);
 /* Create a command from a list of redis strings */
 MRCommand MR_NewCommandFromRedisStrings(int argc, RedisModuleString **argv);
 
+/* Return an argument of the command. It is valid until the command's arguments change */
 static inline const char *MRCommand_ArgStringPtrLen(const MRCommand *cmd, size_t idx, size_t *len) {
   // assert(idx < cmd->num);
+  const MRCommandArg *arg = &cmd->args->args[idx];
   if (len) {
-    *len = cmd->lens[idx];
+    *len = arg->len;
   }
-  return cmd->strs[idx];
+  return cmd->args->buf + arg->off;
 }
 
 /* A generator producing a list of commands on successive calls to Next(); */
@@ -97,7 +126,11 @@ int MRCommand_IsUnsharded(MRCommand *cmd);
 void MRCommand_Print(MRCommand *cmd);
 void MRCommand_FPrint(FILE *fd, MRCommand *cmd);
 
-/* Create a copy of a command by duplicating all strings */
+/* Create a copy of a command. The copy shares the arguments of the command until either of them
+ * changes, so copying is cheap */
 MRCommand MRCommand_Copy(const MRCommand *cmd);
 
+/* Return the wire format (RESP) of the command, as a new sds string */
+sds MRCommand_Format(const MRCommand *cmd);
+
 #endif
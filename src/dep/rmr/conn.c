@@ -12,25 +12,46 @@
 static void MRConn_ConnectCallback(const redisAsyncContext *c, int status);
 static void MRConn_DisconnectCallback(const redisAsyncContext *, int);
 static int MRConn_Connect(MRConn *conn);
+static int MRConn_TryConnect(MRConn *conn);
 static void MRConn_SwitchState(MRConn *conn, MRConnState nextState);
 static void MRConn_Free(void *ptr);
 static void MRConn_Stop(MRConn *conn);
 static MRConn *MR_NewConn(MREndpoint *ep);
 static int MRConn_StartNewConnection(MRConn *conn);
 static int MRConn_SendAuth(MRConn *conn);
+void _MRConn_CommandSent(MRConn *conn, uint64_t deadline);
 
-#define RSCONN_RECONNECT_TIMEOUT 250
+// Reconnect delays start at RSCONN_RECONNECT_TIMEOUT, and double with every retry up to the max
+#define RSCONN_RECONNECT_TIMEOUT 100
+#define RSCONN_RECONNECT_TIMEOUT_MAX 10000
+// Connection attempts in flight at once, over all nodes
+#define RSCONN_MAX_CONCURRENT_CONNECTS 32
 #define RSCONN_REAUTH_TIMEOUT 1000
 
 #define CONN_LOG(conn, fmt, ...)                                                \
   fprintf(stderr, "[%p %s:%d %s]" fmt "\n", conn, conn->ep.host, conn->ep.port, \
           MRConnState_Str((conn)->state), ##__VA_ARGS__)
 
+static MRConnCounters counters_g = {0};
+
+MRConnCounters MRConn_GetCounters(void) {
+  return counters_g;
+}
+
+/* The connection's attempt to connect is over, whether it succeeded or not */
+static void connAttemptEnded(MRConn *conn) {
+  if (conn->attempting) {
+    conn->attempting = 0;
+    counters_g.inFlight--;
+  }
+}
+
 /** detaches from our redis context */
 static redisAsyncContext *detachFromConn(MRConn *conn, int shouldFree) {
   if (!conn->conn) {
     return NULL;
   }
+  connAttemptEnded(conn);
 
   redisAsyncContext *ac = conn->conn;
   ac->data = NULL;
@@ -47,6 +68,7 @@ typedef struct {
   size_t num;
   size_t rr;  // round robin counter
   MRConn **conns;
+  MRNodeStats *stats;
 } MRConnPool;
 
 static MRConnPool *_MR_NewConnPool(MREndpoint *ep, size_t num) {
@@ -55,11 +77,13 @@ static MRConnPool *_MR_NewConnPool(MREndpoint *ep, size_t num) {
       .num = num,
       .rr = 0,
       .conns = calloc(num, sizeof(MRConn *)),
+      .stats = calloc(1, sizeof(MRNodeStats)),
   };
 
   /* Create the connection */
   for (size_t i = 0; i < num; i++) {
     pool->conns[i] = MR_NewConn(ep);
+    pool->conns[i]->stats = pool->stats;
   }
   return pool;
 }
@@ -72,9 +96,21 @@ static void MRConnPool_Free(void *p) {
     MRConn_Stop(pool->conns[i]);
   }
   free(pool->conns);
+  if (pool->stats->outstanding) {
+    pool->stats->released = 1;
+  } else {
+    free(pool->stats);
+  }
   free(pool);
 }
 
+void MRNodeStats_CommandDone(MRNodeStats *st) {
+  if (st->outstanding) st->outstanding--;
+  if (st->released && !st->outstanding) {
+    free(st);
+  }
+}
+
 /* Get a connection from the connection pool. We select the next available connected connection with
  * a roundrobin selector */
 static MRConn *MRConnPool_Get(MRConnPool *pool) {
@@ -95,11 +131,19 @@ void MRConnManager_Init(MRConnManager *mgr, int nodeConns) {
   /* Create the connection map */
   mgr->map = NewTrieMap();
   mgr->nodeConns = nodeConns;
+  mgr->healthTimer = NULL;
+  mgr->maxRttMS = 0;
 }
 
 /* Free the entire connection manager */
-static void MRConnManager_Free(MRConnManager *mgr) {
+void MRConnManager_Free(MRConnManager *mgr) {
+  if (mgr->healthTimer) {
+    uv_timer_stop(mgr->healthTimer);
+    uv_close(mgr->healthTimer, (uv_close_cb)free);
+    mgr->healthTimer = NULL;
+  }
   TrieMap_Free(mgr->map, MRConnPool_Free);
+  mgr->map = NULL;
 }
 
 /* Get the connection for a specific node by id, return NULL if this node is not in the pool */
@@ -113,6 +157,15 @@ MRConn *MRConn_Get(MRConnManager *mgr, const char *id) {
   return NULL;
 }
 
+/* Get the load statistics of a node by id, return NULL if this node is not in the pool */
+MRNodeStats *MRConn_GetStats(MRConnManager *mgr, const char *id) {
+  void *ptr = TrieMap_Find(mgr->map, (char *)id, strlen(id));
+  if (ptr != TRIEMAP_NOTFOUND) {
+    return ((MRConnPool *)ptr)->stats;
+  }
+  return NULL;
+}
+
 /* Send a command to the connection */
 int MRConn_SendCommand(MRConn *c, MRCommand *cmd, redisCallbackFn *fn, void *privdata) {
 
@@ -123,11 +176,14 @@ int MRConn_SendCommand(MRConn *c, MRCommand *cmd, redisCallbackFn *fn, void *pri
   // printf("Sending to %s:%d\n", c->ep.host, c->ep.port);
   // MRCommand_Print(cmd);
   if (!cmd->cmd) {
-    if (redisFormatSdsCommandArgv(&cmd->cmd, cmd->num, (const char **)cmd->strs, cmd->lens) == REDIS_ERR) {
-      return REDIS_ERR;
-    }
+    cmd->cmd = MRCommand_Format(cmd);
+  }
+  if (redisAsyncFormattedCommand(c->conn, fn, privdata, cmd->cmd, sdslen(cmd->cmd)) == REDIS_ERR) {
+    return REDIS_ERR;
   }
-  return redisAsyncFormattedCommand(c->conn, fn, privdata, cmd->cmd, sdslen(cmd->cmd));
+  c->lastUsed = uv_now(uv_default_loop());
+  _MRConn_CommandSent(c, cmd->timeoutMS ? c->lastUsed + cmd->timeoutMS : UINT64_MAX);
+  return REDIS_OK;
 }
 
 // replace an existing coonnection pool with a new one
@@ -158,7 +214,9 @@ int MRConnManager_Add(MRConnManager *m, const char *id, MREndpoint *ep, int conn
   MRConnPool *pool = _MR_NewConnPool(ep, m->nodeConns);
   if (connect) {
     for (size_t i = 0; i < pool->num; i++) {
-      MRConn_Connect(pool->conns[i]);
+      if (MRConn_TryConnect(pool->conns[i]) == REDIS_ERR) {
+        MRConn_SwitchState(pool->conns[i], MRConn_Connecting);
+      }
     }
   }
 
@@ -170,7 +228,7 @@ int MRConnManager_Add(MRConnManager *m, const char *id, MREndpoint *ep, int conn
  */
 static int MRConn_StartNewConnection(MRConn *conn) {
   if (conn && conn->state == MRConn_Disconnected) {
-    if (MRConn_Connect(conn) == REDIS_ERR) {
+    if (MRConn_TryConnect(conn) == REDIS_ERR) {
       MRConn_SwitchState(conn, MRConn_Connecting);
     }
     return REDIS_OK;
@@ -212,6 +270,128 @@ int MRConnManager_Disconnect(MRConnManager *m, const char *id) {
 static void MRConn_Stop(MRConn *conn) {
   CONN_LOG(conn, "Requesting to stop");
   MRConn_SwitchState(conn, MRConn_Freeing);
+  // the pool, which owns the stats, is freed right after its connections are stopped
+  conn->stats = NULL;
+}
+
+// Health check PINGs unanswered for this many intervals mark the node suspect
+#define MRCONN_HEALTHCHECK_MISSED 3
+// Weight of the latest PING round trip time in the node's moving average
+#define MRCONN_RTT_ALPHA 0.2
+
+static void MRConn_PingCallback(redisAsyncContext *c, void *r, void *privdata) {
+  MRConn *conn = c->data;
+  if (!conn || conn->state == MRConn_Freeing || !r) {
+    // Will be picked up by disconnect callback
+    return;
+  }
+
+  double rtt = uv_now(uv_default_loop()) - conn->pingSentAt;
+  conn->pingSentAt = 0;
+  if (conn->stats) {
+    conn->stats->rttEWMA =
+        conn->stats->rttEWMA ? (1 - MRCONN_RTT_ALPHA) * conn->stats->rttEWMA + MRCONN_RTT_ALPHA * rtt
+                             : rtt;
+    conn->stats->suspect = 0;
+  }
+}
+
+/* Record the loop time (ms) by which a command sent should be answered */
+void _MRConn_CommandSent(MRConn *conn, uint64_t deadline) {
+  conn->deadlines[conn->numSent++ % MRCONN_SENT_HISTORY] = deadline;
+  conn->maxDeadline = MAX(conn->maxDeadline, deadline);
+}
+
+/* The latest loop time (ms) by which the commands still waiting for their replies should be
+ * answered, 0 if there are none, or UINT64_MAX if any of them has no timeout. If more commands
+ * are waiting than the history holds, the latest deadline of all the commands stands for them */
+static uint64_t MRConn_PendingDeadline(MRConn *conn) {
+  size_t pending = 0;
+  for (redisCallback *cb = conn->conn->replies.head; cb; cb = cb->next) {
+    pending++;
+  }
+  if (pending > MIN(conn->numSent, MRCONN_SENT_HISTORY)) {
+    return conn->numSent ? conn->maxDeadline : 0;
+  }
+  uint64_t deadline = 0;
+  for (size_t i = conn->numSent - pending; i < conn->numSent; i++) {
+    deadline = MAX(deadline, conn->deadlines[i % MRCONN_SENT_HISTORY]);
+  }
+  return deadline;
+}
+
+/* Return 1 if the node missed the deadline of a command, or of a health check PING, by a few
+ * health check intervals. Commands that take as long as their timeout allows are not held against
+ * the node */
+int _MRConn_Unresponsive(MRConn *conn, uint64_t now, uint64_t intervalMS) {
+  uint64_t deadline = MRConn_PendingDeadline(conn);
+  return deadline && deadline != UINT64_MAX &&
+         now >= deadline + MRCONN_HEALTHCHECK_MISSED * intervalMS;
+}
+
+/* Drop the connection of an unresponsive node, failing its pending commands, and connect again */
+static void MRConn_Reconnect(MRConn *conn) {
+  CONN_LOG(conn, "Not answering in time, reconnecting");
+  conn->pingSentAt = 0;
+  detachFromConn(conn, 1);
+  if (MRConn_TryConnect(conn) == REDIS_ERR) {
+    MRConn_SwitchState(conn, MRConn_Connecting);
+  }
+}
+
+static void MRConn_HealthCheck(MRConn *conn, uint64_t now, uint64_t intervalMS) {
+  if (conn->state != MRConn_Connected) {
+    if (conn->stats) conn->stats->suspect = 1;
+    return;
+  }
+
+  // a busy connection is checked by the deadlines of its commands, and a PING is due at once
+  if (_MRConn_Unresponsive(conn, now, intervalMS)) {
+    if (conn->stats) conn->stats->suspect = 1;
+    MRConn_Reconnect(conn);
+    return;
+  }
+  if (conn->conn->replies.head) {
+    return;
+  }
+
+  // idle connections are PINGed
+  if (now - conn->lastUsed >= intervalMS &&
+      redisAsyncCommand(conn->conn, MRConn_PingCallback, NULL, "PING") == REDIS_OK) {
+    conn->pingSentAt = now;
+    _MRConn_CommandSent(conn, now);
+  }
+}
+
+static void healthCheckCallback(uv_timer_t *tm) {
+  MRConnManager *m = tm->data;
+  uint64_t now = uv_now(uv_default_loop());
+  uint64_t intervalMS = uv_timer_get_repeat(tm);
+
+  TrieMapIterator *it = TrieMap_Iterate(m->map, "", 0);
+  char *key;
+  tm_len_t len;
+  void *p;
+  double maxRtt = 0;
+  while (TrieMapIterator_Next(it, &key, &len, &p)) {
+    MRConnPool *pool = p;
+    if (!pool) continue;
+    for (size_t i = 0; i < pool->num; i++) {
+      MRConn_HealthCheck(pool->conns[i], now, intervalMS);
+    }
+    maxRtt = MAX(maxRtt, pool->stats->rttEWMA);
+  }
+  TrieMapIterator_Free(it);
+  m->maxRttMS = maxRtt;
+}
+
+void MRConnManager_StartHealthCheck(MRConnManager *m, uint64_t intervalMS) {
+  if (!m->healthTimer) {
+    m->healthTimer = malloc(sizeof(uv_timer_t));
+    uv_timer_init(uv_default_loop(), m->healthTimer);
+    ((uv_timer_t *)m->healthTimer)->data = m;
+  }
+  uv_timer_start(m->healthTimer, healthCheckCallback, intervalMS, intervalMS);
 }
 
 static void freeConn(MRConn *conn) {
@@ -235,6 +415,7 @@ static void signalCallback(uv_timer_t *tm) {
     if (conn->conn) {
       redisAsyncContext *ac = conn->conn;
       // detach the connection
+      connAttemptEnded(conn);
       ac->data = NULL;
       conn->conn = NULL;
       redisAsyncDisconnect(ac);
@@ -249,7 +430,7 @@ static void signalCallback(uv_timer_t *tm) {
       MRConn_SwitchState(conn, MRConn_Connecting);
     }
   } else if (conn->state == MRConn_Connecting) {
-    if (MRConn_Connect(conn) == REDIS_ERR) {
+    if (MRConn_TryConnect(conn) == REDIS_ERR) {
       detachFromConn(conn, 1);
       MRConn_SwitchState(conn, MRConn_Connecting);
     }
@@ -258,6 +439,22 @@ static void signalCallback(uv_timer_t *tm) {
   }
 }
 
+/* The delay before the next reconnect attempt: exponential in the number of retries, up to a cap.
+ * Half of it is random, so that coordinators do not all retry a node at the same moments. An
+ * attempt put off by the concurrent connect cap waits without backing off further */
+static uint64_t MRConn_ReconnectDelay(MRConn *conn) {
+  uint64_t delay = RSCONN_RECONNECT_TIMEOUT_MAX;
+  if (conn->retries < 16) {
+    delay = MIN(delay, (uint64_t)RSCONN_RECONNECT_TIMEOUT << conn->retries);
+  }
+  if (conn->deferred) {
+    conn->deferred = 0;
+  } else {
+    conn->retries++;
+  }
+  return delay / 2 + rand() % (delay / 2 + 1);
+}
+
 /* Safely transition to current state */
 static void MRConn_SwitchState(MRConn *conn, MRConnState nextState) {
   if (!conn->timer) {
@@ -283,7 +480,7 @@ static void MRConn_SwitchState(MRConn *conn, MRConnState nextState) {
       abort();
 
     case MRConn_Connecting:
-      nextTimeout = RSCONN_RECONNECT_TIMEOUT;
+      nextTimeout = MRConn_ReconnectDelay(conn);
       conn->state = nextState;
       break;
 
@@ -295,6 +492,12 @@ static void MRConn_SwitchState(MRConn *conn, MRConnState nextState) {
     case MRConn_Connected:
       // "Dummy" states:
       conn->state = nextState;
+      conn->pingSentAt = 0;
+      conn->numSent = 0;
+      conn->maxDeadline = 0;
+      conn->retries = 0;
+      conn->deferred = 0;
+      if (conn->stats) conn->stats->suspect = 0;
       if (uv_is_active(conn->timer)) {
         uv_timer_stop(conn->timer);
       }
@@ -367,8 +570,10 @@ static void MRConn_ConnectCallback(const redisAsyncContext *c, int status) {
   }
 
   // fprintf(stderr, "Connect callback! status :%d\n", status);
+  connAttemptEnded(conn);
   // if the connection is not stopped - try to reconnect
   if (status != REDIS_OK) {
+    counters_g.failures++;
     CONN_LOG(conn, "Error on connect: %s", c->errstr);
     detachFromConn(conn, 0);  // Free the connection as well - we have an error
     MRConn_SwitchState(conn, MRConn_Connecting);
@@ -445,9 +650,11 @@ static int MRConn_Connect(MRConn *conn) {
                           .options = REDIS_OPT_NOAUTOFREEREPLIES,
                           .endpoint.tcp = {.ip = conn->ep.host, .port = conn->ep.port}};
 
+  counters_g.attempts++;
   redisAsyncContext *c = redisAsyncConnectWithOptions(&options);
   if (c->err) {
     CONN_LOG(conn, "Could not connect to node: %s", c->errstr);
+    counters_g.failures++;
     redisAsyncFree(c);
     return REDIS_ERR;
   }
@@ -455,6 +662,8 @@ static int MRConn_Connect(MRConn *conn) {
   conn->conn = c;
   conn->conn->data = conn;
   conn->state = MRConn_Connecting;
+  conn->attempting = 1;
+  counters_g.inFlight++;
 
   redisLibuvAttach(conn->conn, uv_default_loop());
   redisAsyncSetConnectCallback(conn->conn, MRConn_ConnectCallback);
@@ -462,3 +671,14 @@ static int MRConn_Connect(MRConn *conn) {
 
   return REDIS_OK;
 }
+
+/* Connect, unless too many connection attempts are already in flight. Returns REDIS_ERR if the
+ * connection was not started, and should be tried again later */
+static int MRConn_TryConnect(MRConn *conn) {
+  if (counters_g.inFlight >= RSCONN_MAX_CONCURRENT_CONNECTS) {
+    counters_g.deferred++;
+    conn->deferred = 1;
+    return REDIS_ERR;
+  }
+  return MRConn_Connect(conn);
+}
@@ -10,6 +10,9 @@
 
 #define MR_CONN_POOL_SIZE 1
 
+/* The number of the latest commands of a connection whose send times are kept */
+#define MRCONN_SENT_HISTORY 64
+
 /*
  * The state of the connection.
  * TODO: Not all of these are "real" states
@@ -47,17 +50,77 @@ static inline const char *MRConnState_Str(MRConnState state) {
   }
 }
 
+/* Load statistics of a node, used when selecting which of a shard's nodes to send a command to */
+typedef struct MRNodeStats {
+  /* Exponentially weighted moving average of the node's response time, in milliseconds, where
+   * failed commands count as slow replies. 0 until the node first replies */
+  double latencyEWMA;
+  /* Number of commands sent to the node that have not been replied yet */
+  size_t outstanding;
+  /* Moving average of the health check PING round trip time, in milliseconds */
+  double rttEWMA;
+  /* Set while the node is not connected, or does not answer health checks */
+  int suspect;
+  /* Circuit breaker: the node's consecutive failed commands, the loop time (ms) until which it is
+   * not sent commands once they are too many, and whether a probing command is in flight after
+   * that time */
+  int failures;
+  uint64_t openUntil;
+  int probing;
+  /* Set once the node's pool is freed while it has outstanding commands, whose callbacks keep
+   * using the stats. They are freed by MRNodeStats_CommandDone once the last one is done */
+  int released;
+} MRNodeStats;
+
+/* Account for the reply, or the failure, of one of the node's outstanding commands */
+void MRNodeStats_CommandDone(MRNodeStats *st);
+
 typedef struct {
   MREndpoint ep;
   redisAsyncContext *conn;
   MRConnState state;
   void *timer;
+  /* The statistics of the connection's node, owned by its pool */
+  MRNodeStats *stats;
+  /* Loop time (ms) the connection last sent a command, and of its unanswered health check PING */
+  uint64_t lastUsed;
+  uint64_t pingSentAt;
+  /* Loop times (ms) by which the latest commands sent since the connection was connected should
+   * be answered, by their number modulo MRCONN_SENT_HISTORY, or UINT64_MAX for commands without a
+   * timeout. Replies arrive in the order of the commands, so the unanswered commands are found
+   * from the number of replies pending. maxDeadline is the latest deadline of all the commands */
+  uint64_t deadlines[MRCONN_SENT_HISTORY];
+  uint64_t numSent;
+  uint64_t maxDeadline;
+  /* Consecutive failed connection attempts since the connection was last connected */
+  unsigned retries;
+  /* Set when the last attempt was put off rather than failed, so it does not count as a retry */
+  int deferred;
+  /* Set while a connection attempt is in flight */
+  int attempting;
 } MRConn;
 
+/* Global connection attempt counters */
+typedef struct {
+  size_t attempts;
+  size_t failures;
+  /* Attempts put off because too many others were in flight */
+  size_t deferred;
+  /* Attempts in flight */
+  size_t inFlight;
+} MRConnCounters;
+
+/* Get a snapshot of the global connection attempt counters */
+MRConnCounters MRConn_GetCounters(void);
+
 /* A pool indexes connections by the node id */
 typedef struct {
   TrieMap *map;
   int nodeConns;
+  /* Periodically checks the health of idle connections */
+  void *healthTimer;
+  /* The highest health check round trip time of the nodes, in milliseconds */
+  double maxRttMS;
 } MRConnManager;
 
 void MRConnManager_Init(MRConnManager *mgr, int nodeConns);
@@ -67,13 +130,25 @@ MRConn *MRConn_Get(MRConnManager *mgr, const char *id);
 
 int MRConn_SendCommand(MRConn *c, MRCommand *cmd, redisCallbackFn *fn, void *privdata);
 
+/* Get the load statistics of a node by id, return NULL if this node is not in the pool */
+MRNodeStats *MRConn_GetStats(MRConnManager *mgr, const char *id);
+
 /* Add a node to the connection manager */
 int MRConnManager_Add(MRConnManager *m, const char *id, MREndpoint *ep, int connect);
 
 /* Connect all nodes to their destinations */
 int MRConnManager_ConnectAll(MRConnManager *m);
 
+/* Start PINGing idle connections every intervalMS. Nodes that do not answer a PING, or a command
+ * with a timeout, within a few intervals of its deadline are marked suspect, and their connections
+ * are dropped and reconnected. Must be called on the I/O loop thread */
+void MRConnManager_StartHealthCheck(MRConnManager *m, uint64_t intervalMS);
+
 /* Disconnect a node */
 int MRConnManager_Disconnect(MRConnManager *m, const char *id);
 
+/* Stop the health checks and disconnect all the nodes. The connections are freed asynchronously
+ * by the I/O loop. Must be called on the I/O loop thread */
+void MRConnManager_Free(MRConnManager *m);
+
 #endif
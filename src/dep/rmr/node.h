@@ -5,10 +5,15 @@
 
 typedef enum { MRNode_Master = 0x1, MRNode_Self = 0x2, MRNode_Coordinator = 0x4 } MRNodeFlags;
 
+struct MRNodeStats;
+
 typedef struct {
   MREndpoint endpoint;
   const char *id;
   MRNodeFlags flags;
+  /* The load statistics of the node, owned by its connection pool. Set when the cluster applies
+   * the topology */
+  struct MRNodeStats *stats;
 } MRClusterNode;
 
 /* Free an MRendpoint object */
@@ -37,6 +42,8 @@ void MRNodeMapIterator_Free(MRNodeMapIterator *it);
 MRNodeMap *MR_NewNodeMap();
 void MRNodeMap_Free(MRNodeMap *m);
 void MRNodeMap_Add(MRNodeMap *m, MRClusterNode *n);
+/* Remove the node at n's address, and its host once it has no more nodes */
+void MRNodeMap_Remove(MRNodeMap *m, MRClusterNode *n);
 MRClusterNode *MRNodeMap_RandomNode(MRNodeMap *m);
 size_t MRNodeMap_NumHosts(MRNodeMap *m);
 size_t MRNodeMap_NumNodes(MRNodeMap *m);
@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
 #include "node.h"
 #include "dep/triemap/triemap.h"
 #include "dep/triemap/triemap.h"
@@ -101,6 +103,24 @@ void MRNodeMap_Add(MRNodeMap *m, MRClusterNode *n) {
   free(addr);
 }
 
+void MRNodeMap_Remove(MRNodeMap *m, MRClusterNode *n) {
+  char *addr;
+  asprintf(&addr, "%s:%d", n->endpoint.host, n->endpoint.port);
+  size_t hostLen = strlen(n->endpoint.host) + 1;
+  TrieMap_Delete(m->nodes, addr, strlen(addr), _nodemap_free);
+
+  // the host stays as long as any node is at "host:"
+  TrieMapIterator *it = TrieMap_Iterate(m->nodes, addr, hostLen);
+  char *k;
+  tm_len_t len;
+  void *p;
+  if (!TrieMapIterator_Next(it, &k, &len, &p)) {
+    TrieMap_Delete(m->hosts, n->endpoint.host, strlen(n->endpoint.host), NULL);
+  }
+  TrieMapIterator_Free(it);
+  free(addr);
+}
+
 MRClusterNode *MRNodeMap_RandomNode(MRNodeMap *m) {
   char *k;
   tm_len_t len;
@@ -19,6 +19,27 @@ int MRReply_StringEquals(MRReply *r, const char *s, int caseSensitive) {
     return !strncasecmp(s, rs, slen);
   }
 }
+
+size_t MRReply_MergeArrays(MRReply **replies, int count, MRReply **out) {
+  size_t len = 0;
+  for (int i = 0; i < count; i++) {
+    MRReply *r = replies[i];
+    if (!r || MRReply_Type(r) != MR_REPLY_ARRAY) continue;
+    size_t n = MRReply_Length(r);
+    // the positions past the merged ones so far have no element yet
+    for (size_t j = len; j < n; j++) {
+      out[j] = NULL;
+    }
+    if (n > len) len = n;
+    for (size_t j = 0; j < n; j++) {
+      if (!out[j] || MRReply_Type(out[j]) == MR_REPLY_NIL) {
+        out[j] = MRReply_ArrayElement(r, j);
+      }
+    }
+  }
+  return len;
+}
+
 void MRReply_Print(FILE *fp, MRReply *r) {
   if (!r) {
     fprintf(fp, "NULL");
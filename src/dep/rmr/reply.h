@@ -44,6 +44,11 @@ static inline MRReply *MRReply_ArrayElement(MRReply *reply, size_t idx) {
   return reply->element[idx];
 }
 
+/* Merge array replies position by position, taking at every position the first element that is not
+ * NIL, or a NIL if all of them are. Replies that are not arrays are skipped. out must have room for
+ * the longest of the arrays. Returns the length of the merged array. Every element is visited once */
+size_t MRReply_MergeArrays(MRReply **replies, int count, MRReply **out);
+
 void MRReply_Print(FILE *fp, MRReply *r);
 int MRReply_ToInteger(MRReply *reply, long long *i);
 int MRReply_ToDouble(MRReply *reply, double *d);
@@ -19,17 +19,51 @@
 #include "cluster.h"
 #include "chan.h"
 #include "rq.h"
+#include "timer_wheel.h"
 
 extern int redisMajorVesion;
 
 /* Currently a single cluster is supported */
 static MRCluster *cluster_g = NULL;
+/* Queue of the loop's own tasks, e.g. topology updates */
 static MRWorkQueue *rq_g = NULL;
+/* Queues of the requests of every class, each with its own admission limit */
+static MRWorkQueue *requestQueues_g[MR_NUM_REQUEST_CLASSES] = {NULL};
+/* Tracks the deadlines of the requests in flight */
+static MRTimerWheel *deadlines_g = NULL;
+
+// Granularity and size of the deadline wheel - a turn takes about 10 seconds
+#define MR_DEADLINE_TICK_MS 10
+#define MR_DEADLINE_SLOTS 1024
+// The blocked client's own timeout is a backstop, in case the loop stalls past the deadline
+#define MR_BLOCK_TIMEOUT_BACKSTOP_MS 1000
 
 #define MAX_CONCURRENT_REQUESTS (MR_CONN_POOL_SIZE * 50)
+
+/* The admission limits of every request class. Concurrency starts at the initial limit, and adapts
+ * to the latency of the requests up to the max. Once too many requests are waiting, new ones are
+ * rejected */
+static const struct {
+  const char *name;
+  size_t maxQueued;
+  int initialPending;
+  int maxPending;
+} requestClasses_g[MR_NUM_REQUEST_CLASSES] = {
+    [MRRequestClass_Single] = {"single", 100000, MAX_CONCURRENT_REQUESTS,
+                               MAX_CONCURRENT_REQUESTS * 20},
+    [MRRequestClass_Fanout] = {"fanout", 10000, MAX_CONCURRENT_REQUESTS,
+                               MAX_CONCURRENT_REQUESTS * 4},
+    [MRRequestClass_Iterator] = {"iterator", 1000, MR_CONN_POOL_SIZE * 8, MAX_CONCURRENT_REQUESTS},
+};
 /* Coordination request timeout */
 long long timeout_g = 5000;
 
+/* The command a reply answers, for requests whose replies are kept in the order of their commands */
+typedef struct {
+  struct MRCtx *ctx;
+  int idx;
+} MRReplySlot;
+
 /* MapReduce context for a specific command's execution */
 typedef struct MRCtx {
   struct timespec startTime;
@@ -42,10 +76,36 @@ typedef struct MRCtx {
   int repliesCap;
   MRReduceFunc reducer;
   void *privdata;
+  /* Frees privdata along with the context, whether or not the reducer ran */
+  void (*freePrivdata)(void *);
   void *redisCtx;
   MRCoordinationStrategy strategy;
   MRCommand *cmds;
   int numCmds;
+  /* Commands not sent because no node could serve them */
+  int numUnavailable;
+  /* Whether the reducer may reply with the replies of the available nodes only */
+  int allowPartial;
+
+  /* The request is timed out at the deadline, in MRTimerWheel_Now ms. Its replies are not waited
+   * for anymore, and late ones are discarded */
+  uint64_t deadline;
+  MRTimerEntry deadlineEntry;
+  int timedOut;
+  /* The owner and every command in flight hold a reference, so late replies find the context */
+  int refcount;
+  /* The work queue holding the request's slot, and whether the slot is released */
+  MRWorkQueue *rq;
+  int slotReleased;
+  /* Set if the request was not admitted */
+  int rejected;
+  /* Whether replies[i] is the reply of cmds[i], and the places of the replies of the commands */
+  int orderedReplies;
+  MRReplySlot *replySlots;
+  /* Called with every reply as it arrives. The replies it takes are counted in numTaken and are
+   * not kept for the reducer */
+  MRReplyHandler replyHandler;
+  int numTaken;
 
   /**
    * This is a reduce function inside the MRCtx.
@@ -83,28 +143,58 @@ MRCtx *MR_CreateCtx(RedisModuleCtx *ctx, void *privdata) {
   ret->replies = calloc(ret->repliesCap, sizeof(redisReply *));
   ret->reducer = NULL;
   ret->privdata = privdata;
+  ret->freePrivdata = NULL;
   ret->strategy = MRCluster_FlatCoordination;
   ret->redisCtx = ctx;
   ret->fn = NULL;
+  ret->numUnavailable = 0;
+  ret->allowPartial = 0;
+  ret->deadline = MRTimerWheel_Now() + timeout_g;
+  ret->deadlineEntry = (MRTimerEntry){0};
+  ret->timedOut = 0;
+  ret->refcount = 1;
+  ret->rq = NULL;
+  ret->slotReleased = 0;
+  ret->rejected = 0;
+  ret->cmds = NULL;
+  ret->numCmds = 0;
+  ret->orderedReplies = 0;
+  ret->replySlots = NULL;
+  ret->replyHandler = NULL;
+  ret->numTaken = 0;
   totalAllocd++;
 
   return ret;
 }
 
+/* The number of replies the reducer gets. Ordered replies have a place for every command, which is
+ * NULL if the command failed */
+static int replyCount(MRCtx *ctx) {
+  return ctx->orderedReplies ? ctx->numCmds : ctx->numReplied;
+}
+
 void MRCtx_Free(MRCtx *ctx) {
+  // commands in flight still reference the context
+  if (__atomic_sub_fetch(&ctx->refcount, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
 
   for (int i = 0; i < ctx->numCmds; i++) {
     MRCommand_Free(&ctx->cmds[i]);
   }
   free(ctx->cmds);
 
-  for (int i = 0; i < ctx->numReplied; i++) {
+  for (int i = 0; i < replyCount(ctx); i++) {
     if (ctx->replies[i] != NULL) {
       MRReply_Free(ctx->replies[i]);
       ctx->replies[i] = NULL;
     }
   }
   free(ctx->replies);
+  free(ctx->replySlots);
+  if (ctx->privdata && ctx->freePrivdata) {
+    ctx->freePrivdata(ctx->privdata);
+  }
 
   // free the context
   free(ctx);
@@ -115,6 +205,10 @@ void *MRCtx_GetPrivdata(struct MRCtx *ctx) {
   return ctx->privdata;
 }
 
+void MRCtx_SetFreePrivdata(struct MRCtx *ctx, void (*freePrivdata)(void *)) {
+  ctx->freePrivdata = freePrivdata;
+}
+
 RedisModuleCtx *MRCtx_GetRedisCtx(struct MRCtx *ctx) {
   return ctx->redisCtx;
 }
@@ -135,11 +229,49 @@ void MRCtx_SetReduceFunction(struct MRCtx *ctx, MRReduceFunc fn) {
   ctx->fn = fn;
 }
 
+void MRCtx_SetAllowPartial(struct MRCtx *ctx, int allow) {
+  ctx->allowPartial = allow;
+}
+
+void MRCtx_SetOrderedReplies(struct MRCtx *ctx) {
+  ctx->orderedReplies = 1;
+}
+
+void MRCtx_SetReplyHandler(struct MRCtx *ctx, MRReplyHandler handler) {
+  ctx->replyHandler = handler;
+}
+
+int MRCtx_AllowPartial(struct MRCtx *ctx) {
+  return ctx->allowPartial;
+}
+
+int MRCtx_NumUnavailable(struct MRCtx *ctx) {
+  return ctx->numUnavailable;
+}
+
+int MRCtx_TimedOut(struct MRCtx *ctx) {
+  return ctx->timedOut;
+}
+
+long long MRCtx_RemainingMS(struct MRCtx *ctx) {
+  uint64_t now = MRTimerWheel_Now();
+  return ctx->deadline > now ? ctx->deadline - now : 0;
+}
+
+void MRCtx_RequestCompleted(struct MRCtx *ctx) {
+  // a timed out request has its slot released already
+  if (!__atomic_exchange_n(&ctx->slotReleased, 1, __ATOMIC_ACQ_REL) && ctx->rq) {
+    RQ_Done(ctx->rq);
+  }
+}
+
+
 static void freePrivDataCB(void *p) {
   // printf("FreePrivData called!\n");
-  MR_requestCompleted();
+  // a client unblocked without a context holds no slot of any class
   if (p) {
     MRCtx *mc = p;
+    MRCtx_RequestCompleted(mc);
     MRCtx_Free(mc);
   }
 }
@@ -161,21 +293,56 @@ static int unblockHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int arg
 
   mc->redisCtx = ctx;
 
-  return mc->reducer(mc, mc->numReplied, mc->replies);
+  if (mc->rejected) {
+    return RedisModule_ReplyWithError(ctx, MR_OVERLOADED_ERR);
+  }
+  if (mc->timedOut && !mc->allowPartial) {
+    return timeoutHandler(ctx, argv, argc);
+  }
+  return mc->reducer(mc, replyCount(mc), mc->replies);
 }
 
-/* The callback called from each fanout request to aggregate their replies */
-static void fanoutCallback(redisAsyncContext *c, void *r, void *privdata) {
-  MRCtx *ctx = privdata;
+/* Hand the replies received so far to the reducer, or to the unblocked client */
+static void requestFinished(MRCtx *ctx) {
+  if (ctx->fn) {
+    ctx->fn(ctx, replyCount(ctx), ctx->replies);
+  } else {
+    RedisModuleBlockedClient *bc = ctx->redisCtx;
+    RedisModule_UnblockClient(bc, ctx);
+  }
+}
+
+/* The request's deadline passed before all its replies arrived. Its slot is released right away,
+ * and the replies still in flight will be discarded */
+static void requestTimedOut(void *p) {
+  MRCtx *ctx = p;
+  ctx->timedOut = 1;
+  MRCtx_RequestCompleted(ctx);
+  requestFinished(ctx);
+}
+
+/* Aggregate a reply of a request, in the place of its command idx if the replies are ordered */
+static void replyReceived(MRCtx *ctx, MRReply *r, int idx) {
+  if (ctx->timedOut) {
+    if (r) MRReply_Free(r);
+    MRCtx_Free(ctx);
+    return;
+  }
   struct timespec now;
   clock_gettime(CLOCK_REALTIME, &now);
 
-  if (ctx->numReplied == 0 && ctx->numErrored == 0) {
+  if (ctx->numReplied == 0 && ctx->numTaken == 0 && ctx->numErrored == 0) {
     clock_gettime(CLOCK_REALTIME, &ctx->firstRespTime);
   }
   if (!r) {
     ctx->numErrored++;
 
+  } else if (ctx->replyHandler && ctx->replyHandler(ctx, r)) {
+    ctx->numTaken++;
+
+  } else if (ctx->orderedReplies) {
+    ctx->replies[idx] = r;
+    ctx->numReplied++;
   } else {
     /* If needed - double the capacity for replies */
     if (ctx->numReplied == ctx->repliesCap) {
@@ -189,14 +356,27 @@ static void fanoutCallback(redisAsyncContext *c, void *r, void *privdata) {
   //        ctx->numExpected);
 
   // If we've received the last reply - unblock the client
-  if (ctx->numReplied + ctx->numErrored == ctx->numExpected) {
-    if (ctx->fn) {
-      ctx->fn(ctx, ctx->numReplied, ctx->replies);
-    } else {
-      RedisModuleBlockedClient *bc = ctx->redisCtx;
-      RedisModule_UnblockClient(bc, ctx);
-    }
+  if (ctx->numReplied + ctx->numTaken + ctx->numErrored == ctx->numExpected) {
+    MRTimerWheel_Remove(deadlines_g, &ctx->deadlineEntry);
+    requestFinished(ctx);
   }
+  MRCtx_Free(ctx);
+}
+
+/* The callback called from each fanout request to aggregate their replies */
+static void fanoutCallback(redisAsyncContext *c, void *r, void *privdata) {
+  replyReceived(privdata, r, -1);
+}
+
+static void orderedReplyCallback(redisAsyncContext *c, void *r, void *privdata) {
+  MRReplySlot *slot = privdata;
+  replyReceived(slot->ctx, r, slot->idx);
+}
+
+/* Commands were sent - hold a reference for each of them, and start tracking the deadline */
+static void requestSent(MRCtx *ctx) {
+  __atomic_add_fetch(&ctx->refcount, ctx->numExpected, __ATOMIC_ACQ_REL);
+  MRTimerWheel_Add(deadlines_g, &ctx->deadlineEntry, ctx->deadline, requestTimedOut, ctx);
 }
 
 // temporary request context to pass to the event loop
@@ -227,12 +407,32 @@ static void sideThread(void *arg) {
 
 uv_thread_t loop_th;
 
+// Idle connections are PINGed at this interval
+#define MR_HEALTHCHECK_INTERVAL_MS 1000
+
+/* Start the connections' health check on the io loop */
+static void uvStartHealthCheck(void *p) {
+  MRConnManager_StartHealthCheck(&cluster_g->mgr, MR_HEALTHCHECK_INTERVAL_MS);
+  RQ_Done(rq_g);
+}
+
 /* Initialize the MapReduce engine with a node provider */
 void MR_Init(MRCluster *cl, long long timeoutMS) {
 
   cluster_g = cl;
   timeout_g = timeoutMS;
-  rq_g = RQ_New(8, MAX_CONCURRENT_REQUESTS);
+  // replies arriving after their request timed out count against their node's circuit breaker
+  MRCluster_SetSlowReplyThreshold(cl, timeoutMS);
+  rq_g = RQ_New(0, 8, 8);
+  for (int i = 0; i < MR_NUM_REQUEST_CLASSES; i++) {
+    requestQueues_g[i] = RQ_New(requestClasses_g[i].maxQueued, requestClasses_g[i].initialPending,
+                                requestClasses_g[i].maxPending);
+  }
+  // requests that would wait for a slot past their deadline are shed right away
+  RQ_SetMaxWait(requestQueues_g[MRRequestClass_Single], timeoutMS);
+  RQ_SetMaxWait(requestQueues_g[MRRequestClass_Fanout], timeoutMS);
+  deadlines_g = MRTimerWheel_New(MR_DEADLINE_TICK_MS, MR_DEADLINE_SLOTS);
+  RQ_Push(rq_g, uvStartHealthCheck, NULL);
 
   // MRCluster_ConnectAll(cluster_g);
   printf("Creating thread...\n");
@@ -244,19 +444,30 @@ void MR_Init(MRCluster *cl, long long timeoutMS) {
   printf("Thread created\n");
 }
 
+void MR_SetReadPolicy(MRReadPolicy policy) {
+  if (cluster_g) {
+    MRCluster_SetReadPolicy(cluster_g, policy);
+  }
+}
+
 MRClusterTopology *MR_GetCurrentTopology() {
-  return cluster_g ? cluster_g->topo : NULL;
+  return cluster_g ? MRCluster_GetTopology(cluster_g) : NULL;
 }
 
 MRClusterNode *MR_GetMyNode() {
   return cluster_g ? cluster_g->myNode : NULL;
 }
 
+int MR_KeySlot(const char *key, size_t len) {
+  return cluster_g ? MRCluster_KeySlot(cluster_g, key, len) : -1;
+}
+
 /* The fanout request received in the event loop in a thread safe manner */
 static void uvFanoutRequest(struct MRRequestCtx *mc) {
 
   MRCtx *mrctx = mc->ctx;
   mrctx->numReplied = 0;
+  mrctx->numTaken = 0;
   mrctx->reducer = mc->f;
   mrctx->numExpected = 0;
 
@@ -270,12 +481,17 @@ static void uvFanoutRequest(struct MRRequestCtx *mc) {
     MRCommand *cmd = &mc->cmds[0];
     mrctx->numExpected =
         MRCluster_FanoutCommand(cluster_g, mrctx->strategy, cmd, fanoutCallback, mrctx);
+    // reads are sent to a single node of every shard
+    if (mrctx->strategy & MRCluster_ReadOnly) {
+      mrctx->numUnavailable = cluster_g->topo->numShards - mrctx->numExpected;
+    }
   }
 
   if (mrctx->numExpected == 0) {
-    RedisModuleBlockedClient *bc = mrctx->redisCtx;
-    RedisModule_UnblockClient(bc, mrctx);
-    // printf("could not send single command. hande fail please\n");
+    // nothing was sent - a chained reducer fails the request right away, as no reply will come
+    requestFinished(mrctx);
+  } else {
+    requestSent(mrctx);
   }
 
   free(mc->cmds);
@@ -285,6 +501,7 @@ static void uvFanoutRequest(struct MRRequestCtx *mc) {
 static void uvMapRequest(struct MRRequestCtx *mc) {
   MRCtx *mrctx = mc->ctx;
   mrctx->numReplied = 0;
+  mrctx->numTaken = 0;
   mrctx->reducer = mc->f;
   mrctx->numExpected = 0;
 
@@ -294,18 +511,36 @@ static void uvMapRequest(struct MRRequestCtx *mc) {
     mrctx->cmds[i] = mc->cmds[i];
   }
 
-  for (int i = 0; i < mc->numCmds; i++) {
+  if (mrctx->orderedReplies) {
+    // every command has a place for its reply
+    mrctx->replySlots = malloc(mc->numCmds * sizeof(*mrctx->replySlots));
+    if (mrctx->repliesCap < mc->numCmds) {
+      mrctx->repliesCap = mc->numCmds;
+      mrctx->replies = realloc(mrctx->replies, mrctx->repliesCap * sizeof(MRReply *));
+    }
+    memset(mrctx->replies, 0, mrctx->repliesCap * sizeof(MRReply *));
+  }
 
-    if (MRCluster_SendCommand(cluster_g, mrctx->strategy, &mc->cmds[i], fanoutCallback, mrctx) ==
+  for (int i = 0; i < mc->numCmds; i++) {
+    redisCallbackFn *cb = fanoutCallback;
+    void *privdata = mrctx;
+    if (mrctx->orderedReplies) {
+      mrctx->replySlots[i] = (MRReplySlot){.ctx = mrctx, .idx = i};
+      cb = orderedReplyCallback;
+      privdata = &mrctx->replySlots[i];
+    }
+    if (MRCluster_SendCommand(cluster_g, mrctx->strategy, &mc->cmds[i], cb, privdata) ==
         REDIS_OK) {
       mrctx->numExpected++;
     }
   }
+  mrctx->numUnavailable = mc->numCmds - mrctx->numExpected;
 
   if (mrctx->numExpected == 0) {
-    RedisModuleBlockedClient *bc = mrctx->redisCtx;
-    RedisModule_UnblockClient(bc, mrctx);
-    // printf("could not send single command. hande fail please\n");
+    // nothing was sent - a chained reducer fails the request right away, as no reply will come
+    requestFinished(mrctx);
+  } else {
+    requestSent(mrctx);
   }
 
   free(mc->cmds);
@@ -314,8 +549,22 @@ static void uvMapRequest(struct MRRequestCtx *mc) {
   // return REDIS_OK;
 }
 
-void MR_requestCompleted() {
-  RQ_Done(rq_g);
+/* Queue a request of a class, or fail it right away if the class has too many waiting */
+static void pushRequest(MRCtx *ctx, MRRequestClass cls, struct MRRequestCtx *rc) {
+  ctx->rq = requestQueues_g[cls];
+  if (RQ_TryPush(ctx->rq, requestCb, rc)) {
+    return;
+  }
+
+  for (int i = 0; i < rc->numCmds; i++) {
+    MRCommand_Free(&rc->cmds[i]);
+  }
+  free(rc->cmds);
+  free(rc);
+  // the request holds no slot
+  ctx->rejected = 1;
+  ctx->slotReleased = 1;
+  requestFinished(ctx);
 }
 
 /* Fanout map - send the same command to all the shards, sending the collective
@@ -327,7 +576,7 @@ int MR_Fanout(struct MRCtx *ctx, MRReduceFunc reducer, MRCommand cmd, bool block
     ctx->redisCtx = RedisModule_BlockClient(
         ctx->redisCtx, unblockHandler, timeoutHandler,
         redisMajorVesion < 5 ? (void (*)(RedisModuleCtx *, void *))freePrivDataCB : freePrivDataCB_V5,
-        timeout_g);
+        timeout_g + MR_BLOCK_TIMEOUT_BACKSTOP_MS);
   }
   rc->ctx = ctx;
   rc->f = reducer;
@@ -335,7 +584,7 @@ int MR_Fanout(struct MRCtx *ctx, MRReduceFunc reducer, MRCommand cmd, bool block
   rc->numCmds = 1;
   rc->cmds[0] = cmd;
   rc->cb = uvFanoutRequest;
-  RQ_Push(rq_g, requestCb, rc);
+  pushRequest(ctx, MRRequestClass_Fanout, rc);
   return REDIS_OK;
 }
 
@@ -359,11 +608,11 @@ int MR_Map(struct MRCtx *ctx, MRReduceFunc reducer, MRCommandGenerator cmds, boo
                                             redisMajorVesion < 5
                                                 ? (void (*)(RedisModuleCtx *, void *))freePrivDataCB
                                                 : freePrivDataCB_V5,
-                                            timeout_g);
+                                            timeout_g + MR_BLOCK_TIMEOUT_BACKSTOP_MS);
   }
 
   rc->cb = uvMapRequest;
-  RQ_Push(rq_g, requestCb, rc);
+  pushRequest(ctx, rc->numCmds > 1 ? MRRequestClass_Fanout : MRRequestClass_Single, rc);
 
   return REDIS_OK;
 }
@@ -379,13 +628,35 @@ int MR_MapSingle(struct MRCtx *ctx, MRReduceFunc reducer, MRCommand cmd) {
   ctx->redisCtx = RedisModule_BlockClient(
       ctx->redisCtx, unblockHandler, timeoutHandler,
       redisMajorVesion < 5 ? (void (*)(RedisModuleCtx *, void *))freePrivDataCB : freePrivDataCB_V5,
-      timeout_g);
+      timeout_g + MR_BLOCK_TIMEOUT_BACKSTOP_MS);
 
   rc->cb = uvMapRequest;
-  RQ_Push(rq_g, requestCb, rc);
+  pushRequest(ctx, MRRequestClass_Single, rc);
   return REDIS_OK;
 }
 
+// Time left for the network, on top of the slowest node's round trip
+#define MR_MIN_NETWORK_MARGIN_MS 1
+
+long long MR_ShardTimeoutMS(long long budgetMS) {
+  long long margin = MR_MIN_NETWORK_MARGIN_MS;
+  if (cluster_g) {
+    margin += (long long)cluster_g->mgr.maxRttMS;
+  }
+  return MAX(1, budgetMS - margin);
+}
+
+const char *MRRequestClass_Str(MRRequestClass cls) {
+  return cls < MR_NUM_REQUEST_CLASSES ? requestClasses_g[cls].name : "unknown";
+}
+
+MRWorkQueueStats MR_GetAdmissionStats(MRRequestClass cls) {
+  if (cls >= MR_NUM_REQUEST_CLASSES || !requestQueues_g[cls]) {
+    return (MRWorkQueueStats){0};
+  }
+  return RQ_GetStats(requestQueues_g[cls]);
+}
+
 /* Return the active cluster's host count */
 size_t MR_NumHosts() {
   return cluster_g ? MRCluster_NumHosts(cluster_g) : 0;
@@ -394,8 +665,9 @@ size_t MR_NumHosts() {
 void SetMyPartition(MRClusterTopology *ct, MRClusterShard *myShard);
 /* on-loop update topology request. This can't be done from the main thread */
 static void uvUpdateTopologyRequest(struct MRRequestCtx *mc) {
+  // an unchanged topology is dropped, so the cluster's topology is the one to use
   MRCLuster_UpdateTopology(cluster_g, (MRClusterTopology *)mc->ctx);
-  SetMyPartition((MRClusterTopology *)mc->ctx, cluster_g->myshard);
+  SetMyPartition(cluster_g->topo, cluster_g->myshard);
   RQ_Done(rq_g);
   // fprintf(stderr, "topo update: conc requests: %d\n", concurrentRequests_g);
   free(mc);
@@ -426,11 +698,19 @@ typedef struct MRIteratorCtx {
   void *privdata;
   MRIteratorCallback cb;
   int pending;
+  // set by the consumer when it does not need any more replies
+  volatile int stopped;
 } MRIteratorCtx;
 
 typedef struct MRIteratorCallbackCtx {
   MRIteratorCtx *ic;
   MRCommand cmd;
+  // the replies of this command only, if the iterator keeps its sources apart
+  MRChannel *chan;
+  // set by the consumer when it does not need any more replies of this command
+  volatile int stopped;
+  // the node the command was first sent to. Follow up commands (e.g. cursor reads) are sent to it
+  char *nodeId;
 } MRIteratorCallbackCtx;
 
 typedef struct MRIterator {
@@ -453,18 +733,26 @@ static void mrIteratorRedisCB(redisAsyncContext *c, void *r, void *privdata) {
   }
 }
 
+/* Iterator commands only read, so the cluster's read policy decides which nodes serve them */
+#define MRITERATOR_STRATEGY (MRCluster_FlatCoordination | MRCluster_ReadOnly)
+
 int MRIteratorCallback_ResendCommand(MRIteratorCallbackCtx *ctx, MRCommand *cmd) {
   ctx->cmd = *cmd;
-  return MRCluster_SendCommand(ctx->ic->cluster, MRCluster_MastersOnly, cmd, mrIteratorRedisCB,
-                               ctx);
+  if (ctx->nodeId) {
+    return MRCluster_SendCommandToNode(ctx->ic->cluster, ctx->nodeId, cmd, mrIteratorRedisCB, ctx);
+  }
+  return MRCluster_SendCommand(ctx->ic->cluster, MRITERATOR_STRATEGY, cmd, mrIteratorRedisCB, ctx);
 }
 
 void *MRITERATOR_DONE = "MRITERATOR_DONE";
 
 int MRIteratorCallback_Done(MRIteratorCallbackCtx *ctx, int error) {
+  if (ctx->chan) {
+    MRChannel_Close(ctx->chan);
+  }
   if (--ctx->ic->pending <= 0) {
     // fprintf(stderr, "FINISHED iterator, error? %d pending %d\n", error, ctx->ic->pending);
-    RQ_Done(rq_g);
+    RQ_Done(requestQueues_g[MRRequestClass_Iterator]);
 
     MRChannel_Close(ctx->ic->chan);
     return 0;
@@ -475,21 +763,37 @@ int MRIteratorCallback_Done(MRIteratorCallbackCtx *ctx, int error) {
 }
 
 int MRIteratorCallback_AddReply(MRIteratorCallbackCtx *ctx, MRReply *rep) {
-  return MRChannel_Push(ctx->ic->chan, rep);
+  if (!ctx->chan) {
+    return MRChannel_Push(ctx->ic->chan, rep);
+  }
+  // Keep the reply with its source, and let the iterator's channel know which source it is in
+  return MRChannel_Push(ctx->chan, rep) && MRChannel_Push(ctx->ic->chan, ctx);
+}
+
+int MRIteratorCallback_IsStopped(MRIteratorCallbackCtx *ctx) {
+  return ctx->ic->stopped || ctx->stopped;
 }
 
 void iterStartCb(void *p) {
   MRIterator *it = p;
   for (size_t i = 0; i < it->len; i++) {
-    if (MRCluster_SendCommand(it->ctx.cluster, MRCluster_MastersOnly, &it->cbxs[i].cmd,
-                              mrIteratorRedisCB, &it->cbxs[i]) == REDIS_ERR) {
+    MRIteratorCallbackCtx *cbx = &it->cbxs[i];
+    MRClusterNode *node =
+        MRCluster_SelectCommandNode(it->ctx.cluster, MRITERATOR_STRATEGY, &cbx->cmd);
+    // pin the command to its node, where its cursor (if any) lives
+    if (node) {
+      cbx->nodeId = strdup(node->id);
+    }
+    if (!node || MRCluster_SendCommandToNode(it->ctx.cluster, cbx->nodeId, &cbx->cmd,
+                                             mrIteratorRedisCB, cbx) == REDIS_ERR) {
       // fprintf(stderr, "Could not send command!\n");
       MRIteratorCallback_Done(&it->cbxs[i], 1);
     }
   }
 }
 
-MRIterator *MR_Iterate(MRCommandGenerator cg, MRIteratorCallback cb, void *privdata) {
+static MRIterator *mrIterate(MRCommandGenerator cg, MRIteratorCallback cb, void *privdata,
+                             int perSource) {
 
   MRIterator *ret = malloc(sizeof(*ret));
   size_t len = cg.Len(cg.ctx);
@@ -501,6 +805,7 @@ MRIterator *MR_Iterate(MRCommandGenerator cg, MRIteratorCallback cb, void *privd
               .privdata = privdata,
               .cb = cb,
               .pending = 0,
+              .stopped = 0,
           },
       .cbxs = calloc(len, sizeof(MRIteratorCallbackCtx)),
       .len = len,
@@ -513,6 +818,9 @@ MRIterator *MR_Iterate(MRCommandGenerator cg, MRIteratorCallback cb, void *privd
       ret->len = i;
       break;
     }
+    if (perSource) {
+      ret->cbxs[i].chan = MR_NewChannel(0);
+    }
   }
 
   // Could not create command, probably invalid cluster
@@ -522,10 +830,51 @@ MRIterator *MR_Iterate(MRCommandGenerator cg, MRIteratorCallback cb, void *privd
   }
   ret->ctx.pending = ret->len;
 
-  RQ_Push(rq_g, iterStartCb, ret);
+  if (!RQ_TryPush(requestQueues_g[MRRequestClass_Iterator], iterStartCb, ret)) {
+    MRIterator_Free(ret);
+    return NULL;
+  }
   return ret;
 }
 
+MRIterator *MR_Iterate(MRCommandGenerator cg, MRIteratorCallback cb, void *privdata) {
+  return mrIterate(cg, cb, privdata, 0);
+}
+
+MRIterator *MR_IterateSources(MRCommandGenerator cg, MRIteratorCallback cb, void *privdata) {
+  return mrIterate(cg, cb, privdata, 1);
+}
+
+size_t MRIterator_NumSources(MRIterator *it) {
+  return it->len;
+}
+
+MRReply *MRIterator_NextFromSource(MRIterator *it, size_t source) {
+  void *p = MRChannel_Pop(it->cbxs[source].chan);
+  if (p == MRCHANNEL_CLOSED) {
+    return MRITERATOR_DONE;
+  }
+  return p;
+}
+
+MRReply *MRIterator_NextFromAny(MRIterator *it, size_t *source) {
+  void *p = MRChannel_Pop(it->ctx.chan);
+  if (p == MRCHANNEL_CLOSED) {
+    return MRITERATOR_DONE;
+  }
+  MRIteratorCallbackCtx *ctx = p;
+  *source = ctx - it->cbxs;
+  return MRChannel_ForcePop(ctx->chan);
+}
+
+void MRIterator_Stop(MRIterator *it) {
+  it->ctx.stopped = 1;
+}
+
+void MRIterator_StopSource(MRIterator *it, size_t source) {
+  it->cbxs[source].stopped = 1;
+}
+
 MRReply *MRIterator_Next(MRIterator *it) {
 
   void *p = MRChannel_Pop(it->ctx.chan);
@@ -541,12 +890,23 @@ void MRIterator_WaitDone(MRIterator *it) {
 }
 void MRIterator_Free(MRIterator *it) {
   if (!it) return;
+  MRReply *reply;
   for (size_t i = 0; i < it->len; i++) {
     MRCommand_Free(&it->cbxs[i].cmd);
+    free(it->cbxs[i].nodeId);
+    if (it->cbxs[i].chan) {
+      while ((reply = MRChannel_ForcePop(it->cbxs[i].chan))) {
+        MRReply_Free(reply);
+      }
+      MRChannel_Free(it->cbxs[i].chan);
+    }
   }
-  MRReply *reply;
+  // when the sources are kept apart, the iterator's channel only points at them
+  int perSource = it->len && it->cbxs[0].chan;
   while((reply = MRChannel_ForcePop(it->ctx.chan))){
+    if (!perSource) {
       MRReply_Free(reply);
+    }
   }
   MRChannel_Free(it->ctx.chan);
   free(it->cbxs);
@@ -6,13 +6,37 @@
 #include "reply.h"
 #include "cluster.h"
 #include "command.h"
+#include "rq.h"
 
 struct MRCtx;
 struct RedisModuleCtx;
 
+/* Requests are admitted by class, each with its own adaptive concurrency limit */
+typedef enum {
+  // a command sent to a single shard
+  MRRequestClass_Single = 0,
+  // a command sent to all the shards, whose replies are reduced together
+  MRRequestClass_Fanout,
+  // an iterator, e.g. of a distributed aggregation
+  MRRequestClass_Iterator,
+} MRRequestClass;
+#define MR_NUM_REQUEST_CLASSES 3
+
+/* The reply to a request that was not admitted */
+#define MR_OVERLOADED_ERR "Coordinator overloaded, request rejected"
+
+const char *MRRequestClass_Str(MRRequestClass cls);
+
+/* Get the admission state of a request class */
+MRWorkQueueStats MR_GetAdmissionStats(MRRequestClass cls);
+
 /* Prototype for all reduce functions */
 typedef int (*MRReduceFunc)(struct MRCtx *ctx, int count, MRReply **replies);
 
+/* A function called with each reply of a request as it arrives, on the event loop thread. Returns
+ * 1 if it took the reply, which it then frees, or 0 to keep it for the reducer */
+typedef int (*MRReplyHandler)(struct MRCtx *ctx, MRReply *reply);
+
 /* Fanout map - send the same command to all the shards, sending the collective
  * reply to the reducer callback */
 int MR_Fanout(struct MRCtx *ctx, MRReduceFunc reducer, MRCommand cmd, bool block);
@@ -26,18 +50,30 @@ void MR_SetCoordinationStrategy(struct MRCtx *ctx, MRCoordinationStrategy strate
 /* Initialize the MapReduce engine with a node provider */
 void MR_Init(MRCluster *cl, long long timeoutMS);
 
+/* Set which nodes may serve read only commands, including the commands of iterators */
+void MR_SetReadPolicy(MRReadPolicy policy);
+
 /* Set a new topology for the cluster */
 int MR_UpdateTopology(MRClusterTopology *newTopology);
 
-/* Get the current cluster topology */
+/* Get a reference to the current cluster topology. It stays valid after the topology is updated,
+ * and must be released with MRClusterTopology_Release */
 MRClusterTopology *MR_GetCurrentTopology();
 
 /* Return our current node as detected by cluster state calls */
 MRClusterNode *MR_GetMyNode();
 
+/* The slot of a key in the current cluster, or -1 if there is no topology yet */
+int MR_KeySlot(const char *key, size_t len);
+
 /* Get the user stored private data from the context */
 void *MRCtx_GetPrivdata(struct MRCtx *ctx);
 
+/* Free the private data with the context. Reducers are not called for requests that are rejected
+ * or time out without partial results, so private data they would free leaks unless the context
+ * owns it */
+void MRCtx_SetFreePrivdata(struct MRCtx *ctx, void (*freePrivdata)(void *));
+
 /* The request duration in microsecnds, relevant only on the reducer */
 int64_t MR_RequestDuration(struct MRCtx *ctx);
 
@@ -46,7 +82,40 @@ void MRCtx_SetRedisCtx(struct MRCtx *ctx, void* rctx);
 MRCommand *MRCtx_GetCmds(struct MRCtx *ctx);
 int MRCtx_GetCmdsSize(struct MRCtx *ctx);
 void MRCtx_SetReduceFunction(struct MRCtx *ctx, MRReduceFunc fn);
-void MR_requestCompleted();
+
+/* Let the reducer reply with the replies of the available shards, when some of them could not be
+ * sent the command. Otherwise, the request should fail */
+void MRCtx_SetAllowPartial(struct MRCtx *ctx, int allow);
+int MRCtx_AllowPartial(struct MRCtx *ctx);
+
+/* Keep the replies of a mapped request in the order of its commands, so that the reducer gets the
+ * reply of the i-th command as replies[i], or NULL if the command failed, with count being the
+ * number of commands */
+void MRCtx_SetOrderedReplies(struct MRCtx *ctx);
+
+/* Hand every reply to handler as soon as it arrives, so that a request can fold its replies into
+ * its private data instead of keeping them all until the reducer runs. The handler is not called
+ * after the request timed out, and the reducer gets only the replies it did not take. With ordered
+ * replies, the places of the taken replies are NULL */
+void MRCtx_SetReplyHandler(struct MRCtx *ctx, MRReplyHandler handler);
+
+/* The number of commands that were not sent, because no node was available to serve them */
+int MRCtx_NumUnavailable(struct MRCtx *ctx);
+
+/* Whether the request's deadline passed before all its replies arrived. The reducer then gets the
+ * replies received until the deadline, and only if partial replies are allowed */
+int MRCtx_TimedOut(struct MRCtx *ctx);
+
+/* Milliseconds left until the request's deadline */
+long long MRCtx_RemainingMS(struct MRCtx *ctx);
+
+/* The timeout to give a shard working on a request that has budgetMS left, keeping a margin for
+ * the network round trip. Never below 1, as shards take 0 as no timeout */
+long long MR_ShardTimeoutMS(long long budgetMS);
+
+/* Release the request's slot in the work queue. Reducers that are not called through an unblocked
+ * client call it before freeing the context. Calling it more than once does nothing */
+void MRCtx_RequestCompleted(struct MRCtx *ctx);
 
 
 /* Free the MapReduce context */
@@ -66,8 +135,34 @@ typedef int (*MRIteratorCallback)(MRIteratorCallbackCtx *ctx, MRReply *rep, MRCo
 
 MRReply *MRIterator_Next(MRIterator *it);
 
+/* Start iterating over the replies of the commands. Returns NULL if there are no commands, or if
+ * the iterator was not admitted */
 MRIterator *MR_Iterate(MRCommandGenerator cg, MRIteratorCallback cb, void *privdata);
 
+/* Like MR_Iterate, but keep the replies of each command apart, so they can be consumed per source
+ * with MRIterator_NextFromSource */
+MRIterator *MR_IterateSources(MRCommandGenerator cg, MRIteratorCallback cb, void *privdata);
+
+size_t MRIterator_NumSources(MRIterator *it);
+
+/* Get the next reply of a single source of an iterator created with MR_IterateSources. Returns
+ * MRITERATOR_DONE once that source is done */
+MRReply *MRIterator_NextFromSource(MRIterator *it, size_t source);
+
+/* Get the next reply of any of the sources of an iterator created with MR_IterateSources, in their
+ * order of arrival, setting the source it came from. Returns MRITERATOR_DONE once all sources are
+ * done. An iterator should be consumed either per source or with this function, not both */
+MRReply *MRIterator_NextFromAny(MRIterator *it, size_t *source);
+
+/* Tell the producers that no more replies are needed. Callbacks should check
+ * MRIteratorCallback_IsStopped and wind down instead of resending their commands */
+void MRIterator_Stop(MRIterator *it);
+
+/* Like MRIterator_Stop, for a single source */
+void MRIterator_StopSource(MRIterator *it, size_t source);
+
+int MRIteratorCallback_IsStopped(MRIteratorCallbackCtx *ctx);
+
 int MRIteratorCallback_AddReply(MRIteratorCallbackCtx *ctx, MRReply *rep);
 
 int MRIteratorCallback_Done(MRIteratorCallbackCtx *ctx, int error);
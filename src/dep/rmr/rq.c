@@ -1,6 +1,8 @@
 #define RQ_C__
 
 #include <stdlib.h>
+#include <math.h>
+#include <assert.h>
 #include <uv.h>
 #include "rq.h"
 
@@ -10,22 +12,84 @@ struct queueItem {
   struct queueItem *next;
 };
 
+/* The limit of pending requests is recomputed at the end of every window - once it has enough
+ * completions and lasted long enough */
+#define RQ_WINDOW_MIN_COMPLETIONS 20
+#define RQ_WINDOW_MIN_NS (100 * 1000000ULL)
+/* The lowest latency is forgotten every so many windows, to follow changes of the workload */
+#define RQ_MIN_LATENCY_WINDOWS 600
+/* Weight of the latest window's limit in the smoothed limit */
+#define RQ_LIMIT_SMOOTHING 0.2
+
 typedef struct MRWorkQueue {
   struct queueItem *head;
   struct queueItem *tail;
   int pending;
-  int maxPending;
   size_t sz;
+  size_t maxQueued;
+  uint64_t maxWaitNS;
   uv_mutex_t lock;
   uv_async_t async;
+
+  /* Adaptive limit of pending requests */
+  double limit;
+  int maxPending;
+
+  /* The current window: the time integral of pending requests, which by Little's law divided by
+   * the completions gives the average time requests hold their slot */
+  uint64_t windowStart;
+  uint64_t lastChange;
+  double pendingArea;
+  size_t windowCompleted;
+  int windowMaxPending;
+  size_t windows;
+
+  double latencyNS;
+  double minLatencyNS;
+  size_t rejected;
+  size_t completed;
 } MRWorkQueue;
 
-void RQ_Push(MRWorkQueue *q, MRQueueCallback cb, void *privdata) {
-  uv_mutex_lock(&q->lock);
-  struct queueItem *item = malloc(sizeof(*item));
-  item->cb = cb;
-  item->privdata = privdata;
-  item->next = NULL;
+/* Account for the time spent at the current number of pending requests. Called with the lock held,
+ * before the number changes */
+static void rqTrackPending(MRWorkQueue *q, uint64_t now) {
+  q->pendingArea += (double)q->pending * (now - q->lastChange);
+  q->lastChange = now;
+}
+
+/* Close the window if it is complete, and move the limit by the ratio between the lowest latency
+ * and the window's - down when requests queue up on the nodes, and up by a margin of about the
+ * limit's square root when they don't */
+static void rqUpdateLimit(MRWorkQueue *q, uint64_t now) {
+  if (q->windowCompleted < RQ_WINDOW_MIN_COMPLETIONS || now - q->windowStart < RQ_WINDOW_MIN_NS) {
+    return;
+  }
+  double latency = q->pendingArea / q->windowCompleted;
+  q->latencyNS = latency;
+  q->windows++;
+  if (!q->minLatencyNS || latency < q->minLatencyNS || q->windows % RQ_MIN_LATENCY_WINDOWS == 0) {
+    q->minLatencyNS = latency;
+  }
+
+  double gradient = latency > 0 ? q->minLatencyNS / latency : 1;
+  if (gradient < 0.5) gradient = 0.5;
+  if (gradient > 1) gradient = 1;
+  double newLimit = q->limit * gradient + sqrt(q->limit);
+  // don't grow a limit that is not reached
+  if (newLimit > q->limit && q->windowMaxPending < q->limit / 2) {
+    newLimit = q->limit;
+  }
+  q->limit = (1 - RQ_LIMIT_SMOOTHING) * q->limit + RQ_LIMIT_SMOOTHING * newLimit;
+  if (q->limit < 1) q->limit = 1;
+  if (q->limit > q->maxPending) q->limit = q->maxPending;
+
+  q->windowStart = now;
+  q->pendingArea = 0;
+  q->windowCompleted = 0;
+  q->windowMaxPending = q->pending;
+}
+
+static void rqAppend(MRWorkQueue *q, struct queueItem *item) {
   // append the request to the tail of the list
   if (q->tail) {
     // make it the next of the current tail
@@ -36,24 +100,46 @@ void RQ_Push(MRWorkQueue *q, MRQueueCallback cb, void *privdata) {
     q->head = q->tail = item;
   }
   q->sz++;
+}
 
+static struct queueItem *newItem(MRQueueCallback cb, void *privdata) {
+  struct queueItem *item = malloc(sizeof(*item));
+  item->cb = cb;
+  item->privdata = privdata;
+  item->next = NULL;
+  return item;
+}
+
+void RQ_Push(MRWorkQueue *q, MRQueueCallback cb, void *privdata) {
+  struct queueItem *item = newItem(cb, privdata);
+  uv_mutex_lock(&q->lock);
+  rqAppend(q, item);
   uv_mutex_unlock(&q->lock);
   uv_async_send(&q->async);
 }
 
-static struct queueItem *rqPop(MRWorkQueue *q) {
+int RQ_TryPush(MRWorkQueue *q, MRQueueCallback cb, void *privdata) {
   uv_mutex_lock(&q->lock);
-  // fprintf(stderr, "%d %zd\n", concurrentRequests_g, q->sz);
-
-  if (q->head == NULL) {
+  // the expected wait is the time for the requests ahead to get through the pending slots
+  int reject = q->sz >= q->maxQueued ||
+               (q->maxWaitNS && q->latencyNS * q->sz / q->limit > q->maxWaitNS);
+  if (reject) {
+    q->rejected++;
     uv_mutex_unlock(&q->lock);
-    return NULL;
+    return 0;
   }
-  if (q->pending >= q->maxPending) {
-    uv_mutex_unlock(&q->lock);
-    // If the queue is full we need to wake up the drain callback
-    uv_async_send(&q->async);
+  uv_mutex_unlock(&q->lock);
+
+  RQ_Push(q, cb, privdata);
+  return 1;
+}
+
+static struct queueItem *rqPop(MRWorkQueue *q, uint64_t now) {
+  uv_mutex_lock(&q->lock);
 
+  // If the queue is full, RQ_Done wakes us up once a slot is released
+  if (q->head == NULL || q->pending >= (int)q->limit) {
+    uv_mutex_unlock(&q->lock);
     return NULL;
   }
 
@@ -61,39 +147,88 @@ static struct queueItem *rqPop(MRWorkQueue *q) {
   q->head = r->next;
   if (!q->head) q->tail = NULL;
   q->sz--;
+  rqTrackPending(q, now);
   q->pending++;
+  if (q->pending > q->windowMaxPending) q->windowMaxPending = q->pending;
 
   uv_mutex_unlock(&q->lock);
   return r;
 }
 
-void RQ_Done(MRWorkQueue *q) {
+/* Release a slot at the given time, in uv_hrtime ns. Exposed for tests */
+void _RQ_Done(MRWorkQueue *q, uint64_t now) {
   uv_mutex_lock(&q->lock);
+  // every request done must have taken a slot of this queue
+  assert(q->pending > 0);
+  rqTrackPending(q, now);
   --q->pending;
-  // fprintf(stderr, "Concurrent requests: %d/%d\n", q->pending, q->maxPending);
+  q->completed++;
+  q->windowCompleted++;
+  rqUpdateLimit(q, now);
+  int wakeup = q->head != NULL;
   uv_mutex_unlock(&q->lock);
+  if (wakeup) {
+    uv_async_send(&q->async);
+  }
+}
+
+void RQ_Done(MRWorkQueue *q) {
+  _RQ_Done(q, uv_hrtime());
+}
+
+/* Run the next request if it gets a slot at the given time, in uv_hrtime ns. Returns whether a
+ * request was run. Exposed for tests */
+int _RQ_RunNext(MRWorkQueue *q, uint64_t now) {
+  struct queueItem *req = rqPop(q, now);
+  if (!req) {
+    return 0;
+  }
+  req->cb(req->privdata);
+  free(req);
+  return 1;
 }
 
 static void rqAsyncCb(uv_async_t *async) {
   MRWorkQueue *q = async->data;
-  struct queueItem *req;
-  while (NULL != (req = rqPop(q))) {
-    req->cb(req->privdata);
-    free(req);
+  while (_RQ_RunNext(q, uv_hrtime())) {
   }
 }
 
-MRWorkQueue *RQ_New(size_t cap, int maxPending) {
+MRWorkQueue *RQ_New(size_t maxQueued, int initialPending, int maxPending) {
 
   MRWorkQueue *q = calloc(1, sizeof(*q));
   q->sz = 0;
   q->head = NULL;
   q->tail = NULL;
   q->pending = 0;
-  q->maxPending = maxPending;
+  q->maxQueued = maxQueued;
+  q->maxPending = maxPending > 0 ? maxPending : 1;
+  q->limit = initialPending > 0 && initialPending < q->maxPending ? initialPending : q->maxPending;
+  q->windowStart = q->lastChange = uv_hrtime();
   uv_mutex_init(&q->lock);
   // TODO: Add close cb
   uv_async_init(uv_default_loop(), &q->async, rqAsyncCb);
   q->async.data = q;
   return q;
 }
+
+void RQ_SetMaxWait(MRWorkQueue *q, long long maxWaitMS) {
+  uv_mutex_lock(&q->lock);
+  q->maxWaitNS = maxWaitMS > 0 ? maxWaitMS * 1000000ULL : 0;
+  uv_mutex_unlock(&q->lock);
+}
+
+MRWorkQueueStats RQ_GetStats(MRWorkQueue *q) {
+  uv_mutex_lock(&q->lock);
+  MRWorkQueueStats st = {
+      .queued = q->sz,
+      .pending = q->pending,
+      .limit = (int)q->limit,
+      .rejected = q->rejected,
+      .completed = q->completed,
+      .latencyMS = q->latencyNS / 1000000,
+      .minLatencyMS = q->minLatencyNS / 1000000,
+  };
+  uv_mutex_unlock(&q->lock);
+  return st;
+}
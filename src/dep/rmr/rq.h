@@ -5,13 +5,40 @@
 
 typedef void (*MRQueueCallback)(void *);
 
+/* A snapshot of a work queue's admission state */
+typedef struct {
+  /* Requests waiting for a slot */
+  size_t queued;
+  /* Requests holding a slot */
+  int pending;
+  /* The current limit of pending requests */
+  int limit;
+  /* Requests turned away by RQ_TryPush */
+  size_t rejected;
+  size_t completed;
+  /* Recent and lowest observed time a request holds its slot, in milliseconds */
+  double latencyMS;
+  double minLatencyMS;
+} MRWorkQueueStats;
+
 #ifndef RQ_C__
 typedef struct MRWorkQueue MRWorkQueue;
 
-MRWorkQueue *RQ_New(size_t cap, int maxPending);
+/* Create a work queue whose limit of pending requests adapts to their latency, between 1 and
+ * maxPending, starting at initialPending. RQ_TryPush rejects requests once maxQueued are waiting */
+MRWorkQueue *RQ_New(size_t maxQueued, int initialPending, int maxPending);
+
+/* Also reject requests that would likely wait longer than maxWaitMS for a slot. 0 disables */
+void RQ_SetMaxWait(MRWorkQueue *q, long long maxWaitMS);
 
 void RQ_Done(MRWorkQueue *q);
 
 void RQ_Push(MRWorkQueue *q, MRQueueCallback cb, void *privdata);
+
+/* Like RQ_Push, unless the queue is too long - then the request is not queued, and 0 is
+ * returned */
+int RQ_TryPush(MRWorkQueue *q, MRQueueCallback cb, void *privdata);
+
+MRWorkQueueStats RQ_GetStats(MRWorkQueue *q);
+#endif
 #endif
-#endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include "minunit.h"
+#include <endpoint.h>
+#include <cluster.h>
+
+#include <uv.h>
+#include <stdio.h>
+#include <time.h>
+#include "../../rmutil/alloc.h"
+
+/**
+ * Benchmark routing slots to shards, as every sharded command does, for clusters of various sizes.
+ */
+
+#define NUM_SLOTS 16384
+#define NUM_LOOKUPS 10000000
+
+MRClusterShard *_MRCluster_FindShard(MRCluster *cl, mr_slot_t slot);
+
+/* A topology of numShards single-node shards, splitting the slots as evenly as possible */
+static MRClusterTopology *getEvenTopology(size_t numSlots, size_t numShards) {
+  MRClusterTopology *topo = MR_NewTopology(numShards, numSlots);
+  for (size_t i = 0; i < numShards; i++) {
+    char host[32];
+    sprintf(host, "localhost:%zu", 7000 + i);
+    MRClusterNode node = {.flags = MRNode_Master, .id = strdup(host)};
+    MREndpoint_Parse(host, &node.endpoint);
+
+    MRClusterShard sh =
+        MR_NewClusterShard(i * numSlots / numShards, (i + 1) * numSlots / numShards - 1, 1);
+    MRClusterShard_AddNode(&sh, &node);
+    MRClusterTopology_AddShard(topo, &sh);
+  }
+  return topo;
+}
+
+static double nsSince(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+void benchSlotLookup() {
+  size_t shardCounts[] = {3, 30, 300};
+
+  for (size_t c = 0; c < sizeof(shardCounts) / sizeof(shardCounts[0]); c++) {
+    MRCluster *cl = MR_NewCluster(getEvenTopology(NUM_SLOTS, shardCounts[c]), CRC16ShardFunc, 1);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t sum = 0;
+    for (size_t i = 0; i < NUM_LOOKUPS; i++) {
+      sum += _MRCluster_FindShard(cl, (i * 7919) % NUM_SLOTS)->startSlot;
+    }
+    double ns = nsSince(&start);
+    printf("%zu shards: %.2fns per slot lookup (%zu)\n", shardCounts[c], ns / NUM_LOOKUPS, sum);
+
+    MRCluster_Free(cl);
+    uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+  }
+}
+
+int main(int argc, char **argv) {
+  RMUTil_InitAlloc();
+  MU_RUN_TEST(benchSlotLookup);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -4,6 +4,7 @@
 #include <cluster.h>
 
 #include <hiredis/hiredis.h>
+#include <uv.h>
 #include "../../rmutil/alloc.h"
 
 void testEndpoint() {
@@ -68,6 +69,12 @@ static MRClusterTopology *getTopology(size_t numSlots, size_t numNodes,  const c
 }
 MRClusterShard *_MRCluster_FindShard(MRCluster *cl, mr_slot_t slot);
 
+/* Free a cluster, and let the loop free its stopped connections */
+static void freeCluster(MRCluster *cl) {
+  MRCluster_Free(cl);
+  uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+}
+
 void testCluster() {
 
   int n = 4;
@@ -90,7 +97,7 @@ void testCluster() {
 
     printf("%d..%d --> %s\n", sh->startSlot, sh->endSlot, sh->nodes[0].id);
   }
-
+  freeCluster(cl);
 }
 
 void testClusterSharding() {
@@ -109,7 +116,150 @@ void testClusterSharding() {
   mu_check(!strcmp(sh->nodes[0].id, hosts[3]));
   printf("%d..%d --> %s\n", sh->startSlot, sh->endSlot, sh->nodes[0].id);
 
-  // MRClust_Free(cl);
+  MRCommand_Free(&cmd);
+  freeCluster(cl);
+}
+
+/* A topology of numShards single-node shards, splitting the slots as evenly as possible */
+static MRClusterTopology *getEvenTopology(size_t numSlots, size_t numShards) {
+  MRClusterTopology *topo = MR_NewTopology(numShards, numSlots);
+  for (size_t i = 0; i < numShards; i++) {
+    char host[32];
+    sprintf(host, "localhost:%zu", 7000 + i);
+    MRClusterNode node = {.flags = MRNode_Master, .id = strdup(host)};
+    MREndpoint_Parse(host, &node.endpoint);
+
+    MRClusterShard sh =
+        MR_NewClusterShard(i * numSlots / numShards, (i + 1) * numSlots / numShards - 1, 1);
+    MRClusterShard_AddNode(&sh, &node);
+    MRClusterTopology_AddShard(topo, &sh);
+  }
+  return topo;
+}
+
+void testClusterRouting() {
+  size_t shardCounts[] = {3, 30, 300};
+  const size_t numSlots = 16384;
+
+  for (size_t c = 0; c < sizeof(shardCounts) / sizeof(shardCounts[0]); c++) {
+    MRCluster *cl = MR_NewCluster(getEvenTopology(numSlots, shardCounts[c]), CRC16ShardFunc, 1);
+
+    // every slot is routed to the shard serving it
+    size_t misrouted = 0;
+    for (size_t slot = 0; slot < numSlots; slot++) {
+      MRClusterShard *sh = _MRCluster_FindShard(cl, slot);
+      if (!sh || sh->startSlot > slot || sh->endSlot < slot) {
+        misrouted++;
+      }
+    }
+    mu_check(misrouted == 0);
+    mu_check(_MRCluster_FindShard(cl, numSlots) == NULL);
+    freeCluster(cl);
+  }
+}
+
+void testTopologyUpdate() {
+  MRCluster *cl = MR_NewCluster(getEvenTopology(16384, 30), CRC16ShardFunc, 1);
+  MRClusterTopology *topo = cl->topo;
+  mu_check(topo->version == 1);
+  mu_check(MRClusterTopology_Equals(topo, topo));
+
+  // an identical topology is dropped, keeping the current one and its nodes
+  MRClusterNode *myNode = cl->myNode;
+  mu_check(MRCLuster_UpdateTopology(cl, getEvenTopology(16384, 30)) == REDIS_OK);
+  mu_check(cl->topo == topo);
+  mu_check(cl->topoVersion == 1);
+  mu_check(cl->myNode == myNode);
+  mu_check(MRCluster_NumNodes(cl) == 30);
+
+  MRClusterTopology *other = getEvenTopology(16384, 31);
+  mu_check(!MRClusterTopology_Equals(topo, other));
+  MRClusterTopology_Free(other);
+
+  // readers keep their reference across updates
+  MRClusterTopology *ref = MRCluster_GetTopology(cl);
+  mu_check(ref == topo && topo->refcount == 2);
+  MRClusterTopology_Release(ref);
+  mu_check(topo->refcount == 1);
+  freeCluster(cl);
+}
+
+MRClusterNode *_MRClusterShard_SelectNode(MRCluster *cl, MRClusterShard *sh,
+                                          MRCoordinationStrategy strategy);
+
+void testNodeSelection() {
+  const char *hosts[] = {"localhost:7000", "localhost:7001", "localhost:7002"};
+  MRClusterTopology *topo = MR_NewTopology(1, 4096);
+  MRClusterShard sh = MR_NewClusterShard(0, 4095, 3);
+  for (int i = 0; i < 3; i++) {
+    MRClusterNode node = {.flags = i == 0 ? MRNode_Master : 0, .id = strdup(hosts[i])};
+    MREndpoint_Parse(hosts[i], &node.endpoint);
+    MRClusterShard_AddNode(&sh, &node);
+  }
+  MRClusterTopology_AddShard(topo, &sh);
+  MRCluster *cl = MR_NewCluster(topo, CRC16ShardFunc, 1);
+  MRClusterShard *shard = &cl->topo->shards[0];
+
+  // the first replica is slow, and the second one is fast but busy
+  MRConn_GetStats(&cl->mgr, hosts[0])->latencyEWMA = 1;
+  MRConn_GetStats(&cl->mgr, hosts[1])->latencyEWMA = 20;
+  MRConn_GetStats(&cl->mgr, hosts[2])->latencyEWMA = 2;
+  MRConn_GetStats(&cl->mgr, hosts[2])->outstanding = 3;
+
+  // the slow replica is never preferred over another node
+  for (int i = 0; i < 100; i++) {
+    MRClusterNode *n = _MRClusterShard_SelectNode(cl, shard, MRCluster_FlatCoordination);
+    mu_check(n && n != &shard->nodes[1]);
+    n = _MRClusterShard_SelectNode(cl, shard, MRCluster_FlatCoordination | MRCluster_MastersOnly);
+    mu_check(n == &shard->nodes[0]);
+  }
+
+  MRCluster_SetNodeSelectPolicy(cl, MRCluster_FlatCoordination, MRNodeSelect_First);
+  mu_check(_MRClusterShard_SelectNode(cl, shard, MRCluster_FlatCoordination) == &shard->nodes[0]);
+
+  // reads follow the read policy, whatever their MastersOnly flag
+  MRCoordinationStrategy read = MRCluster_FlatCoordination | MRCluster_ReadOnly;
+  mu_check(_MRClusterShard_SelectNode(cl, shard, read) == &shard->nodes[0]);
+  MRCluster_SetReadPolicy(cl, MRReadPolicy_PreferReplicas);
+  mu_check(_MRClusterShard_SelectNode(cl, shard, read) == &shard->nodes[1]);
+  mu_check(_MRClusterShard_SelectNode(cl, shard, read | MRCluster_MastersOnly) == &shard->nodes[1]);
+  MRCluster_SetReadPolicy(cl, MRReadPolicy_Any);
+  mu_check(_MRClusterShard_SelectNode(cl, shard, read) == &shard->nodes[0]);
+
+  // suspect nodes are avoided, unless there is no other choice
+  MRConn_GetStats(&cl->mgr, hosts[0])->suspect = 1;
+  mu_check(_MRClusterShard_SelectNode(cl, shard, read) == &shard->nodes[1]);
+  mu_check(_MRClusterShard_SelectNode(cl, shard, MRCluster_MastersOnly) == &shard->nodes[0]);
+  MRConn_GetStats(&cl->mgr, hosts[0])->suspect = 0;
+
+  // failing nodes are avoided while their circuit breaker is open, and probed once it expires
+  MRNodeStats *st = MRConn_GetStats(&cl->mgr, hosts[0]);
+  mu_check(MRCluster_NodeAvailable(cl, hosts[0]));
+  st->failures = 100;
+  st->openUntil = uv_now(uv_default_loop()) + 60000;
+  mu_check(!MRCluster_NodeAvailable(cl, hosts[0]));
+  mu_check(_MRClusterShard_SelectNode(cl, shard, read) == &shard->nodes[1]);
+  st->openUntil = 0;
+  mu_check(MRCluster_NodeAvailable(cl, hosts[0]));
+  st->probing = 1;
+  mu_check(!MRCluster_NodeAvailable(cl, hosts[0]));
+  st->probing = 0;
+
+  // nodes that have not replied yet are expected to be as fast as the cluster's average
+  MRCluster_SetNodeSelectPolicy(cl, MRCluster_FlatCoordination, MRNodeSelect_LeastLoaded);
+  MRConn_GetStats(&cl->mgr, hosts[1])->latencyEWMA = 0;
+  MRConn_GetStats(&cl->mgr, hosts[2])->outstanding = 0;
+  cl->latencyEWMA = 50;
+  for (int i = 0; i < 100; i++) {
+    mu_check(_MRClusterShard_SelectNode(cl, shard, MRCluster_FlatCoordination) !=
+             &shard->nodes[1]);
+  }
+  cl->latencyEWMA = 1.5;
+  for (int i = 0; i < 100; i++) {
+    mu_check(_MRClusterShard_SelectNode(cl, shard, MRCluster_FlatCoordination) !=
+             &shard->nodes[2]);
+  }
+  freeCluster(cl);
 }
 
 int main(int argc, char **argv) {
@@ -118,6 +268,9 @@ int main(int argc, char **argv) {
   MU_RUN_TEST(testShardingFunc);
   MU_RUN_TEST(testCluster);
   MU_RUN_TEST(testClusterSharding);
+  MU_RUN_TEST(testClusterRouting);
+  MU_RUN_TEST(testNodeSelection);
+  MU_RUN_TEST(testTopologyUpdate);
   MU_REPORT();
 
   return minunit_status;
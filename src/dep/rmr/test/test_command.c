@@ -1,7 +1,122 @@
 #include <stdio.h>
+#include <stdarg.h>
 #include "minunit.h"
 #include <command.h>
+#include <hiredis/hiredis.h>
 
-int main() {
-  printf("Hello!\n");
-}
\ No newline at end of file
+// the reference wire format, by hiredis
+static sds formatCommand(MRCommand *cmd) {
+  const char *argv[cmd->num];
+  size_t lens[cmd->num];
+  for (size_t i = 0; i < cmd->num; i++) {
+    argv[i] = MRCommand_ArgStringPtrLen(cmd, i, &lens[i]);
+  }
+  sds s = NULL;
+  redisFormatSdsCommandArgv(&s, cmd->num, argv, lens);
+  return s;
+}
+
+static void assertArgs(MRCommand *cmd, int num, ...) {
+  mu_assert_int_eq(num, cmd->num);
+  va_list ap;
+  va_start(ap, num);
+  for (int i = 0; i < num; i++) {
+    const char *expected = va_arg(ap, const char *);
+    size_t n;
+    const char *arg = MRCommand_ArgStringPtrLen(cmd, i, &n);
+    mu_assert_int_eq(strlen(expected), n);
+    mu_check(!strcmp(expected, arg));
+  }
+  va_end(ap);
+}
+
+void testArgs() {
+  MRCommand cmd = MR_NewCommand(4, "FT.SEARCH", "idx", "hello", "LIMIT");
+  MRCommand_ReplaceArg(&cmd, 1, "ix", 2);
+  MRCommand_ReplaceArg(&cmd, 2, "a much longer query than before", 31);
+  MRCommand_AppendArgsAtPos(&cmd, 3, 2, "WITHSCORES", "WITHSORTKEYS");
+  MRCommand_AppendArgs(&cmd, 2, "0", "10");
+  MRCommand_SetPrefix(&cmd, "_FT");
+  assertArgs(&cmd, 8, "_FT.SEARCH", "ix", "a much longer query than before", "WITHSCORES",
+             "WITHSORTKEYS", "LIMIT", "0", "10");
+  mu_assert_int_eq(MRCommand_Read | MRCommand_SingleKey | MRCommand_Aliased,
+                   MRCommand_GetFlags(&cmd));
+
+  // arguments may come from the command itself, even when its buffer grows
+  char big[MRCOMMAND_INLINE_BUF * 2];
+  memset(big, 'x', sizeof(big) - 1);
+  big[sizeof(big) - 1] = 0;
+  MRCommand_AppendFrom(&cmd, &cmd, 2);
+  MRCommand_Append(&cmd, big, strlen(big));
+  MRCommand_AppendFrom(&cmd, &cmd, 9);
+  mu_assert_int_eq(11, cmd.num);
+  mu_check(!strcmp(MRCommand_ArgStringPtrLen(&cmd, 8, NULL), "a much longer query than before"));
+  mu_check(!strcmp(MRCommand_ArgStringPtrLen(&cmd, 10, NULL), big));
+
+  // more arguments than fit inline
+  for (int i = 0; i < MRCOMMAND_INLINE_ARGS; i++) {
+    MRCommand_AppendArgs(&cmd, 1, "arg");
+  }
+  mu_assert_int_eq(11 + MRCOMMAND_INLINE_ARGS, cmd.num);
+  mu_check(!strcmp(MRCommand_ArgStringPtrLen(&cmd, cmd.num - 1, NULL), "arg"));
+  mu_check(!strcmp(MRCommand_ArgStringPtrLen(&cmd, 1, NULL), "ix"));
+  MRCommand_Free(&cmd);
+}
+
+void testCopyOnWrite() {
+  MRCommand cmd = MR_NewCommand(3, "_FT.SEARCH", "idx", "hello");
+  MRCommand cp = MRCommand_Copy(&cmd);
+  mu_check(cp.args == cmd.args);
+  mu_assert_int_eq(2, cmd.args->refcount);
+
+  // a copy that changes gets arguments of its own, and leaves the others as they were
+  MRCommand_ReplaceArg(&cp, 1, "idx{06S}", 8);
+  mu_check(cp.args != cmd.args);
+  mu_assert_int_eq(1, cmd.args->refcount);
+  assertArgs(&cmd, 3, "_FT.SEARCH", "idx", "hello");
+  assertArgs(&cp, 3, "_FT.SEARCH", "idx{06S}", "hello");
+
+  MRCommand cp2 = MRCommand_Copy(&cmd);
+  MRCommand_Free(&cmd);
+  assertArgs(&cp2, 3, "_FT.SEARCH", "idx", "hello");
+  MRCommand_AppendArgs(&cp2, 1, "NOCONTENT");
+  assertArgs(&cp2, 4, "_FT.SEARCH", "idx", "hello", "NOCONTENT");
+
+  // the formatted command is the same as hiredis'
+  sds expected = formatCommand(&cp2);
+  sds s = MRCommand_Format(&cp2);
+  mu_assert_int_eq(sdslen(expected), sdslen(s));
+  mu_check(!memcmp(expected, s, sdslen(s)));
+  sdsfree(s);
+  sdsfree(expected);
+
+  MRCommand_Free(&cp);
+  MRCommand_Free(&cp2);
+}
+
+void testFormatted() {
+  MRCommand cmd = MR_NewCommand(4, "_FT.SEARCH", "idx", "hello world", "NOCONTENT");
+
+  // a copy sent with the wire format of its command sends the same bytes
+  MRCommand cp = MRCommand_Copy(&cmd);
+  cmd.cmd = MRCommand_Format(&cmd);
+  sds expected = formatCommand(&cp);
+  mu_assert_int_eq(sdslen(expected), sdslen(cmd.cmd));
+  mu_check(!memcmp(expected, cmd.cmd, sdslen(expected)));
+  sdsfree(expected);
+  MRCommand_Free(&cp);
+
+  // changing the arguments drops a formatted command
+  MRCommand_ReplaceArg(&cmd, 2, "foo", 3);
+  mu_check(cmd.cmd == NULL);
+  MRCommand_Free(&cmd);
+}
+
+int main(int argc, char **argv) {
+  MU_RUN_TEST(testArgs);
+  MU_RUN_TEST(testCopyOnWrite);
+  MU_RUN_TEST(testFormatted);
+  MU_REPORT();
+
+  return minunit_status;
+}
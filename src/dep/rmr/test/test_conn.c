@@ -0,0 +1,102 @@
+#include "minunit.h"
+#include <conn.h>
+
+#include <hiredis/async.h>
+#include <string.h>
+#include "../../rmutil/alloc.h"
+
+void _MRConn_CommandSent(MRConn *conn, uint64_t deadline);
+int _MRConn_Unresponsive(MRConn *conn, uint64_t now, uint64_t intervalMS);
+
+#define INTERVAL_MS 1000
+
+/* Queue a reply callback, as sending a command does */
+static void addPending(redisAsyncContext *ac, redisCallback *cb) {
+  cb->next = NULL;
+  if (ac->replies.tail) {
+    ac->replies.tail->next = cb;
+  } else {
+    ac->replies.head = cb;
+  }
+  ac->replies.tail = cb;
+}
+
+/* Pop the oldest reply callback, as a reply does */
+static void popPending(redisAsyncContext *ac) {
+  ac->replies.head = ac->replies.head->next;
+  if (!ac->replies.head) {
+    ac->replies.tail = NULL;
+  }
+}
+
+static void sendCommand(MRConn *conn, redisCallback *cb, uint64_t now, long long timeoutMS) {
+  addPending(conn->conn, cb);
+  _MRConn_CommandSent(conn, timeoutMS ? now + timeoutMS : UINT64_MAX);
+}
+
+void testSlowReply() {
+  redisAsyncContext ac;
+  memset(&ac, 0, sizeof(ac));
+  MRConn conn = {.state = MRConn_Connected, .conn = &ac};
+  redisCallback cbs[2];
+
+  // a command allowed 10s is not held against the node after 3s, nor until its deadline passes
+  sendCommand(&conn, &cbs[0], 0, 10000);
+  mu_check(!_MRConn_Unresponsive(&conn, 3500, INTERVAL_MS));
+  mu_check(!_MRConn_Unresponsive(&conn, 12000, INTERVAL_MS));
+  mu_check(_MRConn_Unresponsive(&conn, 13000, INTERVAL_MS));
+
+  // once it is answered, the connection is idle
+  popPending(&ac);
+  mu_check(!_MRConn_Unresponsive(&conn, 20000, INTERVAL_MS));
+
+  // a quick command queued behind a slow one waits for it
+  sendCommand(&conn, &cbs[0], 20000, 10000);
+  sendCommand(&conn, &cbs[1], 21000, 100);
+  mu_check(!_MRConn_Unresponsive(&conn, 25000, INTERVAL_MS));
+  popPending(&ac);
+  mu_check(_MRConn_Unresponsive(&conn, 25000, INTERVAL_MS));
+  popPending(&ac);
+
+  // commands without a timeout are never held against the node
+  sendCommand(&conn, &cbs[0], 30000, 0);
+  mu_check(!_MRConn_Unresponsive(&conn, 1000000, INTERVAL_MS));
+  popPending(&ac);
+}
+
+void testUnansweredPing() {
+  redisAsyncContext ac;
+  memset(&ac, 0, sizeof(ac));
+  MRConn conn = {.state = MRConn_Connected, .conn = &ac};
+  redisCallback cb;
+
+  // a PING is due at once
+  addPending(&ac, &cb);
+  _MRConn_CommandSent(&conn, 5000);
+  mu_check(!_MRConn_Unresponsive(&conn, 7000, INTERVAL_MS));
+  mu_check(_MRConn_Unresponsive(&conn, 8000, INTERVAL_MS));
+}
+
+void testManyPending() {
+  redisAsyncContext ac;
+  memset(&ac, 0, sizeof(ac));
+  MRConn conn = {.state = MRConn_Connected, .conn = &ac};
+  redisCallback cbs[MRCONN_SENT_HISTORY * 2];
+
+  // with more commands pending than the history holds, the latest deadline of all counts
+  sendCommand(&conn, &cbs[0], 0, 60000);
+  for (size_t i = 1; i < MRCONN_SENT_HISTORY * 2; i++) {
+    sendCommand(&conn, &cbs[i], i, 100);
+  }
+  mu_check(!_MRConn_Unresponsive(&conn, 10000, INTERVAL_MS));
+  mu_check(_MRConn_Unresponsive(&conn, 63000, INTERVAL_MS));
+}
+
+int main(int argc, char **argv) {
+  RMUTil_InitAlloc();
+  MU_RUN_TEST(testSlowReply);
+  MU_RUN_TEST(testUnansweredPing);
+  MU_RUN_TEST(testManyPending);
+  MU_REPORT();
+  return minunit_status;
+}
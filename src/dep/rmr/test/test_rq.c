@@ -0,0 +1,143 @@
+#include "minunit.h"
+#include <rq.h>
+#include <uv.h>
+#include <stdint.h>
+
+#define MS (1000000ULL)
+
+// Test hooks running and completing requests at given times
+int _RQ_RunNext(MRWorkQueue *q, uint64_t now);
+void _RQ_Done(MRWorkQueue *q, uint64_t now);
+
+static int numRun = 0;
+
+static void onRequest(void *p) {
+  numRun++;
+}
+
+void testAdmission() {
+  MRWorkQueue *q = RQ_New(2, 1, 4);
+
+  // requests beyond the queue's length are rejected
+  mu_check(RQ_TryPush(q, onRequest, NULL));
+  mu_check(RQ_TryPush(q, onRequest, NULL));
+  mu_check(!RQ_TryPush(q, onRequest, NULL));
+  MRWorkQueueStats st = RQ_GetStats(q);
+  mu_assert_int_eq(2, st.queued);
+  mu_assert_int_eq(1, st.rejected);
+  mu_assert_int_eq(1, st.limit);
+
+  // a single request at a time gets a slot, the next one waits for it to be done
+  uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+  mu_assert_int_eq(1, numRun);
+  st = RQ_GetStats(q);
+  mu_assert_int_eq(1, st.pending);
+  mu_assert_int_eq(1, st.queued);
+
+  RQ_Done(q);
+  uv_run(uv_default_loop(), UV_RUN_NOWAIT);
+  mu_assert_int_eq(2, numRun);
+  RQ_Done(q);
+
+  st = RQ_GetStats(q);
+  mu_assert_int_eq(0, st.pending);
+  mu_assert_int_eq(0, st.queued);
+  mu_assert_int_eq(2, st.completed);
+}
+
+/* Keep the queue full, and run its requests in rounds: as many as the limit allows start together
+ * and complete latencyMS later. Returns the time after the rounds */
+static uint64_t runRounds(MRWorkQueue *q, uint64_t now, int rounds, uint64_t latencyMS) {
+  for (int ii = 0; ii < rounds; ++ii) {
+    while (RQ_GetStats(q).queued < RQ_GetStats(q).limit) {
+      RQ_Push(q, onRequest, NULL);
+    }
+    int started = 0;
+    while (_RQ_RunNext(q, now)) {
+      started++;
+    }
+    now += latencyMS * MS;
+    while (started--) {
+      _RQ_Done(q, now);
+    }
+  }
+  return now;
+}
+
+/* Drop the requests left in the queue */
+static void drain(MRWorkQueue *q, uint64_t now) {
+  while (_RQ_RunNext(q, now)) {
+    _RQ_Done(q, now);
+  }
+}
+
+void testAdaptiveLimit() {
+  MRWorkQueue *q = RQ_New(1000, 4, 100);
+  uint64_t now = uv_hrtime();
+
+  // while the latency stays at its lowest, the limit grows as it is reached
+  now = runRounds(q, now, 500, 10);
+  MRWorkQueueStats st = RQ_GetStats(q);
+  mu_check(st.limit > 20);
+  mu_check(st.latencyMS >= 9.9 && st.latencyMS <= 10.1);
+  mu_check(st.minLatencyMS >= 9.9 && st.minLatencyMS <= 10.1);
+  int grown = st.limit;
+
+  // once requests take 4 times as long, they queue up on the nodes, and the limit shrinks
+  now = runRounds(q, now, 100, 40);
+  st = RQ_GetStats(q);
+  mu_check(st.limit < grown / 2);
+  mu_check(st.latencyMS >= 39.9 && st.latencyMS <= 40.1);
+  mu_check(st.minLatencyMS >= 9.9 && st.minLatencyMS <= 10.1);
+  drain(q, now);
+}
+
+void testUnreachedLimit() {
+  MRWorkQueue *q = RQ_New(1000, 16, 100);
+  uint64_t now = uv_hrtime();
+
+  // a single request at a time never reaches the limit, which has no reason to grow
+  for (int ii = 0; ii < 100; ++ii) {
+    RQ_Push(q, onRequest, NULL);
+    mu_check(_RQ_RunNext(q, now));
+    now += 10 * MS;
+    _RQ_Done(q, now);
+  }
+  MRWorkQueueStats st = RQ_GetStats(q);
+  mu_assert_int_eq(16, st.limit);
+  mu_assert_int_eq(100, st.completed);
+}
+
+void testMaxWait() {
+  MRWorkQueue *q = RQ_New(1000, 2, 2);
+  RQ_SetMaxWait(q, 50);
+  uint64_t now = uv_hrtime();
+
+  // requests take 100ms, two at a time
+  now = runRounds(q, now, 20, 100);
+  drain(q, now);
+  MRWorkQueueStats st = RQ_GetStats(q);
+  mu_assert_int_eq(2, st.limit);
+  mu_check(st.latencyMS >= 99.9 && st.latencyMS <= 100.1);
+  mu_assert_int_eq(0, st.queued);
+
+  // a request behind a single other one waits 50ms, and behind two it would wait 100ms - it is
+  // rejected, and the coordinator replies MR_OVERLOADED_ERR
+  mu_check(RQ_TryPush(q, onRequest, NULL));
+  mu_check(RQ_TryPush(q, onRequest, NULL));
+  mu_check(!RQ_TryPush(q, onRequest, NULL));
+  st = RQ_GetStats(q);
+  mu_assert_int_eq(2, st.queued);
+  mu_assert_int_eq(1, st.rejected);
+  drain(q, now);
+}
+
+int main(int argc, char **argv) {
+  MU_RUN_TEST(testAdmission);
+  MU_RUN_TEST(testAdaptiveLimit);
+  MU_RUN_TEST(testUnreachedLimit);
+  MU_RUN_TEST(testMaxWait);
+  MU_REPORT();
+
+  return minunit_status;
+}
@@ -0,0 +1,65 @@
+#include "minunit.h"
+#include <timer_wheel.h>
+#include <uv.h>
+
+static int fired[4];
+static int numFired = 0;
+
+static void onDeadline(void *p) {
+  fired[numFired++] = *(int *)p;
+}
+
+void testTimerWheel() {
+  // a small wheel, so that some deadlines are more than a turn away
+  MRTimerWheel *w = MRTimerWheel_New(5, 4);
+  MRTimerEntry entries[4] = {0};
+  int ids[4] = {0, 1, 2, 3};
+  uint64_t now = MRTimerWheel_Now();
+
+  MRTimerWheel_Add(w, &entries[0], now + 60, onDeadline, &ids[0]);
+  MRTimerWheel_Add(w, &entries[1], now + 10, onDeadline, &ids[1]);
+  MRTimerWheel_Add(w, &entries[2], now + 30, onDeadline, &ids[2]);
+  // past deadlines fire on the next tick
+  MRTimerWheel_Add(w, &entries[3], now - 100, onDeadline, &ids[3]);
+  mu_assert_int_eq(4, MRTimerWheel_Size(w));
+
+  // removed entries never fire, and removing them again does nothing
+  MRTimerWheel_Remove(w, &entries[2]);
+  MRTimerWheel_Remove(w, &entries[2]);
+  mu_assert_int_eq(3, MRTimerWheel_Size(w));
+
+  // the loop runs until the wheel stops its timer, once all entries fired
+  uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+  mu_assert_int_eq(0, MRTimerWheel_Size(w));
+  mu_assert_int_eq(3, numFired);
+  mu_assert_int_eq(3, fired[0]);
+  mu_assert_int_eq(1, fired[1]);
+  mu_assert_int_eq(0, fired[2]);
+  mu_check(MRTimerWheel_Now() >= now + 60);
+}
+
+void testDeadlineWithinTick() {
+  // a turn of the wheel is 10s, so an entry left for the next turn would fire far too late
+  MRTimerWheel *w = MRTimerWheel_New(10, 1024);
+  MRTimerEntry entry = {0};
+  int id = 0;
+  numFired = 0;
+
+  // the last millisecond of a tick, which is processed before the deadline passes
+  uint64_t deadline = (MRTimerWheel_Now() / 10 + 2) * 10 - 1;
+  MRTimerWheel_Add(w, &entry, deadline, onDeadline, &id);
+  uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+
+  uint64_t firedAt = MRTimerWheel_Now();
+  mu_assert_int_eq(1, numFired);
+  mu_check(firedAt >= deadline);
+  mu_check(firedAt <= deadline + 100);
+}
+
+int main(int argc, char **argv) {
+  MU_RUN_TEST(testTimerWheel);
+  MU_RUN_TEST(testDeadlineWithinTick);
+  MU_REPORT();
+
+  return minunit_status;
+}
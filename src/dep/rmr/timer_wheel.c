@@ -0,0 +1,117 @@
+#include <uv.h>
+#include "timer_wheel.h"
+
+struct MRTimerWheel {
+  uv_timer_t timer;
+  MRTimerEntry **slots;
+  size_t numSlots;
+  uint64_t tickMS;
+  /* The last tick whose slot was processed */
+  uint64_t lastTick;
+  size_t size;
+};
+
+uint64_t MRTimerWheel_Now(void) {
+  return uv_hrtime() / 1000000;
+}
+
+/* The tick an entry fires on: the first one that starts at or after its deadline, so that no
+ * entry fires before its deadline */
+static uint64_t deadlineTick(MRTimerWheel *w, uint64_t deadline) {
+  return (deadline + w->tickMS - 1) / w->tickMS;
+}
+
+static void wheelTick(uv_timer_t *timer) {
+  MRTimerWheel *w = timer->data;
+  uint64_t now = MRTimerWheel_Now();
+  uint64_t nowTick = now / w->tickMS;
+
+  // a stalled loop may have skipped more than a full turn of the wheel
+  uint64_t tick = w->lastTick + 1;
+  if (nowTick >= w->numSlots && tick < nowTick - w->numSlots + 1) {
+    tick = nowTick - w->numSlots + 1;
+  }
+
+  for (; tick <= nowTick; tick++) {
+    size_t slot = tick % w->numSlots;
+    MRTimerEntry *e = w->slots[slot];
+    while (e) {
+      // entries more than a turn away share the slot, and are left for a later turn
+      if (deadlineTick(w, e->deadline) > tick) {
+        e = e->next;
+        continue;
+      }
+      MRTimerWheel_Remove(w, e);
+      e->cb(e->privdata);
+      // the callback may have removed other entries of the slot
+      e = w->slots[slot];
+    }
+  }
+  w->lastTick = nowTick;
+
+  if (!w->size) {
+    uv_timer_stop(&w->timer);
+  }
+}
+
+MRTimerWheel *MRTimerWheel_New(uint64_t tickMS, size_t numSlots) {
+  MRTimerWheel *w = calloc(1, sizeof(*w));
+  w->tickMS = tickMS ? tickMS : 1;
+  w->numSlots = numSlots ? numSlots : 1;
+  w->slots = calloc(w->numSlots, sizeof(*w->slots));
+  uv_timer_init(uv_default_loop(), &w->timer);
+  w->timer.data = w;
+  return w;
+}
+
+void MRTimerWheel_Add(MRTimerWheel *w, MRTimerEntry *e, uint64_t deadline, MRTimerCallback cb,
+                      void *privdata) {
+  MRTimerWheel_Remove(w, e);
+
+  // the timer only runs while there are entries to fire
+  if (!w->size) {
+    w->lastTick = MRTimerWheel_Now() / w->tickMS;
+    uv_timer_start(&w->timer, wheelTick, w->tickMS, w->tickMS);
+  }
+
+  // past deadlines fire on the next tick
+  uint64_t tick = deadlineTick(w, deadline);
+  if (tick <= w->lastTick) {
+    tick = w->lastTick + 1;
+  }
+  size_t slot = tick % w->numSlots;
+
+  e->deadline = deadline;
+  e->cb = cb;
+  e->privdata = privdata;
+  e->prev = NULL;
+  e->next = w->slots[slot];
+  if (e->next) {
+    e->next->prev = e;
+  }
+  w->slots[slot] = e;
+  e->slot = slot;
+  e->armed = 1;
+  w->size++;
+}
+
+void MRTimerWheel_Remove(MRTimerWheel *w, MRTimerEntry *e) {
+  if (!e->armed) {
+    return;
+  }
+  if (e->prev) {
+    e->prev->next = e->next;
+  } else {
+    w->slots[e->slot] = e->next;
+  }
+  if (e->next) {
+    e->next->prev = e->prev;
+  }
+  e->prev = e->next = NULL;
+  e->armed = 0;
+  w->size--;
+}
+
+size_t MRTimerWheel_Size(MRTimerWheel *w) {
+  return w->size;
+}
@@ -0,0 +1,41 @@
+#ifndef MR_TIMER_WHEEL_H_
+#define MR_TIMER_WHEEL_H_
+#include <stdlib.h>
+#include <stdint.h>
+
+typedef void (*MRTimerCallback)(void *privdata);
+
+/* A deadline tracked by a timer wheel, embedded in the object it belongs to */
+typedef struct MRTimerEntry {
+  struct MRTimerEntry *prev;
+  struct MRTimerEntry *next;
+  uint64_t deadline;
+  MRTimerCallback cb;
+  void *privdata;
+  /* The wheel slot holding the entry, if armed */
+  size_t slot;
+  int armed;
+} MRTimerEntry;
+
+typedef struct MRTimerWheel MRTimerWheel;
+
+/* Create a hashed timer wheel on the default uv loop. Entries fire within tickMS of their
+ * deadlines, and adding or removing an entry is O(1) whatever the number of entries. Apart from
+ * MRTimerWheel_Now, all the functions must be called on the loop thread */
+MRTimerWheel *MRTimerWheel_New(uint64_t tickMS, size_t numSlots);
+
+/* The wheel's clock in milliseconds, which deadlines are expressed in. Safe to call from any
+ * thread */
+uint64_t MRTimerWheel_Now(void);
+
+/* Call cb(privdata) once the deadline passes, unless the entry is removed first */
+void MRTimerWheel_Add(MRTimerWheel *w, MRTimerEntry *e, uint64_t deadline, MRTimerCallback cb,
+                      void *privdata);
+
+/* Remove an entry from the wheel. Removing an entry that is not armed does nothing */
+void MRTimerWheel_Remove(MRTimerWheel *w, MRTimerEntry *e);
+
+/* The number of armed entries */
+size_t MRTimerWheel_Size(MRTimerWheel *w);
+
+#endif
@@ -5,11 +5,19 @@
 #include "commands.h"
 #include "aggregate/aggregate.h"
 #include "dist_plan.h"
+#include "dist_groupby.h"
+#include "config.h"
 #include "profile.h"
+#include "aggregate/functions/function.h"
+#include "util/heap.h"
 #include <err.h>
 
-/* Get cursor command using a cursor id and an existing aggregate command */
-static int getCursorCommand(MRReply *prev, MRCommand *cmd) {
+#ifndef DEFAULT_LIMIT
+#define DEFAULT_LIMIT 10
+#endif
+
+/* Get cursor command (READ or DEL) using a cursor id and an existing aggregate command */
+static int getCursorCommand(MRReply *prev, MRCommand *cmd, const char *op) {
   long long cursorId;
   if (!MRReply_ToInteger(MRReply_ArrayElement(prev, 1), &cursorId)) {
     // Invalid format?!
@@ -27,8 +35,9 @@ static int getCursorCommand(MRReply *prev, MRCommand *cmd) {
   sprintf(buf, "%lld", cursorId);
   int shardingKey = MRCommand_GetShardingKey(cmd);
   const char *idx = MRCommand_ArgStringPtrLen(cmd, shardingKey, NULL);
-  MRCommand newCmd = MR_NewCommand(4, "_FT.CURSOR", "READ", idx, buf);
+  MRCommand newCmd = MR_NewCommand(4, "_FT.CURSOR", op, idx, buf);
   newCmd.targetSlot = cmd->targetSlot;
+  newCmd.timeoutMS = cmd->timeoutMS;
   MRCommand_Free(cmd);
   *cmd = newCmd;
 
@@ -36,6 +45,25 @@ static int getCursorCommand(MRReply *prev, MRCommand *cmd) {
 }
 
 static int netCursorCallback(MRIteratorCallbackCtx *ctx, MRReply *rep, MRCommand *cmd) {
+  if (MRIteratorCallback_IsStopped(ctx)) {
+    // No more rows are needed - release the shard's cursor if it is still open
+    int isDone = !rep || MRReply_Type(rep) != MR_REPLY_ARRAY || MRReply_Length(rep) < 2 ||
+                 !getCursorCommand(rep, cmd, "DEL");
+    MRReply_Free(rep);
+    if (isDone || REDIS_ERR == MRIteratorCallback_ResendCommand(ctx, cmd)) {
+      MRIteratorCallback_Done(ctx, 0);
+    }
+    return REDIS_OK;
+  }
+
+  // a shard that ran out of time contributes the rows it sent until then
+  if (SearchCluster_IsTimeoutReply(rep)) {
+    MRReply_Free(rep);
+    MRIteratorCallback_Done(ctx, 0);
+    RedisModule_Log(NULL, "warning", "A shard timed out, its aggregation results are partial");
+    return REDIS_OK;
+  }
+
   // Should we assert this??
   if (!rep || MRReply_Type(rep) != MR_REPLY_ARRAY || 
              (MRReply_Length(rep) != 2 && MRReply_Length(rep) != 3)) {
@@ -50,7 +78,7 @@ static int netCursorCallback(MRIteratorCallbackCtx *ctx, MRReply *rep, MRCommand
 
   // rewrite and resend the cursor command if needed
   int rc = REDIS_OK;
-  int isDone = !getCursorCommand(rep, cmd);
+  int isDone = !getCursorCommand(rep, cmd, "READ");
 
   // Push the reply down the chain
   MRReply *arr = MRReply_ArrayElement(rep, 0);
@@ -116,43 +144,151 @@ RSValue *MRReply_ToValue(MRReply *r) {
   return v;
 }
 
+/* Count the values merged by the local TOLIST of a distributed COUNT_DISTINCT */
+static int distCountDistinct(ExprEval *ctx, RSValue *result, RSValue **argv, size_t argc,
+                             QueryError *err) {
+  const RSValue *v = RSValue_Dereference(argv[0]);
+  size_t n = 0;
+  if (v->t == RSValue_Array) {
+    n = RSValue_ArrayLen(v);
+  } else if (v->t != RSValue_Null) {
+    n = 1;
+  }
+  RSValue_SetNumber(result, n);
+  return EXPR_EVAL_OK;
+}
+
+void DistAggregate_RegisterFunctions(void) {
+  static int registered = 0;
+  if (registered) {
+    return;
+  }
+  RSFunctionRegistry_RegisterFunction(DIST_COUNT_DISTINCT_FUNC, distCountDistinct, RSValue_Number,
+                                      1, 1);
+  registered = 1;
+}
+
+// A single shard's stream of rows
+typedef struct {
+  size_t source;  // Index of the shard's command within the iterator
+  MRReply *root;  // Current reply. We need to free this when done with the rows
+  MRReply *rows;  // Array containing reply rows for quick access
+  size_t curIdx;
+  RLookupRow head;   // The next row of the shard, when merging in order
+  MRReply *profile;  // The shard's last reply, holding its profile info
+  int done;
+
+  // metrics
+  size_t numReplies;
+  size_t numRows;
+  double waitTime;  // Time spent waiting for the shard's replies, in ms
+  int stopped;      // Stopped before the shard had sent all of its rows
+} RPNetShard;
+
 typedef struct {
   ResultProcessor base;
-  struct {
-    MRReply *root;  // Root reply. We need to free this when done with the rows
-    MRReply *rows;  // Array containing reply rows for quick access
-  } current;
   // Lookup - the rows are written in here
   RLookup *lookup;
-  size_t curIdx;
   MRIterator *it;
   MRCommand cmd;
   MRCommandGenerator cg;
 
-  // profile vars
-  MRReply **shardsProfile;
-  int shardsProfileIdx;
+  RPNetShard *shards;
+  size_t nshards;
+  // The shard whose reply is being read, when merging in order of arrival
+  RPNetShard *current;
+  // Keep the shards' profile replies
+  int profile;
+
+  // Ordered merge, when each of the shards' streams is already sorted by the arrange keys
+  struct {
+    const RLookupKey **keys;
+    size_t nkeys;
+    uint64_t ascMap;
+    size_t limit;  // No more rows are needed after that many
+    size_t emitted;
+    heap_t *heap;
+  } merge;
 } RPNet;
 
-static int getNextReply(RPNet *nc) {
-  while (1) {
-    MRReply *root = MRIterator_Next(nc->it);
+static double elapsedMS(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1000000.0;
+}
+
+/* Set a new reply as the shard's current one. Returns 0 if it has no rows */
+static int rpnetShardSetReply(RPNet *nc, RPNetShard *sh, MRReply *root) {
+  MRReply *rows = MRReply_ArrayElement(root, 0);
+  if (rows == NULL || MRReply_Type(rows) != MR_REPLY_ARRAY || MRReply_Length(rows) == 0) {
+    MRReply_Free(root);
+    RedisModule_Log(NULL, "warning", "An empty reply was received from a shard");
+    return 0;
+  }
+  sh->root = root;
+  sh->rows = rows;
+  sh->curIdx = 1;
+  sh->numReplies++;
+  // Get the index from the first
+  nc->base.parent->totalResults += MRReply_Integer(MRReply_ArrayElement(rows, 0));
+  return 1;
+}
+
+/* Done with the shard's current reply */
+static void rpnetShardReleaseReply(RPNet *nc, RPNetShard *sh) {
+  if (!sh->root) {
+    return;
+  }
+  long long cursorId = MRReply_Integer(MRReply_ArrayElement(sh->root, 1));
+  // in profile mode, save shard's profile info to be returned later
+  if (cursorId == 0 && nc->profile) {
+    sh->profile = sh->root;
+  } else {
+    MRReply_Free(sh->root);
+  }
+  sh->root = sh->rows = NULL;
+}
+
+/* The next row of the shard's current reply, or NULL if it has been consumed */
+static MRReply *rpnetShardBufferedRow(RPNetShard *sh) {
+  if (!sh || !sh->rows || sh->curIdx == MRReply_Length(sh->rows)) {
+    return NULL;
+  }
+  sh->numRows++;
+  return MRReply_ArrayElement(sh->rows, sh->curIdx++);
+}
+
+/* The next row of the shard, waiting for its next reply if needed. NULL once the shard is done */
+static MRReply *rpnetShardNextRow(RPNet *nc, RPNetShard *sh) {
+  MRReply *row;
+  while (!(row = rpnetShardBufferedRow(sh))) {
+    rpnetShardReleaseReply(nc, sh);
+    if (sh->done) {
+      return NULL;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MRReply *root = MRIterator_NextFromSource(nc->it, sh->source);
+    sh->waitTime += elapsedMS(&start);
     if (root == MRITERATOR_DONE) {
-      // No more replies
-      nc->current.root = NULL;
-      nc->current.rows = NULL;
-      return 0;
+      sh->done = 1;
+      return NULL;
     }
+    rpnetShardSetReply(nc, sh, root);
+  }
+  return row;
+}
 
-    MRReply *rows = MRReply_ArrayElement(root, 0);
-    if (rows == NULL || MRReply_Type(rows) != MR_REPLY_ARRAY || MRReply_Length(rows) == 0) {
-      MRReply_Free(root);
-      RedisModule_Log(NULL, "warning", "An empty reply was received from a shard");
-      ;    
+/* Write a row of a shard's reply into a lookup row */
+static void rpnetWriteRow(RPNet *nc, MRReply *rep, RLookupRow *row) {
+  for (size_t i = 0; i < MRReply_Length(rep); i += 2) {
+    const char *c = MRReply_String(MRReply_ArrayElement(rep, i), NULL);
+    RSValue *v = RS_NullVal();
+    if (i + 1 < MRReply_Length(rep)) {
+      MRReply *val = MRReply_ArrayElement(rep, i + 1);
+      v = MRReply_ToValue(val);
     }
-    nc->current.root = root;
-    nc->current.rows = rows;
-    return 1;
+    RLookup_WriteOwnKeyByName(nc->lookup, c, row, v);
   }
 }
 
@@ -165,52 +301,128 @@ static const RLookupKey *keyForField(RPNet *nc, const char *s) {
   return NULL;
 }
 
+/* Stop the shards that still have rows, as no more rows are needed */
+static void rpnetStopShards(RPNet *nc) {
+  for (size_t i = 0; i < nc->nshards; i++) {
+    RPNetShard *sh = nc->shards + i;
+    if (!sh->done && !sh->stopped) {
+      MRIterator_StopSource(nc->it, sh->source);
+      sh->stopped = 1;
+    }
+  }
+}
+
+/* Merge the shards' rows in their order of arrival */
 static int rpnetNext(ResultProcessor *self, SearchResult *r) {
   RPNet *nc = (RPNet *)self;
-  // if we've consumed the last reply - free it
-  if (nc->current.rows && nc->curIdx == MRReply_Length(nc->current.rows)) {
-    long long cursorId = MRReply_Integer(MRReply_ArrayElement(nc->current.root, 1));
-    // in profile mode, save shard's profile info to be returned later
-    if (cursorId == 0 && nc->shardsProfile) {
-      nc->shardsProfile[nc->shardsProfileIdx++] = nc->current.root; 
-    } else {
-      MRReply_Free(nc->current.root);
+  MRReply *row;
+  while (!(row = rpnetShardBufferedRow(nc->current))) {
+    if (nc->current) {
+      rpnetShardReleaseReply(nc, nc->current);
     }
-    nc->current.root = nc->current.rows = NULL;
-  }
 
-  // get the next reply from the channel
-  if (!nc->current.root) {
-    if (!getNextReply(nc)) {
+    // get the next reply from any of the shards
+    size_t source;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    MRReply *root = MRIterator_NextFromAny(nc->it, &source);
+    if (root == MRITERATOR_DONE) {
+      nc->current = NULL;
       return RS_RESULT_EOF;
     }
-    // Get the index from the first
-    nc->base.parent->totalResults += MRReply_Integer(MRReply_ArrayElement(nc->current.rows, 0));
-    nc->curIdx = 1;
+    nc->current = nc->shards + source;
+    nc->current->waitTime += elapsedMS(&start);
+    rpnetShardSetReply(nc, nc->current, root);
   }
 
-  MRReply *rep = MRReply_ArrayElement(nc->current.rows, nc->curIdx++);
-  for (size_t i = 0; i < MRReply_Length(rep); i += 2) {
-    const char *c = MRReply_String(MRReply_ArrayElement(rep, i), NULL);
-    RSValue *v = RS_NullVal();
-    if (i + 1 < MRReply_Length(rep)) {
-      MRReply *val = MRReply_ArrayElement(rep, i + 1);
-      v = MRReply_ToValue(val);
+  rpnetWriteRow(nc, row, &r->rowdata);
+  return RS_RESULT_OK;
+}
+
+/* Ordering of two rows by the merge keys. A positive value means that r1 comes first */
+static int rpnetCmpRows(const RPNet *nc, const RLookupRow *r1, const RLookupRow *r2) {
+  for (size_t i = 0; i < nc->merge.nkeys; i++) {
+    const RSValue *v1 = RLookup_GetItem(nc->merge.keys[i], r1);
+    const RSValue *v2 = RLookup_GetItem(nc->merge.keys[i], r2);
+    int ascending = !!(nc->merge.ascMap & (1LLU << i));
+    int rc;
+    if (!v1 || !v2) {
+      if (v1 == v2) continue;
+      rc = v1 ? 1 : -1;
+    } else {
+      rc = RSValue_Cmp(v1, v2, NULL);
+      if (!rc) continue;
     }
-    RLookup_WriteOwnKeyByName(nc->lookup, c, &r->rowdata, v);
+    return ascending ? -rc : rc;
+  }
+  return 0;
+}
+
+static int rpnetCmpShards(const void *p1, const void *p2, const void *udata) {
+  const RPNetShard *s1 = p1, *s2 = p2;
+  return rpnetCmpRows(udata, &s1->head, &s2->head);
+}
+
+/* Read the next row of a shard into its head. Returns 0 once the shard has no more rows */
+static int rpnetShardFillHead(RPNet *nc, RPNetShard *sh) {
+  RLookupRow_Wipe(&sh->head);
+  MRReply *row = rpnetShardNextRow(nc, sh);
+  if (!row) {
+    return 0;
+  }
+  rpnetWriteRow(nc, row, &sh->head);
+  return 1;
+}
+
+/* Merge the shards' rows in the order of the arrange keys */
+static int rpnetNextMerged(ResultProcessor *self, SearchResult *r) {
+  RPNet *nc = (RPNet *)self;
+  if (nc->merge.emitted == nc->merge.limit || !heap_count(nc->merge.heap)) {
+    // Whatever the shards still have to say would be discarded anyway
+    rpnetStopShards(nc);
+    return RS_RESULT_EOF;
+  }
+
+  RPNetShard *sh = heap_poll(nc->merge.heap);
+  RLookupRow tmp = r->rowdata;
+  r->rowdata = sh->head;
+  sh->head = tmp;
+  nc->merge.emitted++;
+
+  if (rpnetShardFillHead(nc, sh)) {
+    heap_offerx(nc->merge.heap, sh);
   }
   return RS_RESULT_OK;
 }
 
 static int rpnetNext_Start(ResultProcessor *rp, SearchResult *r) {
   RPNet *nc = (RPNet *)rp;
-  MRIterator *it = MR_Iterate(nc->cg, netCursorCallback, NULL);
+  MRIterator *it = MR_IterateSources(nc->cg, netCursorCallback, NULL);
   if (!it) {
+    QueryError_SetError(rp->parent->err, QUERY_EGENERIC, MR_OVERLOADED_ERR);
     return RS_RESULT_ERROR;
   }
   nc->it = it;
-  nc->base.Next = rpnetNext;
-  return rpnetNext(rp, r);
+  nc->nshards = MRIterator_NumSources(it);
+  nc->shards = rm_calloc(nc->nshards, sizeof(*nc->shards));
+  for (size_t i = 0; i < nc->nshards; i++) {
+    nc->shards[i].source = i;
+  }
+
+  if (!nc->merge.keys) {
+    nc->base.Next = rpnetNext;
+    return rpnetNext(rp, r);
+  }
+
+  nc->merge.heap = rm_malloc(heap_sizeof(nc->nshards));
+  heap_init(nc->merge.heap, rpnetCmpShards, nc, nc->nshards);
+  for (size_t i = 0; i < nc->nshards; i++) {
+    if (rpnetShardFillHead(nc, nc->shards + i)) {
+      heap_offerx(nc->merge.heap, nc->shards + i);
+    }
+  }
+  nc->base.Next = rpnetNextMerged;
+  return rpnetNextMerged(rp, r);
 }
 
 static void rpnetFree(ResultProcessor *rp) {
@@ -224,30 +436,30 @@ static void rpnetFree(ResultProcessor *rp) {
 
   nc->cg.Free(nc->cg.ctx);
 
-  if (nc->shardsProfile) {
-    for (size_t i = 0; i < nc->shardsProfileIdx; ++i) {
-      if (nc->shardsProfile[i] != nc->current.root) {
-        MRReply_Free(nc->shardsProfile[i]);
-      }
+  for (size_t i = 0; i < nc->nshards; i++) {
+    RPNetShard *sh = nc->shards + i;
+    if (sh->root) {
+      MRReply_Free(sh->root);
     }
-    rm_free(nc->shardsProfile);
+    if (sh->profile) {
+      MRReply_Free(sh->profile);
+    }
+    RLookupRow_Cleanup(&sh->head);
   }
-
-  if (nc->current.root) {
-    MRReply_Free(nc->current.root);
+  rm_free(nc->shards);
+  if (nc->merge.heap) {
+    heap_free(nc->merge.heap);
   }
 
   if (nc->it) MRIterator_Free(nc->it);
   free(rp);
 }
 
-static RPNet *RPNet_New(const MRCommand *cmd, SearchCluster *sc) {
+static RPNet *RPNet_New(const MRCommand *cmd, SearchCluster *sc, int queryIdx) {
   //  MRCommand_FPrint(stderr, &cmd);
   RPNet *nc = calloc(1, sizeof(*nc));
   nc->cmd = *cmd;
-  nc->cg = SearchCluster_MultiplexCommand(sc, &nc->cmd);
-  nc->shardsProfileIdx = 0;
-  nc->shardsProfile = NULL;
+  nc->cg = SearchCluster_MultiplexQuery(sc, &nc->cmd, queryIdx);
   nc->base.Free = rpnetFree;
   nc->base.Next = rpnetNext_Start;
   nc->base.type = RP_NETWORK;
@@ -255,7 +467,7 @@ static RPNet *RPNet_New(const MRCommand *cmd, SearchCluster *sc) {
 }
 
 static void buildMRCommand(RedisModuleString **argv, int argc, int profileArgs,
-                           AREQDIST_UpstreamInfo *us, MRCommand *xcmd) {
+                           AREQDIST_UpstreamInfo *us, long long timeoutMS, MRCommand *xcmd) {
   // We need to prepend the array with the command, index, and query that
   // we want to use.
   const char **tmparr = array_new(const char *, us->nserialized);
@@ -284,14 +496,90 @@ static void buildMRCommand(RedisModuleString **argv, int argc, int profileArgs,
 
   *xcmd = MR_NewCommandArgv(array_len(tmparr), tmparr);
   MRCommand_SetPrefix(xcmd, "_FT");
+  if (timeoutMS > 0) {
+    SearchCluster_AppendShardTimeout(xcmd, timeoutMS);
+  }
 
   array_free(tmparr);
 }
 
-static void buildDistRPChain(AREQ *r, MRCommand *xcmd, SearchCluster *sc,
+/* Find the processor right above the network processor, and the one above it, if any */
+static ResultProcessor *findAboveNet(AREQ *r, RPNet *nc, ResultProcessor **downstream) {
+  ResultProcessor *rp = r->qiter.endProc;
+  *downstream = NULL;
+  if (rp == &nc->base) {
+    return NULL;
+  }
+  while (rp->upstream != &nc->base) {
+    *downstream = rp;
+    rp = rp->upstream;
+  }
+  return rp;
+}
+
+/* Replace the processor right above the network processor */
+static void replaceAboveNet(AREQ *r, RPNet *nc, ResultProcessor *old, ResultProcessor *downstream,
+                            ResultProcessor *rp) {
+  if (rp) {
+    rp->upstream = &nc->base;
+    rp->parent = &r->qiter;
+  } else {
+    rp = &nc->base;
+  }
+  if (downstream) {
+    downstream->upstream = rp;
+  } else {
+    r->qiter.endProc = rp;
+  }
+  old->Free(old);
+}
+
+/**
+ * The shards' rows arrive sorted by the arrange step right above the network processor. Replace
+ * the sorter of that step by a merge of the shards' streams, which stops reading from the shards
+ * once the step has all of its rows.
+ */
+static void rpnetSetupMerge(AREQ *r, RPNet *nc, PLN_ArrangeStep *astp) {
+  ResultProcessor *downstream;
+  ResultProcessor *sorter = findAboveNet(r, nc, &downstream);
+  if (!sorter || sorter->type != RP_SORTER || !astp->sortkeysLK) {
+    return;
+  }
+
+  nc->merge.keys = astp->sortkeysLK;
+  nc->merge.nkeys = array_len(astp->sortKeys);
+  nc->merge.ascMap = astp->sortAscMap;
+  nc->merge.limit = astp->offset + (astp->limit ? astp->limit : DEFAULT_LIMIT);
+  replaceAboveNet(r, nc, sorter, downstream, NULL);
+}
+
+/* If the first local step groups the shards' partial groups, and all of its reducers only merge
+ * numeric partials, replace its generic grouper by the specialized one. Only the specialized one
+ * spills to disk, so DIST_AGG_MEMORY_LIMIT does not bound the other group steps */
+static void rpnetSetupGroupMerge(AREQ *r, RPNet *nc, RLookup *lookup) {
+  PLN_DistributeStep *dstp =
+      (PLN_DistributeStep *)AGPLN_FindStep(&r->ap, NULL, NULL, PLN_T_DISTRIBUTE);
+  PLN_BaseStep *next = PLN_NEXT_STEP(&dstp->base);
+  if (&next->llnodePln == &r->ap.steps || next->type != PLN_T_GROUP) {
+    return;
+  }
+
+  ResultProcessor *downstream;
+  ResultProcessor *grouper = findAboveNet(r, nc, &downstream);
+  if (!grouper || grouper->type != RP_GROUP) {
+    return;
+  }
+  ResultProcessor *rp = RPDistGroup_NewFromStep((PLN_GroupStep *)next, lookup);
+  if (rp) {
+    RPDistGroup_SetMemoryLimit(rp, clusterConfig.distAggMemoryLimit);
+    replaceAboveNet(r, nc, grouper, downstream, rp);
+  }
+}
+
+static void buildDistRPChain(AREQ *r, MRCommand *xcmd, int queryIdx, SearchCluster *sc,
                              AREQDIST_UpstreamInfo *us) {
   // Establish our root processor, which is the distributed processor
-  RPNet *rpRoot = RPNet_New(xcmd, sc);
+  RPNet *rpRoot = RPNet_New(xcmd, sc, queryIdx);
   rpRoot->lookup = us->lookup;
 
   assert(!r->qiter.rootProc);
@@ -312,8 +600,16 @@ static void buildDistRPChain(AREQ *r, MRCommand *xcmd, SearchCluster *sc,
   }
   rpRoot->base.parent = &r->qiter;
 
+  if (!IsProfile(r)) {
+    if (us->sortedBy) {
+      rpnetSetupMerge(r, rpRoot, us->sortedBy);
+    } else {
+      rpnetSetupGroupMerge(r, rpRoot, us->lookup);
+    }
+  }
+
   if (IsProfile(r)) {
-    rpRoot->shardsProfile = rm_malloc(sizeof(*rpRoot->shardsProfile) * sc->size);
+    rpRoot->profile = 1;
 
     ResultProcessor *rpProfile = RPProfile_New(&rpRoot->base, &r->qiter);
     if (!found) {
@@ -329,11 +625,18 @@ void printAggProfile(RedisModuleCtx *ctx, AREQ *req) {
   clock_t finishTime = clock();
   RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
 
-  // profileRP replace netRP as end PR
-  RPNet *rpnet = (RPNet *)req->qiter.endProc->upstream;
+  RPNet *rpnet = (RPNet *)req->qiter.rootProc;
 
   // Print shards profile
-  nelem += PrintShardProfile(ctx, rpnet->shardsProfileIdx, rpnet->shardsProfile, 0);
+  MRReply **profiles = rm_malloc(sizeof(*profiles) * (rpnet->nshards + 1));
+  int nprofiles = 0;
+  for (size_t i = 0; i < rpnet->nshards; i++) {
+    if (rpnet->shards[i].profile) {
+      profiles[nprofiles++] = rpnet->shards[i].profile;
+    }
+  }
+  nelem += PrintShardProfile(ctx, nprofiles, profiles, 0);
+  rm_free(profiles);
 
   // Print coordinator profile
   RedisModule_ReplyWithSimpleString(ctx, "Coordinator");
@@ -343,6 +646,23 @@ void printAggProfile(RedisModuleCtx *ctx, AREQ *req) {
   Profile_Print(ctx, req);
   nelem += 2;
 
+  RedisModule_ReplyWithSimpleString(ctx, "Shards network");
+  RedisModule_ReplyWithArray(ctx, rpnet->nshards);
+  for (size_t i = 0; i < rpnet->nshards; i++) {
+    const RPNetShard *sh = rpnet->shards + i;
+    RedisModule_ReplyWithArray(ctx, 9);
+    RedisModule_ReplyWithPrintf(ctx, "Shard #%zu", i + 1);
+    RedisModule_ReplyWithSimpleString(ctx, "Replies");
+    RedisModule_ReplyWithLongLong(ctx, sh->numReplies);
+    RedisModule_ReplyWithSimpleString(ctx, "Rows");
+    RedisModule_ReplyWithLongLong(ctx, sh->numRows);
+    RedisModule_ReplyWithSimpleString(ctx, "Wait time");
+    RedisModule_ReplyWithDouble(ctx, sh->waitTime);
+    RedisModule_ReplyWithSimpleString(ctx, "Stopped early");
+    RedisModule_ReplyWithLongLong(ctx, sh->stopped);
+  }
+  nelem += 2;
+
   RedisModule_ReplyWithSimpleString(ctx, "Total Coordinator time");
   RedisModule_ReplyWithDouble(ctx, (double)(clock() - req->initClock) / CLOCKS_PER_MILLISEC);
   nelem += 2;
@@ -397,12 +717,12 @@ void RSExecDistAggregate(RedisModuleCtx *ctx, RedisModuleString **argv, int argc
 
   SearchCluster *sc = GetSearchCluster();
 
-  // Construct the command string
+  // Construct the command string. The shards get the query's timeout, if it has one
   MRCommand xcmd;
-  buildMRCommand(argv , argc, profileArgs, &us, &xcmd);
+  buildMRCommand(argv , argc, profileArgs, &us, r->reqTimeout, &xcmd);
 
   // Build the result processor chain
-  buildDistRPChain(r, &xcmd, sc, &us);
+  buildDistRPChain(r, &xcmd, 2 + profileArgs, sc, &us);
 
   if (IsProfile(r)) r->parseTime = clock() - r->initClock;
 
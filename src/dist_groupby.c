@@ -0,0 +1,784 @@
+#include "dist_groupby.h"
+#include "rmalloc.h"
+#include "util/arr.h"
+#include "util/heap.h"
+#include "redismodule.h"
+
+#include <sys/param.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <strings.h>
+#include <unistd.h>
+
+// Number of rows read from upstream before any of them is inserted
+#define DISTGROUP_BATCH 64
+// Length marking a missing key value in the encoded keys of a row
+#define DISTGROUP_NULL_LEN UINT32_MAX
+// Types of the encoded key values, so that the keys of spilled groups are read back as they were
+#define DISTGROUP_KEY_STRING 's'
+#define DISTGROUP_KEY_NUMBER 'n'
+// Size of the read buffer of a spilled run while it is merged
+#define DISTGROUP_RUN_BUFSIZE (64 * 1024)
+// Lowest memory limit, below which the groups would be spilled as too many tiny runs
+#define DISTGROUP_MIN_MEMORY (1024 * 1024)
+
+/**
+ * A run of groups spilled to disk, sorted by their hashes and keys. Each group is stored as its
+ * hash, the length of its encoded keys, the encoded keys (with their types) and its accumulators.
+ */
+typedef struct {
+  off_t pos;  // Next offset to read in the spill file
+  off_t end;
+  char *buf;
+  size_t bufLen;
+  size_t bufPos;
+
+  // The current group of the run
+  uint64_t hash;
+  uint32_t len;
+  char *keys;
+  size_t keysCap;
+  double *accs;
+} SpillRun;
+
+typedef struct {
+  ResultProcessor base;
+
+  const RLookupKey **srckeys;
+  const RLookupKey **dstkeys;
+  size_t nkeys;
+  DistGroupReducer *reducers;
+  size_t nreducers;
+
+  /**
+   * The table maps group hashes to groups. Each slot holds the upper half of the group's hash and
+   * its index + 1, so that most mismatches are found without looking at the group itself. A zero
+   * slot is empty.
+   */
+  uint64_t *table;
+  size_t cap;
+
+  // The groups, in order of creation
+  size_t ngroups;
+  size_t groupsCap;
+  uint64_t *hashes;
+  size_t *keyOffsets;  // Offset of the group's encoded keys in the keys buffer
+  uint32_t *keyLens;
+  RSValue **keyValues;  // nkeys values per group, for the output
+  double *accs;         // nreducers accumulators per group
+
+  char *keysBuf;
+  size_t keysLen;
+  size_t keysCap;
+
+  // The current batch of rows, and their encoded keys
+  SearchResult batch[DISTGROUP_BATCH];
+  uint64_t batchHashes[DISTGROUP_BATCH];
+  size_t batchOffsets[DISTGROUP_BATCH];
+  uint32_t batchLens[DISTGROUP_BATCH];
+  char *batchBuf;
+  size_t batchLen;
+  size_t batchCap;
+
+  size_t yieldIdx;
+
+  // Once the groups' estimated memory goes above the limit, they are spilled to disk
+  size_t memLimit;
+  size_t valuesMem;  // Estimated memory held by the groups' key values
+  FILE *spill;
+  off_t spillLen;
+  SpillRun *runs;
+  size_t nruns;
+
+  // Merge of the spilled runs, and the group being merged
+  heap_t *heap;
+  uint64_t mergeHash;
+  uint32_t mergeLen;
+  char *mergeKeys;
+  size_t mergeKeysCap;
+  double *mergeAccs;
+} DistGroup;
+
+static void *growBuffer(char **buf, size_t *cap, size_t len, size_t needed) {
+  if (len + needed > *cap) {
+    *cap = MAX(*cap * 2, len + needed);
+    *buf = rm_realloc(*buf, *cap);
+  }
+  return *buf + len;
+}
+
+static uint64_t hashBytes(const char *s, size_t len) {
+  // FNV-1a, with a final mix so that the lower bits (used for the slot) depend on all the bytes
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/* Encode the group keys of a row at the end of the batch buffer. Each key is its length, and
+ * unless it is missing, its type and its bytes: the double of a number, or the string of any other
+ * value. Keys of different types are different groups, as with the generic grouper */
+static void encodeRowKeys(DistGroup *g, const RLookupRow *row, size_t idx) {
+  g->batchOffsets[idx] = g->batchLen;
+  for (size_t i = 0; i < g->nkeys; i++) {
+    const RSValue *v = RLookup_GetItem(g->srckeys[i], row);
+    uint32_t len = DISTGROUP_NULL_LEN;
+    char type = DISTGROUP_KEY_STRING;
+    const char *s = NULL;
+    char numbuf[128];
+    double d;
+    if (v && RSValue_Dereference(v)->t == RSValue_Number && RSValue_ToNumber(v, &d)) {
+      type = DISTGROUP_KEY_NUMBER;
+      d = d == 0 ? 0 : d;  // -0 and 0 are the same group
+      s = (const char *)&d;
+      len = sizeof(d);
+    } else if (v && RSValue_Dereference(v)->t != RSValue_Null) {
+      size_t n;
+      s = RSValue_ConvertStringPtrLen(v, &n, numbuf, sizeof(numbuf));
+      len = n;
+    }
+    size_t needed = sizeof(len) + (s ? sizeof(type) + len : 0);
+    char *p = growBuffer(&g->batchBuf, &g->batchCap, g->batchLen, needed);
+    memcpy(p, &len, sizeof(len));
+    if (s) {
+      p[sizeof(len)] = type;
+      memcpy(p + sizeof(len) + sizeof(type), s, len);
+    }
+    g->batchLen += needed;
+  }
+  g->batchLens[idx] = g->batchLen - g->batchOffsets[idx];
+}
+
+static void rehash(DistGroup *g) {
+  size_t cap = g->cap ? g->cap * 2 : 1024;
+  uint64_t *table = rm_calloc(cap, sizeof(*table));
+  for (size_t i = 0; i < g->cap; i++) {
+    uint64_t e = g->table[i];
+    if (!e) continue;
+    uint64_t h = g->hashes[(uint32_t)e - 1];
+    size_t pos = h & (cap - 1);
+    while (table[pos]) {
+      pos = (pos + 1) & (cap - 1);
+    }
+    table[pos] = e;
+  }
+  rm_free(g->table);
+  g->table = table;
+  g->cap = cap;
+}
+
+static size_t newGroup(DistGroup *g, uint64_t hash, const char *keys, uint32_t len,
+                       const RLookupRow *row) {
+  if (g->ngroups == g->groupsCap) {
+    g->groupsCap = g->groupsCap ? g->groupsCap * 2 : 1024;
+    g->hashes = rm_realloc(g->hashes, g->groupsCap * sizeof(*g->hashes));
+    g->keyOffsets = rm_realloc(g->keyOffsets, g->groupsCap * sizeof(*g->keyOffsets));
+    g->keyLens = rm_realloc(g->keyLens, g->groupsCap * sizeof(*g->keyLens));
+    g->keyValues = rm_realloc(g->keyValues, g->groupsCap * g->nkeys * sizeof(*g->keyValues));
+    g->accs = rm_realloc(g->accs, g->groupsCap * g->nreducers * sizeof(*g->accs));
+  }
+  size_t gid = g->ngroups++;
+  g->hashes[gid] = hash;
+  g->keyLens[gid] = len;
+  g->keyOffsets[gid] = g->keysLen;
+  memcpy(growBuffer(&g->keysBuf, &g->keysCap, g->keysLen, len), keys, len);
+  g->keysLen += len;
+
+  for (size_t i = 0; i < g->nkeys; i++) {
+    RSValue *v = RLookup_GetItem(g->srckeys[i], row);
+    g->keyValues[gid * g->nkeys + i] = v ? RSValue_IncrRef(v) : NULL;
+  }
+  g->valuesMem += g->nkeys * sizeof(RSValue) + len;
+  double *accs = g->accs + gid * g->nreducers;
+  for (size_t i = 0; i < g->nreducers; i++) {
+    switch (g->reducers[i].op) {
+      case DistGroupOp_Min:
+        accs[i] = INFINITY;
+        break;
+      case DistGroupOp_Max:
+        accs[i] = -INFINITY;
+        break;
+      default:
+        accs[i] = 0;
+        break;
+    }
+  }
+  return gid;
+}
+
+static size_t findOrCreateGroup(DistGroup *g, uint64_t hash, const char *keys, uint32_t len,
+                                const RLookupRow *row) {
+  size_t mask = g->cap - 1;
+  uint64_t tag = hash & 0xFFFFFFFF00000000ULL;
+  for (size_t pos = hash & mask;; pos = (pos + 1) & mask) {
+    uint64_t e = g->table[pos];
+    if (!e) {
+      size_t gid = newGroup(g, hash, keys, len, row);
+      g->table[pos] = tag | (gid + 1);
+      // Keep the load factor under 1/2
+      if (g->ngroups * 2 > g->cap) {
+        rehash(g);
+      }
+      return gid;
+    }
+    if ((e & 0xFFFFFFFF00000000ULL) != tag) continue;
+    size_t gid = (uint32_t)e - 1;
+    if (g->hashes[gid] == hash && g->keyLens[gid] == len &&
+        !memcmp(g->keysBuf + g->keyOffsets[gid], keys, len)) {
+      return gid;
+    }
+  }
+}
+
+static void mergeAcc(DistGroupOp op, double *acc, double d) {
+  switch (op) {
+    case DistGroupOp_Count:
+    case DistGroupOp_Sum:
+      *acc += d;
+      break;
+    case DistGroupOp_Min:
+      if (d < *acc) *acc = d;
+      break;
+    case DistGroupOp_Max:
+      if (d > *acc) *acc = d;
+      break;
+  }
+}
+
+static void accumulate(DistGroup *g, size_t gid, const RLookupRow *row) {
+  double *accs = g->accs + gid * g->nreducers;
+  for (size_t i = 0; i < g->nreducers; i++) {
+    const DistGroupReducer *rd = g->reducers + i;
+    if (rd->op == DistGroupOp_Count) {
+      accs[i]++;
+      continue;
+    }
+    double d;
+    const RSValue *v = RLookup_GetItem(rd->srckey, row);
+    if (v && RSValue_ToNumber(v, &d)) {
+      mergeAcc(rd->op, accs + i, d);
+    }
+  }
+}
+
+static void processBatch(DistGroup *g, size_t n) {
+  // Hash all the rows of the batch first, and get their slots on their way into the cache
+  for (size_t i = 0; i < n; i++) {
+    encodeRowKeys(g, &g->batch[i].rowdata, i);
+  }
+  for (size_t i = 0; i < n; i++) {
+    g->batchHashes[i] = hashBytes(g->batchBuf + g->batchOffsets[i], g->batchLens[i]);
+    __builtin_prefetch(&g->table[g->batchHashes[i] & (g->cap - 1)]);
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    const RLookupRow *row = &g->batch[i].rowdata;
+    size_t gid = findOrCreateGroup(g, g->batchHashes[i], g->batchBuf + g->batchOffsets[i],
+                                   g->batchLens[i], row);
+    accumulate(g, gid, row);
+    SearchResult_Clear(&g->batch[i]);
+  }
+  g->batchLen = 0;
+}
+
+/* Estimated memory held by the groups */
+static size_t distGroupMemory(const DistGroup *g) {
+  size_t perGroup = sizeof(*g->hashes) + sizeof(*g->keyOffsets) + sizeof(*g->keyLens) +
+                    g->nkeys * sizeof(*g->keyValues) + g->nreducers * sizeof(*g->accs);
+  return g->cap * sizeof(*g->table) + g->groupsCap * perGroup + g->keysCap + g->valuesMem;
+}
+
+/* Order of groups in the spilled runs */
+static int cmpGroupKeys(uint64_t h1, const char *k1, uint32_t l1, uint64_t h2, const char *k2,
+                        uint32_t l2) {
+  if (h1 != h2) {
+    return h1 < h2 ? -1 : 1;
+  }
+  if (l1 != l2) {
+    return l1 < l2 ? -1 : 1;
+  }
+  return memcmp(k1, k2, l1);
+}
+
+typedef struct {
+  uint64_t hash;
+  const char *keys;
+  uint32_t len;
+  size_t gid;
+} SpillEntry;
+
+static int cmpSpillEntries(const void *p1, const void *p2) {
+  const SpillEntry *e1 = p1, *e2 = p2;
+  return cmpGroupKeys(e1->hash, e1->keys, e1->len, e2->hash, e2->keys, e2->len);
+}
+
+/* Drop all the groups in memory, and shrink the table back to its initial size */
+static void resetGroups(DistGroup *g) {
+  for (size_t i = 0; i < g->ngroups * g->nkeys; i++) {
+    if (g->keyValues[i]) {
+      RSValue_Decref(g->keyValues[i]);
+    }
+  }
+  rm_free(g->table);
+  rm_free(g->hashes);
+  rm_free(g->keyOffsets);
+  rm_free(g->keyLens);
+  rm_free(g->keyValues);
+  rm_free(g->accs);
+  rm_free(g->keysBuf);
+  g->table = NULL;
+  g->cap = 0;
+  g->hashes = NULL;
+  g->keyOffsets = NULL;
+  g->keyLens = NULL;
+  g->keyValues = NULL;
+  g->accs = NULL;
+  g->keysBuf = NULL;
+  g->ngroups = g->groupsCap = 0;
+  g->keysLen = g->keysCap = 0;
+  g->valuesMem = 0;
+  rehash(g);
+}
+
+/* Append a group to the spill file */
+static int writeGroup(DistGroup *g, uint64_t hash, uint32_t len, const char *keys,
+                      const double *accs) {
+  if (fwrite(&hash, sizeof(hash), 1, g->spill) != 1 ||
+      fwrite(&len, sizeof(len), 1, g->spill) != 1 || fwrite(keys, 1, len, g->spill) != len ||
+      fwrite(accs, sizeof(*accs), g->nreducers, g->spill) != g->nreducers) {
+    return REDISMODULE_ERR;
+  }
+  g->spillLen += sizeof(hash) + sizeof(len) + len + sizeof(*accs) * g->nreducers;
+  return REDISMODULE_OK;
+}
+
+/* Add the groups written to the spill file since start as a new run */
+static int pushRun(DistGroup *g, off_t start) {
+  if (fflush(g->spill) != 0 || ferror(g->spill)) {
+    return REDISMODULE_ERR;
+  }
+  g->runs = rm_realloc(g->runs, sizeof(*g->runs) * (g->nruns + 1));
+  g->runs[g->nruns++] = (SpillRun){.pos = start, .end = g->spillLen};
+  return REDISMODULE_OK;
+}
+
+/* Write the groups in memory as a sorted run at the end of the spill file, and drop them */
+static int spillGroups(DistGroup *g) {
+  if (!g->spill && !(g->spill = tmpfile())) {
+    return REDISMODULE_ERR;
+  }
+
+  SpillEntry *entries = rm_malloc(sizeof(*entries) * (g->ngroups + 1));
+  for (size_t i = 0; i < g->ngroups; i++) {
+    entries[i] = (SpillEntry){.hash = g->hashes[i],
+                              .keys = g->keysBuf + g->keyOffsets[i],
+                              .len = g->keyLens[i],
+                              .gid = i};
+  }
+  qsort(entries, g->ngroups, sizeof(*entries), cmpSpillEntries);
+
+  off_t start = g->spillLen;
+  int rc = REDISMODULE_OK;
+  for (size_t i = 0; i < g->ngroups && rc == REDISMODULE_OK; i++) {
+    const SpillEntry *e = entries + i;
+    rc = writeGroup(g, e->hash, e->len, e->keys, g->accs + e->gid * g->nreducers);
+  }
+  rm_free(entries);
+  if (rc != REDISMODULE_OK || pushRun(g, start) != REDISMODULE_OK) {
+    return REDISMODULE_ERR;
+  }
+  resetGroups(g);
+  return REDISMODULE_OK;
+}
+
+/* Read n bytes of a run. Returns 0 if the run ended before all of them were read */
+static int runRead(DistGroup *g, SpillRun *run, void *dst, size_t n) {
+  char *p = dst;
+  while (n) {
+    if (run->bufPos == run->bufLen) {
+      size_t toRead = MIN(DISTGROUP_RUN_BUFSIZE, run->end - run->pos);
+      ssize_t nr = toRead ? pread(fileno(g->spill), run->buf, toRead, run->pos) : 0;
+      if (nr <= 0) {
+        return 0;
+      }
+      run->pos += nr;
+      run->bufLen = nr;
+      run->bufPos = 0;
+    }
+    size_t k = MIN(n, run->bufLen - run->bufPos);
+    memcpy(p, run->buf + run->bufPos, k);
+    run->bufPos += k;
+    p += k;
+    n -= k;
+  }
+  return 1;
+}
+
+/* Read the next group of a run. Returns 0 once the run is exhausted, and -1 on a read error */
+static int runNext(DistGroup *g, SpillRun *run) {
+  if (run->pos == run->end && run->bufPos == run->bufLen) {
+    return 0;
+  }
+  if (!runRead(g, run, &run->hash, sizeof(run->hash)) ||
+      !runRead(g, run, &run->len, sizeof(run->len))) {
+    return -1;
+  }
+  if (run->len > run->keysCap) {
+    run->keysCap = run->len;
+    run->keys = rm_realloc(run->keys, run->keysCap);
+  }
+  if (!runRead(g, run, run->keys, run->len) ||
+      !runRead(g, run, run->accs, sizeof(*run->accs) * g->nreducers)) {
+    return -1;
+  }
+  return 1;
+}
+
+static int cmpRuns(const void *p1, const void *p2, const void *udata) {
+  const SpillRun *r1 = p1, *r2 = p2;
+  // The heap polls its greatest element first
+  return -cmpGroupKeys(r1->hash, r1->keys, r1->len, r2->hash, r2->keys, r2->len);
+}
+
+/* Read the next group of a run, and put it back in the merge if it has one */
+static int runAdvance(DistGroup *g, SpillRun *run) {
+  int rc = runNext(g, run);
+  if (rc > 0) {
+    heap_offerx(g->heap, run);
+  }
+  return rc < 0 ? REDISMODULE_ERR : REDISMODULE_OK;
+}
+
+/* Release the buffers of a run, once it is merged */
+static void runClose(SpillRun *run) {
+  rm_free(run->buf);
+  rm_free(run->keys);
+  rm_free(run->accs);
+  run->buf = run->keys = NULL;
+  run->accs = NULL;
+  run->keysCap = 0;
+}
+
+/* Start merging n runs from the first one. The runs only get their read buffers here, so that
+ * only the runs of the current merge hold one */
+static int mergeRuns(DistGroup *g, size_t first, size_t n) {
+  heap_init(g->heap, cmpRuns, g, n);
+  for (size_t i = first; i < first + n; i++) {
+    SpillRun *run = g->runs + i;
+    run->buf = rm_malloc(DISTGROUP_RUN_BUFSIZE);
+    run->accs = rm_calloc(g->nreducers + 1, sizeof(*run->accs));
+    if (runAdvance(g, run) != REDISMODULE_OK) {
+      return REDISMODULE_ERR;
+    }
+  }
+  return REDISMODULE_OK;
+}
+
+/* Merge the next group out of the runs in the heap, summing up their partials. Returns 0 once all
+ * the runs are exhausted, and -1 on a read error */
+static int mergeNext(DistGroup *g) {
+  if (!heap_count(g->heap)) {
+    return 0;
+  }
+
+  SpillRun *run = heap_poll(g->heap);
+  g->mergeHash = run->hash;
+  g->mergeLen = run->len;
+  if (g->mergeLen > g->mergeKeysCap) {
+    g->mergeKeysCap = g->mergeLen;
+    g->mergeKeys = rm_realloc(g->mergeKeys, g->mergeKeysCap);
+  }
+  memcpy(g->mergeKeys, run->keys, g->mergeLen);
+  memcpy(g->mergeAccs, run->accs, sizeof(*g->mergeAccs) * g->nreducers);
+  if (runAdvance(g, run) != REDISMODULE_OK) {
+    return -1;
+  }
+
+  while (heap_count(g->heap)) {
+    run = heap_peek(g->heap);
+    if (cmpGroupKeys(g->mergeHash, g->mergeKeys, g->mergeLen, run->hash, run->keys, run->len)) {
+      break;
+    }
+    heap_poll(g->heap);
+    for (size_t i = 0; i < g->nreducers; i++) {
+      mergeAcc(g->reducers[i].op, g->mergeAccs + i, run->accs[i]);
+    }
+    if (runAdvance(g, run) != REDISMODULE_OK) {
+      return -1;
+    }
+  }
+  return 1;
+}
+
+static int spillError(ResultProcessor *base) {
+  if (base->parent->err) {
+    QueryError_SetError(base->parent->err, QUERY_EGENERIC,
+                        "Could not spill the aggregation's groups to disk");
+  }
+  return RS_RESULT_ERROR;
+}
+
+/* Write the encoded group keys into the output row, with the types they had */
+static void writeEncodedKeys(DistGroup *g, const char *keys, RLookupRow *row) {
+  for (size_t i = 0; i < g->nkeys; i++) {
+    uint32_t len;
+    memcpy(&len, keys, sizeof(len));
+    keys += sizeof(len);
+    if (len == DISTGROUP_NULL_LEN) {
+      RLookup_WriteOwnKey(g->dstkeys[i], row, RS_NullVal());
+      continue;
+    }
+    char type = *keys++;
+    if (type == DISTGROUP_KEY_NUMBER) {
+      double d;
+      memcpy(&d, keys, sizeof(d));
+      RLookup_WriteOwnKey(g->dstkeys[i], row, RS_NumVal(d));
+    } else {
+      RLookup_WriteOwnKey(g->dstkeys[i], row, RS_NewCopiedString(keys, len));
+    }
+    keys += len;
+  }
+}
+
+/* Yield the groups of the spilled runs, merging the runs' partials of every group */
+static int rpDistGroupYieldMerged(ResultProcessor *base, SearchResult *r) {
+  DistGroup *g = (DistGroup *)base;
+  int rc = mergeNext(g);
+  if (rc <= 0) {
+    return rc < 0 ? spillError(base) : RS_RESULT_EOF;
+  }
+
+  writeEncodedKeys(g, g->mergeKeys, &r->rowdata);
+  for (size_t i = 0; i < g->nreducers; i++) {
+    RLookup_WriteOwnKey(g->reducers[i].dstkey, &r->rowdata, RS_NumVal(g->mergeAccs[i]));
+  }
+  // The number of groups is only known once all of them are merged
+  base->parent->totalResults++;
+  return RS_RESULT_OK;
+}
+
+/* Merge runs from the first one, fanIn at a time, into longer runs at the end of the spill file,
+ * until no more than fanIn runs are left from *first on */
+static int mergePasses(DistGroup *g, size_t fanIn, size_t *first) {
+  while (g->nruns - *first > fanIn) {
+    off_t start = g->spillLen;
+    if (mergeRuns(g, *first, fanIn) != REDISMODULE_OK) {
+      return REDISMODULE_ERR;
+    }
+    int rc;
+    while ((rc = mergeNext(g)) > 0) {
+      if (writeGroup(g, g->mergeHash, g->mergeLen, g->mergeKeys, g->mergeAccs) !=
+          REDISMODULE_OK) {
+        return REDISMODULE_ERR;
+      }
+    }
+    if (rc < 0) {
+      return REDISMODULE_ERR;
+    }
+    for (size_t i = *first; i < *first + fanIn; i++) {
+      runClose(g->runs + i);
+    }
+    // The heap points into the runs, so the merged run is only added once the heap is drained
+    if (pushRun(g, start) != REDISMODULE_OK) {
+      return REDISMODULE_ERR;
+    }
+    *first += fanIn;
+  }
+  return REDISMODULE_OK;
+}
+
+/* Spill the groups left in memory as the last run, and start merging the runs */
+static int startMerge(ResultProcessor *base, SearchResult *r) {
+  DistGroup *g = (DistGroup *)base;
+  if (g->ngroups && spillGroups(g) != REDISMODULE_OK) {
+    return spillError(base);
+  }
+  // All the groups are on disk by now, so the memory limit goes to the read buffers of the runs
+  // merged at once
+  size_t fanIn = MAX(2, g->memLimit / DISTGROUP_RUN_BUFSIZE);
+  g->heap = rm_malloc(heap_sizeof(fanIn));
+  g->mergeAccs = rm_calloc(g->nreducers + 1, sizeof(*g->mergeAccs));
+  size_t first = 0;
+  if (mergePasses(g, fanIn, &first) != REDISMODULE_OK ||
+      mergeRuns(g, first, g->nruns - first) != REDISMODULE_OK) {
+    return spillError(base);
+  }
+  base->parent->totalResults = 0;
+  base->Next = rpDistGroupYieldMerged;
+  return rpDistGroupYieldMerged(base, r);
+}
+
+static int rpDistGroupYield(ResultProcessor *base, SearchResult *r) {
+  DistGroup *g = (DistGroup *)base;
+  if (g->yieldIdx == g->ngroups) {
+    return RS_RESULT_EOF;
+  }
+  size_t gid = g->yieldIdx++;
+  for (size_t i = 0; i < g->nkeys; i++) {
+    RSValue *v = g->keyValues[gid * g->nkeys + i];
+    if (v) {
+      RLookup_WriteKey(g->dstkeys[i], &r->rowdata, v);
+    } else {
+      RLookup_WriteOwnKey(g->dstkeys[i], &r->rowdata, RS_NullVal());
+    }
+  }
+  const double *accs = g->accs + gid * g->nreducers;
+  for (size_t i = 0; i < g->nreducers; i++) {
+    RLookup_WriteOwnKey(g->reducers[i].dstkey, &r->rowdata, RS_NumVal(accs[i]));
+  }
+  return RS_RESULT_OK;
+}
+
+static int rpDistGroupAccum(ResultProcessor *base, SearchResult *r) {
+  DistGroup *g = (DistGroup *)base;
+  ResultProcessor *up = base->upstream;
+  int rc;
+  do {
+    size_t n = 0;
+    while (n < DISTGROUP_BATCH && (rc = up->Next(up, &g->batch[n])) == RS_RESULT_OK) {
+      n++;
+    }
+    if (n) {
+      processBatch(g, n);
+    }
+    if (g->memLimit && distGroupMemory(g) > g->memLimit && spillGroups(g) != REDISMODULE_OK) {
+      return spillError(base);
+    }
+  } while (rc == RS_RESULT_OK);
+
+  if (rc != RS_RESULT_EOF) {
+    return rc;
+  }
+  if (g->nruns) {
+    return startMerge(base, r);
+  }
+  base->parent->totalResults = g->ngroups;
+  base->Next = rpDistGroupYield;
+  return rpDistGroupYield(base, r);
+}
+
+static void rpDistGroupFree(ResultProcessor *base) {
+  DistGroup *g = (DistGroup *)base;
+  for (size_t i = 0; i < g->ngroups * g->nkeys; i++) {
+    if (g->keyValues[i]) {
+      RSValue_Decref(g->keyValues[i]);
+    }
+  }
+  for (size_t i = 0; i < DISTGROUP_BATCH; i++) {
+    SearchResult_Destroy(&g->batch[i]);
+  }
+  rm_free(g->srckeys);
+  rm_free(g->dstkeys);
+  rm_free(g->reducers);
+  rm_free(g->table);
+  rm_free(g->hashes);
+  rm_free(g->keyOffsets);
+  rm_free(g->keyLens);
+  rm_free(g->keyValues);
+  rm_free(g->accs);
+  rm_free(g->keysBuf);
+  rm_free(g->batchBuf);
+  for (size_t i = 0; i < g->nruns; i++) {
+    runClose(g->runs + i);
+  }
+  rm_free(g->runs);
+  if (g->spill) {
+    fclose(g->spill);
+  }
+  if (g->heap) {
+    heap_free(g->heap);
+  }
+  rm_free(g->mergeKeys);
+  rm_free(g->mergeAccs);
+  rm_free(g);
+}
+
+ResultProcessor *RPDistGroup_New(const RLookupKey **srckeys, const RLookupKey **dstkeys,
+                                 size_t nkeys, const DistGroupReducer *reducers, size_t nreducers) {
+  DistGroup *g = rm_calloc(1, sizeof(*g));
+  g->srckeys = rm_malloc(sizeof(*srckeys) * nkeys);
+  memcpy(g->srckeys, srckeys, sizeof(*srckeys) * nkeys);
+  g->dstkeys = rm_malloc(sizeof(*dstkeys) * nkeys);
+  memcpy(g->dstkeys, dstkeys, sizeof(*dstkeys) * nkeys);
+  g->nkeys = nkeys;
+  g->reducers = rm_malloc(sizeof(*reducers) * nreducers);
+  memcpy(g->reducers, reducers, sizeof(*reducers) * nreducers);
+  g->nreducers = nreducers;
+  rehash(g);
+
+  g->base.Next = rpDistGroupAccum;
+  g->base.Free = rpDistGroupFree;
+  g->base.type = RP_GROUP;
+  return &g->base;
+}
+
+void RPDistGroup_SetMemoryLimit(ResultProcessor *rp, size_t limit) {
+  ((DistGroup *)rp)->memLimit = limit ? MAX(limit, DISTGROUP_MIN_MEMORY) : 0;
+}
+
+static const char *stripAtPrefix(const char *s) {
+  while (*s == '@') {
+    s++;
+  }
+  return s;
+}
+
+ResultProcessor *RPDistGroup_NewFromStep(PLN_GroupStep *gstp, RLookup *srclk) {
+  static const struct {
+    const char *name;
+    DistGroupOp op;
+  } ops[] = {
+      {"COUNT", DistGroupOp_Count},
+      {"SUM", DistGroupOp_Sum},
+      {"MIN", DistGroupOp_Min},
+      {"MAX", DistGroupOp_Max},
+  };
+
+  size_t nkeys = gstp->nproperties, nreducers = array_len(gstp->reducers);
+  const RLookupKey *srckeys[nkeys + 1], *dstkeys[nkeys + 1];
+  DistGroupReducer reducers[nreducers + 1];
+
+  for (size_t i = 0; i < nkeys; i++) {
+    const char *name = stripAtPrefix(gstp->properties[i]);
+    srckeys[i] = RLookup_GetKey(srclk, name, RLOOKUP_F_NOINCREF);
+    dstkeys[i] = RLookup_GetKey(&gstp->lookup, name, RLOOKUP_F_NOINCREF);
+    if (!srckeys[i] || !dstkeys[i]) {
+      return NULL;
+    }
+  }
+
+  for (size_t i = 0; i < nreducers; i++) {
+    PLN_Reducer *pr = gstp->reducers + i;
+    size_t j = 0;
+    while (j < sizeof(ops) / sizeof(ops[0]) && strcasecmp(pr->name, ops[j].name)) {
+      j++;
+    }
+    if (j == sizeof(ops) / sizeof(ops[0])) {
+      return NULL;
+    }
+    reducers[i].op = ops[j].op;
+    reducers[i].srckey = NULL;
+    if (ops[j].op != DistGroupOp_Count) {
+      if (pr->args.argc != 1) {
+        return NULL;
+      }
+      const char *name = stripAtPrefix((const char *)pr->args.objs[0]);
+      reducers[i].srckey = RLookup_GetKey(srclk, name, RLOOKUP_F_NOINCREF);
+    } else if (pr->args.argc != 0) {
+      return NULL;
+    }
+    reducers[i].dstkey = RLookup_GetKey(&gstp->lookup, pr->alias, RLOOKUP_F_NOINCREF);
+    if ((ops[j].op != DistGroupOp_Count && !reducers[i].srckey) || !reducers[i].dstkey) {
+      return NULL;
+    }
+  }
+
+  return RPDistGroup_New(srckeys, dstkeys, nkeys, reducers, nreducers);
+}
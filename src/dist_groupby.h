@@ -0,0 +1,54 @@
+#ifndef RS_DIST_GROUPBY_H_
+#define RS_DIST_GROUPBY_H_
+
+#include "result_processor.h"
+#include "aggregate/aggregate_plan.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A group-by specialized for merging the partial groups of the shards: each shard has already
+ * grouped its rows, and sends a single row per group with numeric partials (counts, sums, minimums
+ * and maximums). Merging them only needs the partials summed up, or their minimum / maximum.
+ *
+ * Rows are read in batches; the group keys of a whole batch are hashed before the table is probed
+ * for any of them, and the groups are kept in an open-addressing table over the pre-computed
+ * hashes.
+ *
+ * With a memory limit set, the groups are written to a temporary file as a sorted run whenever
+ * their estimated memory goes above it, and the runs are merged once all the rows are read. The
+ * merge reads as many runs at once as their read buffers fit in the limit, merging the rest into
+ * longer runs first.
+ */
+
+typedef enum {
+  DistGroupOp_Count,  // Count the merged rows
+  DistGroupOp_Sum,
+  DistGroupOp_Min,
+  DistGroupOp_Max,
+} DistGroupOp;
+
+typedef struct {
+  DistGroupOp op;
+  const RLookupKey *srckey;  // The partial value. Unused by COUNT
+  const RLookupKey *dstkey;
+} DistGroupReducer;
+
+ResultProcessor *RPDistGroup_New(const RLookupKey **srckeys, const RLookupKey **dstkeys,
+                                 size_t nkeys, const DistGroupReducer *reducers, size_t nreducers);
+
+/* Limit the estimated memory of the groups, in bytes, above which they are spilled to disk.
+ * 0 (the default) is unlimited, and a limit under 1MB is raised to 1MB */
+void RPDistGroup_SetMemoryLimit(ResultProcessor *rp, size_t limit);
+
+/* Create a merge group-by for the local group step of a distributed plan, reading its rows from
+ * srclk. Returns NULL if any of the step's reducers is not a COUNT, SUM, MIN or MAX, in which case
+ * the step keeps the generic grouper, which holds all of its groups in memory whatever the limit */
+ResultProcessor *RPDistGroup_NewFromStep(PLN_GroupStep *gstp, RLookup *srclk);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -73,6 +73,18 @@ struct ReducerDistCtx {
     auto *s = (const char *)srcReducer->args.objs[n];
     return stripAtPrefix(s);
   }
+
+  // Add a local APPLY step computing `expr` into `alias`, right after the current local step
+  void addLocalApply(const std::string &expr, const char *alias) {
+    PLN_MapFilterStep *applyStep = PLNMapFilterStep_New(rm_strdup(expr.c_str()), PLN_T_APPLY);
+    applyStep->shouldFreeRaw = 1;
+    applyStep->base.alias = rm_strdup(alias);
+
+    assert(currentLocal);
+    AGPLN_AddAfter(localPlan, currentLocal, &applyStep->base);
+    currentLocal = PLN_NEXT_STEP(currentLocal);
+    addedLocalSteps.push_back(&applyStep->base);
+  }
 };
 
 typedef int (*reducerDistributionFunc)(ReducerDistCtx *rdctx, QueryError *status);
@@ -317,15 +329,83 @@ static int distributeAvg(ReducerDistCtx *rdctx, QueryError *status) {
     return REDISMODULE_ERR;
   }
   std::string ss = std::string("(@") + localSumSumAlias + "/@" + localCountSumAlias + ")";
-  char *expr = rm_strdup(ss.c_str());
-  PLN_MapFilterStep *applyStep = PLNMapFilterStep_New(expr, PLN_T_APPLY);
-  applyStep->shouldFreeRaw = 1;
-  applyStep->base.alias = rm_strdup(src->alias);
-
-  assert(rdctx->currentLocal);
-  AGPLN_AddAfter(rdctx->localPlan, rdctx->currentLocal, &applyStep->base);
-  rdctx->currentLocal = PLN_NEXT_STEP(rdctx->currentLocal);
-  rdctx->addedLocalSteps.push_back(&applyStep->base);
+  rdctx->addLocalApply(ss, src->alias);
+  return REDISMODULE_OK;
+}
+
+/* Distribute FIRST_VALUE into a remote FIRST_VALUE, and a local FIRST_VALUE picking the best of
+ * the shards' values. When sorted, the remote side also returns the winning sort value so the local
+ * side can compare the shards' candidates with the same order */
+static int distributeFirstValue(ReducerDistCtx *rdctx, QueryError *status) {
+  PLN_Reducer *src = rdctx->srcReducer;
+  size_t argc = src->args.argc;
+
+  if (argc == 1) {
+    const char *alias;
+    if (!rdctx->addRemote("FIRST_VALUE", &alias, status, "1", rdctx->srcarg(0))) {
+      return REDISMODULE_ERR;
+    }
+    if (!rdctx->addLocal("FIRST_VALUE", status, "1", alias, "AS", src->alias)) {
+      return REDISMODULE_ERR;
+    }
+    return REDISMODULE_OK;
+  }
+
+  const char *order = argc == 4 ? rdctx->srcarg(3) : "ASC";
+  if ((argc != 3 && argc != 4) || strcasecmp(rdctx->srcarg(1), "BY") ||
+      (strcasecmp(order, "ASC") && strcasecmp(order, "DESC"))) {
+    QueryError_SetErrorFmt(status, QUERY_EPARSEARGS, "Invalid arguments for reducer %s",
+                           src->name);
+    return REDISMODULE_ERR;
+  }
+
+  const char *valueAlias, *sortAlias;
+  if (!rdctx->addRemote("FIRST_VALUE", &valueAlias, status, "4", rdctx->srcarg(0), "BY",
+                        rdctx->srcarg(2), order)) {
+    return REDISMODULE_ERR;
+  }
+  if (!rdctx->addRemote("FIRST_VALUE", &sortAlias, status, "4", rdctx->srcarg(2), "BY",
+                        rdctx->srcarg(2), order)) {
+    return REDISMODULE_ERR;
+  }
+  if (!rdctx->addLocal("FIRST_VALUE", status, "4", valueAlias, "BY", sortAlias, order, "AS",
+                       src->alias)) {
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+/* Distribute RANDOM_SAMPLE into remote RANDOM_SAMPLE of the same size and a local RANDOM_SAMPLE
+ * over the shards' samples. Like QUANTILE and STDDEV, the merged sample is not weighted by the
+ * number of rows each shard sampled from */
+static int distributeRandomSample(ReducerDistCtx *rdctx, QueryError *status) {
+  PLN_Reducer *src = rdctx->srcReducer;
+  CHECK_ARG_COUNT(2);
+  const char *alias;
+  if (!rdctx->addRemote("RANDOM_SAMPLE", &alias, status, "2", rdctx->srcarg(0),
+                        rdctx->srcarg(1))) {
+    return REDISMODULE_ERR;
+  }
+  if (!rdctx->addLocal("RANDOM_SAMPLE", status, "2", alias, rdctx->srcarg(1), "AS", src->alias)) {
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+/* Distribute COUNT_DISTINCT into remote TOLIST (the distinct values of each shard), a local TOLIST
+ * merging them into a single set of distinct values and a local APPLY counting that set */
+static int distributeCountDistinct(ReducerDistCtx *rdctx, QueryError *status) {
+  PLN_Reducer *src = rdctx->srcReducer;
+  CHECK_ARG_COUNT(1);
+  const char *remoteAlias, *localAlias;
+  if (!rdctx->addRemote("TOLIST", &remoteAlias, status, "1", rdctx->srcarg(0))) {
+    return REDISMODULE_ERR;
+  }
+  if (!rdctx->add(rdctx->localGroup, "TOLIST", &localAlias, status, "1", remoteAlias)) {
+    return REDISMODULE_ERR;
+  }
+  std::string ss = std::string(DIST_COUNT_DISTINCT_FUNC) + "(@" + localAlias + ")";
+  rdctx->addLocalApply(ss, src->alias);
   return REDISMODULE_OK;
 }
 
@@ -343,6 +423,9 @@ static struct {
     {"STDDEV", distributeStdDev},
     {"COUNT_DISTINCTISH", distributeCountDistinctish},
     {"QUANTILE", distributeQuantile},
+    {"FIRST_VALUE", distributeFirstValue},
+    {"RANDOM_SAMPLE", distributeRandomSample},
+    {"COUNT_DISTINCT", distributeCountDistinct},
 
     {NULL, NULL}  // sentinel value
 
@@ -388,6 +471,12 @@ int AGGPLN_Distribute(AGGPlan *src, QueryError *status) {
         PLN_ArrangeStep *newStp = (PLN_ArrangeStep *)rm_calloc(1, sizeof(*newStp));
 
         *newStp = *astp;
+        // Each shard must return all of the rows which may be in the requested page; the offset
+        // is applied once, by the local step
+        if (astp->offset && astp->limit) {
+          newStp->offset = 0;
+          newStp->limit = astp->offset + astp->limit;
+        }
         AGPLN_AddStep(remote, &newStp->base);
         if (astp->sortKeys) {
           newStp->sortKeys = array_new(const char *, array_len(astp->sortKeys));
@@ -507,6 +596,17 @@ int AREQ_BuildDistributedPipeline(AREQ *r, AREQDIST_UpstreamInfo *us, QueryError
     }
   }
 
+  // If the shards sort their rows last, and sorting them is the first thing we do locally, the
+  // shards' streams can be merged rather than sorted all over again
+  us->sortedBy = NULL;
+  auto remoteLast = DLLIST_ITEM(dstp->plan->steps.prev, PLN_BaseStep, llnodePln);
+  auto localNext = PLN_NEXT_STEP(&dstp->base);
+  if (&remoteLast->llnodePln != &dstp->plan->steps && remoteLast->type == PLN_T_ARRANGE &&
+      ((PLN_ArrangeStep *)remoteLast)->sortKeys && &localNext->llnodePln != &r->ap.steps &&
+      localNext->type == PLN_T_ARRANGE && ((PLN_ArrangeStep *)localNext)->sortKeys) {
+    us->sortedBy = (PLN_ArrangeStep *)localNext;
+  }
+
   us->lookup = &dstp->lk;
   us->serialized = const_cast<const char **>(&serargs[0]);
   us->nserialized = serargs.size();
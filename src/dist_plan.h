@@ -23,6 +23,14 @@ typedef struct {
 
 int AGGPLN_Distribute(AGGPlan *src, QueryError *status);
 
+/* Register the expression functions used by the local part of distributed plans, once at module
+ * load */
+void DistAggregate_RegisterFunctions(void);
+
+/* Name of the APPLY function counting the merged values of a distributed COUNT_DISTINCT. The name
+ * is reserved for this internal use; it only counts the elements of its argument */
+#define DIST_COUNT_DISTINCT_FUNC "__dist_count_distinct"
+
 typedef struct {
   // Arguments to upstream FT.AGGREGATE
   const char **serialized;
@@ -30,6 +38,8 @@ typedef struct {
   size_t nserialized;
   // The lookup structure containing the fields that are to be received from upstream
   RLookup *lookup;
+  // If set, every upstream stream arrives sorted by this (local) step's keys
+  PLN_ArrangeStep *sortedBy;
 } AREQDIST_UpstreamInfo;
 
 /**
@@ -11,9 +11,13 @@
 #include "crc12_tags.h"
 #include "dep/rmr/redis_cluster.h"
 #include "dep/rmr/redise.h"
+#include "dep/rmr/timer_wheel.h"
 #include "fnv32.h"
 #include "util/heap.h"
 #include "search_cluster.h"
+#include "search_request.h"
+#include "query_routing.h"
+#include "string_set.h"
 #include "config.h"
 #include "dep/RediSearch/src/module.h"
 #include "info_command.h"
@@ -24,6 +28,7 @@
 #include "value.h"
 #include "cluster_spell_check.h"
 #include "profile.h"
+#include "dist_plan.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -56,107 +61,139 @@ int chainReplyReducer(struct MRCtx *mc, int count, MRReply **replies) {
   return REDISMODULE_OK;
 }
 
+/* Add the strings of an array reply to a set of unique strings */
+static void addUniqueStrings(StringSet *set, MRReply *arr) {
+  for (size_t j = 0; j < MRReply_Length(arr); j++) {
+    size_t sl = 0;
+    char *s = MRReply_String(MRReply_ArrayElement(arr, j), &sl);
+    if (s && sl) {
+      StringSet_Add(set, s, sl);
+    }
+  }
+}
+
+/* Reply with the values of a set of unique strings, in byte order. With no values, reply with an
+ * empty array if any shard replied with one, or else with the first error */
+static int replyUniqueStrings(RedisModuleCtx *ctx, StringSet *set, int nArrs, MRReply *err) {
+  if (StringSet_Size(set) == 0) {
+    if (nArrs > 0) {
+      // the arrays were empty - return an empty array
+      return RedisModule_ReplyWithArray(ctx, 0);
+    }
+    return RedisModule_ReplyWithError(ctx, err ? (const char *)err : "Could not perfrom query");
+  }
+
+  StringSet_Sort(set);
+  RedisModule_ReplyWithArray(ctx, StringSet_Size(set));
+  for (size_t i = 0; i < StringSet_Size(set); i++) {
+    size_t sl;
+    const char *s = StringSet_Get(set, i, &sl);
+    RedisModule_ReplyWithStringBuffer(ctx, s, sl);
+  }
+  return REDISMODULE_OK;
+}
+
 /* A reducer that just merges N arrays of strings by chaining them into one big array with no
  * duplicates */
 int uniqueStringsReducer(struct MRCtx *mc, int count, MRReply **replies) {
   RedisModuleCtx *ctx = MRCtx_GetRedisCtx(mc);
 
   MRReply *err = NULL;
+  size_t total = 0;
+  for (int i = 0; i < count; i++) {
+    if (replies[i] && MRReply_Type(replies[i]) == MR_REPLY_ARRAY) {
+      total += MRReply_Length(replies[i]);
+    }
+  }
 
-  TrieMap *dict = NewTrieMap();
+  // the set references the strings of the replies, which outlive it
+  StringSet *set = NewStringSet(total, 0);
   int nArrs = 0;
-  // Add all the array elements into the dedup dict
+  // Add all the array elements into the dedup set
   for (int i = 0; i < count; i++) {
     if (replies[i] && MRReply_Type(replies[i]) == MR_REPLY_ARRAY) {
       nArrs++;
-      for (size_t j = 0; j < MRReply_Length(replies[i]); j++) {
-        size_t sl = 0;
-        char *s = MRReply_String(MRReply_ArrayElement(replies[i], j), &sl);
-        if (s && sl) {
-          TrieMap_Add(dict, s, sl, NULL, NULL);
-        }
-      }
+      addUniqueStrings(set, replies[i]);
     } else if (MRReply_Type(replies[i]) == MR_REPLY_ERROR && err == NULL) {
       err = replies[i];
     }
   }
 
-  // if there are no values - either reply with an empty array or an error
-  if (dict->cardinality == 0) {
-
-    if (nArrs > 0) {
-      // the arrays were empty - return an empty array
-      RedisModule_ReplyWithArray(ctx, 0);
-    } else {
-      return RedisModule_ReplyWithError(ctx, err ? (const char *)err : "Could not perfrom query");
-    }
-    goto cleanup;
-  }
+  replyUniqueStrings(ctx, set, nArrs, err);
+  StringSet_Free(set);
+  return REDISMODULE_OK;
+}
 
-  char *s;
-  tm_len_t sl;
-  void *p;
-  // Iterate the dict and reply with all values
-  TrieMapIterator *it = TrieMap_Iterate(dict, "", 0);
-  RedisModule_ReplyWithArray(ctx, dict->cardinality);
-  while (TrieMapIterator_Next(it, &s, &sl, &p)) {
-    RedisModule_ReplyWithStringBuffer(ctx, s, sl);
-  }
+/* The unique strings of a request whose array replies are added as they arrive */
+typedef struct {
+  StringSet *set;
+  int nArrs;
+} uniqueStringsCtx;
+
+/* Fold an array reply into the request's unique strings, copying them so that the reply can be
+ * freed right away. Other replies are kept for the reducer */
+static int uniqueStringsReplyHandler(struct MRCtx *mc, MRReply *reply) {
+  if (MRReply_Type(reply) != MR_REPLY_ARRAY) {
+    return 0;
+  }
+  uniqueStringsCtx *uc = MRCtx_GetPrivdata(mc);
+  uc->nArrs++;
+  addUniqueStrings(uc->set, reply);
+  MRReply_Free(reply);
+  return 1;
+}
 
-  TrieMapIterator_Free(it);
+/* The reducer of uniqueStringsReplyHandler. It gets only the replies that were not arrays */
+int uniqueStringsStreamReducer(struct MRCtx *mc, int count, MRReply **replies) {
+  RedisModuleCtx *ctx = MRCtx_GetRedisCtx(mc);
+  uniqueStringsCtx *uc = MRCtx_GetPrivdata(mc);
 
-cleanup:
-  TrieMap_Free(dict, NULL);
+  MRReply *err = NULL;
+  for (int i = 0; i < count && !err; i++) {
+    if (replies[i] && MRReply_Type(replies[i]) == MR_REPLY_ERROR) {
+      err = replies[i];
+    }
+  }
 
+  replyUniqueStrings(ctx, uc->set, uc->nArrs, err);
   return REDISMODULE_OK;
 }
+
+static void uniqueStringsCtx_Free(void *p) {
+  uniqueStringsCtx *uc = p;
+  StringSet_Free(uc->set);
+  free(uc);
+}
+
 /* A reducer that just merges N arrays of the same length, selecting the first non NULL reply from
  * each */
 int mergeArraysReducer(struct MRCtx *mc, int count, MRReply **replies) {
 
   RedisModuleCtx *ctx = MRCtx_GetRedisCtx(mc);
 
+  size_t maxLen = 0;
   for (size_t i = 0; i < count; ++i) {
     if (MRReply_Type(replies[i]) == MR_REPLY_ERROR) {
       // we got an error reply, something goes wrong so we return the error to the user.
       return MR_ReplyWithMRReply(ctx, replies[i]);
     }
-  }
-
-  int j = 0;
-  int stillValid;
-  do {
-    // the number of still valid arrays in the response
-    stillValid = 0;
-
-    for (int i = 0; i < count; i++) {
-      // if this is not an array - ignore it
-      if (MRReply_Type(replies[i]) != MR_REPLY_ARRAY) continue;
-      // if we've overshot the array length - ignore this one
-      if (MRReply_Length(replies[i]) <= j) continue;
-      // increase the number of valid replies
-      stillValid++;
-
-      // get the j element of array i
-      MRReply *ele = MRReply_ArrayElement(replies[i], j);
-      // if it's a valid response OR this is the last array we are scanning -
-      // add this element to the merged array
-      if (MRReply_Type(ele) != MR_REPLY_NIL || i + 1 == count) {
-        // if this is the first reply - we need to crack open a new array reply
-        if (j == 0) RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
-
-        MR_ReplyWithMRReply(ctx, ele);
-        j++;
-        break;
-      }
+    if (MRReply_Type(replies[i]) == MR_REPLY_ARRAY) {
+      maxLen = MAX(maxLen, MRReply_Length(replies[i]));
     }
-  } while (stillValid > 0);
+  }
 
-  // j 0 means we could not process a single reply element from any reply
-  if (j == 0) {
+  // 0 means we could not process a single reply element from any reply
+  if (maxLen == 0) {
     return RedisModule_ReplyWithError(ctx, "Could not process replies");
   }
-  RedisModule_ReplySetArrayLength(ctx, j);
+
+  MRReply **merged = malloc(maxLen * sizeof(*merged));
+  size_t len = MRReply_MergeArrays(replies, count, merged);
+  RedisModule_ReplyWithArray(ctx, len);
+  for (size_t j = 0; j < len; j++) {
+    MR_ReplyWithMRReply(ctx, merged[j]);
+  }
+  free(merged);
 
   return REDISMODULE_OK;
 }
@@ -247,8 +284,10 @@ int synonymUpdateFanOutReducer(struct MRCtx *mc, int count, MRReply **replies) {
   MR_Map(mrctx, synonymAllOKReducer, cg, false);
   cg.Free(cg.ctx);
 
-  // we need to call request complete here manualy since we did not unblocked the client
-  MR_requestCompleted();
+  // we need to call request complete here manualy since we did not unblocked the client. The
+  // lookup's slot is released, and its context freed, as the update is a request of its own
+  MRCtx_RequestCompleted(mc);
+  MRCtx_Free(mc);
   return REDISMODULE_OK;
 }
 
@@ -309,109 +348,9 @@ typedef struct {
   double sortKeyNum;
 } searchResult;
 
-typedef struct {
-  char *queryString;
-  long long offset;
-  long long limit;
-  int withScores;
-  int withExplainScores;
-  int withPayload;
-  int withSortby;
-  int sortAscending;
-  int withSortingKeys;
-  int noContent;
-
-  // used to signal profile flag and count related args
-  int profileArgs;
-  int profileLimited;
-  clock_t profileClock;
-  void *reducer;
-} searchRequestCtx;
-
-void searchRequestCtx_Free(searchRequestCtx *r) {
-  free(r->queryString);
-  free(r);
-}
-
 static int searchResultReducer(struct MRCtx *mc, int count, MRReply **replies);
 static int profileSearchResultReducer(struct MRCtx *mc, int count, MRReply **replies);
 
-static int rscParseProfile(searchRequestCtx *req, RedisModuleString **argv) {
-  req->profileArgs = 0;
-  if (RMUtil_ArgIndex("FT.PROFILE", argv, 1) != -1) {
-    req->profileArgs += 2;
-    req->profileClock = clock();
-    if (RMUtil_ArgIndex("LIMITED", argv + 3, 1) != -1) {
-      req->profileLimited = 1;
-      req->profileArgs++;
-    }
-    if (RMUtil_ArgIndex("QUERY", argv + 3, 2) == -1) {
-      return REDISMODULE_ERR;
-    }
-  }
-  return REDISMODULE_OK;
-}
-
-searchRequestCtx *rscParseRequest(RedisModuleString **argv, int argc) {
-  /* A search request must have at least 3 args */
-  if (argc < 3) {
-    return NULL;
-  }
-
-  searchRequestCtx *req = malloc(sizeof(searchRequestCtx));
-
-  if (rscParseProfile(req, argv) != REDISMODULE_OK) {
-    free(req);
-    return NULL;
-  }
-
-  int argvOffset = 2 + req->profileArgs;
-  req->queryString = strdup(RedisModule_StringPtrLen(argv[argvOffset++], NULL));
-  req->limit = 10;
-  req->offset = 0;
-  // marks the user set WITHSCORES. internally it's always set
-  req->withScores = RMUtil_ArgExists("WITHSCORES", argv, argc, argvOffset) != 0;
-  req->withExplainScores = RMUtil_ArgExists("EXPLAINSCORE", argv, argc, argvOffset) != 0;
-
-  // Parse SORTBY ... ASC
-  int sortByIndex = RMUtil_ArgIndex("SORTBY", argv, argc);
-  req->withSortby = sortByIndex > 2;
-  req->sortAscending = 1;
-  if (req->withSortby && sortByIndex + 2 < argc) {
-    if (RMUtil_StringEqualsCaseC(argv[sortByIndex + 2], "DESC")) {
-      req->sortAscending = 0;
-    }
-  }
-
-  req->withSortingKeys = RMUtil_ArgExists("WITHSORTKEYS", argv, argc, argvOffset) != 0;
-  // fprintf(stderr, "Sortby: %d, asc: %d withsort: %d\n", req->withSortby, req->sortAscending,
-  //         req->withSortingKeys);
-
-  // Detect "NOCONTENT"
-  req->noContent = RMUtil_ArgExists("NOCONTENT", argv, argc, argvOffset) != 0;
-
-  // if RETURN exists - make sure we don't have RETURN 0
-  if (!req->noContent && RMUtil_ArgExists("RETURN", argv, argc, argvOffset)) {
-    long long numReturns = -1;
-    RMUtil_ParseArgsAfter("RETURN", argv, argc, "l", &numReturns);
-    // RETURN 0 equals NOCONTENT
-    if (numReturns <= 0) {
-      req->noContent = 1;
-    }
-  }
-
-  req->withPayload = RMUtil_ArgExists("WITHPAYLOADS", argv, argc, argvOffset) != 0;
-
-  // Parse LIMIT argument
-  RMUtil_ParseArgsAfter("LIMIT", argv + argvOffset, argc - argvOffset, "ll", &req->offset, &req->limit);
-  if (req->limit < 0 || req->offset < 0) {
-    free(req);
-    return NULL;
-  }
-
-  return req;
-}
-
 static int cmpStrings(const char *s1, size_t l1, const char *s2, size_t l2) {
   int cmp = memcmp(s1, s2, MIN(l1, l2));
   if (l1 == l2) {
@@ -554,6 +493,8 @@ typedef struct {
   heap_t *pq;
   size_t totalReplies;
   bool errorOccured;
+  // shards that replied their query reached its timeout
+  int timedOutShards;
 } searchReducerCtx;
 
 typedef struct {
@@ -592,6 +533,10 @@ static void processSearchReply(MRReply *arr, searchReducerCtx *rCtx, RedisModule
   if (arr == NULL) {
     return;
   }
+  if (SearchCluster_IsTimeoutReply(arr)) {
+    rCtx->timedOutShards++;
+    return;
+  }
   if (MRReply_Type(arr) == MR_REPLY_ERROR) {
     rCtx->lastError = arr;
     return;
@@ -771,9 +716,20 @@ static void profileSearchReply(RedisModuleCtx *ctx, searchReducerCtx *rCtx,
   RedisModule_ReplyWithDouble(ctx, (double)(clock() - postProccesTime) / CLOCKS_PER_MILLISEC); 
   arrLen++;
 
+  // the shards that replied with their timeout error
+  RedisModule_ReplyWithArray(ctx, 2);
+  RedisModule_ReplyWithSimpleString(ctx, "Timed out shards");
+  RedisModule_ReplyWithLongLong(ctx, rCtx->timedOutShards);
+  arrLen++;
+
   RedisModule_ReplySetArrayLength(ctx, arrLen);
 }
 
+/* The search request is the private data of its MRCtx, which frees it */
+static void freeSearchRequest(void *p) {
+  searchRequestCtx_Free(p);
+}
+
 static int searchResultReducer(struct MRCtx *mc, int count, MRReply **replies) {
   clock_t postProccesTime;
   RedisModuleBlockedClient *bc = (RedisModuleBlockedClient *)MRCtx_GetRedisCtx(mc);
@@ -787,7 +743,7 @@ static int searchResultReducer(struct MRCtx *mc, int count, MRReply **replies) {
     int res = RedisModule_ReplyWithError(ctx, "Could not send query to cluster");
     RedisModule_UnblockClient(bc, mc);
     RedisModule_FreeThreadSafeContext(ctx);
-    MR_requestCompleted();
+    MRCtx_RequestCompleted(mc);
     MRCtx_Free(mc);
     return res;
   }
@@ -796,11 +752,29 @@ static int searchResultReducer(struct MRCtx *mc, int count, MRReply **replies) {
     int res = MR_ReplyWithMRReply(ctx, *replies);
     RedisModule_UnblockClient(bc, mc);
     RedisModule_FreeThreadSafeContext(ctx);
-    MR_requestCompleted();
+    MRCtx_RequestCompleted(mc);
     MRCtx_Free(mc);
     return res;
   }
 
+  // shards whose nodes are all failing were not sent the query
+  int unavailable = MRCtx_NumUnavailable(mc);
+  if (unavailable) {
+    if (!MRCtx_AllowPartial(mc)) {
+      RedisModule_ReplyWithError(ctx, "Could not send query to all shards");
+      goto cleanup;
+    }
+    RedisModule_Log(ctx, "warning", "Returning partial results, %d of %d shards are unavailable",
+                    unavailable, unavailable + count);
+  }
+  if (MRCtx_TimedOut(mc)) {
+    if (!MRCtx_AllowPartial(mc)) {
+      RedisModule_ReplyWithError(ctx, "Timeout calling command");
+      goto cleanup;
+    }
+    RedisModule_Log(ctx, "warning", "Returning partial results, timed out with %d replies", count);
+  }
+
   size_t num = req->offset + req->limit;
   rCtx.pq = rm_malloc(heap_sizeof(num));
   heap_init(rCtx.pq, cmp_results, req, num);
@@ -814,6 +788,16 @@ static int searchResultReducer(struct MRCtx *mc, int count, MRReply **replies) {
   if (rCtx.cachedResult) {
     free(rCtx.cachedResult);
   }
+  // shards that ran out of time under the FAIL policy hold back their results. Under the RETURN
+  // policy they send the results they found until then, with no marker, and are merged as they are
+  if (rCtx.timedOutShards) {
+    if (!MRCtx_AllowPartial(mc)) {
+      RedisModule_ReplyWithError(ctx, "Timeout calling command");
+      goto cleanup;
+    }
+    RedisModule_Log(ctx, "warning", "Returning partial results, %d of %d shards timed out",
+                    rCtx.timedOutShards, count);
+  }
   // If we didn't get any results and we got an error - return it.
   // If some shards returned results and some errors - we prefer to show the results we got an not
   // return an error. This might change in the future
@@ -841,14 +825,22 @@ cleanup:
     heap_free(rCtx.pq);
   }
 
-  searchRequestCtx_Free(req);
   RedisModule_UnblockClient(bc, mc);
   RedisModule_FreeThreadSafeContext(ctx);
-  MR_requestCompleted();
+  MRCtx_RequestCompleted(mc);
   MRCtx_Free(mc);
   return REDISMODULE_OK;
 }
 
+/* Give the shards the time left for the search, or the client's own timeout if it is shorter */
+static void appendSearchTimeout(MRCommand *cmd, searchRequestCtx *req, struct MRCtx *mrctx) {
+  long long budget = MRCtx_RemainingMS(mrctx);
+  if (req->timeout > 0 && req->timeout < budget) {
+    budget = req->timeout;
+  }
+  SearchCluster_AppendShardTimeout(cmd, budget);
+}
+
 int FirstPartitionCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc,
                                  MRReduceFunc reducer, struct MRCtx *mrCtx) {
 
@@ -932,6 +924,46 @@ int SingleShardCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int
   return REDISMODULE_OK;
 }
 
+/* Reply to FT.MGET with the documents in the shards' replies, in the order of their keys. The
+ * shards were sent the keys they own, as the request's keys map records */
+static int mgetReducer(struct MRCtx *mc, int count, MRReply **replies) {
+  RedisModuleCtx *ctx = MRCtx_GetRedisCtx(mc);
+  SCKeysMap *m = MRCtx_GetPrivdata(mc);
+  for (int i = 0; i < count; i++) {
+    if (!replies[i]) {
+      return RedisModule_ReplyWithError(ctx, "Could not get the documents of all the shards");
+    }
+    if (MRReply_Type(replies[i]) == MR_REPLY_ERROR) {
+      return MR_ReplyWithMRReply(ctx, replies[i]);
+    }
+  }
+
+  // the document of every key, if its shard had it
+  MRReply **docs = calloc(m->numKeys, sizeof(*docs));
+  for (int i = 0; i < count && i < m->numCmds; i++) {
+    if (MRReply_Type(replies[i]) != MR_REPLY_ARRAY) continue;
+    size_t n = MIN(MRReply_Length(replies[i]), m->offsets[i + 1] - m->offsets[i]);
+    for (size_t j = 0; j < n; j++) {
+      docs[m->positions[m->offsets[i] + j]] = MRReply_ArrayElement(replies[i], j);
+    }
+  }
+  RedisModule_ReplyWithArray(ctx, m->numKeys);
+  for (size_t k = 0; k < m->numKeys; k++) {
+    if (docs[k]) {
+      MR_ReplyWithMRReply(ctx, docs[k]);
+    } else {
+      RedisModule_ReplyWithNull(ctx);
+    }
+  }
+  free(docs);
+  return REDISMODULE_OK;
+}
+
+/* The keys map is the private data of its MRCtx, which frees it */
+static void freeKeysMap(void *p) {
+  SCKeysMap_Free(p);
+}
+
 /* FT.MGET {idx} {key} ... */
 int MGetCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
@@ -951,10 +983,18 @@ int MGetCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 //    SearchCluster_RewriteCommandArg(GetSearchCluster(), &cmd, i, i);
 //  }
 
-  MRCommandGenerator cg = SearchCluster_MultiplexCommand(GetSearchCluster(), &cmd);
-  struct MRCtx *mrctx = MR_CreateCtx(ctx, NULL);
+  // every shard is sent the keys it owns
+  SCKeysMap *keysMap;
+  MRCommandGenerator cg = SearchCluster_MultiplexKeys(GetSearchCluster(), &cmd, 2, &keysMap);
+  struct MRCtx *mrctx = MR_CreateCtx(ctx, keysMap);
+  MRCtx_SetFreePrivdata(mrctx, freeKeysMap);
   MR_SetCoordinationStrategy(mrctx, MRCluster_MastersOnly | MRCluster_FlatCoordination);
-  MR_Map(mrctx, mergeArraysReducer, cg, true);
+  if (keysMap) {
+    MRCtx_SetOrderedReplies(mrctx);
+    MR_Map(mrctx, mgetReducer, cg, true);
+  } else {
+    MR_Map(mrctx, mergeArraysReducer, cg, true);
+  }
   cg.Free(cg.ctx);
   return REDISMODULE_OK;
 }
@@ -1012,8 +1052,487 @@ int MastersFanoutCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, i
   return mastersCommandCommon(ctx, argv, argc, 1);
 }
 
-static int MastersUnshardedHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  return mastersCommandCommon(ctx, argv, argc, 0);
+/* Tell all the coordinators about a change of the routing or the aliases of an index, once its
+ * shards made it. The command to the coordinators is the request's private data */
+static int coordinatorsUpdateReducer(struct MRCtx *mc, int count, MRReply **replies) {
+  RedisModuleBlockedClient *bc = (RedisModuleBlockedClient *)MRCtx_GetRedisCtx(mc);
+  MRCommand *update = MRCtx_GetPrivdata(mc);
+  int failed = count == 0 || count < MRCtx_GetCmdsSize(mc);
+  for (int i = 0; i < count && !failed; i++) {
+    failed = MRReply_Type(replies[i]) == MR_REPLY_ERROR;
+  }
+  if (failed) {
+    // the client gets the shards' replies
+    MRCommand_Free(update);
+    free(update);
+    RedisModule_UnblockClient(bc, mc);
+    return REDISMODULE_OK;
+  }
+
+  // every node serves searches, replicas included
+  struct MRCtx *mrctx = MR_CreateCtx((RedisModuleCtx *)bc, NULL);
+  MR_SetCoordinationStrategy(mrctx, MRCluster_FlatCoordination);
+  MR_Fanout(mrctx, allOKReducer, *update, false);
+  free(update);
+
+  // the client is unblocked by the update
+  MRCtx_RequestCompleted(mc);
+  MRCtx_Free(mc);
+  return REDISMODULE_OK;
+}
+
+/* Send a command on an index to the masters of its shards - the shard of slot alone for a
+ * single-partition index, or all of them if slot is -1 - and then the update to all the
+ * coordinators */
+static int coordinatedIndexCommand(RedisModuleCtx *ctx, MRCommand cmd, int slot, MRCommand update) {
+  MRCommand_SetPrefix(&cmd, "_FT");
+
+  MRCommand *privdata = malloc(sizeof(*privdata));
+  *privdata = update;
+  struct MRCtx *mrctx = MR_CreateCtx(ctx, privdata);
+  MR_SetCoordinationStrategy(mrctx, MRCluster_MastersOnly | MRCluster_FlatCoordination);
+  MRCtx_SetReduceFunction(mrctx, coordinatorsUpdateReducer);
+  if (slot >= 0) {
+    cmd.targetSlot = slot;
+    MR_MapSingle(mrctx, singleReplyReducer, cmd);
+  } else {
+    MRCommandGenerator cg = SearchCluster_MultiplexCommand(GetSearchCluster(), &cmd);
+    MR_Map(mrctx, allOKReducer, cg, true);
+    cg.Free(cg.ctx);
+  }
+  return REDISMODULE_OK;
+}
+
+/* The position of an option among the index options of FT.CREATE, which come before its SCHEMA.
+ * Returns 0 if there is none */
+static int createOption(RedisModuleString **argv, int argc, const char *name) {
+  for (int i = 2; i < argc; i++) {
+    const char *arg = RedisModule_StringPtrLen(argv[i], NULL);
+    if (!strcasecmp(arg, "SCHEMA")) {
+      break;
+    }
+    if (!strcasecmp(arg, name)) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+/* Check that the routing field of FT.CREATE, at fieldPos, is a CASESENSITIVE tag field of its
+ * SCHEMA */
+static int createRoutingFieldValid(RedisModuleString **argv, int argc, int fieldPos) {
+  int schemaPos = 2;
+  while (schemaPos < argc &&
+         strcasecmp(RedisModule_StringPtrLen(argv[schemaPos], NULL), "SCHEMA")) {
+    schemaPos++;
+  }
+  const char *schema[argc];
+  size_t nargs = 0;
+  for (int i = schemaPos + 1; i < argc; i++) {
+    schema[nargs++] = RedisModule_StringPtrLen(argv[i], NULL);
+  }
+  size_t len;
+  const char *field = RedisModule_StringPtrLen(argv[fieldPos], &len);
+  return QueryRouting_IsCaseSensitiveTag(schema, nargs, field, len);
+}
+
+/* Version a change of the routing of an index sent to the coordinators, so that they all keep the
+ * newest one however they hear of them */
+static void appendRoutingVersion(MRCommand *cmd, uint64_t version) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%llu", (unsigned long long)version);
+  MRCommand_Append(cmd, "VERSION", 7);
+  MRCommand_Append(cmd, buf, strlen(buf));
+}
+
+/* FT.CREATE {index} [SINGLEPARTITION {key}] [ROUTINGFIELD {field}] ...
+ * An index created with SINGLEPARTITION lives on the shard that owns {key} alone, so that its
+ * commands are sent to that shard only. Its documents should share the hash tag of {key}.
+ * An index created with ROUTINGFIELD has its documents partitioned by their value of the tag field
+ * {field}, which their keys have as hash tag, so that queries requiring some values of the field
+ * are sent to the partitions of these values only. The field must be a CASESENSITIVE tag field, as
+ * hash tags are */
+int CreateCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  int pinPos = createOption(argv, argc, "SINGLEPARTITION");
+  int routingPos = createOption(argv, argc, "ROUTINGFIELD");
+  if (!pinPos && !routingPos) {
+    return MastersFanoutCommandHandler(ctx, argv, argc);
+  }
+  if (pinPos && pinPos + 1 >= argc) {
+    return RedisModule_ReplyWithError(ctx, "SINGLEPARTITION requires a key");
+  }
+  if (routingPos && routingPos + 1 >= argc) {
+    return RedisModule_ReplyWithError(ctx, "ROUTINGFIELD requires a field");
+  }
+  if (routingPos && !createRoutingFieldValid(argv, argc, routingPos + 1)) {
+    return RedisModule_ReplyWithError(ctx, "ROUTINGFIELD must be a CASESENSITIVE TAG field");
+  }
+  // Check that the cluster state is valid
+  if (!SearchCluster_Ready(GetSearchCluster())) {
+    return RedisModule_ReplyWithError(ctx, CLUSTERDOWN_ERR);
+  }
+  int slot = -1;
+  if (pinPos) {
+    size_t keyLen;
+    const char *key = RedisModule_StringPtrLen(argv[pinPos + 1], &keyLen);
+    slot = MR_KeySlot(key, keyLen);
+    if (slot < 0) {
+      return RedisModule_ReplyWithError(ctx, CLUSTERDOWN_ERR);
+    }
+  }
+  RedisModule_AutoMemory(ctx);
+
+  // the shards are not told about the options
+  MRCommand cmd = MR_NewCommandFromRedisStrings(2, argv);
+  for (int i = 2; i < argc; i++) {
+    if ((pinPos && (i == pinPos || i == pinPos + 1)) ||
+        (routingPos && (i == routingPos || i == routingPos + 1))) {
+      continue;
+    }
+    size_t n;
+    const char *arg = RedisModule_StringPtrLen(argv[i], &n);
+    MRCommand_Append(&cmd, arg, n);
+  }
+
+  MRCommand update = MR_NewCommand(2, RSCOORDINATOR_MODULE_NAME ".INDEXROUTING",
+                                   RedisModule_StringPtrLen(argv[1], NULL));
+  if (pinPos) {
+    char slotStr[16];
+    snprintf(slotStr, sizeof(slotStr), "%d", slot);
+    MRCommand_Append(&update, "SLOT", 4);
+    MRCommand_Append(&update, slotStr, strlen(slotStr));
+  }
+  if (routingPos) {
+    size_t n;
+    const char *field = RedisModule_StringPtrLen(argv[routingPos + 1], &n);
+    MRCommand_Append(&update, "ROUTINGFIELD", 12);
+    MRCommand_Append(&update, field, n);
+  }
+  size_t nameLen;
+  const char *name = RedisModule_StringPtrLen(argv[1], &nameLen);
+  appendRoutingVersion(&update, SearchCluster_NextIndexRoutingVersion(name, nameLen));
+  return coordinatedIndexCommand(ctx, cmd, slot, update);
+}
+
+/* FT.DROPINDEX {index} ...
+ * A routed index is dropped from its shards, and then from the coordinators */
+int DropCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 2) {
+    return RedisModule_WrongArity(ctx);
+  }
+  size_t len;
+  const char *name = RedisModule_StringPtrLen(argv[1], &len);
+  if (!SearchCluster_HasIndexRouting(name, len)) {
+    return MastersFanoutCommandHandler(ctx, argv, argc);
+  }
+  // Check that the cluster state is valid
+  if (!SearchCluster_Ready(GetSearchCluster())) {
+    return RedisModule_ReplyWithError(ctx, CLUSTERDOWN_ERR);
+  }
+  RedisModule_AutoMemory(ctx);
+
+  MRCommand cmd = MR_NewCommandFromRedisStrings(argc, argv);
+  MRCommand del = MR_NewCommand(2, RSCOORDINATOR_MODULE_NAME ".INDEXROUTINGDEL", name);
+  appendRoutingVersion(&del, SearchCluster_NextIndexRoutingVersion(name, len));
+  return coordinatedIndexCommand(ctx, cmd, SearchCluster_PinnedSlot(name, len), del);
+}
+
+/* FT.ALIASADD {alias} {index}, FT.ALIASUPDATE {alias} {index}, FT.ALIASDEL {alias}
+ * The coordinators resolve aliases once and cache their targets, so they drop the cached names of
+ * the indexes once the shards changed the alias */
+int AliasCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 2) {
+    return RedisModule_WrongArity(ctx);
+  }
+  // Check that the cluster state is valid
+  if (!SearchCluster_Ready(GetSearchCluster())) {
+    return RedisModule_ReplyWithError(ctx, CLUSTERDOWN_ERR);
+  }
+  RedisModule_AutoMemory(ctx);
+
+  MRCommand cmd = MR_NewCommandFromRedisStrings(argc, argv);
+  MRCommand flush = MR_NewCommand(1, RSCOORDINATOR_MODULE_NAME ".INDEXNAMESFLUSH");
+  return coordinatedIndexCommand(ctx, cmd, -1, flush);
+}
+
+/* SEARCH.INDEXNAMESFLUSH
+ * Drop the cached names of the indexes. Sent to every node when an alias changes */
+int IndexNamesFlushCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 1) {
+    return RedisModule_WrongArity(ctx);
+  }
+  SearchCluster_InvalidateIndexNames();
+  return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/* Parse the VERSION of a change of the routing of an index. Changes from nodes that do not
+ * version them have version 0 */
+static int parseRoutingVersion(RedisModuleString *arg, uint64_t *version) {
+  long long v;
+  if (RedisModule_StringToLongLong(arg, &v) != REDISMODULE_OK || v < 0) {
+    return REDISMODULE_ERR;
+  }
+  *version = v;
+  return REDISMODULE_OK;
+}
+
+/* SEARCH.INDEXROUTING {index} [SLOT {slot}] [ROUTINGFIELD {field}] [VERSION {version}]
+ * Record how the commands on an index are routed, unless a newer version of its routing was
+ * recorded. Sent to every node on FT.CREATE */
+int IndexRoutingCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 2 || argc % 2) {
+    return RedisModule_WrongArity(ctx);
+  }
+  long long slot = -1;
+  const char *field = NULL;
+  uint64_t version = 0;
+  for (int i = 2; i < argc; i += 2) {
+    const char *arg = RedisModule_StringPtrLen(argv[i], NULL);
+    if (!strcasecmp(arg, "SLOT")) {
+      if (RedisModule_StringToLongLong(argv[i + 1], &slot) != REDISMODULE_OK || slot < 0 ||
+          slot > UINT16_MAX) {
+        return RedisModule_ReplyWithError(ctx, "Invalid slot");
+      }
+    } else if (!strcasecmp(arg, "ROUTINGFIELD")) {
+      field = RedisModule_StringPtrLen(argv[i + 1], NULL);
+    } else if (!strcasecmp(arg, "VERSION")) {
+      if (parseRoutingVersion(argv[i + 1], &version) != REDISMODULE_OK) {
+        return RedisModule_ReplyWithError(ctx, "Invalid version");
+      }
+    } else {
+      return RedisModule_ReplyWithError(ctx, "Unknown index routing option");
+    }
+  }
+  size_t len;
+  const char *name = RedisModule_StringPtrLen(argv[1], &len);
+  SearchCluster_SetIndexRouting(name, len, slot, field, version);
+  return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+/* SEARCH.INDEXROUTINGDEL {index} [VERSION {version}]
+ * Delete the routing of an index, unless a newer version of it was recorded. Sent to every node on
+ * FT.DROPINDEX */
+int IndexRoutingDelCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 2 && argc != 4) {
+    return RedisModule_WrongArity(ctx);
+  }
+  uint64_t version = 0;
+  if (argc == 4) {
+    if (strcasecmp(RedisModule_StringPtrLen(argv[2], NULL), "VERSION")) {
+      return RedisModule_ReplyWithError(ctx, "Unknown index routing option");
+    }
+    if (parseRoutingVersion(argv[3], &version) != REDISMODULE_OK) {
+      return RedisModule_ReplyWithError(ctx, "Invalid version");
+    }
+  }
+  size_t len;
+  const char *name = RedisModule_StringPtrLen(argv[1], &len);
+  SearchCluster_DelIndexRouting(name, len, version);
+  return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
+static void replyWithIndexRouting(const char *name, size_t len, int slot, const char *routingField,
+                                  uint64_t version, int deleted, void *p) {
+  RedisModuleCtx *ctx = p;
+  RedisModule_ReplyWithArray(ctx, 5);
+  RedisModule_ReplyWithStringBuffer(ctx, name, len);
+  RedisModule_ReplyWithLongLong(ctx, slot);
+  if (routingField) {
+    RedisModule_ReplyWithStringBuffer(ctx, routingField, strlen(routingField));
+  } else {
+    RedisModule_ReplyWithNull(ctx);
+  }
+  RedisModule_ReplyWithLongLong(ctx, version);
+  RedisModule_ReplyWithLongLong(ctx, deleted);
+}
+
+/* SEARCH.INDEXROUTINGLIST
+ * The routing of every index this node knows of, as {index} {slot} {field or nil} {version}
+ * {deleted}. Pulled by the coordinators that may have missed some of it */
+int IndexRoutingListCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 1) {
+    return RedisModule_WrongArity(ctx);
+  }
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  size_t n = SearchCluster_ForEachIndexRouting(replyWithIndexRouting, ctx);
+  RedisModule_ReplySetArrayLength(ctx, n);
+  return REDISMODULE_OK;
+}
+
+/* Record the routings of an SEARCH.INDEXROUTINGLIST reply. Each is only recorded if newer than
+ * the one this node has */
+static void mergeIndexRoutingList(MRReply *list) {
+  for (size_t i = 0; i < MRReply_Length(list); i++) {
+    MRReply *e = MRReply_ArrayElement(list, i);
+    if (MRReply_Type(e) != MR_REPLY_ARRAY || MRReply_Length(e) != 5) {
+      continue;
+    }
+    size_t len;
+    const char *name = MRReply_String(MRReply_ArrayElement(e, 0), &len);
+    long long slot = MRReply_Integer(MRReply_ArrayElement(e, 1));
+    MRReply *fieldReply = MRReply_ArrayElement(e, 2);
+    char *field = NULL;
+    if (MRReply_Type(fieldReply) == MR_REPLY_STRING) {
+      size_t fieldLen;
+      const char *s = MRReply_String(fieldReply, &fieldLen);
+      field = strndup(s, fieldLen);
+    }
+    uint64_t version = MRReply_Integer(MRReply_ArrayElement(e, 3));
+    if (MRReply_Integer(MRReply_ArrayElement(e, 4))) {
+      SearchCluster_DelIndexRouting(name, len, version);
+    } else {
+      SearchCluster_SetIndexRouting(name, len, slot, field, version);
+    }
+    free(field);
+  }
+}
+
+/* The routing of the indexes is pulled from all the coordinators when this node gets its first
+ * topology or the partitions change, and then every INDEX_ROUTING_SYNC_INTERVAL_MS, so that a
+ * coordinator that restarted, joined late or missed an update catches up. A pull that did not
+ * hear from all the nodes is retried on the next topology update */
+#define INDEX_ROUTING_SYNC_INTERVAL_MS 60000
+
+static struct {
+  // whether a pull was requested, and not made yet
+  int pending;
+  int inFlight;
+  uint64_t lastSync;
+} indexRoutingSync_g = {.pending = 1};
+
+static int indexRoutingSyncReducer(struct MRCtx *mc, int count, MRReply **replies) {
+  size_t numNodes = (size_t)MRCtx_GetPrivdata(mc);
+  for (int i = 0; i < count; i++) {
+    // nodes that do not know the command reply with an error
+    if (MRReply_Type(replies[i]) == MR_REPLY_ARRAY) {
+      mergeIndexRoutingList(replies[i]);
+    }
+  }
+  if ((size_t)count < numNodes) {
+    __atomic_store_n(&indexRoutingSync_g.pending, 1, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&indexRoutingSync_g.inFlight, 0, __ATOMIC_RELEASE);
+  MRCtx_RequestCompleted(mc);
+  MRCtx_Free(mc);
+  return REDISMODULE_OK;
+}
+
+/* The number of nodes of a topology, or 0 if it is not valid */
+static size_t topologyNumNodes(MRClusterTopology *topo) {
+  if (!MRClusterTopology_IsValid(topo)) {
+    return 0;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < topo->numShards; i++) {
+    n += topo->shards[i].numNodes;
+  }
+  return n;
+}
+
+/* Pull the routing of the indexes from the numNodes nodes of the cluster, if due. Called on the
+ * main thread, once the topology was updated */
+static void syncIndexRouting(size_t numNodes, int partitionsChanged) {
+  if (partitionsChanged) {
+    __atomic_store_n(&indexRoutingSync_g.pending, 1, __ATOMIC_RELEASE);
+  }
+  uint64_t now = MRTimerWheel_Now();
+  if (!__atomic_load_n(&indexRoutingSync_g.pending, __ATOMIC_ACQUIRE) &&
+      now - indexRoutingSync_g.lastSync < INDEX_ROUTING_SYNC_INTERVAL_MS) {
+    return;
+  }
+  if (!numNodes || __atomic_load_n(&indexRoutingSync_g.inFlight, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+  indexRoutingSync_g.pending = 0;
+  indexRoutingSync_g.inFlight = 1;
+  indexRoutingSync_g.lastSync = now;
+  SearchCluster_ExpireIndexRoutingDeletions();
+
+  MRCommand cmd = MR_NewCommand(1, RSCOORDINATOR_MODULE_NAME ".INDEXROUTINGLIST");
+  struct MRCtx *mrctx = MR_CreateCtx(NULL, (void *)numNodes);
+  // every node is a coordinator, replicas included
+  MR_SetCoordinationStrategy(mrctx, MRCluster_FlatCoordination);
+  MRCtx_SetReduceFunction(mrctx, indexRoutingSyncReducer);
+  MR_Fanout(mrctx, NULL, cmd, false);
+}
+
+/* The routing of the indexes is saved in the RDB, for the nodes to have it when they restart
+ * together, with no coordinator to pull it from */
+#define INDEX_ROUTING_ENCVER 0
+
+static void saveIndexRouting(const char *name, size_t len, int slot, const char *routingField,
+                             uint64_t version, int deleted, void *p) {
+  RedisModuleIO *rdb = p;
+  RedisModule_SaveUnsigned(rdb, 1);
+  RedisModule_SaveStringBuffer(rdb, name, len);
+  RedisModule_SaveSigned(rdb, slot);
+  RedisModule_SaveStringBuffer(rdb, routingField ? routingField : "",
+                               routingField ? strlen(routingField) : 0);
+  RedisModule_SaveUnsigned(rdb, version);
+  RedisModule_SaveUnsigned(rdb, deleted);
+}
+
+/* Every routing follows a 1, and the last one a 0, as the routing may change while it is saved */
+static void indexRoutingAuxSave(RedisModuleIO *rdb, int when) {
+  SearchCluster_ExpireIndexRoutingDeletions();
+  SearchCluster_ForEachIndexRouting(saveIndexRouting, rdb);
+  RedisModule_SaveUnsigned(rdb, 0);
+}
+
+static int indexRoutingAuxLoad(RedisModuleIO *rdb, int encver, int when) {
+  if (encver > INDEX_ROUTING_ENCVER) {
+    return REDISMODULE_ERR;
+  }
+  while (RedisModule_LoadUnsigned(rdb)) {
+    size_t len, fieldLen;
+    char *name = RedisModule_LoadStringBuffer(rdb, &len);
+    int slot = RedisModule_LoadSigned(rdb);
+    char *fieldBuf = RedisModule_LoadStringBuffer(rdb, &fieldLen);
+    uint64_t version = RedisModule_LoadUnsigned(rdb);
+    int deleted = RedisModule_LoadUnsigned(rdb);
+    if (deleted) {
+      SearchCluster_DelIndexRouting(name, len, version);
+    } else {
+      char *field = fieldLen ? strndup(fieldBuf, fieldLen) : NULL;
+      SearchCluster_SetIndexRouting(name, len, slot, field, version);
+      free(field);
+    }
+    RedisModule_Free(name);
+    RedisModule_Free(fieldBuf);
+  }
+  return REDISMODULE_OK;
+}
+
+// the type has no keys, only the auxiliary data of the RDB
+static void *indexRoutingRdbLoad(RedisModuleIO *rdb, int encver) {
+  return NULL;
+}
+
+static void indexRoutingRdbSave(RedisModuleIO *rdb, void *value) {
+}
+
+static void indexRoutingFree(void *value) {
+}
+
+static void indexRoutingOnShutdown(RedisModuleCtx *ctx, RedisModuleEvent eid, uint64_t subevent,
+                                   void *data) {
+  SearchCluster_FreeIndexRouting();
+}
+
+static int registerIndexRoutingType(RedisModuleCtx *ctx) {
+  if (RedisModule_SubscribeToServerEvent) {
+    RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_Shutdown, indexRoutingOnShutdown);
+  }
+  RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
+                               .rdb_load = indexRoutingRdbLoad,
+                               .rdb_save = indexRoutingRdbSave,
+                               .free = indexRoutingFree,
+                               .aux_load = indexRoutingAuxLoad,
+                               .aux_save = indexRoutingAuxSave,
+                               .aux_save_triggers = REDISMODULE_AUX_BEFORE_RDB};
+  return RedisModule_CreateDataType(ctx, "rsc-route", INDEX_ROUTING_ENCVER, &tm)
+             ? REDISMODULE_OK
+             : REDISMODULE_ERR;
 }
 
 int FanoutCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
@@ -1080,8 +1599,16 @@ int TagValsCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int arg
   /* Replace our own FT command with _FT. command */
   MRCommand_SetPrefix(&cmd, "_FT");
 
+  // tag fields may have millions of values, so every shard's values are added to the set as they
+  // arrive, and its reply is freed instead of waiting for all the others
+  uniqueStringsCtx *uc = malloc(sizeof(*uc));
+  *uc = (uniqueStringsCtx){.set = NewStringSet(0, 1), .nArrs = 0};
+  struct MRCtx *mrctx = MR_CreateCtx(ctx, uc);
+  MRCtx_SetFreePrivdata(mrctx, uniqueStringsCtx_Free);
+  MRCtx_SetReplyHandler(mrctx, uniqueStringsReplyHandler);
+
   MRCommandGenerator cg = SearchCluster_MultiplexCommand(GetSearchCluster(), &cmd);
-  MR_Map(MR_CreateCtx(ctx, NULL), uniqueStringsReducer, cg, true);
+  MR_Map(mrctx, uniqueStringsStreamReducer, cg, true);
   cg.Free(cg.ctx);
   return REDISMODULE_OK;
 }
@@ -1169,11 +1696,14 @@ int LocalSearchCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int
     MRCommand_AppendArgsAtPos(&cmd, 3, 1, "WITHSORTKEYS");
   }
 
-  MRCommandGenerator cg = SearchCluster_MultiplexCommand(GetSearchCluster(), &cmd);
+  MRCommandGenerator cg = SearchCluster_MultiplexQuery(GetSearchCluster(), &cmd, 2);
   struct MRCtx *mrctx = MR_CreateCtx(ctx, req);
+  MRCtx_SetFreePrivdata(mrctx, freeSearchRequest);
   // we prefer the next level to be local - we will only approach nodes on our own shard
-  // we also ask only masters to serve the request, to avoid duplications by random
-  MR_SetCoordinationStrategy(mrctx, MRCluster_LocalCoordination | MRCluster_MastersOnly);
+  // the read policy decides whether masters or replicas serve the request
+  MR_SetCoordinationStrategy(mrctx, MRCluster_LocalCoordination | MRCluster_ReadOnly);
+  MRCtx_SetAllowPartial(mrctx, clusterConfig.partialResults);
+  appendSearchTimeout(&cmd, req, mrctx);
 
   MR_Map(mrctx, searchResultReducer, cg, true);
   cg.Free(cg.ctx);
@@ -1184,7 +1714,8 @@ int FlatSearchCommandHandler(RedisModuleBlockedClient *bc, RedisModuleString **a
   RedisModuleCtx* ctx = RedisModule_GetThreadSafeContext(NULL);
   RedisModule_AutoMemory(ctx);
 
-  searchRequestCtx *req = rscParseRequest(argv, argc);
+  MRCommand cmd;
+  searchRequestCtx *req = rscParseFlatSearch(argv, argc, &cmd);
   if (!req) {
     RedisModuleCtx* clientCtx = RedisModule_GetThreadSafeContext(bc);
     RedisModule_ReplyWithError(clientCtx, "Invalid search request");
@@ -1194,42 +1725,28 @@ int FlatSearchCommandHandler(RedisModuleBlockedClient *bc, RedisModuleString **a
     return REDISMODULE_OK;
   }
 
-  MRCommand cmd = MR_NewCommandFromRedisStrings(argc, argv);
-
-  // replace the LIMIT {offset} {limit} with LIMIT 0 {limit}, because we need all top N to merge
-  int limitIndex = RMUtil_ArgExists("LIMIT", argv, argc, 3);
-  if (limitIndex && req->limit > 0 && limitIndex < argc - 2) {
-    MRCommand_ReplaceArg(&cmd, limitIndex + 1, "0", 1);
-    char buf[32];
-    snprintf(buf, sizeof(buf), "%lld", req->limit + req->offset);
-    MRCommand_ReplaceArg(&cmd, limitIndex + 2, buf, strlen(buf));
-  }
-
-  /* Replace our own FT command with _FT. command */
-  if (req->profileArgs == 0) {
-    MRCommand_ReplaceArg(&cmd, 0, "_FT.SEARCH", sizeof("_FT.SEARCH") - 1);
-  } else {
-    MRCommand_ReplaceArg(&cmd, 0, "_FT.PROFILE", sizeof("_FT.PROFILE") - 1);
-  }
-
-  // adding the WITHSCORES option anyway immediately after the query.
-  // Worst case it will appears twice.
-  MRCommand_AppendArgsAtPos(&cmd, 3 + req->profileArgs, 1, "WITHSCORES");
-  if (req->withSortby) {
-    // if sort by requested we adding the WITHSORTKEYS option anyway immediately after the query.
-    // Worst case it will appears twice.
-    MRCommand_AppendArgsAtPos(&cmd, 3 + req->profileArgs, 1, "WITHSORTKEYS");
-    // req->withSortingKeys = 1;
-  }
-
   struct MRCtx *mrctx = MR_CreateCtx(ctx, req);
-  // we prefer the next level to be local - we will only approach nodes on our own shard
-  // we also ask only masters to serve the request, to avoid duplications by random
-  MR_SetCoordinationStrategy(mrctx, MRCluster_FlatCoordination);
+  MRCtx_SetFreePrivdata(mrctx, freeSearchRequest);
+  // a single node of every shard serves the request, to avoid duplications. The read policy
+  // decides whether it is the master or a replica
+  MR_SetCoordinationStrategy(mrctx, MRCluster_FlatCoordination | MRCluster_ReadOnly);
+  MRCtx_SetAllowPartial(mrctx, clusterConfig.partialResults);
+  appendSearchTimeout(&cmd, req, mrctx);
 
   MRCtx_SetReduceFunction(mrctx, searchResultReducer);
   MRCtx_SetRedisCtx(mrctx, bc);
-  MR_Fanout(mrctx, NULL, cmd, false);
+  SearchCluster *sc = GetSearchCluster();
+  MRCommand query = MRCommand_Copy(&cmd);
+  MRCommandGenerator cg = SearchCluster_MultiplexQuery(sc, &query, 2 + req->profileArgs);
+  if (cg.Len(cg.ctx) < sc->size) {
+    // the index is pinned to a shard, or the query requires values of its routing field, so it is
+    // only searched on the shards that may have its results
+    MRCommand_Free(&cmd);
+    MR_Map(mrctx, NULL, cg, false);
+  } else {
+    MR_Fanout(mrctx, NULL, cmd, false);
+  }
+  cg.Free(cg.ctx);
   RedisModule_FreeThreadSafeContext(ctx);
   return REDISMODULE_OK;
 }
@@ -1295,6 +1812,42 @@ int ProfileCommandHandler(RedisModuleCtx *ctx, RedisModuleString **argv, int arg
   return RedisModule_ReplyWithError(ctx, "No `SEARCH` or `AGGREGATE` provided");
 }
 
+/* SEARCH.PARTITIONMOVES {num_partitions} {key} ...
+ * Report which of the keys would move to another partition if the cluster had num_partitions
+ * partitions, as [key, partition, new partition] triplets */
+int PartitionMovesCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 3) {
+    return RedisModule_WrongArity(ctx);
+  }
+  long long numPartitions;
+  if (RedisModule_StringToLongLong(argv[1], &numPartitions) != REDISMODULE_OK ||
+      numPartitions <= 0) {
+    return RedisModule_ReplyWithError(ctx, "Invalid number of partitions");
+  }
+  SearchCluster *sc = GetSearchCluster();
+  if (!SearchCluster_Ready(sc)) {
+    return RedisModule_ReplyWithError(ctx, CLUSTERDOWN_ERR);
+  }
+
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  long long n = 0;
+  for (int i = 2; i < argc; i++) {
+    size_t len;
+    const char *key = RedisModule_StringPtrLen(argv[i], &len);
+    size_t from = PartitionForKey(&sc->part, key, len);
+    size_t to = PartitionForKeyWithSize(&sc->part, key, len, numPartitions);
+    if (from != to) {
+      RedisModule_ReplyWithArray(ctx, 3);
+      RedisModule_ReplyWithString(ctx, argv[i]);
+      RedisModule_ReplyWithLongLong(ctx, from);
+      RedisModule_ReplyWithLongLong(ctx, to);
+      n++;
+    }
+  }
+  RedisModule_ReplySetArrayLength(ctx, n);
+  return REDISMODULE_OK;
+}
+
 int ClusterInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
   RedisModule_AutoMemory(ctx);
@@ -1326,7 +1879,52 @@ int ClusterInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
   }
   n++;
 
+  // Report connection attempts
+  MRConnCounters cc = MRConn_GetCounters();
+  RedisModule_ReplyWithSimpleString(ctx, "connections");
+  n++;
+  RedisModule_ReplyWithArray(ctx, 8);
+  RedisModule_ReplyWithSimpleString(ctx, "attempts");
+  RedisModule_ReplyWithLongLong(ctx, cc.attempts);
+  RedisModule_ReplyWithSimpleString(ctx, "failures");
+  RedisModule_ReplyWithLongLong(ctx, cc.failures);
+  RedisModule_ReplyWithSimpleString(ctx, "deferred");
+  RedisModule_ReplyWithLongLong(ctx, cc.deferred);
+  RedisModule_ReplyWithSimpleString(ctx, "in_flight");
+  RedisModule_ReplyWithLongLong(ctx, cc.inFlight);
+  n++;
+
+  // Report admission control, per request class
+  RedisModule_ReplyWithSimpleString(ctx, "admission");
+  n++;
+  RedisModule_ReplyWithArray(ctx, MR_NUM_REQUEST_CLASSES);
+  for (int i = 0; i < MR_NUM_REQUEST_CLASSES; i++) {
+    MRWorkQueueStats st = MR_GetAdmissionStats(i);
+    RedisModule_ReplyWithArray(ctx, 15);
+    RedisModule_ReplyWithSimpleString(ctx, MRRequestClass_Str(i));
+    RedisModule_ReplyWithSimpleString(ctx, "queued");
+    RedisModule_ReplyWithLongLong(ctx, st.queued);
+    RedisModule_ReplyWithSimpleString(ctx, "pending");
+    RedisModule_ReplyWithLongLong(ctx, st.pending);
+    RedisModule_ReplyWithSimpleString(ctx, "limit");
+    RedisModule_ReplyWithLongLong(ctx, st.limit);
+    RedisModule_ReplyWithSimpleString(ctx, "rejected");
+    RedisModule_ReplyWithLongLong(ctx, st.rejected);
+    RedisModule_ReplyWithSimpleString(ctx, "completed");
+    RedisModule_ReplyWithLongLong(ctx, st.completed);
+    RedisModule_ReplyWithSimpleString(ctx, "latency_ms");
+    RedisModule_ReplyWithDouble(ctx, st.latencyMS);
+    RedisModule_ReplyWithSimpleString(ctx, "min_latency_ms");
+    RedisModule_ReplyWithDouble(ctx, st.minLatencyMS);
+  }
+  n++;
+
   // Report topology
+  RedisModule_ReplyWithSimpleString(ctx, "topology_version");
+  n++;
+  RedisModule_ReplyWithLongLong(ctx, topo ? (long long)topo->version : 0);
+  n++;
+
   RedisModule_ReplyWithSimpleString(ctx, "num_slots");
   n++;
   RedisModule_ReplyWithLongLong(ctx, topo ? (long long)topo->numSlots : 0);
@@ -1359,6 +1957,7 @@ int ClusterInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
                                                 node->flags & MRNode_Self ? "self" : ""));
       }
     }
+    MRClusterTopology_Release(topo);
   }
 
   RedisModule_ReplySetArrayLength(ctx, n);
@@ -1375,9 +1974,12 @@ int RefreshClusterCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int arg
   RedisModule_AutoMemory(ctx);
   MRClusterTopology *topo = RedisCluster_GetTopology(ctx);
 
-  SearchCluster_EnsureSize(ctx, GetSearchCluster(), topo);
+  int changed = SearchCluster_EnsureSize(ctx, GetSearchCluster(), topo);
+  // the topology belongs to the cluster once updated
+  size_t numNodes = topologyNumNodes(topo);
 
   MR_UpdateTopology(topo);
+  syncIndexRouting(numNodes, changed);
   RedisModule_ReplyWithSimpleString(ctx, "OK");
 
   return REDISMODULE_OK;
@@ -1391,7 +1993,8 @@ int SetClusterCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     return REDISMODULE_ERR;
   }
 
-  SearchCluster_EnsureSize(ctx, GetSearchCluster(), topo);
+  int changed = SearchCluster_EnsureSize(ctx, GetSearchCluster(), topo);
+  size_t numNodes = topologyNumNodes(topo);
   // If the cluster hash func or cluster slots has changed, set the new value
   switch (topo->hashFunc) {
     case MRHashFunc_CRC12:
@@ -1414,6 +2017,7 @@ int SetClusterCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     MRClusterTopology_Free(topo);
     return RedisModule_ReplyWithError(ctx, "Error updating the topology");
   }
+  syncIndexRouting(numNodes, changed);
 
   RedisModule_ReplyWithSimpleString(ctx, "OK");
 
@@ -1425,8 +2029,11 @@ int initSearchCluster(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   clusterConfig.type = DetectClusterType();
 
   RedisModule_Log(ctx, "notice",
-                  "Cluster configuration: %ld partitions, type: %d, coordinator timeout: %dms",
-                  clusterConfig.numPartitions, clusterConfig.type, clusterConfig.timeoutMS);
+                  "Cluster configuration: %ld partitions, type: %d, coordinator timeout: %dms, "
+                  "partitioner: %s",
+                  clusterConfig.numPartitions, clusterConfig.type, clusterConfig.timeoutMS,
+                  clusterConfig.partitioner == PartitionHash_Jump ? PARTITIONHASH_JUMP_STR
+                                                                  : PARTITIONHASH_MODULO_STR);
 
   /* Configure cluster injections */
   ShardFunc sf;
@@ -1457,7 +2064,9 @@ int initSearchCluster(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
   MRCluster *cl = MR_NewCluster(initialTopology, sf, 2);
   MR_Init(cl, clusterConfig.timeoutMS);
+  MR_SetReadPolicy(clusterConfig.readPolicy);
   InitGlobalSearchCluster(clusterConfig.numPartitions, slotTable, tableSize);
+  PartitionCtx_SetHashFunc(&GetSearchCluster()->part, clusterConfig.partitioner);
 
   return REDISMODULE_OK;
 }
@@ -1574,6 +2183,7 @@ RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_Log(ctx, "warning", "Could not init search library...");
     return REDISMODULE_ERR;
   }
+  DistAggregate_RegisterFunctions();
 
   // Init the configuration and global cluster structs
   if (initSearchCluster(ctx, argv, argc) == REDISMODULE_ERR) {
@@ -1581,6 +2191,8 @@ RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     return REDISMODULE_ERR;
   }
 
+  RM_TRY(registerIndexRoutingType(ctx));
+
   // Init the aggregation thread pool
   DIST_AGG_THREADPOOL = ConcurrentSearch_CreatePool(RSGlobalConfig.searchPoolSize);
 
@@ -1625,23 +2237,23 @@ RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     // write commands (on enterprise we do not define them, the dmc take care of them)
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.ADD", SafeCmd(SingleShardCommandHandler), "readonly", 0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.DEL", SafeCmd(SingleShardCommandHandler), "readonly", 0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT.CREATE", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT._CREATEIFNX", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT.CREATE", SafeCmd(CreateCommandHandler), "readonly", 0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT._CREATEIFNX", SafeCmd(CreateCommandHandler), "readonly", 0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.ALTER", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT._ALTERIFNX", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT.DROP", SafeCmd(MastersFanoutCommandHandler), "readonly",0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT._DROPIFX", SafeCmd(MastersFanoutCommandHandler), "readonly",0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT.DROPINDEX", SafeCmd(MastersFanoutCommandHandler), "readonly",0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT._DROPINDEXIFX", SafeCmd(MastersFanoutCommandHandler), "readonly",0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT.DROP", SafeCmd(DropCommandHandler), "readonly",0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT._DROPIFX", SafeCmd(DropCommandHandler), "readonly",0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT.DROPINDEX", SafeCmd(DropCommandHandler), "readonly",0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT._DROPINDEXIFX", SafeCmd(DropCommandHandler), "readonly",0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.DELETE", SafeCmd(MastersFanoutCommandHandler), "readonly",0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.BROADCAST", SafeCmd(BroadcastCommand), "readonly", 0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.DICTADD", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.DICTDEL", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT.ALIASADD", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT._ALIASADDIFNX", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT.ALIASDEL", SafeCmd(MastersUnshardedHandler), "readonly", 0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT._ALIASDELIFX", SafeCmd(MastersUnshardedHandler), "readonly", 0, 0, -1));
-    RM_TRY(RedisModule_CreateCommand(ctx, "FT.ALIASUPDATE", SafeCmd(MastersFanoutCommandHandler), "readonly", 0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT.ALIASADD", SafeCmd(AliasCommandHandler), "readonly", 0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT._ALIASADDIFNX", SafeCmd(AliasCommandHandler), "readonly", 0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT.ALIASDEL", SafeCmd(AliasCommandHandler), "readonly", 0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT._ALIASDELIFX", SafeCmd(AliasCommandHandler), "readonly", 0, 0, -1));
+    RM_TRY(RedisModule_CreateCommand(ctx, "FT.ALIASUPDATE", SafeCmd(AliasCommandHandler), "readonly", 0, 0, -1));
     // todo : how to handle those
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.SYNADD", SafeCmd(SynAddCommandHandler), "readonly", 0, 0, -1));
     RM_TRY(RedisModule_CreateCommand(ctx, "FT.SYNUPDATE", SafeCmd(MastersFanoutCommandHandler),"readonly", 0, 0, -1));
@@ -1653,6 +2265,11 @@ RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   RM_TRY(RedisModule_CreateCommand(ctx, RSCOORDINATOR_MODULE_NAME".CLUSTERSET", SafeCmd(SetClusterCommand), "readonly allow-loading", 0,0, -1));
   RM_TRY(RedisModule_CreateCommand(ctx, RSCOORDINATOR_MODULE_NAME".CLUSTERREFRESH", SafeCmd(RefreshClusterCommand),"readonly", 0, 0, -1));
   RM_TRY(RedisModule_CreateCommand(ctx, RSCOORDINATOR_MODULE_NAME".CLUSTERINFO", SafeCmd(ClusterInfoCommand), "readonly allow-loading",0, 0, -1));
+  RM_TRY(RedisModule_CreateCommand(ctx, RSCOORDINATOR_MODULE_NAME".PARTITIONMOVES", SafeCmd(PartitionMovesCommand), "readonly", 0, 0, -1));
+  RM_TRY(RedisModule_CreateCommand(ctx, RSCOORDINATOR_MODULE_NAME".INDEXROUTING", SafeCmd(IndexRoutingCommand), "readonly", 0, 0, -1));
+  RM_TRY(RedisModule_CreateCommand(ctx, RSCOORDINATOR_MODULE_NAME".INDEXROUTINGDEL", SafeCmd(IndexRoutingDelCommand), "readonly", 0, 0, -1));
+  RM_TRY(RedisModule_CreateCommand(ctx, RSCOORDINATOR_MODULE_NAME".INDEXROUTINGLIST", SafeCmd(IndexRoutingListCommand), "readonly", 0, 0, -1));
+  RM_TRY(RedisModule_CreateCommand(ctx, RSCOORDINATOR_MODULE_NAME".INDEXNAMESFLUSH", SafeCmd(IndexNamesFlushCommand), "readonly", 0, 0, -1));
 
   return REDISMODULE_OK;
 }
@@ -1,12 +1,39 @@
 #include "partition.h"
 #include "fnv32.h"
 #include <stdio.h>
+#include <stdint.h>
+
+/* Jump consistent hash, by Lamping and Veach: the bucket of a key out of numBuckets. Growing the
+ * number of buckets moves keys only to the new buckets */
+static size_t jumpConsistentHash(uint64_t key, size_t numBuckets) {
+  int64_t b = -1, j = 0;
+  while (j < (int64_t)numBuckets) {
+    b = j;
+    key = key * 2862933555777941757ULL + 1;
+    j = (b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1));
+  }
+  return b;
+}
+
+size_t PartitionForKeyWithSize(PartitionCtx *ctx, const char *key, size_t len,
+                               size_t numPartitions) {
+  uint32_t hash = fnv_32a_buf((void *)key, len, 0);
+  if (ctx->hashFunc == PartitionHash_Jump) {
+    return jumpConsistentHash(hash, numPartitions);
+  }
+  return hash % numPartitions;
+}
 
 size_t PartitionForKey(PartitionCtx *ctx, const char *key, size_t len) {
-  return fnv_32a_buf((void *)key, len, 0) % ctx->size;
+  return PartitionForKeyWithSize(ctx, key, len, ctx->size);
 }
 
 int GetSlotByPartition(PartitionCtx *ctx, size_t partition){
+  if (ctx->hashFunc == PartitionHash_Jump && ctx->partitionSlots && partition < ctx->size) {
+    // shards serve contiguous ranges of slots, so a partition is tagged with a slot of its own
+    // shard, the one of the same position. Growing the cluster adds partitions for the new shards
+    return ctx->partitionSlots[partition] % ctx->tableSize;
+  }
   size_t step = ctx->tableSize / ctx->size;
   return ((partition + 1) * step - 1) % ctx->tableSize;
 }
@@ -26,6 +53,8 @@ void PartitionCtx_Init(PartitionCtx *ctx, size_t numPartitions, const char **tab
   ctx->size = numPartitions;
   ctx->table = table;
   ctx->tableSize = tableSize;
+  ctx->hashFunc = PartitionHash_Modulo;
+  ctx->partitionSlots = NULL;
 }
 
 void PartitionCtx_SetSlotTable(PartitionCtx *ctx, const char **table, size_t tableSize) {
@@ -37,3 +66,11 @@ void PartitionCtx_SetSlotTable(PartitionCtx *ctx, const char **table, size_t tab
 void PartitionCtx_SetSize(PartitionCtx *ctx, size_t size) {
   ctx->size = size;
 }
+
+void PartitionCtx_SetPartitionSlots(PartitionCtx *ctx, const int *slots) {
+  ctx->partitionSlots = slots;
+}
+
+void PartitionCtx_SetHashFunc(PartitionCtx *ctx, PartitionHashFunc hashFunc) {
+  ctx->hashFunc = hashFunc;
+}
@@ -3,6 +3,20 @@
 
 #include <stdlib.h>
 
+/* How keys are assigned to partitions */
+typedef enum {
+  /* The key's hash modulo the number of partitions. Changing the number of partitions moves
+   * almost all the keys */
+  PartitionHash_Modulo = 0,
+  /* Jump consistent hash of the key. Growing from n to m partitions moves only the keys that go to
+   * the new partitions, about (m-n)/m of them. Every partition is served by the shard of the same
+   * position in the topology, which it keeps as shards are added */
+  PartitionHash_Jump,
+} PartitionHashFunc;
+
+#define PARTITIONHASH_MODULO_STR "MODULO"
+#define PARTITIONHASH_JUMP_STR "JUMP"
+
 /* A partitioner takes command keys and tags them according to a ssharding function matching the
  * cluster's sharding function.
  * Using a partitioner we can paste sharding tags onto redis arguments to make sure they reach
@@ -13,10 +27,18 @@ typedef struct {
   size_t size;
   const char **table;
   size_t tableSize;
+  PartitionHashFunc hashFunc;
+  /* The start slot of the shard serving every partition, for the jump partitioner. Owned by the
+   * cluster */
+  const int *partitionSlots;
 } PartitionCtx;
 
 size_t PartitionForKey(PartitionCtx *ctx, const char *key, size_t len);
 
+/* The partition of a key if there were numPartitions partitions */
+size_t PartitionForKeyWithSize(PartitionCtx *ctx, const char *key, size_t len,
+                               size_t numPartitions);
+
 int GetSlotByPartition(PartitionCtx *ctx, size_t partition);
 
 const char *PartitionTag(PartitionCtx *ctx, size_t partition);
@@ -28,4 +50,12 @@ void PartitionCtx_SetSlotTable(PartitionCtx *ctx, const char **table, size_t tab
 
 /* Set the number of partitions in this partition context */
 void PartitionCtx_SetSize(PartitionCtx *ctx, size_t size);
-#endif
\ No newline at end of file
+
+/* Set the slots of the partitions' shards, slots[i] being a slot of the i-th shard of the
+ * topology. The jump partitioner tags every partition with the slot of its own shard */
+void PartitionCtx_SetPartitionSlots(PartitionCtx *ctx, const int *slots);
+
+/* Set how keys are assigned to partitions. Must be set before any key is partitioned, as it
+ * changes the partition of the keys */
+void PartitionCtx_SetHashFunc(PartitionCtx *ctx, PartitionHashFunc hashFunc);
+#endif
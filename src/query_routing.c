@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include "query_routing.h"
+
+/* The position of the character that closes a quoted, tag or range part of a query starting at
+ * pos, or len if it is not closed */
+static size_t skipTo(const char *q, size_t len, size_t pos, char close) {
+  for (size_t i = pos + 1; i < len; i++) {
+    if (q[i] == '\\') {
+      i++;
+    } else if (q[i] == close) {
+      return i;
+    }
+  }
+  return len;
+}
+
+static size_t skipSpaces(const char *q, size_t len, size_t pos) {
+  while (pos < len && isspace((unsigned char)q[pos])) pos++;
+  return pos;
+}
+
+/* Split the contents of a tag constraint by its unescaped '|' and call cb with each value,
+ * unescaped and trimmed. With no cb, only check that all the values can be routed */
+static size_t tagValues(const char *s, size_t len, char *buf, QueryRoutingValueCB cb, void *ctx) {
+  size_t n = 0;
+  for (size_t pos = 0; pos <= len; pos++) {
+    // keep is the length of the value up to its last escaped character, which is not trimmed
+    size_t vlen = 0, keep = 0;
+    int param = 0;
+    for (; pos < len && s[pos] != '|'; pos++) {
+      if (s[pos] == '\\' && pos + 1 < len) {
+        buf[vlen++] = s[++pos];
+        keep = vlen;
+      } else if (s[pos] == '*') {
+        // a prefix may match the values of any partition
+        return 0;
+      } else if (vlen || !isspace((unsigned char)s[pos])) {
+        if (!vlen && s[pos] == '$') param = 1;
+        buf[vlen++] = s[pos];
+      }
+    }
+    while (vlen > keep && isspace((unsigned char)buf[vlen - 1])) vlen--;
+    if (!vlen || param) {
+      return 0;
+    }
+    if (cb) cb(buf, vlen, ctx);
+    n++;
+  }
+  return n;
+}
+
+size_t QueryRouting_FieldValues(const char *query, size_t len, const char *field, size_t fieldLen,
+                                QueryRoutingValueCB cb, void *ctx) {
+  // the contents of the braces of the first constraint on the field
+  const char *values = NULL;
+  size_t valuesLen = 0;
+  int depth = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    switch (query[i]) {
+      case '\\':
+        i++;
+        break;
+      case '"':
+      case '{':
+        i = skipTo(query, len, i, query[i] == '"' ? '"' : '}');
+        break;
+      case '[':
+        i = skipTo(query, len, i, ']');
+        break;
+      case '(':
+        depth++;
+        break;
+      case ')':
+        depth--;
+        break;
+      case '|':
+        // a union at the top level may match documents without the constraint
+        if (depth == 0) return 0;
+        break;
+      case '@': {
+        if (depth || values) break;
+        // a negated or optional constraint does not restrict the field
+        if (i > 0 && (query[i - 1] == '-' || query[i - 1] == '~')) break;
+        size_t j = i + 1;
+        if (len - j < fieldLen || memcmp(query + j, field, fieldLen)) break;
+        // the field name is followed by a colon, and not by more of a longer name or by a list
+        j = skipSpaces(query, len, j + fieldLen);
+        if (j >= len || query[j] != ':') break;
+        j = skipSpaces(query, len, j + 1);
+        if (j >= len || query[j] != '{') break;
+        size_t end = skipTo(query, len, j, '}');
+        if (end >= len) return 0;
+        values = query + j + 1;
+        valuesLen = end - j - 1;
+        i = end;
+        break;
+      }
+    }
+  }
+  if (!values) {
+    return 0;
+  }
+
+  char *buf = malloc(valuesLen + 1);
+  size_t n = tagValues(values, valuesLen, buf, NULL, NULL);
+  if (n) {
+    tagValues(values, valuesLen, buf, cb, ctx);
+  }
+  free(buf);
+  return n;
+}
+
+/* The options a field of a schema can have after its type, and the number of their arguments */
+static const struct {
+  const char *name;
+  int nargs;
+} schemaOptions[] = {
+    {"SORTABLE", 0},
+    {"UNF", 0},
+    {"NOINDEX", 0},
+    {"NOSTEM", 0},
+    {"CASESENSITIVE", 0},
+    {"WITHSUFFIXTRIE", 0},
+    {"INDEXEMPTY", 0},
+    {"INDEXMISSING", 0},
+    {"FLAT", 0},
+    {"SPHERICAL", 0},
+    {"SEPARATOR", 1},
+    {"WEIGHT", 1},
+    {"PHONETIC", 1},
+};
+
+static int schemaOption(const char *arg) {
+  for (int i = 0; i < (int)(sizeof(schemaOptions) / sizeof(*schemaOptions)); i++) {
+    if (!strcasecmp(arg, schemaOptions[i].name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int QueryRouting_IsCaseSensitiveTag(const char **schema, size_t nargs, const char *field,
+                                    size_t fieldLen) {
+  size_t i = 0;
+  while (i < nargs) {
+    // {identifier} [AS {attribute}] {type} [options...]
+    const char *name = schema[i++];
+    if (i + 1 < nargs && !strcasecmp(schema[i], "AS")) {
+      name = schema[i + 1];
+      i += 2;
+    }
+    if (i == nargs) {
+      return 0;
+    }
+    const char *type = schema[i++];
+    if (!strcasecmp(type, "VECTOR") && i + 1 < nargs) {
+      // VECTOR {algorithm} {count} {attributes...}
+      i += 2 + strtoul(schema[i + 1], NULL, 10);
+    }
+    int caseSensitive = 0, opt;
+    for (; i < nargs && (opt = schemaOption(schema[i])) >= 0; i += 1 + schemaOptions[opt].nargs) {
+      caseSensitive |= !strcasecmp(schema[i], "CASESENSITIVE");
+    }
+    if (strlen(name) == fieldLen && !memcmp(name, field, fieldLen)) {
+      return !strcasecmp(type, "TAG") && caseSensitive;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef SRC_QUERY_ROUTING_H_
+#define SRC_QUERY_ROUTING_H_
+
+#include <stddef.h>
+
+typedef void (*QueryRoutingValueCB)(const char *value, size_t len, void *ctx);
+
+/* Find the values a query requires a tag field to have, from a constraint such as @field:{a | b}
+ * at the top level of the query. Calls cb with each of the values, unescaped, and returns their
+ * number.
+ * Returns 0 if the query does not restrict the field to a set of values: when there is no such
+ * constraint, or it is negated, optional, nested in parentheses, part of a union, or has a value
+ * that is a prefix or a parameter */
+size_t QueryRouting_FieldValues(const char *query, size_t len, const char *field, size_t fieldLen,
+                                QueryRoutingValueCB cb, void *ctx);
+
+/* Check that the schema of FT.CREATE, given as the arguments after its SCHEMA, declares the field
+ * as a CASESENSITIVE tag field. Tag values are matched case-insensitively otherwise, while the hash
+ * tags the documents are partitioned by are not, so the partitions of a value could not be told
+ * from a query */
+int QueryRouting_IsCaseSensitiveTag(const char **schema, size_t nargs, const char *field,
+                                    size_t fieldLen);
+
+#endif /* SRC_QUERY_ROUTING_H_ */
@@ -1,9 +1,50 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
 #include "search_cluster.h"
 #include "partition.h"
 #include "alias.h"
+#include "dep/rmr/rmr.h"
+#include "dep/triemap/triemap.h"
+#include "query_routing.h"
+
+// The error of a shard query that reached its TIMEOUT, with the FAIL timeout policy
+#define SHARD_TIMEOUT_ERR "Timeout limit was reached"
+
+/* Map every slot to the partition of the shard serving it - the one with the greatest start slot
+ * up to it, or partition 0 for the slots before the first shard */
+static void buildSlotPartitions(SearchCluster *c, size_t numSlots) {
+  free(c->slotPartitions);
+  c->slotPartitions = NULL;
+  c->numSlots = 0;
+  if (!c->size || !c->shardsStartSlots || !numSlots) {
+    return;
+  }
+
+  // the partition starting at every slot, the first one of partitions with the same start
+  int *starting = malloc(numSlots * sizeof(*starting));
+  for (size_t slot = 0; slot < numSlots; slot++) {
+    starting[slot] = -1;
+  }
+  for (size_t i = 0; i < c->size; i++) {
+    int start = c->shardsStartSlots[i];
+    if (start >= 0 && (size_t)start < numSlots && starting[start] < 0) {
+      starting[start] = i;
+    }
+  }
+
+  c->slotPartitions = malloc(numSlots * sizeof(*c->slotPartitions));
+  c->numSlots = numSlots;
+  uint16_t part = 0;
+  for (size_t slot = 0; slot < numSlots; slot++) {
+    if (starting[slot] >= 0) part = starting[slot];
+    c->slotPartitions[slot] = part;
+  }
+  free(starting);
+}
 
 SearchCluster NewSearchCluster(size_t size, const char **table, size_t tableSize) {
   SearchCluster ret = (SearchCluster){.size = size, .shardsStartSlots=NULL,};
@@ -11,13 +52,25 @@ SearchCluster NewSearchCluster(size_t size, const char **table, size_t tableSize
   if(size){
     // assume slots are equaly distributed
     ret.shardsStartSlots = malloc(sizeof(int) * size);
-    for(size_t j = 0, i = 0 ; i < tableSize ; j++, i+=(tableSize/size)){
+    for(size_t j = 0, i = 0 ; j < size ; j++, i+=(tableSize/size)){
       ret.shardsStartSlots[j] = i;
     }
+    buildSlotPartitions(&ret, tableSize);
   }
+  PartitionCtx_SetPartitionSlots(&ret.part, ret.shardsStartSlots);
   return ret;
 }
 
+void SearchCluster_Free(SearchCluster *c) {
+  free(c->shardsStartSlots);
+  c->shardsStartSlots = NULL;
+  free(c->slotPartitions);
+  c->slotPartitions = NULL;
+  c->numSlots = 0;
+  c->size = 0;
+  PartitionCtx_SetPartitionSlots(&c->part, NULL);
+}
+
 SearchCluster __searchCluster;
 
 SearchCluster *GetSearchCluster() {
@@ -157,6 +210,34 @@ int SearchCluster_RewriteCommandArg(SearchCluster *sc, MRCommand *cmd, int parti
   return 1;
 }
 
+/* The number of names each of the index name caches holds at most. Names past it are resolved on
+ * every command, so that queries on missing indexes cannot grow the caches */
+#define INDEX_NAMES_CACHE_SIZE 4096
+
+/* The name of an index's commands to the shards, resolved once per index and shared by the
+ * iterators multiplexing its commands */
+typedef struct indexNames {
+  uint32_t refcount;
+  /* The index an alias points to, untagged, or the name itself */
+  char *target;
+  size_t targetLen;
+} indexNames;
+
+/* The cached names of indexes, by the name given to a command. The aliased commands' names are
+ * kept apart, as their aliases are resolved */
+static TrieMap *indexNames_g[2] = {NULL, NULL};
+static size_t numIndexNames_g[2] = {0, 0};
+static pthread_rwlock_t indexNamesLock_g = PTHREAD_RWLOCK_INITIALIZER;
+
+static void indexNames_Release(void *p) {
+  indexNames *n = p;
+  if (__atomic_sub_fetch(&n->refcount, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  free(n->target);
+  free(n);
+}
+
 static const char *getUntaggedId(const char *id, size_t *outlen) {
   const char *openBrace = rindex(id, '{');
   if (openBrace) {
@@ -167,13 +248,68 @@ static const char *getUntaggedId(const char *id, size_t *outlen) {
   return id;
 }
 
-static const char *lookupAlias(const char *orig, size_t *len) {
-  IndexSpec *sp = IndexAlias_Get(orig);
-  if (!sp) {
-    *len = strlen(orig);
-    return orig;
+static indexNames *newIndexNames(const char *name, size_t len, int aliased) {
+  indexNames *n = calloc(1, sizeof(*n));
+  n->refcount = 1;
+  IndexSpec *sp = aliased ? IndexAlias_Get(name) : NULL;
+  if (sp) {
+    const char *target = getUntaggedId(sp->name, &n->targetLen);
+    n->target = strndup(target, n->targetLen);
+  } else {
+    n->target = strndup(name, len);
+    n->targetLen = len;
+  }
+  return n;
+}
+
+static void *replaceIndexNames(void *oldval, void *newval) {
+  indexNames_Release(oldval);
+  return newval;
+}
+
+/* Get the names of an index, from the cache or resolved and added to it. The caller releases them
+ * with indexNames_Release */
+static indexNames *acquireIndexNames(const char *name, size_t len, int aliased) {
+  aliased = !!aliased;
+  pthread_rwlock_rdlock(&indexNamesLock_g);
+  indexNames *n = NULL;
+  if (indexNames_g[aliased]) {
+    void *p = TrieMap_Find(indexNames_g[aliased], (char *)name, len);
+    if (p != TRIEMAP_NOTFOUND) {
+      n = p;
+      __atomic_add_fetch(&n->refcount, 1, __ATOMIC_RELAXED);
+    }
+  }
+  pthread_rwlock_unlock(&indexNamesLock_g);
+  if (n) {
+    return n;
+  }
+
+  n = newIndexNames(name, len, aliased);
+  pthread_rwlock_wrlock(&indexNamesLock_g);
+  if (!indexNames_g[aliased]) {
+    indexNames_g[aliased] = NewTrieMap();
+  }
+  if (numIndexNames_g[aliased] < INDEX_NAMES_CACHE_SIZE) {
+    // the cache holds a reference of its own, and drops the one of names it replaces
+    n->refcount++;
+    numIndexNames_g[aliased] +=
+        TrieMap_Add(indexNames_g[aliased], (char *)name, len, n, replaceIndexNames);
+  }
+  pthread_rwlock_unlock(&indexNamesLock_g);
+  return n;
+}
+
+void SearchCluster_InvalidateIndexNames() {
+  pthread_rwlock_wrlock(&indexNamesLock_g);
+  for (size_t i = 0; i < 2; i++) {
+    if (indexNames_g[i]) {
+      TrieMap_Free(indexNames_g[i], indexNames_Release);
+      indexNames_g[i] = NULL;
+      numIndexNames_g[i] = 0;
+    }
   }
-  return getUntaggedId(sp->name, len);
+  pthread_rwlock_unlock(&indexNamesLock_g);
 }
 
 int SearchCluster_RewriteCommand(SearchCluster *sc, MRCommand *cmd, int partIdx) {
@@ -199,17 +335,17 @@ int SearchCluster_RewriteCommand(SearchCluster *sc, MRCommand *cmd, int partIdx)
 
     size_t partId = PartitionForKey(&sc->part, partStr, partLen);
     const char *tag = PartitionTag(&sc->part, partId);
+    indexNames *names = NULL;
     if (MRCommand_GetFlags(cmd) & MRCommand_Aliased) {
       // 1:1 partition mapping
-      IndexSpec *spec = IndexAlias_Get(target);
-      if (spec) {
-        target = spec->name;
-        targetLen = rindex(spec->name, '{') - target;
-      }
+      names = acquireIndexNames(target, targetLen, 1);
+      target = names->target;
+      targetLen = names->targetLen;
     }
 
     char *tagged = writeTaggedId(target, targetLen, tag, strlen(tag), &taggedLen);
     MRCommand_ReplaceArgNoDup(cmd, sk, tagged, taggedLen);
+    if (names) indexNames_Release(names);
 
     // printf("After rewrite: ");
     // MRCommand_Print(cmd);
@@ -231,14 +367,31 @@ int SearchCluster_RewriteCommandToFirstPartition(SearchCluster *sc, MRCommand *c
   size_t keylen = 0;
   const char *key = MRCommand_ArgStringPtrLen(cmd, sk, &keylen);
   if (MRCommand_GetFlags(cmd) & MRCommand_Aliased) {
-    const char* alias = lookupAlias(key, &keylen);
-    MRCommand_ReplaceArg(cmd, sk, alias, strlen(alias));
+    indexNames *names = acquireIndexNames(key, keylen, 1);
+    MRCommand_ReplaceArg(cmd, sk, names->target, names->targetLen);
+    indexNames_Release(names);
   }
 
   cmd->targetSlot = GetSlotByPartition(&sc->part, 0);
   return 1;
 }
 
+/* The number of commands a multiplexed command is sent as: one per partition, or one per target */
+static size_t muxLen(SCCommandMuxIterator *it) {
+  return it->targetSlots ? it->numTargets : it->cluster->size;
+}
+
+/* Set the wire format of a shard's command, formatted once for all the shards as their commands
+ * are copies of the same one */
+static void muxFormatCommand(SCCommandMuxIterator *it, MRCommand *cmd) {
+  if (!it->wire) {
+    it->wire = MRCommand_Format(cmd);
+  }
+  // set last, as changing the command's arguments drops it
+  if (cmd->cmd) sdsfree(cmd->cmd);
+  cmd->cmd = sdsdup(it->wire);
+}
+
 /* Get the next multiplexed command for spellcheck command. Return 1 if we are not done, else 0 */
 int SpellCheckMuxIterator_Next(void *ctx, MRCommand *cmd) {
   SCCommandMuxIterator *it = ctx;
@@ -246,20 +399,18 @@ int SpellCheckMuxIterator_Next(void *ctx, MRCommand *cmd) {
   if (!SearchCluster_Ready(it->cluster)) return 0;
 
   /* at end */
-  if (it->offset >= it->cluster->size) {
+  if (it->offset >= muxLen(it)) {
     return 0;
   }
 
   *cmd = MRCommand_Copy(it->cmd);
-  if (it->keyOffset >= 0 && it->keyOffset < it->cmd->num) {
-    if (it->keyAlias) {
-      MRCommand_ReplaceArg(cmd, it->keyOffset, it->keyAlias, strlen(it->keyAlias));
-    }
-  }
 
-  cmd->targetSlot = GetSlotByPartition(&it->cluster->part, it->offset++);
+  cmd->targetSlot = it->targetSlots ? it->targetSlots[it->offset]
+                                    : GetSlotByPartition(&it->cluster->part, it->offset);
+  it->offset++;
 
   MRCommand_AppendArgs(cmd, 1, "FULLSCOREINFO");
+  muxFormatCommand(it, cmd);
 
   return 1;
 }
@@ -270,18 +421,16 @@ int NoPartitionCommandMuxIterator_Next(void *ctx, MRCommand *cmd) {
   if (!SearchCluster_Ready(it->cluster)) return 0;
 
   /* at end */
-  if (it->offset >= it->cluster->size) {
+  if (it->offset >= muxLen(it)) {
     return 0;
   }
 
   *cmd = MRCommand_Copy(it->cmd);
-  if (it->keyOffset >= 0 && it->keyOffset < it->cmd->num) {
-    if (it->keyAlias) {
-      MRCommand_ReplaceArg(cmd, it->keyOffset, it->keyAlias, strlen(it->keyAlias));
-    }
-  }
 
-  cmd->targetSlot = it->cluster->shardsStartSlots[it->offset++];
+  cmd->targetSlot = it->targetSlots ? it->targetSlots[it->offset]
+                                    : it->cluster->shardsStartSlots[it->offset];
+  it->offset++;
+  muxFormatCommand(it, cmd);
 
   return 1;
 }
@@ -293,24 +442,23 @@ int SCCommandMuxIterator_Next(void *ctx, MRCommand *cmd) {
   if (!SearchCluster_Ready(it->cluster)) return 0;
 
   /* at end */
-  if (it->offset >= it->cluster->size) {
+  if (it->offset >= muxLen(it)) {
     return 0;
   }
 
   *cmd = MRCommand_Copy(it->cmd);
-  if (it->keyOffset >= 0 && it->keyOffset < it->cmd->num) {
-    size_t argLen;
-    const char *arg;
-    if (it->keyAlias) {
-      arg = it->keyAlias;
-      argLen = strlen(it->keyAlias);
-    } else {
-      arg = MRCommand_ArgStringPtrLen(cmd, it->keyOffset, &argLen);
-    }
-    const char *tag = PartitionTag(&it->cluster->part, it->offset++);
-
+  // the partition of a target is that of its shard, as the targets are a subset of the partitions
+  size_t part = it->offset;
+  if (it->targetSlots) {
+    cmd->targetSlot = it->targetSlots[it->offset];
+    part = SearchCluster_PartitionForSlot(it->cluster, cmd->targetSlot);
+  }
+  it->offset++;
+  if (it->names) {
+    const char *tag = PartitionTag(&it->cluster->part, part);
     size_t taggedLen;
-    char *tagged = writeTaggedId(arg, argLen, tag, strlen(tag), &taggedLen);
+    char *tagged =
+        writeTaggedId(it->names->target, it->names->targetLen, tag, strlen(tag), &taggedLen);
     MRCommand_ReplaceArgNoDup(cmd, it->keyOffset, tagged, taggedLen);
   }
   // MRCommand_Print(cmd);
@@ -320,20 +468,20 @@ int SCCommandMuxIterator_Next(void *ctx, MRCommand *cmd) {
 
 /* Return the size of the command generator */
 size_t SCCommandMuxIterator_Len(void *ctx) {
-  SCCommandMuxIterator *it = ctx;
-  return it->cluster->size;
+  return muxLen(ctx);
 }
 
 size_t NoPartitionCommandMuxIterator_Len(void *ctx) {
-  SCCommandMuxIterator *it = ctx;
-  return it->cluster->size;
+  return muxLen(ctx);
 }
 
 void SCCommandMuxIterator_Free(void *ctx) {
   SCCommandMuxIterator *it = ctx;
   if (it->cmd) MRCommand_Free(it->cmd);
   it->cmd = NULL;
-  free(it->keyAlias);
+  if (it->names) indexNames_Release(it->names);
+  free(it->targetSlots);
+  if (it->wire) sdsfree(it->wire);
   free(it);
 }
 
@@ -341,7 +489,9 @@ void NoPartitionCommandMuxIterator_Free(void *ctx) {
   SCCommandMuxIterator *it = ctx;
   if (it->cmd) MRCommand_Free(it->cmd);
   it->cmd = NULL;
-  free(it->keyAlias);
+  if (it->names) indexNames_Release(it->names);
+  free(it->targetSlots);
+  if (it->wire) sdsfree(it->wire);
   free(it);
 }
 
@@ -372,47 +522,433 @@ MRCommandGenerator SearchCluster_GetCommandGenerator(SCCommandMuxIterator *mux,
   return ret;
 }
 
-/* Multiplex a command to the cluster using an iterator that will yield a multiplexed command per
- * iteration, based on the original command */
-MRCommandGenerator SearchCluster_MultiplexCommand(SearchCluster *c, MRCommand *cmd) {
+/* How the commands on an index are routed, when not to all of the partitions */
+typedef struct {
+  // The slot of the shard a single-partition index is pinned to, or -1
+  int slot;
+  // The field whose value decides the partition of the index's documents, or NULL
+  char *routingField;
+  // When the routing was set or deleted, so that the coordinators keep the newest one they heard of
+  uint64_t version;
+  // A deleted routing is kept, so that an older version of it does not bring it back
+  int deleted;
+} indexRouting;
+
+/* The routing of the indexes that have one. Every coordinator keeps them, as they are sent to all
+ * the nodes when an index is created, and pulled from the other coordinators on topology changes */
+static TrieMap *indexRouting_g = NULL;
+static pthread_rwlock_t indexRoutingLock_g = PTHREAD_RWLOCK_INITIALIZER;
+
+static void indexRouting_Free(void *p) {
+  indexRouting *r = p;
+  free(r->routingField);
+  free(r);
+}
+
+/* The wall clock time in ms, which the versions of the routings are */
+static uint64_t indexRoutingNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Whether a deleted routing of a version is old enough to be forgotten */
+static int indexRoutingExpired(uint64_t version, uint64_t now) {
+  return version + SC_INDEX_ROUTING_DELETION_TTL_MS <= now;
+}
+
+/* Must be called with the routing lock held */
+static indexRouting *getIndexRouting(const char *name, size_t len) {
+  if (!indexRouting_g) {
+    return NULL;
+  }
+  void *p = TrieMap_Find(indexRouting_g, (char *)name, len);
+  return p == TRIEMAP_NOTFOUND ? NULL : p;
+}
+
+/* Must be called with the routing lock held for writing. A deletion wins over a routing of the
+ * same version. Expired deletions of unknown routings are not kept */
+static int putIndexRouting(const char *name, size_t len, int slot, const char *routingField,
+                           uint64_t version, int deleted) {
+  indexRouting *r = getIndexRouting(name, len);
+  if (r && (r->version > version || (r->version == version && (r->deleted || !deleted)))) {
+    return 0;
+  }
+  if (!r && deleted && indexRoutingExpired(version, indexRoutingNow())) {
+    return 0;
+  }
+  if (!r) {
+    if (!indexRouting_g) {
+      indexRouting_g = NewTrieMap();
+    }
+    r = calloc(1, sizeof(*r));
+    TrieMap_Add(indexRouting_g, (char *)name, len, r, NULL);
+  }
+  free(r->routingField);
+  r->slot = slot;
+  r->routingField = routingField ? strdup(routingField) : NULL;
+  r->version = version;
+  r->deleted = deleted;
+  return 1;
+}
+
+int SearchCluster_SetIndexRouting(const char *name, size_t len, int slot,
+                                  const char *routingField, uint64_t version) {
+  pthread_rwlock_wrlock(&indexRoutingLock_g);
+  int ret = putIndexRouting(name, len, slot, routingField, version, 0);
+  pthread_rwlock_unlock(&indexRoutingLock_g);
+  return ret;
+}
+
+int SearchCluster_DelIndexRouting(const char *name, size_t len, uint64_t version) {
+  pthread_rwlock_wrlock(&indexRoutingLock_g);
+  int ret = putIndexRouting(name, len, -1, NULL, version, 1);
+  pthread_rwlock_unlock(&indexRoutingLock_g);
+  return ret;
+}
+
+size_t SearchCluster_ExpireIndexRoutingDeletions() {
+  size_t n = 0;
+  pthread_rwlock_wrlock(&indexRoutingLock_g);
+  if (indexRouting_g) {
+    // the names are collected first, as the map cannot change while it is iterated
+    uint64_t now = indexRoutingNow();
+    char **names = NULL;
+    tm_len_t *lens = NULL;
+    TrieMapIterator *it = TrieMap_Iterate(indexRouting_g, "", 0);
+    char *name;
+    tm_len_t len;
+    void *p;
+    while (TrieMapIterator_Next(it, &name, &len, &p)) {
+      indexRouting *r = p;
+      if (r->deleted && indexRoutingExpired(r->version, now)) {
+        names = realloc(names, (n + 1) * sizeof(*names));
+        lens = realloc(lens, (n + 1) * sizeof(*lens));
+        names[n] = malloc(len);
+        memcpy(names[n], name, len);
+        lens[n++] = len;
+      }
+    }
+    TrieMapIterator_Free(it);
+    for (size_t i = 0; i < n; i++) {
+      TrieMap_Delete(indexRouting_g, names[i], lens[i], indexRouting_Free);
+      free(names[i]);
+    }
+    free(names);
+    free(lens);
+  }
+  pthread_rwlock_unlock(&indexRoutingLock_g);
+  return n;
+}
+
+void SearchCluster_FreeIndexRouting() {
+  pthread_rwlock_wrlock(&indexRoutingLock_g);
+  if (indexRouting_g) {
+    TrieMap_Free(indexRouting_g, indexRouting_Free);
+    indexRouting_g = NULL;
+  }
+  pthread_rwlock_unlock(&indexRoutingLock_g);
+}
 
+uint64_t SearchCluster_NextIndexRoutingVersion(const char *name, size_t len) {
+  uint64_t version = indexRoutingNow();
+
+  pthread_rwlock_rdlock(&indexRoutingLock_g);
+  indexRouting *r = getIndexRouting(name, len);
+  if (r && r->version >= version) {
+    // this node's clock is behind the one that set the routing
+    version = r->version + 1;
+  }
+  pthread_rwlock_unlock(&indexRoutingLock_g);
+  return version;
+}
+
+size_t SearchCluster_ForEachIndexRouting(SCIndexRoutingCallback cb, void *ctx) {
+  size_t n = 0;
+  pthread_rwlock_rdlock(&indexRoutingLock_g);
+  if (indexRouting_g) {
+    TrieMapIterator *it = TrieMap_Iterate(indexRouting_g, "", 0);
+    char *name;
+    tm_len_t len;
+    void *p;
+    while (TrieMapIterator_Next(it, &name, &len, &p)) {
+      indexRouting *r = p;
+      cb(name, len, r->slot, r->routingField, r->version, r->deleted, ctx);
+      n++;
+    }
+    TrieMapIterator_Free(it);
+  }
+  pthread_rwlock_unlock(&indexRoutingLock_g);
+  return n;
+}
+
+/* Must be called with the routing lock held */
+static indexRouting *getLiveIndexRouting(const char *name, size_t len) {
+  indexRouting *r = getIndexRouting(name, len);
+  return r && !r->deleted ? r : NULL;
+}
+
+int SearchCluster_HasIndexRouting(const char *name, size_t len) {
+  pthread_rwlock_rdlock(&indexRoutingLock_g);
+  int ret = getLiveIndexRouting(name, len) != NULL;
+  pthread_rwlock_unlock(&indexRoutingLock_g);
+  return ret;
+}
+
+int SearchCluster_PinnedSlot(const char *name, size_t len) {
+  pthread_rwlock_rdlock(&indexRoutingLock_g);
+  indexRouting *r = getLiveIndexRouting(name, len);
+  int slot = r ? r->slot : -1;
+  pthread_rwlock_unlock(&indexRoutingLock_g);
+  return slot;
+}
+
+size_t SearchCluster_PartitionForSlot(SearchCluster *sc, int slot) {
+  if (slot >= 0 && (size_t)slot < sc->numSlots) {
+    return sc->slotPartitions[slot];
+  }
+  size_t part = 0;
+  for (size_t i = 1; i < sc->size; i++) {
+    if (sc->shardsStartSlots[i] <= slot &&
+        (sc->shardsStartSlots[part] > slot ||
+         sc->shardsStartSlots[i] > sc->shardsStartSlots[part])) {
+      part = i;
+    }
+  }
+  return part;
+}
+
+typedef struct {
+  SearchCluster *sc;
+  // whether each partition has any of the values
+  char *marked;
+  int failed;
+} routeQueryCtx;
+
+/* The documents of a routing field's value are stored in the slot of the value, as their keys have
+ * the value as hash tag */
+static void markValuePartition(const char *value, size_t len, void *p) {
+  routeQueryCtx *ctx = p;
+  int slot = MR_KeySlot(value, len);
+  if (slot < 0) {
+    ctx->failed = 1;
+  } else {
+    ctx->marked[SearchCluster_PartitionForSlot(ctx->sc, slot)] = 1;
+  }
+}
+
+/* Set the target slots of an iterator to the partitions of the values its query requires the
+ * routing field of its index to have */
+static void routeQuery(SCCommandMuxIterator *mux, const char *index, size_t indexLen,
+                       int queryIdx) {
+  SearchCluster *sc = mux->cluster;
+  if (!SearchCluster_Ready(sc) || !sc->shardsStartSlots || queryIdx >= mux->cmd->num) {
+    return;
+  }
+  size_t queryLen;
+  const char *query = MRCommand_ArgStringPtrLen(mux->cmd, queryIdx, &queryLen);
+  routeQueryCtx ctx = {.sc = sc, .marked = calloc(sc->size, 1)};
+
+  pthread_rwlock_rdlock(&indexRoutingLock_g);
+  indexRouting *r = getLiveIndexRouting(index, indexLen);
+  size_t nvalues = 0;
+  if (r && r->routingField) {
+    nvalues = QueryRouting_FieldValues(query, queryLen, r->routingField, strlen(r->routingField),
+                                       markValuePartition, &ctx);
+  }
+  pthread_rwlock_unlock(&indexRoutingLock_g);
+
+  if (nvalues && !ctx.failed) {
+    mux->targetSlots = malloc(sc->size * sizeof(*mux->targetSlots));
+    for (size_t i = 0; i < sc->size; i++) {
+      if (ctx.marked[i]) {
+        mux->targetSlots[mux->numTargets++] = sc->shardsStartSlots[i];
+      }
+    }
+  }
+  free(ctx.marked);
+}
+
+static MRCommandGenerator multiplexCommand(SearchCluster *c, MRCommand *cmd, int queryIdx) {
   SCCommandMuxIterator *mux = malloc(sizeof(SCCommandMuxIterator));
   *mux = (SCCommandMuxIterator){
       .cluster = c, .cmd = cmd, .keyOffset = MRCommand_GetShardingKey(cmd), .offset = 0};
-  if (MRCommand_GetFlags(cmd) & MRCommand_Aliased) {
-    if (mux->keyOffset > 0 && mux->keyOffset < cmd->num) {
-      size_t oldlen = strlen(cmd->strs[mux->keyOffset]);
-      size_t newlen = 0;
-      const char *target = lookupAlias(cmd->strs[mux->keyOffset], &newlen);
-      if (oldlen != newlen) {
-        mux->keyAlias = strndup(target, newlen);
-      }
+  if (mux->keyOffset > 0 && mux->keyOffset < cmd->num) {
+    size_t keylen = 0;
+    const char *key = MRCommand_ArgStringPtrLen(cmd, mux->keyOffset, &keylen);
+    int aliased = MRCommand_GetFlags(cmd) & MRCommand_Aliased;
+    mux->names = acquireIndexNames(key, keylen, aliased);
+    if (aliased && (keylen != mux->names->targetLen || memcmp(key, mux->names->target, keylen))) {
+      // the shards' commands are copies of the command, so its key is resolved once for all
+      MRCommand_ReplaceArg(cmd, mux->keyOffset, mux->names->target, mux->names->targetLen);
+    }
+    key = mux->names->target;
+    keylen = mux->names->targetLen;
+    int slot = SearchCluster_PinnedSlot(key, keylen);
+    if (slot >= 0) {
+      mux->targetSlots = malloc(sizeof(*mux->targetSlots));
+      mux->targetSlots[0] = slot;
+      mux->numTargets = 1;
+    } else if (queryIdx > 0) {
+      routeQuery(mux, key, keylen, queryIdx);
     }
   }
   return SearchCluster_GetCommandGenerator(mux, cmd);
 }
 
+/* Multiplex a command to the cluster using an iterator that will yield a multiplexed command per
+ * iteration, based on the original command */
+MRCommandGenerator SearchCluster_MultiplexCommand(SearchCluster *c, MRCommand *cmd) {
+  return multiplexCommand(c, cmd, -1);
+}
+
+MRCommandGenerator SearchCluster_MultiplexQuery(SearchCluster *c, MRCommand *cmd, int queryIdx) {
+  return multiplexCommand(c, cmd, queryIdx);
+}
+
+/* A command generator yielding the commands a multi-key command was split into */
+typedef struct {
+  MRCommand *cmds;
+  size_t num;
+  size_t offset;
+} keysMuxIterator;
+
+static int keysMux_Next(void *ctx, MRCommand *cmd) {
+  keysMuxIterator *it = ctx;
+  if (it->offset >= it->num) {
+    return 0;
+  }
+  // the command is handed over
+  *cmd = it->cmds[it->offset++];
+  return 1;
+}
+
+static size_t keysMux_Len(void *ctx) {
+  return ((keysMuxIterator *)ctx)->num;
+}
+
+static void keysMux_Free(void *ctx) {
+  keysMuxIterator *it = ctx;
+  for (size_t i = it->offset; i < it->num; i++) {
+    MRCommand_Free(&it->cmds[i]);
+  }
+  free(it->cmds);
+  free(it);
+}
+
+void SCKeysMap_Free(SCKeysMap *m) {
+  free(m->offsets);
+  free(m->positions);
+  free(m);
+}
+
+MRCommandGenerator SearchCluster_MultiplexKeys(SearchCluster *c, MRCommand *cmd, int firstKey,
+                                               SCKeysMap **map) {
+  *map = NULL;
+  size_t numKeys = cmd->num > firstKey ? cmd->num - firstKey : 0;
+  size_t indexLen;
+  const char *index = MRCommand_ArgStringPtrLen(cmd, 1, &indexLen);
+  // a single-partition index has all its documents on its shard
+  if (!SearchCluster_Ready(c) || !c->shardsStartSlots || !numKeys ||
+      SearchCluster_PinnedSlot(index, indexLen) >= 0) {
+    return SearchCluster_MultiplexCommand(c, cmd);
+  }
+
+  // the partition of every key, and the number of keys of every partition
+  size_t *keyParts = malloc(numKeys * sizeof(*keyParts));
+  size_t *counts = calloc(c->size, sizeof(*counts));
+  for (size_t i = 0; i < numKeys; i++) {
+    size_t len;
+    const char *key = MRCommand_ArgStringPtrLen(cmd, firstKey + i, &len);
+    int slot = MR_KeySlot(key, len);
+    if (slot < 0) {
+      free(keyParts);
+      free(counts);
+      return SearchCluster_MultiplexCommand(c, cmd);
+    }
+    keyParts[i] = SearchCluster_PartitionForSlot(c, slot);
+    counts[keyParts[i]]++;
+  }
+
+  SCKeysMap *m = malloc(sizeof(*m));
+  m->numKeys = numKeys;
+  m->numCmds = 0;
+  for (size_t p = 0; p < c->size; p++) {
+    m->numCmds += counts[p] > 0;
+  }
+  m->offsets = malloc((m->numCmds + 1) * sizeof(*m->offsets));
+  m->positions = malloc(numKeys * sizeof(*m->positions));
+
+  // the commands of the partitions with keys, in the order of the partitions. counts become the
+  // next place of a partition's key in positions
+  keysMuxIterator *it = calloc(1, sizeof(*it));
+  it->cmds = malloc(m->numCmds * sizeof(*it->cmds));
+  size_t *cmdOfPart = malloc(c->size * sizeof(*cmdOfPart));
+  size_t total = 0;
+  for (size_t p = 0; p < c->size; p++) {
+    if (!counts[p]) continue;
+    size_t n = it->num++;
+    cmdOfPart[p] = n;
+    m->offsets[n] = total;
+    total += counts[p];
+    counts[p] = m->offsets[n];
+
+    MRCommand *pc = &it->cmds[n];
+    *pc = (MRCommand){NULL};
+    for (int i = 0; i < firstKey; i++) {
+      MRCommand_AppendFrom(pc, cmd, i);
+    }
+    pc->targetSlot = c->shardsStartSlots[p];
+  }
+  m->offsets[m->numCmds] = total;
+  for (size_t i = 0; i < numKeys; i++) {
+    size_t p = keyParts[i];
+    m->positions[counts[p]++] = i;
+    MRCommand_AppendFrom(&it->cmds[cmdOfPart[p]], cmd, firstKey + i);
+  }
+  free(cmdOfPart);
+  free(counts);
+  free(keyParts);
+  MRCommand_Free(cmd);
+
+  *map = m;
+  return (MRCommandGenerator){
+      .Next = keysMux_Next, .Len = keysMux_Len, .Free = keysMux_Free, .ctx = it};
+}
+
 /* Make sure that the cluster either has a size or updates its size from the topology when updated.
  * If the user did not define the number of partitions, we just take the number of shards in the
  * first topology update and get a fix on that */
-void SearchCluster_EnsureSize(RedisModuleCtx *ctx, SearchCluster *c, MRClusterTopology *topo) {
+int SearchCluster_EnsureSize(RedisModuleCtx *ctx, SearchCluster *c, MRClusterTopology *topo) {
+  int changed = 0;
   // If the cluster doesn't have a size yet - set the partition number aligned to the shard number
   if (MRClusterTopology_IsValid(topo)) {
     RedisModule_Log(ctx, "debug", "Setting number of partitions to %ld", topo->numShards);
+    int *startSlots = malloc(sizeof(int) * topo->numShards);
+    for(size_t i = 0 ; i < topo->numShards ; ++i){
+      startSlots[i] = topo->shards[i].startSlot;
+    }
+    if (c->size != topo->numShards || !c->shardsStartSlots ||
+        memcmp(c->shardsStartSlots, startSlots, sizeof(int) * c->size)) {
+      changed = 1;
+    }
     c->size = topo->numShards;
     if(c->shardsStartSlots){
       free(c->shardsStartSlots);
     }
-    c->shardsStartSlots = malloc(sizeof(int) * c->size);
-    for(size_t i = 0 ; i < c->size ; ++i){
-      c->shardsStartSlots[i] = topo->shards[i].startSlot;
-    }
+    c->shardsStartSlots = startSlots;
+    buildSlotPartitions(c, topo->numSlots);
     PartitionCtx_SetSize(&c->part, topo->numShards);
+    PartitionCtx_SetPartitionSlots(&c->part, c->shardsStartSlots);
   }
+  return changed;
 }
 
 void SetMyPartition(MRClusterTopology *ct, MRClusterShard *myShard) {
   SearchCluster *c = GetSearchCluster();
+  if (!myShard) {
+    return;
+  }
   for (size_t i = 0; i < c->size; ++i) {
     int slot = GetSlotByPartition(&c->part, i);
     if (myShard->startSlot <= slot && myShard->endSlot >= slot) {
@@ -421,3 +957,24 @@ void SetMyPartition(MRClusterTopology *ct, MRClusterShard *myShard) {
     }
   }
 }
+
+long long SearchCluster_AppendShardTimeout(MRCommand *cmd, long long budgetMS) {
+  char buf[32];
+  long long timeout = MR_ShardTimeoutMS(budgetMS);
+  // shards take the last TIMEOUT, so this one overrides the client's own
+  int n = snprintf(buf, sizeof(buf), "%lld", timeout);
+  MRCommand_Append(cmd, "TIMEOUT", strlen("TIMEOUT"));
+  MRCommand_Append(cmd, buf, n);
+  cmd->timeoutMS = timeout;
+  return timeout;
+}
+
+int SearchCluster_IsTimeoutReply(MRReply *r) {
+  if (!r || MRReply_Type(r) != MR_REPLY_ERROR) {
+    return 0;
+  }
+  size_t len;
+  const char *err = MRReply_String(r, &len);
+  return err && len >= strlen(SHARD_TIMEOUT_ERR) &&
+         !strncasecmp(err, SHARD_TIMEOUT_ERR, strlen(SHARD_TIMEOUT_ERR));
+}
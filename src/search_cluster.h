@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include "dep/rmr/command.h"
 #include "dep/rmr/cluster.h"
+#include "dep/rmr/reply.h"
 #include "partition.h"
 
 /* A search cluster contains the configuations for partitioning and multiplexing commands */
@@ -12,6 +13,9 @@ typedef struct {
   int* shardsStartSlots;
   PartitionCtx part;
   size_t myPartition;
+  /* The partition of the shard serving every slot, built along with shardsStartSlots */
+  uint16_t *slotPartitions;
+  size_t numSlots;
 
 } SearchCluster;
 
@@ -21,22 +25,102 @@ SearchCluster *GetSearchCluster();
  * TODO: This whole object is a bit redundant and adds nothing on top of the partitioner. Consider
  * consolidating the two  */
 SearchCluster NewSearchCluster(size_t size, const char **table, size_t tableSize);
+/* Free the shards' slots and the slot partitions of a cluster, leaving it without partitions */
+void SearchCluster_Free(SearchCluster *c);
 void InitGlobalSearchCluster(size_t size, const char **table, size_t tableSize);
 /* A command generator that multiplexes a command across multiple partitions by tagging it */
 typedef struct {
   MRCommand *cmd;
-  char *keyAlias;
+  /* The cached names of the command's index, with its alias resolved */
+  struct indexNames *names;
   int keyOffset;
   size_t offset;
   SearchCluster *cluster;
+  /* The wire format of the shards' commands, which differ only in their target slot. Formatted
+   * from the first command */
+  sds wire;
+  /* The slots of the shards the command is sent to, or NULL if it is sent to all partitions */
+  int *targetSlots;
+  size_t numTargets;
 } SCCommandMuxIterator;
 
 int SearchCluster_Ready(SearchCluster *sc);
 
 /* Multiplex a command to the cluster using an iterator that will yield a multiplexed command per
- * iteration, based on the original command */
+ * iteration, based on the original command. A command on a single-partition index yields a single
+ * command, to the shard of the index */
 MRCommandGenerator SearchCluster_MultiplexCommand(SearchCluster *c, MRCommand *cmd);
 
+/* Multiplex a query on an index, like SearchCluster_MultiplexCommand. If the index has a routing
+ * field and the query, at argument queryIdx, restricts the field to a set of values, the command
+ * is only sent to the partitions of these values */
+MRCommandGenerator SearchCluster_MultiplexQuery(SearchCluster *c, MRCommand *cmd, int queryIdx);
+
+/* Where the keys of a multi-key command went, when it was split into a command per shard */
+typedef struct {
+  size_t numKeys;
+  size_t numCmds;
+  /* The keys of the i-th command are the keys of the original command at positions[offsets[i]]
+   * to positions[offsets[i+1]-1], in order */
+  size_t *offsets;
+  size_t *positions;
+} SCKeysMap;
+
+void SCKeysMap_Free(SCKeysMap *m);
+
+/* Multiplex a command whose arguments from firstKey on are document keys, sending every shard only
+ * the keys it owns. Takes over cmd. Sets map to where the keys went, or to NULL if the shards of
+ * the keys are not known, and the command is multiplexed to all the partitions with all its keys */
+MRCommandGenerator SearchCluster_MultiplexKeys(SearchCluster *c, MRCommand *cmd, int firstKey,
+                                               SCKeysMap **map);
+
+/* The partition of the shard that serves a slot. O(1), from the cluster's map of the slots */
+size_t SearchCluster_PartitionForSlot(SearchCluster *sc, int slot);
+
+/* Set how the commands on an index are routed. A single-partition index is pinned to the shard
+ * serving slot, and exists on that shard only; use -1 for an index that spans all partitions. An
+ * index with a routing field keeps each document in the partition of the document's value of the
+ * field; use NULL for none. The routing is only set if no newer version of it (or of its deletion)
+ * was set. Returns 1 if it was set */
+int SearchCluster_SetIndexRouting(const char *name, size_t len, int slot, const char *routingField,
+                                  uint64_t version);
+
+/* Delete the routing of an index, unless a newer version of it was set. The deletion is kept, so
+ * that the older versions coordinators may still send do not bring the routing back, until it
+ * expires */
+int SearchCluster_DelIndexRouting(const char *name, size_t len, uint64_t version);
+
+/* Deleted routings are forgotten this long (ms) after their version, by when every coordinator
+ * has pulled them a few times */
+#define SC_INDEX_ROUTING_DELETION_TTL_MS (10 * 60 * 1000)
+
+/* Forget the expired deletions of routings. Returns the number forgotten */
+size_t SearchCluster_ExpireIndexRoutingDeletions();
+
+/* Free the routing of all the indexes */
+void SearchCluster_FreeIndexRouting();
+
+/* The version for a change of the routing of an index made by this node: the time in ms, or past
+ * the version the routing has, if this node's clock is behind */
+uint64_t SearchCluster_NextIndexRoutingVersion(const char *name, size_t len);
+
+typedef void (*SCIndexRoutingCallback)(const char *name, size_t len, int slot,
+                                       const char *routingField, uint64_t version, int deleted,
+                                       void *ctx);
+
+/* Call cb on the routing of every index, deleted ones included, with the routing locked. cb must
+ * not change the routing. Returns the number of routings */
+size_t SearchCluster_ForEachIndexRouting(SCIndexRoutingCallback cb, void *ctx);
+
+/* Whether an index is pinned to a shard or has a routing field */
+int SearchCluster_HasIndexRouting(const char *name, size_t len);
+
+/* The slot of the shard an index is pinned to, or -1 if the index spans all partitions */
+int SearchCluster_PinnedSlot(const char *name, size_t len);
+
+/* Drop the cached names of the indexes, after their aliases changed */
+void SearchCluster_InvalidateIndexNames();
+
 /* Rewrite a command by tagging its sharding key, using its partitioning key (which may or may not
  * be the same key) */
 int SearchCluster_RewriteCommand(SearchCluster *c, MRCommand *cmd, int partitionKey);
@@ -48,9 +132,9 @@ int SearchCluster_RewriteCommandToFirstPartition(SearchCluster *sc, MRCommand *c
  * of the argument being tagged, and it may be the paritioning key itself */
 int SearchCluster_RewriteCommandArg(SearchCluster *c, MRCommand *cmd, int partitionKey, int arg);
 
-/* Make sure that if the cluster is unaware of its sizing, it will take the size from the topology
- */
-void SearchCluster_EnsureSize(RedisModuleCtx *ctx, SearchCluster *c, MRClusterTopology *topo);
+/* Make sure that if the cluster is unaware of its sizing, it will take the size from the topology.
+ * Returns 1 if the partitions changed, as they do when the cluster gets its first valid topology */
+int SearchCluster_EnsureSize(RedisModuleCtx *ctx, SearchCluster *c, MRClusterTopology *topo);
 
 void SetMyPartition(MRClusterTopology *ct, MRClusterShard *myShard);
 
@@ -58,4 +142,11 @@ char *writeTaggedId(const char *key, size_t keyLen, const char *tag, size_t tagL
                     size_t *taggedLen);
 
 int checkTLS(char** client_key, char** client_cert, char** ca_cert);
+
+/* Append a TIMEOUT to a shard command, so that shards give up on a query about when the
+ * coordinator does. budgetMS is the time left for the whole request. Returns the shards' timeout */
+long long SearchCluster_AppendShardTimeout(MRCommand *cmd, long long budgetMS);
+
+/* Whether a shard reply is the error of a query that reached its timeout */
+int SearchCluster_IsTimeoutReply(MRReply *r);
 #endif
@@ -0,0 +1,254 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include "search_request.h"
+#include "fnv32.h"
+
+/* The number of request layouts whose rewritten shard commands are kept */
+#define SEARCH_PLANS_SIZE 64
+
+void searchRequestCtx_Free(searchRequestCtx *r) {
+  free(r->queryString);
+  free(r);
+}
+
+static int argEquals(RedisModuleString *arg, const char *s) {
+  size_t n;
+  const char *str = RedisModule_StringPtrLen(arg, &n);
+  return n == strlen(s) && !strncasecmp(str, s, n);
+}
+
+static int rscParseProfile(searchRequestCtx *req, RedisModuleString **argv, int argc) {
+  req->profileArgs = 0;
+  if (argEquals(argv[0], "FT.PROFILE")) {
+    req->profileArgs += 2;
+    req->profileClock = clock();
+    if (argc > 3 && argEquals(argv[3], "LIMITED")) {
+      req->profileLimited = 1;
+      req->profileArgs++;
+    }
+    if (argc <= 2 + req->profileArgs || !argEquals(argv[1 + req->profileArgs], "QUERY")) {
+      return REDISMODULE_ERR;
+    }
+  }
+  return REDISMODULE_OK;
+}
+
+/* Parse the request's options in one pass, taking the first of every option with values. Sets
+ * limitIndex to the position of LIMIT, or to 0 if there is none */
+static searchRequestCtx *parseRequest(RedisModuleString **argv, int argc, int *limitIndex) {
+  /* A search request must have at least 3 args */
+  if (argc < 3) {
+    return NULL;
+  }
+
+  searchRequestCtx *req = calloc(1, sizeof(searchRequestCtx));
+
+  if (rscParseProfile(req, argv, argc) != REDISMODULE_OK) {
+    free(req);
+    return NULL;
+  }
+
+  int argvOffset = 2 + req->profileArgs;
+  req->queryString = strdup(RedisModule_StringPtrLen(argv[argvOffset++], NULL));
+  req->limit = 10;
+  req->offset = 0;
+  req->sortAscending = 1;
+  *limitIndex = 0;
+
+  int returnIndex = 0, timeoutIndex = 0;
+  for (int i = argvOffset; i < argc; i++) {
+    size_t n;
+    const char *arg = RedisModule_StringPtrLen(argv[i], &n);
+#define ARG_IS(s) (n == sizeof(s) - 1 && !strncasecmp(arg, s, n))
+    if (ARG_IS("WITHSCORES")) {
+      // marks the user set WITHSCORES. internally it's always set
+      req->withScores = 1;
+    } else if (ARG_IS("EXPLAINSCORE")) {
+      req->withExplainScores = 1;
+    } else if (ARG_IS("WITHSORTKEYS")) {
+      req->withSortingKeys = 1;
+    } else if (ARG_IS("NOCONTENT")) {
+      req->noContent = 1;
+    } else if (ARG_IS("WITHPAYLOADS")) {
+      req->withPayload = 1;
+    } else if (ARG_IS("SORTBY") && !req->withSortby) {
+      // SORTBY {field} [ASC|DESC]
+      req->withSortby = 1;
+      if (i + 2 < argc && argEquals(argv[i + 2], "DESC")) {
+        req->sortAscending = 0;
+      }
+    } else if (ARG_IS("RETURN") && !returnIndex) {
+      returnIndex = i;
+    } else if (ARG_IS("LIMIT") && !*limitIndex) {
+      *limitIndex = i;
+    } else if (ARG_IS("TIMEOUT") && !timeoutIndex) {
+      timeoutIndex = i;
+    }
+#undef ARG_IS
+  }
+
+  // RETURN 0 equals NOCONTENT
+  if (!req->noContent && returnIndex) {
+    long long numReturns = -1;
+    if (returnIndex + 1 < argc) {
+      RedisModule_StringToLongLong(argv[returnIndex + 1], &numReturns);
+    }
+    if (numReturns <= 0) {
+      req->noContent = 1;
+    }
+  }
+
+  // Parse LIMIT {offset} {limit}
+  long long offset, limit;
+  if (*limitIndex && *limitIndex + 2 < argc &&
+      RedisModule_StringToLongLong(argv[*limitIndex + 1], &offset) == REDISMODULE_OK &&
+      RedisModule_StringToLongLong(argv[*limitIndex + 2], &limit) == REDISMODULE_OK) {
+    req->offset = offset;
+    req->limit = limit;
+  }
+  if (req->limit < 0 || req->offset < 0) {
+    searchRequestCtx_Free(req);
+    return NULL;
+  }
+
+  // Parse TIMEOUT {ms}
+  if (timeoutIndex && timeoutIndex + 1 < argc) {
+    RedisModule_StringToLongLong(argv[timeoutIndex + 1], &req->timeout);
+  }
+
+  return req;
+}
+
+searchRequestCtx *rscParseRequest(RedisModuleString **argv, int argc) {
+  int limitIndex;
+  return parseRequest(argv, argc, &limitIndex);
+}
+
+/* Rewrite a flat search request to the command sent to the shards */
+static void rewriteFlatSearch(MRCommand *cmd, const searchRequestCtx *req, int limitIndex) {
+  // replace the LIMIT {offset} {limit} with LIMIT 0 {offset+limit}, because we need all top N to
+  // merge
+  if (limitIndex && req->limit > 0 && limitIndex < cmd->num - 2) {
+    MRCommand_ReplaceArg(cmd, limitIndex + 1, "0", 1);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", req->limit + req->offset);
+    MRCommand_ReplaceArg(cmd, limitIndex + 2, buf, strlen(buf));
+  }
+
+  /* Replace our own FT command with _FT. command */
+  if (req->profileArgs == 0) {
+    MRCommand_ReplaceArg(cmd, 0, "_FT.SEARCH", sizeof("_FT.SEARCH") - 1);
+  } else {
+    MRCommand_ReplaceArg(cmd, 0, "_FT.PROFILE", sizeof("_FT.PROFILE") - 1);
+  }
+
+  // adding the WITHSCORES option anyway immediately after the query.
+  // Worst case it will appears twice.
+  MRCommand_AppendArgsAtPos(cmd, 3 + req->profileArgs, 1, "WITHSCORES");
+  if (req->withSortby) {
+    // if sort by requested we adding the WITHSORTKEYS option anyway immediately after the query.
+    // Worst case it will appears twice.
+    MRCommand_AppendArgsAtPos(cmd, 3 + req->profileArgs, 1, "WITHSORTKEYS");
+  }
+}
+
+/* The parsed options and the shard command of a request layout */
+typedef struct {
+  uint32_t hash;
+  /* The request's arguments, to tell apart layouts with the same hash */
+  MRCommand args;
+  int queryIdx;
+  searchRequestCtx req;
+  /* The shard command, with the query of the request that built it. The query keeps its position
+   * in the shard command, as the rewrite only inserts arguments after it */
+  MRCommand cmd;
+} searchPlan;
+
+static searchPlan plans_g[SEARCH_PLANS_SIZE];
+static pthread_mutex_t plansLock_g = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hash the arguments of a request, except for its query */
+static uint32_t hashLayout(RedisModuleString **argv, int argc, int queryIdx) {
+  uint32_t h = fnv_32a_buf(&argc, sizeof(argc), 0);
+  for (int i = 0; i < argc; i++) {
+    if (i == queryIdx) continue;
+    size_t n;
+    const char *arg = RedisModule_StringPtrLen(argv[i], &n);
+    h = fnv_32a_buf(&n, sizeof(n), h);
+    h = fnv_32a_buf((void *)arg, n, h);
+  }
+  return h;
+}
+
+static int planMatches(const searchPlan *p, uint32_t h, RedisModuleString **argv, int argc,
+                       int queryIdx) {
+  if (!p->args.args || p->hash != h || p->args.num != argc || p->queryIdx != queryIdx) {
+    return 0;
+  }
+  for (int i = 0; i < argc; i++) {
+    if (i == queryIdx) continue;
+    size_t n, pn;
+    const char *arg = RedisModule_StringPtrLen(argv[i], &n);
+    const char *parg = MRCommand_ArgStringPtrLen(&p->args, i, &pn);
+    if (n != pn || memcmp(arg, parg, n)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+searchRequestCtx *rscParseFlatSearch(RedisModuleString **argv, int argc, MRCommand *cmd) {
+  if (argc < 3) {
+    return NULL;
+  }
+  searchRequestCtx profile = {0};
+  if (rscParseProfile(&profile, argv, argc) != REDISMODULE_OK) {
+    return NULL;
+  }
+  int queryIdx = 2 + profile.profileArgs;
+  uint32_t h = hashLayout(argv, argc, queryIdx);
+  searchPlan *p = &plans_g[h % SEARCH_PLANS_SIZE];
+
+  pthread_mutex_lock(&plansLock_g);
+  if (planMatches(p, h, argv, argc, queryIdx)) {
+    searchRequestCtx *req = malloc(sizeof(*req));
+    *req = p->req;
+    *cmd = MRCommand_Copy(&p->cmd);
+    pthread_mutex_unlock(&plansLock_g);
+
+    size_t n;
+    const char *query = RedisModule_StringPtrLen(argv[queryIdx], &n);
+    req->queryString = strdup(query);
+    req->profileClock = profile.profileClock;
+    MRCommand_ReplaceArg(cmd, queryIdx, query, n);
+    return req;
+  }
+  pthread_mutex_unlock(&plansLock_g);
+
+  int limitIndex;
+  searchRequestCtx *req = parseRequest(argv, argc, &limitIndex);
+  if (!req) {
+    return NULL;
+  }
+  *cmd = MR_NewCommandFromRedisStrings(argc, argv);
+  MRCommand args = MRCommand_Copy(cmd);
+  rewriteFlatSearch(cmd, req, limitIndex);
+
+  // the new layout takes the place of the one in its slot
+  searchPlan old;
+  pthread_mutex_lock(&plansLock_g);
+  old = *p;
+  *p = (searchPlan){
+      .hash = h, .args = args, .queryIdx = queryIdx, .req = *req, .cmd = MRCommand_Copy(cmd)};
+  p->req.queryString = NULL;
+  pthread_mutex_unlock(&plansLock_g);
+
+  if (old.args.args) {
+    MRCommand_Free(&old.args);
+    MRCommand_Free(&old.cmd);
+  }
+  return req;
+}
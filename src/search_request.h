@@ -0,0 +1,42 @@
+#ifndef SRC_SEARCH_REQUEST_H_
+#define SRC_SEARCH_REQUEST_H_
+
+#include <time.h>
+#include "redismodule.h"
+#include "dep/rmr/command.h"
+
+typedef struct {
+  char *queryString;
+  long long offset;
+  long long limit;
+  int withScores;
+  int withExplainScores;
+  int withPayload;
+  int withSortby;
+  int sortAscending;
+  int withSortingKeys;
+  int noContent;
+
+  // used to signal profile flag and count related args
+  int profileArgs;
+  int profileLimited;
+  clock_t profileClock;
+  void *reducer;
+  // the client's own TIMEOUT, 0 if not given
+  long long timeout;
+} searchRequestCtx;
+
+void searchRequestCtx_Free(searchRequestCtx *r);
+
+/* Parse an FT.SEARCH (or FT.PROFILE ... SEARCH QUERY) request in a single pass over its arguments.
+ * Returns NULL if the request is invalid */
+searchRequestCtx *rscParseRequest(RedisModuleString **argv, int argc);
+
+/* Parse a request, and build the command a flat search sends to every shard: the internal command,
+ * with scores and sorting keys, and the top offset+limit results.
+ * Most requests share a handful of option layouts, and differ only in their query. A request with
+ * the same options as a recent one reuses its parsed options and rewritten command, and only its
+ * query is spliced in. Returns NULL if the request is invalid */
+searchRequestCtx *rscParseFlatSearch(RedisModuleString **argv, int argc, MRCommand *cmd);
+
+#endif /* SRC_SEARCH_REQUEST_H_ */
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include "string_set.h"
+#include "fnv32.h"
+
+/* The size of the blocks copied strings are stored in. Longer strings get a block of their own */
+#define STRING_SET_BLOCK_SIZE (64 * 1024)
+
+/* Put the position of a value in the first free bucket of its probe sequence */
+static void insertPos(StringSet *set, uint32_t hash, uint32_t pos) {
+  size_t b = hash & set->mask;
+  while (set->table[b]) {
+    b = (b + 1) & set->mask;
+  }
+  set->table[b] = pos + 1;
+}
+
+/* Allocate a table for at least n values, keeping it at most half full */
+static void rehash(StringSet *set, size_t n) {
+  size_t tableSize = 16;
+  while (tableSize < n * 2) tableSize *= 2;
+
+  free(set->table);
+  set->table = calloc(tableSize, sizeof(*set->table));
+  set->mask = tableSize - 1;
+  for (size_t i = 0; i < set->size; i++) {
+    insertPos(set, set->values[i].hash, i);
+  }
+}
+
+StringSet *NewStringSet(size_t sizeHint, int copy) {
+  StringSet *set = calloc(1, sizeof(*set));
+  set->copy = copy;
+  set->cap = sizeHint ? sizeHint : 16;
+  set->values = malloc(set->cap * sizeof(*set->values));
+  rehash(set, set->cap);
+  return set;
+}
+
+static const char *copyString(StringSet *set, const char *s, size_t len) {
+  if (!len) {
+    return "";
+  }
+  if (len >STRING_SET_BLOCK_SIZE / 4) {
+    // a long string would waste most of a shared block
+    char *block = malloc(len);
+    set->blocks = realloc(set->blocks, (set->numBlocks + 1) * sizeof(*set->blocks));
+    // keep the current block last, so that the next strings still go to it
+    if (set->numBlocks) {
+      set->blocks[set->numBlocks] = set->blocks[set->numBlocks - 1];
+      set->blocks[set->numBlocks - 1] = block;
+    } else {
+      set->blocks[0] = block;
+      set->blockUsed = set->blockCap = 0;
+    }
+    set->numBlocks++;
+    memcpy(block, s, len);
+    return block;
+  }
+  if (set->blockCap - set->blockUsed < len) {
+    set->blocks = realloc(set->blocks, (set->numBlocks + 1) * sizeof(*set->blocks));
+    set->blocks[set->numBlocks++] = malloc(STRING_SET_BLOCK_SIZE);
+    set->blockUsed = 0;
+    set->blockCap = STRING_SET_BLOCK_SIZE;
+  }
+  char *p = set->blocks[set->numBlocks - 1] + set->blockUsed;
+  memcpy(p, s, len);
+  set->blockUsed += len;
+  return p;
+}
+
+int StringSet_Add(StringSet *set, const char *s, size_t len) {
+  uint32_t hash = fnv_32a_buf((void *)s, len, 0);
+  size_t b = hash & set->mask;
+  for (uint32_t pos; (pos = set->table[b]); b = (b + 1) & set->mask) {
+    const StringSetValue *v = &set->values[pos - 1];
+    if (v->hash == hash && v->len == len && !memcmp(v->str, s, len)) {
+      return 0;
+    }
+  }
+
+  if (set->size == set->cap) {
+    set->cap *= 2;
+    set->values = realloc(set->values, set->cap * sizeof(*set->values));
+  }
+  set->values[set->size] = (StringSetValue){
+      .str = set->copy ? copyString(set, s, len) : s, .len = len, .hash = hash};
+  if ((set->size + 1) * 2 > set->mask + 1) {
+    // the table is too full - the new value is placed along with the others
+    set->size++;
+    rehash(set, set->size);
+  } else {
+    set->table[b] = ++set->size;
+  }
+  return 1;
+}
+
+static int cmpValues(const void *p1, const void *p2) {
+  const StringSetValue *v1 = p1, *v2 = p2;
+  int rc = memcmp(v1->str, v2->str, v1->len < v2->len ? v1->len : v2->len);
+  if (rc) return rc;
+  return v1->len < v2->len ? -1 : v1->len > v2->len;
+}
+
+void StringSet_Sort(StringSet *set) {
+  qsort(set->values, set->size, sizeof(*set->values), cmpValues);
+  // the values moved, so their positions in the table are rebuilt
+  memset(set->table, 0, (set->mask + 1) * sizeof(*set->table));
+  for (size_t i = 0; i < set->size; i++) {
+    insertPos(set, set->values[i].hash, i);
+  }
+}
+
+void StringSet_Free(StringSet *set) {
+  for (size_t i = 0; i < set->numBlocks; i++) {
+    free(set->blocks[i]);
+  }
+  free(set->blocks);
+  free(set->values);
+  free(set->table);
+  free(set);
+}
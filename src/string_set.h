@@ -0,0 +1,54 @@
+#ifndef SRC_STRING_SET_H_
+#define SRC_STRING_SET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A value of a string set. Unless the set copies its values, str points into the buffer it was
+ * added from, which must outlive the set */
+typedef struct {
+  const char *str;
+  size_t len;
+  uint32_t hash;
+} StringSetValue;
+
+/* A set of strings, hashed with open addressing. The values are kept in the order they were added,
+ * and the table only holds their positions */
+typedef struct {
+  StringSetValue *values;
+  size_t size;
+  size_t cap;
+  /* Positions of the values plus one, 0 marking an empty bucket. Its size is a power of two */
+  uint32_t *table;
+  size_t mask;
+  /* Whether added strings are copied to blocks owned by the set */
+  int copy;
+  char **blocks;
+  size_t numBlocks;
+  size_t blockUsed;
+  size_t blockCap;
+} StringSet;
+
+/* Create a set sized for about sizeHint values. With copy set, the set keeps copies of the strings
+ * it is given, otherwise it only references them */
+StringSet *NewStringSet(size_t sizeHint, int copy);
+
+/* Add a string to the set. Returns 1 if it was added, or 0 if the set already had it */
+int StringSet_Add(StringSet *set, const char *s, size_t len);
+
+static inline size_t StringSet_Size(const StringSet *set) {
+  return set->size;
+}
+
+/* The i-th value of the set, in the order of addition or, once sorted, in byte order */
+static inline const char *StringSet_Get(const StringSet *set, size_t i, size_t *len) {
+  *len = set->values[i].len;
+  return set->values[i].str;
+}
+
+/* Sort the values of the set in byte order, shorter strings before the strings they prefix */
+void StringSet_Sort(StringSet *set);
+
+void StringSet_Free(StringSet *set);
+
+#endif /* SRC_STRING_SET_H_ */
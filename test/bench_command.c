@@ -0,0 +1,77 @@
+#include "redismodule.h"
+#include <rmr/command.h>
+#include <crc16_tags.h>
+#include "search_cluster.h"
+#include "alias.h"
+#include "minunit.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Benchmark building the shard commands of a typical FT.SEARCH: the coordinator rewrites the
+ * user's command, multiplexes it to every partition, and formats each partition's command.
+ */
+
+#define NUM_REQUESTS 200000
+#define NUM_PARTITIONS 16
+
+static double secondsSince(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void benchSearchRewrite() {
+  SearchCluster sc = NewSearchCluster(NUM_PARTITIONS, crc16_slot_table, 16384);
+  char *argv[] = {"FT.SEARCH", "products", "@title:(wireless headphones) @price:[50 200]",
+                  "SORTBY",    "price",    "ASC",
+                  "LIMIT",     "20",       "10",
+                  "RETURN",    "2",        "title",
+                  "price"};
+  int argc = sizeof(argv) / sizeof(*argv);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  size_t nbytes = 0, ncmds = 0;
+  for (size_t i = 0; i < NUM_REQUESTS; i++) {
+    // the same rewrite as the FT.SEARCH handler
+    MRCommand cmd = MR_NewCommandFromStrings(argc, argv);
+    MRCommand_ReplaceArg(&cmd, 7, "0", 1);
+    MRCommand_ReplaceArg(&cmd, 8, "30", 2);
+    MRCommand_ReplaceArg(&cmd, 0, "_FT.SEARCH", sizeof("_FT.SEARCH") - 1);
+    MRCommand_AppendArgsAtPos(&cmd, 3, 1, "WITHSCORES");
+    MRCommand_AppendArgsAtPos(&cmd, 3, 1, "WITHSORTKEYS");
+    SearchCluster_AppendShardTimeout(&cmd, 500);
+
+    MRCommandGenerator cg = SearchCluster_MultiplexCommand(&sc, &cmd);
+    MRCommand mxcmd;
+    while (cg.Next(cg.ctx, &mxcmd)) {
+      if (!mxcmd.cmd) {
+        mxcmd.cmd = MRCommand_Format(&mxcmd);
+      }
+      nbytes += sdslen(mxcmd.cmd);
+      ncmds++;
+      MRCommand_Free(&mxcmd);
+    }
+    cg.Free(cg.ctx);
+  }
+  double elapsed = secondsSince(&start);
+
+  mu_check(ncmds == NUM_REQUESTS * NUM_PARTITIONS);
+  printf("Built %d requests of %d shard commands (%zu bytes) in %.3fs (%.0f requests/s)\n",
+         NUM_REQUESTS, NUM_PARTITIONS, nbytes, elapsed, NUM_REQUESTS / elapsed);
+}
+
+int main(int argc, char **argv) {
+  RedisModule_Alloc = malloc;
+  RedisModule_Calloc = calloc;
+  RedisModule_Realloc = realloc;
+  RedisModule_Free = free;
+  RedisModule_Strdup = strdup;
+  IndexAlias_InitGlobal();
+  MU_RUN_TEST(benchSearchRewrite);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,128 @@
+#include "redismodule.h"
+#include "dist_groupby.h"
+#include "minunit.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Benchmark the coordinator's merge group-by over synthetic partial groups: every one of the
+ * shards sends a row for each group, with a partial COUNT and a partial MAX.
+ */
+
+#define NUM_GROUPS 1000000
+#define NUM_SHARDS 3
+
+typedef struct {
+  ResultProcessor base;
+  const RLookupKey *key;
+  const RLookupKey *count;
+  const RLookupKey *max;
+  size_t next;
+} PartialsSource;
+
+static int partialsNext(ResultProcessor *rp, SearchResult *r) {
+  PartialsSource *src = (PartialsSource *)rp;
+  if (src->next == NUM_GROUPS * NUM_SHARDS) {
+    return RS_RESULT_EOF;
+  }
+  size_t group = src->next % NUM_GROUPS, shard = src->next / NUM_GROUPS;
+  src->next++;
+
+  // Partials arrive from the shards as strings
+  char buf[32];
+  int n = sprintf(buf, "group:%zu", group);
+  RLookup_WriteOwnKey(src->key, &r->rowdata, RS_NewCopiedString(buf, n));
+  n = sprintf(buf, "%zu", shard + 1);
+  RLookup_WriteOwnKey(src->count, &r->rowdata, RS_NewCopiedString(buf, n));
+  n = sprintf(buf, "%zu", group + shard);
+  RLookup_WriteOwnKey(src->max, &r->rowdata, RS_NewCopiedString(buf, n));
+  return RS_RESULT_OK;
+}
+
+static double secondsSince(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void mergeGroups(size_t memLimit) {
+  RLookup srclk = {0}, dstlk = {0};
+  RLookup_Init(&srclk, NULL);
+  RLookup_Init(&dstlk, NULL);
+
+  PartialsSource src = {.base = {.Next = partialsNext}};
+  src.key = RLookup_GetKey(&srclk, "brand", RLOOKUP_F_OCREAT);
+  src.count = RLookup_GetKey(&srclk, "__count", RLOOKUP_F_OCREAT);
+  src.max = RLookup_GetKey(&srclk, "__max", RLOOKUP_F_OCREAT);
+
+  const RLookupKey *srckeys[] = {src.key};
+  const RLookupKey *dstkeys[] = {RLookup_GetKey(&dstlk, "brand", RLOOKUP_F_OCREAT)};
+  DistGroupReducer reducers[] = {
+      {DistGroupOp_Sum, src.count, RLookup_GetKey(&dstlk, "count", RLOOKUP_F_OCREAT)},
+      {DistGroupOp_Max, src.max, RLookup_GetKey(&dstlk, "max", RLOOKUP_F_OCREAT)},
+  };
+
+  QueryIterator qiter = {0};
+  ResultProcessor *rp = RPDistGroup_New(srckeys, dstkeys, 1, reducers, 2);
+  RPDistGroup_SetMemoryLimit(rp, memLimit);
+  rp->upstream = &src.base;
+  rp->parent = &qiter;
+  src.base.parent = &qiter;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  SearchResult r = {0};
+  size_t ngroups = 0, nbad = 0;
+  while (rp->Next(rp, &r) == RS_RESULT_OK) {
+    double count = 0, max = 0;
+    RSValue_ToNumber(RLookup_GetItem(reducers[0].dstkey, &r.rowdata), &count);
+    RSValue_ToNumber(RLookup_GetItem(reducers[1].dstkey, &r.rowdata), &max);
+    // every group has partial counts 1..NUM_SHARDS, and its maximum is from the last shard
+    if (count != NUM_SHARDS * (NUM_SHARDS + 1) / 2 || max < NUM_SHARDS - 1) {
+      nbad++;
+    }
+    ngroups++;
+    SearchResult_Clear(&r);
+  }
+  double elapsed = secondsSince(&start);
+
+  mu_check(nbad == 0);
+  mu_check(ngroups == NUM_GROUPS);
+  mu_check(qiter.totalResults == NUM_GROUPS);
+  printf("Merged %d partial rows into %zu groups in %.3fs (%.0f rows/s), memory limit: %zu\n",
+         NUM_GROUPS * NUM_SHARDS, ngroups, elapsed, NUM_GROUPS * NUM_SHARDS / elapsed, memLimit);
+
+  SearchResult_Destroy(&r);
+  rp->Free(rp);
+  RLookup_Cleanup(&srclk);
+  RLookup_Cleanup(&dstlk);
+}
+
+void benchMergeGroups() {
+  mergeGroups(0);
+}
+
+// The groups take a few hundred MB, so they are spilled as a handful of runs
+void benchMergeGroupsSpill() {
+  mergeGroups(64 * 1024 * 1024);
+}
+
+// The lowest limit spills hundreds of runs, which are merged in several passes
+void benchMergeGroupsSpillMinLimit() {
+  mergeGroups(1);
+}
+
+int main(int argc, char **argv) {
+  RedisModule_Alloc = malloc;
+  RedisModule_Calloc = calloc;
+  RedisModule_Realloc = realloc;
+  RedisModule_Free = free;
+  RedisModule_Strdup = strdup;
+  MU_RUN_TEST(benchMergeGroups);
+  MU_RUN_TEST(benchMergeGroupsSpill);
+  MU_RUN_TEST(benchMergeGroupsSpillMinLimit);
+  MU_REPORT();
+  return minunit_status;
+}
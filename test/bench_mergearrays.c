@@ -0,0 +1,104 @@
+#include "redismodule.h"
+#include <rmr/reply.h>
+#include "minunit.h"
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * Benchmark merging the shards' replies of a large FT.MGET: every shard replies with an array of all
+ * the keys, NIL for the keys it does not own, and the coordinator takes the element of the owner
+ * of every key.
+ */
+
+#define NUM_KEYS 10000
+#define NUM_SHARDS 30
+#define NUM_ITERATIONS 50
+
+static double secondsSince(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static MRReply *newReply(int type) {
+  MRReply *r = calloc(1, sizeof(*r));
+  r->type = type;
+  return r;
+}
+
+static void freeReply(MRReply *r) {
+  for (size_t i = 0; i < r->elements; i++) {
+    freeReply(r->element[i]);
+  }
+  free(r->element);
+  free(r);
+}
+
+/* The reply of a shard, with a document for the keys it owns */
+static MRReply *shardReply(int shard) {
+  MRReply *r = newReply(MR_REPLY_ARRAY);
+  r->elements = NUM_KEYS;
+  r->element = calloc(NUM_KEYS, sizeof(*r->element));
+  for (size_t i = 0; i < NUM_KEYS; i++) {
+    r->element[i] = newReply(i % NUM_SHARDS == shard ? MR_REPLY_ARRAY : MR_REPLY_NIL);
+  }
+  return r;
+}
+
+/* The merge as it was, scanning the replies from the first one for every position */
+static size_t mergeByPosition(MRReply **replies, int count, MRReply **out) {
+  size_t j = 0;
+  int stillValid;
+  do {
+    stillValid = 0;
+    for (int i = 0; i < count; i++) {
+      if (MRReply_Type(replies[i]) != MR_REPLY_ARRAY) continue;
+      if (MRReply_Length(replies[i]) <= j) continue;
+      stillValid++;
+      MRReply *ele = MRReply_ArrayElement(replies[i], j);
+      if (MRReply_Type(ele) != MR_REPLY_NIL || i + 1 == count) {
+        out[j++] = ele;
+        break;
+      }
+    }
+  } while (stillValid > 0);
+  return j;
+}
+
+static void benchMerge(const char *name, size_t (*merge)(MRReply **, int, MRReply **),
+                       MRReply **replies) {
+  MRReply **out = malloc(NUM_KEYS * sizeof(*out));
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t n = 0; n < NUM_ITERATIONS; n++) {
+    mu_assert_int_eq(NUM_KEYS, merge(replies, NUM_SHARDS, out));
+  }
+  double elapsed = secondsSince(&start);
+
+  // every key got the document of its shard
+  for (size_t i = 0; i < NUM_KEYS; i++) {
+    mu_check(out[i] == MRReply_ArrayElement(replies[i % NUM_SHARDS], i));
+  }
+  free(out);
+  printf("%s: merged %d keys of %d shards in %.3fms\n", name, NUM_KEYS, NUM_SHARDS,
+         elapsed * 1000 / NUM_ITERATIONS);
+}
+
+void benchMergeArrays() {
+  MRReply *replies[NUM_SHARDS];
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    replies[i] = shardReply(i);
+  }
+  benchMerge("by position", mergeByPosition, replies);
+  benchMerge("MRReply_MergeArrays", MRReply_MergeArrays, replies);
+  for (int i = 0; i < NUM_SHARDS; i++) {
+    freeReply(replies[i]);
+  }
+}
+
+int main(int argc, char **argv) {
+  MU_RUN_TEST(benchMergeArrays);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -1,8 +1,14 @@
 #include "redismodule.h"
 #include "dist_plan.h"
+#include "dist_groupby.h"
 #include <aggregate/aggregate.h>
+extern "C" {
+#include <aggregate/functions/function.h>
+}
+#include <util/arr.h>
 #include <cpptests/redismock/util.h>
 #include <vector>
+#include <string.h>
 
 extern "C" {
 static int my_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
@@ -13,6 +19,47 @@ static int my_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 }
 }
 
+static const char *propName(const char *s) {
+  return *s == '@' ? s + 1 : s;
+}
+
+// Whether the remote command has `REDUCE <name> <nargs> <args...>`
+static bool hasRemoteReducer(const AREQDIST_UpstreamInfo &us, const char *name,
+                             std::vector<const char *> args) {
+  for (size_t ii = 0; ii + 3 + args.size() <= us.nserialized; ++ii) {
+    if (strcasecmp(us.serialized[ii], "REDUCE") || strcasecmp(us.serialized[ii + 1], name) ||
+        strtoul(us.serialized[ii + 2], NULL, 10) != args.size()) {
+      continue;
+    }
+    bool match = true;
+    for (size_t jj = 0; jj < args.size(); ++jj) {
+      match = match && !strcasecmp(propName(us.serialized[ii + 3 + jj]), propName(args[jj]));
+    }
+    if (match) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The reducer of the local GROUPBY producing `alias`
+static const PLN_Reducer *findLocalReducer(AREQ *r, const char *alias) {
+  const PLN_GroupStep *gstp =
+      (const PLN_GroupStep *)AGPLN_FindStep(&r->ap, NULL, NULL, PLN_T_GROUP);
+  assert(gstp);
+  for (size_t ii = 0; ii < array_len(gstp->reducers); ++ii) {
+    if (!strcmp(gstp->reducers[ii].alias, alias)) {
+      return &gstp->reducers[ii];
+    }
+  }
+  return NULL;
+}
+
+static const char *reducerArg(const PLN_Reducer *rd, size_t n) {
+  assert(n < rd->args.argc);
+  return propName((const char *)rd->args.objs[n]);
+}
+
 // Declare the main query
 
 // cmd = ['ft.aggregate', 'games', 'sony',
@@ -113,6 +160,107 @@ static void testCountDistinct() {
   for (size_t ii = 0; ii < us.nserialized; ++ii) {
     printf("Serialized[%lu]: %s\n", ii, us.serialized[ii]);
   }
+
+  // shards send their distinct values, merged locally and counted by the internal function
+  assert(hasRemoteReducer(us, "TOLIST", {"@title"}));
+  const PLN_MapFilterStep *apply =
+      (const PLN_MapFilterStep *)AGPLN_FindStep(&r->ap, NULL, NULL, PLN_T_APPLY);
+  assert(apply && !strcmp(apply->base.alias, "count_distinct(title)"));
+  const char *func = DIST_COUNT_DISTINCT_FUNC;
+  assert(!strncmp(apply->rawExpr, func, strlen(func)) && apply->rawExpr[strlen(func)] == '(');
+  assert(RSFunctionRegistry_Get(func, strlen(func)));
+  AREQ_Free(r);
+}
+
+static void testFirstValue() {
+  AREQ *r = AREQ_New();
+  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(NULL);
+  RMCK::ArgvList vv(ctx, "*",                                                          // nl
+                    "GROUPBY", "1", "@brand",                                          // nl
+                    "REDUCE", "FIRST_VALUE", "4", "@title", "BY", "@price", "DESC",    // nl
+                    "AS", "top_title",                                                 // nl
+                    "REDUCE", "RANDOM_SAMPLE", "2", "@title", "10", "AS", "titles"     // nl
+  );
+  QueryError status{QueryErrorCode(0)};
+  int rc = AREQ_Compile(r, vv, vv.size(), &status);
+  if (rc != REDISMODULE_OK) {
+    printf("Couldn't compile: %s\n", QueryError_GetError(&status));
+    abort();
+  }
+
+  rc = AGGPLN_Distribute(&r->ap, &status);
+  assert(rc == REDISMODULE_OK);
+
+  PLN_DistributeStep *dstp =
+      (PLN_DistributeStep *)AGPLN_FindStep(&r->ap, NULL, NULL, PLN_T_DISTRIBUTE);
+  assert(dstp);
+  // The group step must have been distributed rather than executed locally
+  assert(dstp->oldSteps && array_len(dstp->oldSteps) == 1);
+
+  AREQDIST_UpstreamInfo us = {0};
+  rc = AREQ_BuildDistributedPipeline(r, &us, &status);
+  if (rc != REDISMODULE_OK) {
+    printf("Couldn't build distributed pipeline: %s\n", QueryError_GetError(&status));
+  }
+  assert(rc == REDISMODULE_OK);
+
+  // each shard returns its first title and the price it won by, and the best price wins locally
+  assert(hasRemoteReducer(us, "FIRST_VALUE", {"@title", "BY", "@price", "DESC"}));
+  assert(hasRemoteReducer(us, "FIRST_VALUE", {"@price", "BY", "@price", "DESC"}));
+  const PLN_Reducer *first = findLocalReducer(r, "top_title");
+  assert(first && !strcasecmp(first->name, "FIRST_VALUE") && first->args.argc == 4);
+  assert(!strcasecmp(reducerArg(first, 1), "BY") && !strcasecmp(reducerArg(first, 3), "DESC"));
+  assert(strcmp(reducerArg(first, 0), reducerArg(first, 2)));
+
+  // each shard samples as many titles as requested, and so do the merged samples
+  assert(hasRemoteReducer(us, "RANDOM_SAMPLE", {"@title", "10"}));
+  const PLN_Reducer *sample = findLocalReducer(r, "titles");
+  assert(sample && !strcasecmp(sample->name, "RANDOM_SAMPLE") && sample->args.argc == 2);
+  assert(!strcmp(reducerArg(sample, 1), "10"));
+  AREQ_Free(r);
+}
+
+// Whether the local group step of the distributed `GROUPBY 1 @brand <reducers...>` gets the merge
+// group-by, rather than the generic grouper which ignores the memory limit
+static bool hasMergeGroupBy(std::vector<const char *> reducers) {
+  AREQ *r = AREQ_New();
+  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(NULL);
+  std::vector<const char *> args = {"*", "GROUPBY", "1", "@brand"};
+  args.insert(args.end(), reducers.begin(), reducers.end());
+  RedisModuleString **argv = new RedisModuleString *[args.size()];
+  for (size_t ii = 0; ii < args.size(); ++ii) {
+    argv[ii] = RedisModule_CreateString(ctx, args[ii], strlen(args[ii]));
+  }
+  QueryError status{QueryErrorCode(0)};
+  int rc = AREQ_Compile(r, argv, args.size(), &status);
+  assert(rc == REDISMODULE_OK);
+  rc = AGGPLN_Distribute(&r->ap, &status);
+  assert(rc == REDISMODULE_OK);
+  AREQDIST_UpstreamInfo us = {0};
+  rc = AREQ_BuildDistributedPipeline(r, &us, &status);
+  assert(rc == REDISMODULE_OK);
+
+  PLN_GroupStep *gstp = (PLN_GroupStep *)AGPLN_FindStep(&r->ap, NULL, NULL, PLN_T_GROUP);
+  assert(gstp);
+  ResultProcessor *rp = RPDistGroup_NewFromStep(gstp, us.lookup);
+  if (rp) {
+    rp->Free(rp);
+  }
+  AREQ_Free(r);
+  for (size_t ii = 0; ii < args.size(); ++ii) {
+    RedisModule_FreeString(ctx, argv[ii]);
+  }
+  delete[] argv;
+  return rp != NULL;
+}
+
+static void testGroupMerge() {
+  assert(hasMergeGroupBy({"REDUCE", "COUNT", "0", "REDUCE", "SUM", "1", "@price",  // nl
+                          "REDUCE", "MAX", "1", "@price"}));
+  assert(hasMergeGroupBy({"REDUCE", "AVG", "1", "@price"}));
+  // merging the shards' lists needs the generic grouper, unbounded by DIST_AGG_MEMORY_LIMIT
+  assert(!hasMergeGroupBy({"REDUCE", "COUNT", "0", "REDUCE", "TOLIST", "1", "@title"}));
+  assert(!hasMergeGroupBy({"REDUCE", "FIRST_VALUE", "1", "@title"}));
 }
 
 static void testSplit() {
@@ -154,8 +302,11 @@ static void testSplit() {
 int main(int, char **) {
   RMCK_Bootstrap(my_OnLoad, NULL, 0);
   RMCK::init();
+  DistAggregate_RegisterFunctions();
   // testAverage();
   testCountDistinct();
+  testFirstValue();
+  testGroupMerge();
 }
 
 //REDISMODULE_INIT_SYMBOLS();
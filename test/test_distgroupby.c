@@ -0,0 +1,113 @@
+#include "redismodule.h"
+#include "dist_groupby.h"
+#include "minunit.h"
+
+#include <stdio.h>
+
+#define NUM_GROUPS 100000
+#define NUM_SHARDS 3
+
+/**
+ * Partial groups of the shards, keyed by a number, except for every tenth group which is keyed by
+ * a string. The first group is keyed by -0 on one of the shards and by 0 on the others.
+ */
+typedef struct {
+  ResultProcessor base;
+  const RLookupKey *key;
+  const RLookupKey *count;
+  size_t next;
+} PartialsSource;
+
+static int partialsNext(ResultProcessor *rp, SearchResult *r) {
+  PartialsSource *src = (PartialsSource *)rp;
+  if (src->next == NUM_GROUPS * NUM_SHARDS) {
+    return RS_RESULT_EOF;
+  }
+  size_t group = src->next % NUM_GROUPS, shard = src->next / NUM_GROUPS;
+  src->next++;
+
+  if (group % 10 == 9) {
+    char buf[32];
+    int n = sprintf(buf, "%zu", group);
+    RLookup_WriteOwnKey(src->key, &r->rowdata, RS_NewCopiedString(buf, n));
+  } else {
+    double key = group ? group : (shard == 1 ? -0.0 : 0.0);
+    RLookup_WriteOwnKey(src->key, &r->rowdata, RS_NumVal(key));
+  }
+  RLookup_WriteOwnKey(src->count, &r->rowdata, RS_NumVal(shard + 1));
+  return RS_RESULT_OK;
+}
+
+/* Merge the partial groups, and check that every group keeps the type of its key */
+static void mergeGroups(size_t memLimit) {
+  RLookup srclk = {0}, dstlk = {0};
+  RLookup_Init(&srclk, NULL);
+  RLookup_Init(&dstlk, NULL);
+
+  PartialsSource src = {.base = {.Next = partialsNext}};
+  src.key = RLookup_GetKey(&srclk, "id", RLOOKUP_F_OCREAT);
+  src.count = RLookup_GetKey(&srclk, "__count", RLOOKUP_F_OCREAT);
+
+  const RLookupKey *srckeys[] = {src.key};
+  const RLookupKey *dstkeys[] = {RLookup_GetKey(&dstlk, "id", RLOOKUP_F_OCREAT)};
+  DistGroupReducer reducers[] = {
+      {DistGroupOp_Sum, src.count, RLookup_GetKey(&dstlk, "count", RLOOKUP_F_OCREAT)},
+  };
+
+  QueryIterator qiter = {0};
+  ResultProcessor *rp = RPDistGroup_New(srckeys, dstkeys, 1, reducers, 1);
+  RPDistGroup_SetMemoryLimit(rp, memLimit);
+  rp->upstream = &src.base;
+  rp->parent = &qiter;
+  src.base.parent = &qiter;
+
+  SearchResult r = {0};
+  size_t ngroups = 0, nbad = 0;
+  while (rp->Next(rp, &r) == RS_RESULT_OK) {
+    const RSValue *key = RSValue_Dereference(RLookup_GetItem(dstkeys[0], &r.rowdata));
+    double id = 0, count = 0;
+    if (key->t == RSValue_Number) {
+      RSValue_ToNumber(key, &id);
+    } else {
+      size_t len;
+      id = strtod(RSValue_StringPtrLen(key, &len), NULL);
+    }
+    RSValue_ToNumber(RLookup_GetItem(reducers[0].dstkey, &r.rowdata), &count);
+    int isString = (size_t)id % 10 == 9;
+    if ((key->t == RSValue_Number) == isString || count != NUM_SHARDS * (NUM_SHARDS + 1) / 2) {
+      nbad++;
+    }
+    ngroups++;
+    SearchResult_Clear(&r);
+  }
+
+  mu_check(nbad == 0);
+  mu_check(ngroups == NUM_GROUPS);
+  mu_check(qiter.totalResults == NUM_GROUPS);
+
+  SearchResult_Destroy(&r);
+  rp->Free(rp);
+  RLookup_Cleanup(&srclk);
+  RLookup_Cleanup(&dstlk);
+}
+
+void testKeyTypes() {
+  mergeGroups(0);
+}
+
+// The groups take several MB, so they are spilled as runs and read back from them
+void testKeyTypesSpilled() {
+  mergeGroups(1);
+}
+
+int main(int argc, char **argv) {
+  RedisModule_Alloc = malloc;
+  RedisModule_Calloc = calloc;
+  RedisModule_Realloc = realloc;
+  RedisModule_Free = free;
+  RedisModule_Strdup = strdup;
+  MU_RUN_TEST(testKeyTypes);
+  MU_RUN_TEST(testKeyTypesSpilled);
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,100 @@
+#include "query_routing.h"
+#include "minunit.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_VALUES 8
+
+typedef struct {
+  char values[MAX_VALUES][64];
+  size_t n;
+} collected;
+
+static void collect(const char *value, size_t len, void *ctx) {
+  collected *c = ctx;
+  if (c->n < MAX_VALUES) {
+    snprintf(c->values[c->n++], sizeof(c->values[0]), "%.*s", (int)len, value);
+  }
+}
+
+static size_t fieldValues(const char *query, collected *c) {
+  memset(c, 0, sizeof(*c));
+  return QueryRouting_FieldValues(query, strlen(query), "tenant", strlen("tenant"), collect, c);
+}
+
+void testFieldValues() {
+  collected c;
+  mu_assert_int_eq(1, fieldValues("@tenant:{acme} hello world", &c));
+  mu_check(!strcmp("acme", c.values[0]));
+
+  mu_assert_int_eq(2, fieldValues("hello @title:(foo|bar) @tenant : { acme | big\\ corp }", &c));
+  mu_check(!strcmp("acme", c.values[0]));
+  mu_check(!strcmp("big corp", c.values[1]));
+
+  // ranges, phrases and tags of other fields do not get in the way
+  mu_assert_int_eq(1, fieldValues("@price:[10 (20] \"a | b\" @tag:{x|y} @tenant:{acme}", &c));
+  mu_check(!strcmp("acme", c.values[0]));
+  mu_assert_int_eq(1, c.n);
+}
+
+void testUnroutedQueries() {
+  collected c;
+  const char *queries[] = {
+      "hello world",
+      "@tenants:{acme}",
+      "@tenant|owner:{acme}",
+      "-@tenant:{acme}",
+      "~@tenant:{acme}",
+      "(@tenant:{acme}) | hello",
+      "@tenant:{acme} | hello",
+      "hello | (@tenant:{acme} world)",
+      "@tenant:{acme*}",
+      "@tenant:{$t}",
+      "@tenant:{acme|}",
+      "@tenant:{acme",
+      "@tenant:acme",
+  };
+  for (size_t i = 0; i < sizeof(queries) / sizeof(*queries); i++) {
+    mu_assert_int_eq(0, fieldValues(queries[i], &c));
+    mu_assert_int_eq(0, c.n);
+  }
+}
+
+static int caseSensitiveTag(const char *field, const char **schema) {
+  size_t n = 0;
+  while (schema[n]) n++;
+  return QueryRouting_IsCaseSensitiveTag(schema, n, field, strlen(field));
+}
+
+void testRoutingFieldSchema() {
+  const char *schema[] = {
+      "title", "TEXT",    "WEIGHT", "5.0", "SORTABLE",
+      "$.t",   "AS",      "tenant", "TAG", "SEPARATOR", ",", "casesensitive",
+      "vec",   "VECTOR",  "FLAT",   "2",   "DIM",       "tag",
+      "price", "NUMERIC",
+      "owner", "TAG",     "SORTABLE",
+      NULL,
+  };
+  mu_check(caseSensitiveTag("tenant", schema));
+  // the identifier of an aliased field is not its name in queries
+  mu_check(!caseSensitiveTag("$.t", schema));
+  // tags are matched case-insensitively by default
+  mu_check(!caseSensitiveTag("owner", schema));
+  mu_check(!caseSensitiveTag("title", schema));
+  mu_check(!caseSensitiveTag("price", schema));
+  // the arguments of the vector field are not taken for fields
+  mu_check(!caseSensitiveTag("tag", schema));
+  mu_check(!caseSensitiveTag("missing", schema));
+
+  const char *notTag[] = {"tenant", "TEXT", "CASESENSITIVE", NULL};
+  mu_check(!caseSensitiveTag("tenant", notTag));
+}
+
+int main(int argc, char **argv) {
+  MU_RUN_TEST(testFieldValues);
+  MU_RUN_TEST(testUnroutedQueries);
+  MU_RUN_TEST(testRoutingFieldSchema);
+  MU_REPORT();
+  return minunit_status;
+}
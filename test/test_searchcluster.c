@@ -6,6 +6,7 @@
 #include "minunit.h"
 
 const char *FNVTagFunc(const char *key, size_t len, size_t k);
+int SCCommandMuxIterator_Next(void *ctx, MRCommand *cmd);
 // void testTagFunc() {
 
 //   SearchCluster sc = NewSearchCluster(100, FNVTagFunc);
@@ -15,8 +16,14 @@ const char *FNVTagFunc(const char *key, size_t len, size_t k);
 //   printf("%s\n", tag);
 // }
 
+/* A cluster of the given number of partitions over the cluster's slots, freed with
+ * SearchCluster_Free */
+static SearchCluster newCluster(size_t size) {
+  return NewSearchCluster(size, crc16_slot_table, 16384);
+}
+
 void testCommandMux() {
-  SearchCluster sc = NewSearchCluster(100, crc16_slot_table, 16384);
+  SearchCluster sc = newCluster(100);
   MRCommand cmd = MR_NewCommand(3, "_FT.SEARCH", "idx", "foo");
 
   MRCommandGenerator cg = SearchCluster_MultiplexCommand(&sc, &cmd);
@@ -29,6 +36,227 @@ void testCommandMux() {
     if (i > 100) mu_fail("number of iterations exceeded");
   }
   cg.Free(cg.ctx);
+  SearchCluster_Free(&sc);
+}
+
+void testSinglePartitionMux() {
+  SearchCluster sc = newCluster(100);
+  SearchCluster_SetIndexRouting("idx", 3, 1234, NULL, 1);
+  mu_assert_int_eq(1234, SearchCluster_PinnedSlot("idx", 3));
+  mu_assert_int_eq(-1, SearchCluster_PinnedSlot("idx2", 4));
+
+  // a pinned index gets a single command, to its shard
+  MRCommand cmd = MR_NewCommand(3, "_FT.SEARCH", "idx", "foo");
+  MRCommandGenerator cg = SearchCluster_MultiplexCommand(&sc, &cmd);
+  mu_assert_int_eq(1, cg.Len(cg.ctx));
+  MRCommand mxcmd;
+  mu_check(cg.Next(cg.ctx, &mxcmd));
+  mu_assert_int_eq(1234, mxcmd.targetSlot);
+  mu_check(!strcmp("idx", MRCommand_ArgStringPtrLen(&mxcmd, 1, NULL)));
+  MRCommand_Free(&mxcmd);
+  mu_check(!cg.Next(cg.ctx, &mxcmd));
+  cg.Free(cg.ctx);
+
+  // and once unpinned, it spans all the partitions again
+  SearchCluster_DelIndexRouting("idx", 3, 2);
+  mu_assert_int_eq(-1, SearchCluster_PinnedSlot("idx", 3));
+  cmd = MR_NewCommand(3, "_FT.SEARCH", "idx", "foo");
+  cg = SearchCluster_MultiplexCommand(&sc, &cmd);
+  mu_assert_int_eq(100, cg.Len(cg.ctx));
+  cg.Free(cg.ctx);
+  SearchCluster_Free(&sc);
+}
+
+void testRoutingFieldMux() {
+  SearchCluster sc = newCluster(100);
+  SearchCluster_SetIndexRouting("idx", 3, -1, "tenant", 3);
+  mu_check(SearchCluster_HasIndexRouting("idx", 3));
+  mu_assert_int_eq(-1, SearchCluster_PinnedSlot("idx", 3));
+
+  // a query that may match documents of any value of the routing field goes to all partitions
+  MRCommand cmd = MR_NewCommand(3, "_FT.SEARCH", "idx", "@tenant:{acme} | hello");
+  MRCommandGenerator cg = SearchCluster_MultiplexQuery(&sc, &cmd, 2);
+  mu_assert_int_eq(100, cg.Len(cg.ctx));
+  cg.Free(cg.ctx);
+
+  // and so does a routed query, while the cluster has no topology to find the value's shard by
+  cmd = MR_NewCommand(3, "_FT.SEARCH", "idx", "@tenant:{acme}");
+  cg = SearchCluster_MultiplexQuery(&sc, &cmd, 2);
+  mu_assert_int_eq(100, cg.Len(cg.ctx));
+  cg.Free(cg.ctx);
+
+  SearchCluster_DelIndexRouting("idx", 3, 4);
+  mu_check(!SearchCluster_HasIndexRouting("idx", 3));
+  SearchCluster_Free(&sc);
+}
+
+static void countRouting(const char *name, size_t len, int slot, const char *routingField,
+                         uint64_t version, int deleted, void *p) {
+  if (len == 4 && !memcmp(name, "vidx", 4)) {
+    ++*(int *)p;
+  }
+}
+
+void testIndexRoutingVersions() {
+  // routings arriving out of order keep the newest one
+  mu_check(SearchCluster_SetIndexRouting("vidx", 4, 10, NULL, 100));
+  mu_check(!SearchCluster_SetIndexRouting("vidx", 4, 20, NULL, 99));
+  mu_assert_int_eq(10, SearchCluster_PinnedSlot("vidx", 4));
+  mu_check(SearchCluster_SetIndexRouting("vidx", 4, 30, NULL, 101));
+  mu_assert_int_eq(30, SearchCluster_PinnedSlot("vidx", 4));
+
+  // a deletion wins over the routing of its version, and older routings do not bring it back
+  mu_check(SearchCluster_DelIndexRouting("vidx", 4, 101));
+  mu_check(!SearchCluster_HasIndexRouting("vidx", 4));
+  mu_check(!SearchCluster_SetIndexRouting("vidx", 4, 30, NULL, 101));
+  mu_check(!SearchCluster_SetIndexRouting("vidx", 4, 10, NULL, 100));
+  mu_check(!SearchCluster_HasIndexRouting("vidx", 4));
+  mu_check(!SearchCluster_DelIndexRouting("vidx", 4, 100));
+
+  // the deletion is listed, for the coordinators that did not hear of it
+  int n = 0;
+  SearchCluster_ForEachIndexRouting(countRouting, &n);
+  mu_assert_int_eq(1, n);
+
+  // a change made on this node is newer than any it heard of
+  uint64_t version = SearchCluster_NextIndexRoutingVersion("vidx", 4);
+  mu_check(version > 101);
+  mu_check(SearchCluster_SetIndexRouting("vidx", 4, -1, "tenant", version));
+  mu_check(SearchCluster_HasIndexRouting("vidx", 4));
+  mu_check(SearchCluster_NextIndexRoutingVersion("vidx", 4) > version);
+  SearchCluster_DelIndexRouting("vidx", 4, SearchCluster_NextIndexRoutingVersion("vidx", 4));
+  mu_check(!SearchCluster_HasIndexRouting("vidx", 4));
+
+  // old deletions are forgotten, and not brought back by the coordinators that still list them
+  mu_check(SearchCluster_SetIndexRouting("oidx", 4, 10, NULL, 100));
+  mu_check(SearchCluster_DelIndexRouting("oidx", 4, 101));
+  mu_check(SearchCluster_ExpireIndexRoutingDeletions() >= 1);
+  mu_check(!SearchCluster_DelIndexRouting("oidx", 4, 101));
+  n = 0;
+  SearchCluster_ForEachIndexRouting(countRouting, &n);
+  mu_assert_int_eq(1, n);
+  SearchCluster_FreeIndexRouting();
+}
+
+/* Check the index names a tagging iterator yields for every partition of a cluster */
+static void assertTaggedNames(SearchCluster *sc) {
+  MRCommand cmd = MR_NewCommand(3, "_FT.SEARCH", "idx", "foo");
+  MRCommandGenerator cg = SearchCluster_MultiplexCommand(sc, &cmd);
+  cg.Next = SCCommandMuxIterator_Next;
+  MRCommand mxcmd;
+  for (size_t i = 0; i < sc->size; i++) {
+    mu_check(cg.Next(cg.ctx, &mxcmd));
+    char expected[64];
+    snprintf(expected, sizeof(expected), "idx{%s}", PartitionTag(&sc->part, i));
+    mu_check(!strcmp(expected, MRCommand_ArgStringPtrLen(&mxcmd, 1, NULL)));
+    MRCommand_Free(&mxcmd);
+  }
+  mu_check(!cg.Next(cg.ctx, &mxcmd));
+  cg.Free(cg.ctx);
+}
+
+/* A tagging iterator with target slots tags each target with the partition of its shard */
+static void assertTaggedTargets(SearchCluster *sc) {
+  MRCommand cmd = MR_NewCommand(3, "_FT.SEARCH", "idx", "foo");
+  MRCommandGenerator cg = SearchCluster_MultiplexCommand(sc, &cmd);
+  cg.Next = SCCommandMuxIterator_Next;
+  SCCommandMuxIterator *mux = cg.ctx;
+  mux->targetSlots = malloc(sizeof(*mux->targetSlots));
+  mux->targetSlots[0] = GetSlotByPartition(&sc->part, 2);
+  mux->numTargets = 1;
+  mu_assert_int_eq(1, cg.Len(cg.ctx));
+
+  MRCommand mxcmd;
+  mu_check(cg.Next(cg.ctx, &mxcmd));
+  mu_assert_int_eq(GetSlotByPartition(&sc->part, 2), mxcmd.targetSlot);
+  char expected[64];
+  snprintf(expected, sizeof(expected), "idx{%s}", PartitionTag(&sc->part, 2));
+  mu_check(!strcmp(expected, MRCommand_ArgStringPtrLen(&mxcmd, 1, NULL)));
+  MRCommand_Free(&mxcmd);
+  mu_check(!cg.Next(cg.ctx, &mxcmd));
+  cg.Free(cg.ctx);
+}
+
+void testIndexNamesCache() {
+  SearchCluster sc = newCluster(4);
+  assertTaggedNames(&sc);
+  // the cached names are used again
+  assertTaggedNames(&sc);
+
+  // and tagged for the partitions of any cluster, or resolved again once dropped
+  SearchCluster sc2 = newCluster(8);
+  assertTaggedNames(&sc2);
+  SearchCluster_InvalidateIndexNames();
+  assertTaggedNames(&sc);
+  assertTaggedTargets(&sc);
+  SearchCluster_Free(&sc);
+  SearchCluster_Free(&sc2);
+}
+
+void testMultiplexKeys() {
+  SearchCluster sc = newCluster(10);
+  // with no topology to find the shards of the keys by, every partition gets all of them
+  MRCommand cmd = MR_NewCommand(4, "_FT.MGET", "idx", "doc:1", "doc:2");
+  SCKeysMap *map;
+  MRCommandGenerator cg = SearchCluster_MultiplexKeys(&sc, &cmd, 2, &map);
+  mu_check(map == NULL);
+  mu_assert_int_eq(10, cg.Len(cg.ctx));
+  MRCommand mxcmd;
+  mu_check(cg.Next(cg.ctx, &mxcmd));
+  mu_assert_int_eq(4, mxcmd.num);
+  MRCommand_Free(&mxcmd);
+  cg.Free(cg.ctx);
+
+  // the partitions of the slots are those of the shards' slot ranges
+  mu_assert_int_eq(0, SearchCluster_PartitionForSlot(&sc, 0));
+  mu_assert_int_eq(0, SearchCluster_PartitionForSlot(&sc, 1637));
+  mu_assert_int_eq(1, SearchCluster_PartitionForSlot(&sc, 1638));
+  mu_assert_int_eq(5, SearchCluster_PartitionForSlot(&sc, 8192));
+  mu_assert_int_eq(9, SearchCluster_PartitionForSlot(&sc, 16383));
+  SearchCluster_Free(&sc);
+}
+
+void testJumpPartitioner() {
+  // every partition is tagged with a slot of its own shard, wherever it is in the slot table
+  SearchCluster small = newCluster(3);
+  PartitionCtx_SetHashFunc(&small.part, PartitionHash_Jump);
+  for (size_t i = 0; i < 3; i++) {
+    int slot = GetSlotByPartition(&small.part, i);
+    mu_assert_int_eq(i, SearchCluster_PartitionForSlot(&small, slot));
+  }
+
+  SearchCluster sc = newCluster(10);
+  PartitionCtx_SetHashFunc(&sc.part, PartitionHash_Jump);
+  for (size_t i = 0; i < 10; i++) {
+    int slot = GetSlotByPartition(&sc.part, i);
+    mu_assert_int_eq(i, SearchCluster_PartitionForSlot(&sc, slot));
+  }
+
+  // growing to 11 partitions only moves keys to the new partition, about 1/11 of them
+  size_t moved = 0, numKeys = 10000;
+  char key[32];
+  for (size_t i = 0; i < numKeys; i++) {
+    size_t len = sprintf(key, "doc:%zu", i);
+    size_t from = PartitionForKey(&sc.part, key, len);
+    size_t to = PartitionForKeyWithSize(&sc.part, key, len, 11);
+    mu_check(from < 10);
+    if (from != to) {
+      mu_assert_int_eq(10, to);
+      moved++;
+    }
+  }
+  mu_check(moved > numKeys / 11 / 2 && moved < numKeys / 11 * 2);
+
+  // while the modulo partitioner moves most of them
+  PartitionCtx_SetHashFunc(&sc.part, PartitionHash_Modulo);
+  moved = 0;
+  for (size_t i = 0; i < numKeys; i++) {
+    size_t len = sprintf(key, "doc:%zu", i);
+    moved += PartitionForKey(&sc.part, key, len) != PartitionForKeyWithSize(&sc.part, key, len, 11);
+  }
+  mu_check(moved > numKeys / 2);
+  SearchCluster_Free(&small);
+  SearchCluster_Free(&sc);
 }
 
 int main(int argc, char **argv) {
@@ -39,6 +267,12 @@ int main(int argc, char **argv) {
   RedisModule_Free = free;
   IndexAlias_InitGlobal();
   MU_RUN_TEST(testCommandMux);
+  MU_RUN_TEST(testSinglePartitionMux);
+  MU_RUN_TEST(testRoutingFieldMux);
+  MU_RUN_TEST(testIndexRoutingVersions);
+  MU_RUN_TEST(testIndexNamesCache);
+  MU_RUN_TEST(testJumpPartitioner);
+  MU_RUN_TEST(testMultiplexKeys);
 
   MU_REPORT();
   return minunit_status;
@@ -0,0 +1,137 @@
+#include "redismodule.h"
+#include <rmr/command.h>
+#include "search_request.h"
+#include "minunit.h"
+
+#include <stdarg.h>
+
+struct RedisModuleString {
+  const char *str;
+};
+
+static const char *stringPtrLen(const RedisModuleString *s, size_t *len) {
+  if (len) *len = strlen(s->str);
+  return s->str;
+}
+
+static int stringToLongLong(const RedisModuleString *s, long long *ll) {
+  char *end;
+  *ll = strtoll(s->str, &end, 10);
+  return *s->str && !*end ? REDISMODULE_OK : REDISMODULE_ERR;
+}
+
+#define MAX_ARGS 32
+
+/* Build a request's argv from a NULL terminated list of strings */
+static int makeArgv(RedisModuleString *strs, RedisModuleString **argv, ...) {
+  va_list ap;
+  va_start(ap, argv);
+  int argc = 0;
+  const char *s;
+  while ((s = va_arg(ap, const char *))) {
+    strs[argc].str = s;
+    argv[argc] = &strs[argc];
+    argc++;
+  }
+  va_end(ap);
+  return argc;
+}
+
+static void assertArgs(MRCommand *cmd, const char **expected, int num) {
+  mu_assert_int_eq(num, cmd->num);
+  for (int i = 0; i < num; i++) {
+    mu_check(!strcmp(expected[i], MRCommand_ArgStringPtrLen(cmd, i, NULL)));
+  }
+}
+
+void testParseRequest() {
+  RedisModuleString strs[MAX_ARGS], *argv[MAX_ARGS];
+  int argc = makeArgv(strs, argv, "FT.SEARCH", "idx", "hello", "LIMIT", "5", "10", "SORTBY",
+                      "price", "DESC", "RETURN", "0", "TIMEOUT", "100", NULL);
+  searchRequestCtx *req = rscParseRequest(argv, argc);
+  mu_check(req != NULL);
+  mu_check(!strcmp("hello", req->queryString));
+  mu_assert_int_eq(5, req->offset);
+  mu_assert_int_eq(10, req->limit);
+  mu_check(req->withSortby);
+  mu_check(!req->sortAscending);
+  mu_check(req->noContent);
+  mu_check(!req->withScores);
+  mu_assert_int_eq(100, req->timeout);
+  mu_assert_int_eq(0, req->profileArgs);
+  searchRequestCtx_Free(req);
+
+  argc = makeArgv(strs, argv, "FT.SEARCH", "idx", "hello", "withscores", "LIMIT", "-1", "10",
+                  NULL);
+  mu_check(rscParseRequest(argv, argc) == NULL);
+
+  argc = makeArgv(strs, argv, "FT.PROFILE", "idx", "SEARCH", "LIMITED", "QUERY", "hello", NULL);
+  req = rscParseRequest(argv, argc);
+  mu_check(req != NULL);
+  mu_assert_int_eq(3, req->profileArgs);
+  mu_check(req->profileLimited);
+  mu_check(!strcmp("hello", req->queryString));
+  mu_assert_int_eq(10, req->limit);
+  searchRequestCtx_Free(req);
+
+  argc = makeArgv(strs, argv, "FT.PROFILE", "idx", "SEARCH", "hello", NULL);
+  mu_check(rscParseRequest(argv, argc) == NULL);
+}
+
+void testFlatSearchPlan() {
+  RedisModuleString strs[MAX_ARGS], *argv[MAX_ARGS];
+  const char *expected[] = {"_FT.SEARCH", "idx",    "hello", "WITHSORTKEYS", "WITHSCORES",
+                            "LIMIT",      "0",      "15",    "SORTBY",       "price"};
+  int num = sizeof(expected) / sizeof(*expected);
+
+  int argc = makeArgv(strs, argv, "FT.SEARCH", "idx", "hello", "LIMIT", "5", "10", "SORTBY",
+                      "price", NULL);
+  MRCommand cmd;
+  searchRequestCtx *req = rscParseFlatSearch(argv, argc, &cmd);
+  mu_check(req != NULL);
+  assertArgs(&cmd, expected, num);
+
+  // the same options with another query reuse the rewritten command
+  argc = makeArgv(strs, argv, "FT.SEARCH", "idx", "@title:world", "LIMIT", "5", "10", "SORTBY",
+                  "price", NULL);
+  MRCommand cmd2;
+  searchRequestCtx *req2 = rscParseFlatSearch(argv, argc, &cmd2);
+  mu_check(req2 != NULL);
+  mu_check(!strcmp("@title:world", req2->queryString));
+  mu_assert_int_eq(5, req2->offset);
+  mu_assert_int_eq(10, req2->limit);
+  mu_check(req2->withSortby);
+  expected[2] = "@title:world";
+  assertArgs(&cmd2, expected, num);
+  // and leave the commands of earlier requests as they were
+  mu_check(!strcmp("hello", MRCommand_ArgStringPtrLen(&cmd, 2, NULL)));
+
+  // other options make another plan
+  argc = makeArgv(strs, argv, "FT.SEARCH", "idx", "hello", "LIMIT", "0", "20", NULL);
+  MRCommand cmd3;
+  searchRequestCtx *req3 = rscParseFlatSearch(argv, argc, &cmd3);
+  const char *expected3[] = {"_FT.SEARCH", "idx", "hello", "WITHSCORES", "LIMIT", "0", "20"};
+  assertArgs(&cmd3, expected3, sizeof(expected3) / sizeof(*expected3));
+  mu_check(!req3->withSortby);
+
+  searchRequestCtx_Free(req);
+  searchRequestCtx_Free(req2);
+  searchRequestCtx_Free(req3);
+  MRCommand_Free(&cmd);
+  MRCommand_Free(&cmd2);
+  MRCommand_Free(&cmd3);
+}
+
+int main(int argc, char **argv) {
+  RedisModule_Alloc = malloc;
+  RedisModule_Calloc = calloc;
+  RedisModule_Realloc = realloc;
+  RedisModule_Free = free;
+  RedisModule_StringPtrLen = stringPtrLen;
+  RedisModule_StringToLongLong = stringToLongLong;
+  MU_RUN_TEST(testParseRequest);
+  MU_RUN_TEST(testFlatSearchPlan);
+
+  MU_REPORT();
+  return minunit_status;
+}
@@ -0,0 +1,83 @@
+#include "string_set.h"
+#include "minunit.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void testStringSetAdd() {
+  StringSet *set = NewStringSet(0, 0);
+  const char *values[] = {"foo", "bar", "foo", "foobar", "bar", "fo"};
+  int added[] = {1, 1, 0, 1, 0, 1};
+  for (size_t i = 0; i < sizeof(values) / sizeof(*values); i++) {
+    mu_assert_int_eq(added[i], StringSet_Add(set, values[i], strlen(values[i])));
+  }
+  mu_assert_int_eq(4, StringSet_Size(set));
+
+  // values are kept in the order they were added, and reference the added strings
+  size_t len;
+  const char *s = StringSet_Get(set, 2, &len);
+  mu_check(s == values[3]);
+  mu_assert_int_eq(6, len);
+
+  // a prefix is not the same value
+  mu_assert_int_eq(0, StringSet_Add(set, "foobar", 3));
+  mu_assert_int_eq(1, StringSet_Add(set, "foobar", 1));
+  StringSet_Free(set);
+}
+
+void testStringSetSort() {
+  StringSet *set = NewStringSet(0, 0);
+  const char *values[] = {"foobar", "b", "foo", "", "ab", "ba"};
+  for (size_t i = 0; i < sizeof(values) / sizeof(*values); i++) {
+    StringSet_Add(set, values[i], strlen(values[i]));
+  }
+  StringSet_Sort(set);
+  const char *sorted[] = {"", "ab", "b", "ba", "foo", "foobar"};
+  for (size_t i = 0; i < sizeof(sorted) / sizeof(*sorted); i++) {
+    size_t len;
+    const char *s = StringSet_Get(set, i, &len);
+    mu_assert_int_eq(strlen(sorted[i]), len);
+    mu_check(!memcmp(sorted[i], s, len));
+  }
+  // the set still finds its values after they moved
+  for (size_t i = 0; i < sizeof(values) / sizeof(*values); i++) {
+    mu_assert_int_eq(0, StringSet_Add(set, values[i], strlen(values[i])));
+  }
+  StringSet_Free(set);
+}
+
+void testStringSetCopy() {
+  StringSet *set = NewStringSet(4, 1);
+  char buf[32];
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 50000; i++) {
+      int n = snprintf(buf, sizeof(buf), "value%d", i);
+      mu_assert_int_eq(!round, StringSet_Add(set, buf, n));
+    }
+  }
+  // a value longer than the blocks copies are stored in
+  static char longValue[100000];
+  memset(longValue, 'x', sizeof(longValue));
+  mu_assert_int_eq(1, StringSet_Add(set, longValue, sizeof(longValue)));
+  mu_assert_int_eq(1, StringSet_Add(set, "after", 5));
+  mu_assert_int_eq(50002, StringSet_Size(set));
+
+  // the copies do not change with the buffers they were added from
+  strcpy(buf, "changed");
+  size_t len;
+  const char *s = StringSet_Get(set, 49999, &len);
+  mu_check(len == 10 && !memcmp("value49999", s, len));
+  s = StringSet_Get(set, 50000, &len);
+  mu_check(len == sizeof(longValue) && s != longValue && !memcmp(longValue, s, len));
+  s = StringSet_Get(set, 50001, &len);
+  mu_check(len == 5 && !memcmp("after", s, len));
+  StringSet_Free(set);
+}
+
+int main(int argc, char **argv) {
+  MU_RUN_TEST(testStringSetAdd);
+  MU_RUN_TEST(testStringSetSort);
+  MU_RUN_TEST(testStringSetCopy);
+  MU_REPORT();
+  return minunit_status;
+}